@@ -10,6 +10,7 @@
 #ifndef _CGI_H
 #define _CGI_H	1
 
+#include <stdarg.h>
 #include <stdio.h>
 
 #include <libcgi/cgi_types.h>
@@ -46,6 +47,8 @@ extern char *cgi_param_multiple(const char *name);
 extern char *htmlentities(const char *str);
 extern int cgi_include(const char *path);
 extern formvars *cgi_process_form(void);
+extern void cgi_form_decode_in_place(int enable);
+extern void cgi_form_limits(unsigned long content_max, size_t field_max);
 extern int cgi_init(void);
 extern void cgi_end(void);
 extern char *cgi_param(const char *var_name);
@@ -117,6 +120,342 @@ extern void cgi_session_save_path(const char *path);
  */
 void cgi_session_free( void );
 
+/*	where cgi_session_start() keeps the session variables	*/
+enum cgi_session_backend {
+	CGI_SESSION_FILES,		/**< a file per session, the default	*/
+	CGI_SESSION_COOKIE,		/**< the session cookie, signed	*/
+	CGI_SESSION_SHM,		/**< memory shared by the processes of a host	*/
+};
+
+/**
+ *	Select where sessions started from now on keep their variables.
+ *
+ *	With CGI_SESSION_COOKIE there are no files: the variables travel
+ *	in the session cookie, signed with HMAC-SHA256 under the keys of
+ *	cgi_session_cookie_key(), so any server knowing the keys can serve
+ *	the session.  The client can read the variables but not change
+ *	them.  A change sets the cookie again, so it has to happen before
+ *	the headers are sent, or with a buffered response, and a session
+ *	has to fit into a cookie of about 4000 bytes.  A cookie can't be
+ *	revoked, so it always expires, after the max idle time or after a
+ *	day without one.
+ *
+ *	With CGI_SESSION_SHM sessions live in a table in shared memory, see
+ *	cgi_session_shm_path(), read and written without system calls once
+ *	it is mapped.  Only the processes of one host share it.
+ *
+ *	@param[in]	backend	CGI_SESSION_FILES, CGI_SESSION_COOKIE or
+ *						CGI_SESSION_SHM.
+ *
+ *	@see	cgi_session_set_max_idle_time()
+ *	@see	cgi_session_shm_path()
+ */
+void cgi_session_set_backend( enum cgi_session_backend backend );
+
+/**
+ *	Set the file of the table CGI_SESSION_SHM keeps sessions in, by
+ *	default "/dev/shm/libcgi-sessions".  The first process creates it
+ *	with 4096 slots of 4 KiB, and every process maps it on its first
+ *	cgi_session_start().  A session takes one slot, up to about 4000
+ *	bytes of names and values; when the slots around it are taken, a
+ *	new session replaces the one unused for the longest time.  Sessions
+ *	are not kept over a reboot.
+ *
+ *	The file is created with mode 0600.  An existing file is only used
+ *	if it is a regular file, not a symbolic link, owned by the effective
+ *	user and without permissions for group or others; otherwise
+ *	cgi_session_start() fails.
+ *
+ *	@param[in]	path	File name, on a tmpfs for the table to stay in
+ *						memory.
+ *
+ *	@note	This function must be called before cgi_session_start().
+ */
+void cgi_session_shm_path( const char *path );
+
+/**
+ *	Add a key for signed session cookies.  The key added last signs,
+ *	the others are kept to verify cookies signed before, so keys can be
+ *	rotated without ending the sessions: add the new key, and remove the
+ *	old one once its cookies have expired.  Up to 8 keys are kept, the
+ *	oldest is dropped for more.
+ *
+ *	@param[in]	id		Number of the key, it is sent with the cookie.  A
+ *						key of the same id is replaced.
+ *	@param[in]	key		Secret key, NULL to remove the key of id.
+ *	@param[in]	len		Length of key in bytes, at least 16.
+ *
+ *	@return	True on success, false for a key shorter than 16 bytes.
+ */
+int cgi_session_cookie_key( unsigned int id, const void *key, size_t len );
+
+/**
+ *	Set the block size of the request memory, see cgi_arena_peak().
+ *
+ *	@param[in]	size	Block size in bytes, 0 restores the default.
+ */
+void cgi_arena_set_size( size_t size );
+
+/**
+ *	Peak usage of the request memory holding form variables, cookies
+ *	and session variables.  Use it to size the memory with
+ *	cgi_arena_set_size().
+ *
+ *	@return	Largest number of bytes used by a single request so far.
+ */
+size_t cgi_arena_peak( void );
+
+/**
+ *	Like cgi_unescape_special_chars(), for data with known length which
+ *	may contain NUL bytes.
+ *
+ *	@param[in]	str			URL encoded data.
+ *	@param[in]	len			Length of str.
+ *	@param[out]	decoded_len	Length of the result without the terminating
+ *							NUL, may be NULL.
+ *
+ *	@return	Newly allocated, NUL terminated string.
+ */
+char *cgi_unescape_special_chars_len( const char *str, size_t len,
+		size_t *decoded_len );
+
+/**
+ *	Like cgi_escape_special_chars(), but writes to a buffer of the
+ *	caller instead of allocating.  Nothing is written if the result does
+ *	not fit, so the return value can be used to size the buffer or to
+ *	append several strings to one buffer.
+ *
+ *	@param[out]	buf		Buffer, NUL terminated on success.
+ *	@param[in]	size	Size of buf, may be 0.
+ *	@param[in]	str		String to escape.
+ *
+ *	@return	Length of the escaped string without NUL, it was written if
+ *			less than size.
+ */
+size_t cgi_escape_special_chars_buf( char *buf, size_t size,
+		const char *str );
+
+/**
+ *	Number of values sent for a form variable, in constant time.
+ *
+ *	@param[in]	name	Form variable name, case insensitive.
+ *
+ *	@return	Number of values, empty ones included.
+ */
+size_t cgi_param_count( const char *name );
+
+/**
+ *	Start iterating over all values of a form variable, in the order
+ *	they were sent.  Unlike cgi_param_multiple() any number of
+ *	iterations may run at the same time.  An iteration ends early if
+ *	form variables are deleted, or with cgi_end().
+ *
+ *	@code
+ *	cgi_param_iter it;
+ *	const char *value;
+ *
+ *	cgi_param_iter_start( &it, "like" );
+ *	while ( (value = cgi_param_next( &it )) )
+ *		puts( value );
+ *	@endcode
+ *
+ *	@param[out]	it		Iterator.
+ *	@param[in]	name	Form variable name, case insensitive.
+ *
+ *	@return	Number of values.
+ */
+size_t cgi_param_iter_start( cgi_param_iter *it, const char *name );
+
+/**
+ *	Next value of an iteration started with cgi_param_iter_start(),
+ *	in constant time.
+ *
+ *	@param[in,out]	it	Iterator.
+ *
+ *	@return	Value, "" for empty values, NULL at the end.
+ */
+const char *cgi_param_next( cgi_param_iter *it );
+
+/**
+ *	Buffer the response of the current request instead of writing it
+ *	right away.  Headers and body are collected until cgi_end(), which
+ *	sends them with a single writev() and an exact Content-Length
+ *	header.  Everything the program writes to stdout is captured, as
+ *	well as the output of cgi_include().  Headers can be set, replaced
+ *	and redirects made until cgi_end(), even after cgi_init_headers().
+ *	If there is a body but no Content-type, cgi_end() adds
+ *	"Content-type: text/html".
+ *
+ *	Files of cgi_include() and cgi_send_file() are mapped, not copied,
+ *	and read only when cgi_end() sends them.  They must not be truncated
+ *	until then: reading a page past the new end of a mapped file raises
+ *	SIGBUS.  Replace files with rename() instead of rewriting them in
+ *	place.
+ *
+ *	Call it before any output, each request.
+ *
+ *	@return	1 on success, 0 if headers were sent already or on errors.
+ */
+int cgi_response_buffer( void );
+
+/**
+ *	Add an ETag to the buffered response, computed from the body by
+ *	cgi_end().  If the client sent a matching If-None-Match, only the
+ *	headers go out with "Status: 304 Not Modified".  Responses with a
+ *	Status or Location header of their own are left alone.
+ *
+ *	@return	1 on success, 0 if the response is not buffered.
+ */
+int cgi_response_etag( void );
+
+/**
+ *	Write to the response body, buffered after cgi_response_buffer().
+ *	The data is copied.
+ *
+ *	@param[in]	data	Data, may contain NUL bytes.
+ *	@param[in]	len		Length of data.
+ *
+ *	@return	1 on success, 0 on errors.
+ */
+int cgi_write( const void *data, size_t len );
+
+/**
+ *	Like cgi_write(), but a buffered response only keeps a reference to
+ *	the data.  Use it for large pieces that stay valid until cgi_end().
+ *
+ *	@param[in]	data	Data, must not change before cgi_end().
+ *	@param[in]	len		Length of data.
+ *
+ *	@return	1 on success, 0 on errors.
+ */
+int cgi_write_ref( const void *data, size_t len );
+
+/**
+ *	Write to the response body escaped like htmlentities(), without
+ *	allocating the escaped string.
+ *
+ *	@param[in]	s		Text, may contain NUL bytes.
+ *	@param[in]	len		Length of s.
+ *
+ *	@return	1 on success, 0 on errors.
+ */
+int cgi_write_html_escaped( const char *s, size_t len );
+
+/**
+ *	printf() to the response body with strings HTML escaped, without
+ *	building the escaped strings:
+ *
+ *	- %s, %c	escaped like htmlentities(), NULL gives "(null)"
+ *	- %r		a string as it is, for markup
+ *
+ *	Width and precision of %s and %r count bytes of the string as it
+ *	is.  Numbers and %p are formatted like printf(), %n is not taken.
+ *
+ *	\code
+ *	cgi_printf_html( "<a href=\"?q=%s\">%s</a>%r\n",
+ *			cgi_param( "q" ), title, "<br>" );
+ *	\endcode
+ *
+ *	@param[in]	format	Format.
+ *
+ *	@return	1 on success, 0 on invalid formats or write errors.
+ */
+int cgi_printf_html( const char *format, ... );
+
+/**
+ *	cgi_printf_html() with a va_list.
+ */
+int cgi_vprintf_html( const char *format, va_list ap );
+
+/**
+ *	Compress response bodies with gzip for clients that accept it
+ *	(HTTP_ACCEPT_ENCODING).  Unbuffered responses are compressed from
+ *	cgi_init_headers() on, so headers must be sent with it.  Bodies
+ *	smaller than min_size go out as they are.  "Content-Encoding: gzip"
+ *	and "Vary: Accept-Encoding" are added as needed.  Off by default.
+ *
+ *	cgi_include() sends the content of path.gz instead of compressing
+ *	path again, if that file is a single gzip member of path and not
+ *	older than it.
+ *
+ *	@param[in]	level		zlib level 1 (fast) to 9 (small), 0 disables,
+ *							negative ones are zlib's default level.
+ *	@param[in]	min_size	Smallest body to compress, in bytes.
+ */
+void cgi_compress( int level, size_t min_size );
+
+/**
+ *	Send a file as the whole response, with Content-type, Content-Length,
+ *	Last-Modified and an ETag made of inode, size and modification time.
+ *	If the client has the file already (If-None-Match, or
+ *	If-Modified-Since without it), the answer is "Status: 304 Not
+ *	Modified" and no body.  Do not send headers before.
+ *
+ *	A GET with a Range header, and a matching If-Range if any, gets
+ *	"206 Partial Content" with the requested bytes, several ranges as
+ *	multipart/byteranges.  Overlapping ranges are merged, with more than
+ *	16 the whole file is sent.  If no range is in the file, the answer
+ *	is "416 Requested Range Not Satisfiable".
+ *
+ *	The body is copied like with cgi_include(), ranges from their
+ *	offset without reading the rest of the file.
+ *
+ *	@param[in]	path			File name.
+ *	@param[in]	content_type	Content-type header value, NULL for
+ *								"application/octet-stream".
+ *
+ *	@return	200, 206, 304, 416, or 0 on errors.  Nothing was sent if
+ *			the file can't be read.
+ */
+int cgi_send_file( const char *path, const char *content_type );
+
+/**
+ *	Set the directory for uploaded files.  Files of multipart/form-data
+ *	requests are spooled to anonymous temporary files there, "/tmp" by
+ *	default.  Pick one on the filesystem of the final destination, so
+ *	cgi_upload_save() can link instead of copy.
+ *
+ *	@param[in]	path	Directory, must exist.
+ */
+void cgi_upload_tmpdir( const char *path );
+
+/**
+ *	Receive file contents with a callback while they arrive, instead of
+ *	spooling them to temporary files.  For the default request, see
+ *	cgi_request_upload_set_handler() for others.
+ *
+ *	@param[in]	handler	Callback, NULL to spool to files again.
+ *	@param[in]	arg		Passed to the handler.
+ */
+void cgi_upload_set_handler( cgi_upload_handler handler, void *arg );
+
+/**
+ *	Get an uploaded file after cgi_process_form().
+ *
+ *	@param[in]	name	Form field name, case insensitive.
+ *
+ *	@return	First file sent for that field, NULL if none.
+ */
+struct cgi_upload *cgi_upload_file( const char *name );
+
+/**
+ *	All uploaded files of the request, linked by next.
+ *
+ *	@return	First file, NULL if none.
+ */
+struct cgi_upload *cgi_upload_list( void );
+
+/**
+ *	Store a spooled file.  The temporary file is linked to path where
+ *	the system supports it, its content is copied otherwise.
+ *
+ *	@param[in]	upload	File spooled to disk (fd not -1).
+ *	@param[in]	path	Destination, must not exist.
+ *
+ *	@return	1 on success, 0 on errors.
+ */
+int cgi_upload_save( const struct cgi_upload *upload, const char *path );
+
 /**
  *	The version of this library.
  *
@@ -128,7 +467,8 @@ const char *cgi_version( void );
  *	Send a HTTP header 'Location:' with the uri provided together with a
  *	pseudo header 'Status:' with some HTTP status code. See RFC 3875,
  *	section 6.3 (Response Header Fields) for details on how this is
- *	supposed to work.
+ *	supposed to work.  Headers set before stay, the headers of an
+ *	unbuffered response are sent with it.
  *
  *	@see	https://tools.ietf.org/html/rfc3875#section-6.3
  *
@@ -14,6 +14,8 @@
 #ifndef CGI_TYPES_H
 #define CGI_TYPES_H
 
+#include <stddef.h>
+
 /**
  *	HTTP status codes.
  *
@@ -81,6 +83,42 @@ typedef struct formvarsA {
 	struct formvarsA *next;
 } formvars;
 
+/**
+ *	Position in the values of a form variable, see cgi_param_iter().
+ *	The members are private.
+ */
+typedef struct cgi_param_iter {
+	void			*index;
+	unsigned int	epoch;
+	unsigned int	entry;
+} cgi_param_iter;
+
+/**
+ *	A file of a multipart/form-data request, see cgi_upload_file().
+ *	Lives in request memory until cgi_end().
+ */
+struct cgi_upload {
+	const char			*name;			/**< form field name	*/
+	const char			*filename;		/**< as sent by the client, may be empty	*/
+	const char			*content_type;	/**< NULL if not sent	*/
+	size_t				size;			/**< bytes received	*/
+	int					fd;				/**< spooled file, -1 with an upload handler	*/
+	struct cgi_upload	*next;
+};
+
+/**
+ *	Upload handler, see cgi_upload_set_handler().
+ *
+ *	@param[in]	upload	The file, size counts the bytes so far.
+ *	@param[in]	data	Next piece of content, NULL when the file is complete.
+ *	@param[in]	len		Length of data.
+ *	@param[in]	arg		Argument passed to cgi_upload_set_handler().
+ *
+ *	@return	0 to go on, any other value aborts cgi_process_form().
+ */
+typedef int (*cgi_upload_handler)( const struct cgi_upload *upload,
+		const char *data, size_t len, void *arg );
+
 #ifdef __cplusplus
 }
 #endif
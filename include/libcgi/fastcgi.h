@@ -0,0 +1,94 @@
+/*******************************************************************//**
+ *	@file		libcgi/fastcgi.h
+ *
+ *	@brief		Persistent FastCGI request loop.
+ *
+ *	Instead of paying fork/exec and cgi_init() for every request, a
+ *	program can serve many requests from one process.  The loop reads
+ *	FastCGI records, exports the request parameters as environment
+ *	variables, redirects stdin and stdout to the FCGI_STDIN and
+ *	FCGI_STDOUT streams and calls a handler, which uses the regular
+ *	libcgi API exactly like a classic CGI program does.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#ifndef CGI_FASTCGI_H
+#define CGI_FASTCGI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *	The file descriptor a FastCGI capable web server passes the
+ *	listening socket on, see FastCGI specification, section 2.2.
+ */
+#define CGI_FCGI_LISTENSOCK_FILENO	0
+
+/**
+ *	Request handler called once per FastCGI request.
+ *
+ *	The handler works like main() of a classic CGI program: call
+ *	cgi_init(), cgi_process_form() and so on, write the response to
+ *	stdout.  Whatever the handler leaves over is cleaned up by the loop
+ *	calling cgi_end() after the handler returned.
+ *
+ *	@param[in]	arg		User pointer passed to the loop.
+ *
+ *	@return	Application status reported in FCGI_END_REQUEST, use 0 for
+ *			success like an exit code.
+ */
+typedef int (*cgi_fcgi_handler)( void *arg );
+
+/**
+ *	Create a listening unix domain socket.
+ *
+ *	An existing socket file at @p path is removed first.
+ *
+ *	@param[in]	path	Filesystem path of the socket.
+ *	@param[in]	backlog	Backlog passed to listen(2).
+ *
+ *	@return	Listening file descriptor, -1 on error (errno is set).
+ */
+int cgi_fcgi_listen( const char *path, int backlog );
+
+/**
+ *	Serve all requests arriving on one connected FastCGI socket.
+ *
+ *	Returns when the web server closes the connection or a request
+ *	without FCGI_KEEP_CONN was answered.  The socket is not closed.
+ *
+ *	@param[in]	fd		Connected socket.
+ *	@param[in]	handler	Called for every request.
+ *	@param[in]	arg		Passed to @p handler.
+ *
+ *	@return	0 on orderly end of the connection, -1 on I/O or
+ *			protocol errors.
+ */
+int cgi_fcgi_serve_connection( int fd, cgi_fcgi_handler handler,
+		void *arg );
+
+/**
+ *	Accept loop, serves connections one after another forever.
+ *
+ *	@param[in]	listen_fd	Listening socket, usually
+ *							CGI_FCGI_LISTENSOCK_FILENO or the result
+ *							of cgi_fcgi_listen().
+ *	@param[in]	handler		Called for every request.
+ *	@param[in]	arg			Passed to @p handler.
+ *
+ *	@return	Only returns on accept(2) errors with -1.
+ */
+int cgi_fcgi_run( int listen_fd, cgi_fcgi_handler handler, void *arg );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CGI_FASTCGI_H */
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,187 @@
+/*******************************************************************//**
+ *	@file		libcgi/request.h
+ *
+ *	@brief		Request contexts.
+ *
+ *	All state of a request (form variables, cookies, uploads, session,
+ *	whether headers were sent) lives in a cgi_request.  The classic
+ *	functions like cgi_param() work on a default request kept in the
+ *	process wide globals.  Programs serving several requests at once,
+ *	e.g. from a pool of worker threads, create one context per request
+ *	and use the cgi_request_*() functions instead.
+ *
+ *	A context reads its body from its own input stream, writes headers
+ *	to its own output stream and looks up CGI variables in its own
+ *	environment, so nothing is shared with other requests.  Settings
+ *	like cgi_form_limits() or cgi_session_save_path() are process wide.
+ *	A context must only be used by one thread at a time.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#ifndef CGI_REQUEST_H
+#define CGI_REQUEST_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <libcgi/cgi_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cgi_request cgi_request;
+
+/**
+ *	Create a request context.
+ *
+ *	@return	New context, free it with cgi_request_free().
+ */
+cgi_request *cgi_request_new( void );
+
+/**
+ *	Release a context and all data of its request.  The default
+ *	request is only reset, like cgi_end() does.
+ *
+ *	@param[in]	req		Context, may be NULL.
+ */
+void cgi_request_free( cgi_request *req );
+
+/**
+ *	The context used by the functions without a request argument.
+ *
+ *	@return	Default context.
+ */
+cgi_request *cgi_request_default( void );
+
+/**
+ *	Set the stream the request body is read from.
+ *
+ *	@param[in]	req		Context.
+ *	@param[in]	in		Stream, NULL for stdin.
+ */
+void cgi_request_set_input( cgi_request *req, FILE *in );
+
+/**
+ *	Set the stream headers and cookies are written to.
+ *
+ *	@param[in]	req		Context.
+ *	@param[in]	out		Stream, NULL for stdout.
+ */
+void cgi_request_set_output( cgi_request *req, FILE *out );
+
+/**
+ *	Set a CGI variable like REQUEST_METHOD or QUERY_STRING for the
+ *	request.  As soon as one is set the context no longer uses the
+ *	process environment.  Variables are dropped by cgi_request_end().
+ *
+ *	@param[in]	req		Context.
+ *	@param[in]	name	Variable name, case sensitive.
+ *	@param[in]	value	Value, copied.
+ */
+void cgi_request_setenv( cgi_request *req, const char *name,
+		const char *value );
+
+/**
+ *	Get a CGI variable of the request.
+ *
+ *	@param[in]	req		Context.
+ *	@param[in]	name	Variable name.
+ *
+ *	@return	Value, NULL if not set.
+ */
+const char *cgi_request_getenv( cgi_request *req, const char *name );
+
+/**
+ *	Context versions of cgi_init(), cgi_end(), cgi_process_form(),
+ *	cgi_param(), cgi_param_multiple() and cgi_init_headers().
+ */
+int cgi_request_init( cgi_request *req );
+void cgi_request_end( cgi_request *req );
+formvars *cgi_request_process_form( cgi_request *req );
+char *cgi_request_param( cgi_request *req, const char *name );
+char *cgi_request_param_multiple( cgi_request *req, const char *name );
+void cgi_request_init_headers( cgi_request *req );
+
+/**
+ *	Context versions of cgi_param_count() and cgi_param_iter_start(),
+ *	cgi_param_next() works for iterators of any request.
+ */
+size_t cgi_request_param_count( cgi_request *req, const char *name );
+size_t cgi_request_param_iter_start( cgi_request *req, cgi_param_iter *it,
+		const char *name );
+
+/**
+ *	Context versions of cgi_send_header() and the response buffer.  A
+ *	context does not capture stdout, its body is written with
+ *	cgi_request_write(), cgi_request_write_ref(),
+ *	cgi_request_write_html_escaped() and cgi_request_printf_html().
+ */
+void cgi_request_send_header( cgi_request *req, const char *header );
+int cgi_request_response_buffer( cgi_request *req );
+int cgi_request_response_etag( cgi_request *req );
+int cgi_request_write( cgi_request *req, const void *data, size_t len );
+int cgi_request_write_ref( cgi_request *req, const void *data, size_t len );
+int cgi_request_write_html_escaped( cgi_request *req, const char *s,
+		size_t len );
+int cgi_request_printf_html( cgi_request *req, const char *format, ... );
+int cgi_request_vprintf_html( cgi_request *req, const char *format,
+		va_list ap );
+
+/**
+ *	Context versions of the cookie functions.
+ */
+int cgi_request_add_cookie( cgi_request *req, const char *name,
+		const char *value, const char *max_age, const char *path,
+		const char *domain, const int secure );
+formvars *cgi_request_get_cookies( cgi_request *req );
+char *cgi_request_cookie_value( cgi_request *req, const char *name );
+
+/**
+ *	Context versions of cgi_upload_set_handler(), cgi_upload_file() and
+ *	cgi_upload_list().  The handler is kept over cgi_request_end().
+ */
+void cgi_request_upload_set_handler( cgi_request *req,
+		cgi_upload_handler handler, void *arg );
+struct cgi_upload *cgi_request_upload_file( cgi_request *req,
+		const char *name );
+struct cgi_upload *cgi_request_upload_list( cgi_request *req );
+
+/**
+ *	Context versions of the session functions.  session_lasterror is
+ *	still shared by all requests.
+ */
+int cgi_request_session_start( cgi_request *req );
+int cgi_request_session_destroy( cgi_request *req );
+char *cgi_request_session_var( cgi_request *req, const char *name );
+int cgi_request_session_var_exists( cgi_request *req, const char *name );
+int cgi_request_session_register_var( cgi_request *req, const char *name,
+		const char *value );
+int cgi_request_session_alter_var( cgi_request *req, const char *name,
+		const char *new_value );
+int cgi_request_session_unregister_var( cgi_request *req, char *name );
+
+/**
+ *	Context version of libcgi_error(), the functions taking a request
+ *	report through it.  With cgi_display_errors set the message goes
+ *	to the response of req after its headers, never to another
+ *	request.  E_FATAL and E_MEMORY end req and then the program.
+ *
+ *	@param[in]	req			Context.
+ *	@param[in]	error_code	E_WARNING, E_FATAL … from libcgi/error.h.
+ *	@param[in]	msg			printf() format of the message.
+ */
+void cgi_request_error( cgi_request *req, int error_code, const char *msg,
+		... );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CGI_REQUEST_H */
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
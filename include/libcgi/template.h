@@ -0,0 +1,71 @@
+/*******************************************************************//**
+ *	@file		libcgi/template.h
+ *
+ *	@brief		Compiled HTML templates.
+ *
+ *	A template is a file with tags in double braces:
+ *
+ *	- {{name}}				value of name, escaped like htmlentities()
+ *	- {{{name}}}			value of name as it is
+ *	- {{#name}} … {{/name}}	repeated for every value of name
+ *	- {{^name}} … {{/name}}	only if name has no value
+ *	- {{.}}, {{{.}}}		value of the innermost repetition
+ *	- {{! comment }}		left out
+ *
+ *	Values come from a formvars list, e.g. built with slist_add(), the
+ *	form data or the session variables.  Names are case insensitive
+ *	like cgi_param().  Several items with the same name are its values,
+ *	like for cgi_param_multiple().  Inside a repetition, a name with
+ *	several values gives the one at the position of the repetition, so
+ *	lists of the same length make table rows:
+ *
+ *	\code
+ *	<table>{{#title}}
+ *	<tr><td>{{.}}</td><td>{{price}}</td></tr>{{/title}}
+ *	</table>
+ *	\endcode
+ *
+ *	A file is compiled on first use and cached per thread until it
+ *	changes, so persistent processes parse it once.  Rendering writes
+ *	straight to the response without building strings.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#ifndef CGI_TEMPLATE_H
+#define CGI_TEMPLATE_H
+
+#include <libcgi/cgi_types.h>
+#include <libcgi/request.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *	Render a template file to the response.
+ *
+ *	@param[in]	path	Template file.
+ *	@param[in]	vars	Values, may be NULL.
+ *
+ *	@return	1 on success, 0 if the file can't be read or has syntax
+ *			errors (nothing is written then) or on write errors.
+ */
+int cgi_template_render( const char *path, formvars *vars );
+
+/**
+ *	Context version of cgi_template_render().
+ */
+int cgi_request_template_render( cgi_request *req, const char *path,
+		formvars *vars );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CGI_TEMPLATE_H */
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,191 @@
+/*******************************************************************//**
+ *	@file		arena.c
+ *
+ *	Bump pointer allocator for request data.  Everything parsed from a
+ *	request (form variables, cookies, session variables) is allocated
+ *	here and released at once by cgi_end(), instead of one malloc() and
+ *	free() per string.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/error.h"
+
+#include "internal.h"
+
+#define ARENA_DEFAULT_SIZE	4096
+
+struct cgi_arena_block {
+	struct cgi_arena_block	*next;
+	size_t					size;
+	size_t					used;
+	/*	data follows, ARENA_ALIGN aligned by the header size	*/
+};
+
+#define ARENA_HDR_SIZE	((sizeof(struct cgi_arena_block) + ARENA_ALIGN - 1) \
+							& ~(ARENA_ALIGN - 1))
+
+// memory of the current request, released by cgi_end()
+struct cgi_arena request_arena = { NULL, 0, 0, 0 };
+
+static struct cgi_arena_block *arena_block_new( size_t size )
+{
+	struct cgi_arena_block *block;
+
+	block = malloc( ARENA_HDR_SIZE + size );
+	if ( !block ) return NULL;
+
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+
+	return block;
+}
+
+void *cgi_arena_alloc( struct cgi_arena *arena, size_t size )
+{
+	struct cgi_arena_block *block = arena->head;
+	size_t block_size;
+	void *p;
+
+	/*	rounding up and the block header must not wrap around	*/
+	if ( size > SIZE_MAX - ARENA_ALIGN - ARENA_HDR_SIZE )
+	{
+		libcgi_error( E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+		return NULL;
+	}
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if ( !size ) size = ARENA_ALIGN;
+
+	if ( !block || block->size - block->used < size )
+	{
+		block_size = arena->block_size ? arena->block_size
+				: ARENA_DEFAULT_SIZE;
+		if ( block_size < size ) block_size = size;
+
+		block = arena_block_new( block_size );
+		if ( !block )
+		{
+			libcgi_error( E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+			return NULL;
+		}
+
+		/*	keep the block with free space in front	*/
+		if ( arena->head && block_size == size )
+		{
+			block->next = arena->head->next;
+			arena->head->next = block;
+		}
+		else
+		{
+			block->next = arena->head;
+			arena->head = block;
+		}
+	}
+
+	p = (char *) block + ARENA_HDR_SIZE + block->used;
+	block->used += size;
+
+	arena->used += size;
+	if ( arena->used > arena->peak ) arena->peak = arena->used;
+
+	return p;
+}
+
+void *cgi_arena_calloc( struct cgi_arena *arena, size_t size )
+{
+	return memset( cgi_arena_alloc( arena, size ), 0, size );
+}
+
+char *cgi_arena_strndup( struct cgi_arena *arena, const char *s, size_t len )
+{
+	char *p = cgi_arena_alloc( arena, len + 1 );
+
+	memcpy( p, s, len );
+	p[len] = '\0';
+
+	return p;
+}
+
+formvars *cgi_arena_formvar( struct cgi_arena *arena )
+{
+	return cgi_arena_calloc( arena, sizeof(formvars) );
+}
+
+/*	whether p was allocated from arena, items of request lists that
+ *	are not must be free()d	*/
+int cgi_arena_owns( const struct cgi_arena *arena, const void *p )
+{
+	const struct cgi_arena_block *block;
+	const char *data;
+
+	for ( block = arena->head; block; block = block->next )
+	{
+		data = (const char *) block + ARENA_HDR_SIZE;
+		if ( (const char *) p >= data && (const char *) p < data + block->used )
+			return 1;
+	}
+
+	return 0;
+}
+
+void cgi_arena_release( struct cgi_arena *arena )
+{
+	struct cgi_arena_block *block, *next, *keep = NULL;
+	size_t want = arena->block_size ? arena->block_size : ARENA_DEFAULT_SIZE;
+
+	for ( block = arena->head; block; block = next )
+	{
+		next = block->next;
+
+		/*	keep one block around for the next request	*/
+		if ( !keep && block->size == want )
+		{
+			keep = block;
+			keep->used = 0;
+			keep->next = NULL;
+			continue;
+		}
+
+		free( block );
+	}
+
+	arena->head = keep;
+	arena->used = 0;
+}
+
+void cgi_arena_destroy( struct cgi_arena *arena )
+{
+	struct cgi_arena_block *block, *next;
+
+	for ( block = arena->head; block; block = next )
+	{
+		next = block->next;
+		free( block );
+	}
+
+	arena->head = NULL;
+	arena->used = 0;
+}
+
+void cgi_arena_set_size( size_t size )
+{
+	request_arena.block_size = size;
+}
+
+size_t cgi_arena_peak( void )
+{
+	return request_arena.peak;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
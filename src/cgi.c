@@ -7,21 +7,32 @@
  * License-Filename: LICENSES/LGPL-2.1.txt
  */
 
+#define _GNU_SOURCE
+
 #include "libcgi/cgi.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "libcgi/cgi_types.h"
 #include "libcgi/config.h"
 #include "libcgi/error.h"
 
+#include "internal.h"
+
 // There's no reason to not have this initialised.
-static const char hextable[256] = {
+const unsigned char cgi_hextable[256] = {
 	0xFF, 0xFF, 0xFF, 0xFF,		0xFF, 0xFF, 0xFF, 0xFF,
 	0xFF, 0xFF, 0xFF, 0xFF,		0xFF, 0xFF, 0xFF, 0xFF,
 	0xFF, 0xFF, 0xFF, 0xFF,		0xFF, 0xFF, 0xFF, 0xFF,
@@ -58,36 +69,49 @@ static const char hextable[256] = {
 
 
 
-int headers_initialized = 0;
-
 formvars *formvars_start = NULL;
 formvars *formvars_last = NULL;
 
-// session.c
-extern formvars *sess_list_start;
+// chunk size of cgi_include() if the kernel can't copy
+#define INCLUDE_BUFSIZE 8192
+
+// decode form data in place, see cgi_form_decode_in_place()
+static int form_in_place = 0;
+
+// POST body limits, see cgi_form_limits()
+static unsigned long form_content_max = 1024UL * 1024UL;
+static size_t form_field_max = 1024UL * 1024UL;
 
 // Set to 1 to activate runtime debugation, 0 to disable it
 int cgi_display_errors = 1;
 
-// cookie.c
-extern formvars *cookie_start;
-extern formvars *cookie_end;
 
 // Separates *query in name=value pairs, then gets each piece of result of them, storing
-// the result in the linked list global variable
+// the result in the linked list global variable. All memory comes from the
+// request arena and is released by cgi_end().
 formvars *process_data(const char *query, formvars **start, formvars **last,
 	                   const char sep_value, const char sep_name)
+{
+	return process_data_arena(&request_arena, query, start, last, sep_value,
+	                          sep_name);
+}
+
+// process_data() with memory from the arena of a request
+formvars *process_data_arena(struct cgi_arena *arena, const char *query,
+                             formvars **start, formvars **last,
+                             const char sep_value, const char sep_name)
 {
 	formvars *item;
 	const char *equal, *amp;
 	size_t name_len;
 	size_t value_len;
-	char *str_unesc;
-	const char *query_end = strchr(query, '\0');
+	const char *query_end;
 
 	if (query == NULL)
 		return *start;
 
+	query_end = strchr(query, '\0');
+
 	for ( ; query < query_end; query = amp + 1)
 	{
 		/* find end of name and value pair (with or without value) */
@@ -105,33 +129,108 @@ formvars *process_data(const char *query, formvars **start, formvars **last,
 		if (! name_len)
 			continue;
 
-		/* allocate and initialise memory for new formvars */
-		item = (formvars *)calloc(1, sizeof(formvars));
-		if (! item)
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
-
-		/* add name and value to new formvar item */
-		item->name = strndup(query, name_len);
-		if (! item->name)
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+		item = cgi_arena_formvar(arena);
+		item->name = cgi_arena_strndup(arena, query, name_len);
 
 		if (value_len)
 		{
-			item->value = strndup(equal + 1, value_len);
-			if (! item->value)
-				libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+			/* decoding only ever shrinks, so value_len + 1 is enough */
+			item->value = cgi_arena_alloc(arena, value_len + 1);
+			item->value[cgi_unescape_into(item->value, equal + 1, value_len)] = '\0';
+		}
+
+		slist_add(item, start, last);
+	}
+
+	return *start;
+}
+
+// Like process_data(), but values are decoded in place and the items
+// point into buf, which must live as long as the list. Names are not
+// decoded, the same as in the other modes.
+formvars *process_data_in_place(struct cgi_arena *arena, char *buf,
+                                formvars **start, formvars **last,
+                                const char sep_value, const char sep_name)
+{
+	formvars *item;
+	char *equal, *amp, *end = strchr(buf, '\0');
+	size_t name_len;
+	size_t value_len;
+
+	for ( ; buf < end; buf = amp + 1)
+	{
+		for (amp = buf; (*amp != sep_name) && (*amp); ++amp);
+		for (equal = buf; (*equal != sep_value) && (equal < amp); ++equal);
+
+		name_len = equal - buf;
+		value_len = (*equal == sep_value) ? amp - (equal + 1) : 0;
+
+		if (! name_len)
+			continue;
 
-			str_unesc = cgi_unescape_special_chars(item->value);
-			free(item->value);
-			item->value = str_unesc;
+		item = cgi_arena_formvar(arena);
+
+		// the terminators may overwrite '=' and '&', both were read above
+		if (value_len)
+		{
+			item->value = equal + 1;
+			item->value[cgi_unescape_into(item->value, item->value, value_len)] = '\0';
 		}
 
+		item->name = buf;
+		item->name[name_len] = '\0';
+
 		slist_add(item, start, last);
 	}
 
 	return *start;
 }
 
+// Decode len bytes of URL encoded src into dst, returns the decoded length.
+// dst may be src, decoding in place works because the data only shrinks.
+// Malformed escapes are copied as they are.
+size_t cgi_unescape_into(char *dst, const char *src, size_t len)
+{
+	const unsigned char *hex = cgi_hextable;
+	char *write = dst;
+	size_t i = 0, run;
+
+	while (i < len)
+	{
+		// everything up to the next '%' or '+' is copied at once, in
+		// place there is nothing to copy until the first escape
+		run = cgi_scan_url_special(src + i, len - i);
+		if (write != src + i)
+			memmove(write, src + i, run);
+		write += run;
+		i += run;
+
+		if (i == len)
+			break;
+
+		if (src[i] == '+')
+		{
+			*write++ = ' ';
+			i++;
+		}
+		else if (i + 2 < len
+				&& hex[(unsigned char) src[i + 1]] != 0xFF
+				&& hex[(unsigned char) src[i + 2]] != 0xFF)
+		{
+			*write++ = (hex[(unsigned char) src[i + 1]] << 4)
+				| hex[(unsigned char) src[i + 2]];
+			i += 3;
+		}
+		else
+		{
+			*write++ = '%';
+			i++;
+		}
+	}
+
+	return write - dst;
+}
+
 /*****************************************************
 					CGI GROUP
 *****************************************************/
@@ -147,58 +246,117 @@ formvars *process_data(const char *query, formvars **start, formvars **last,
 * @see cgi_init, cgi_init_headers
 **/
 formvars *cgi_process_form()
+{
+	return cgi_request_process_form(&cgi_default_request);
+}
+
+formvars *cgi_request_process_form(cgi_request *req)
 {
 	formvars *ret = NULL;
-	char *method = getenv("REQUEST_METHOD");
+	const char *method = cgi_request_getenv(req, "REQUEST_METHOD");
 
 	/* When METHOD has no contents, the default action is to process it as
 	 * GET method
 	 */
 	if (! method || ! strcasecmp("GET", method))
 	{
-		char *q = getenv("QUERY_STRING");
+		const char *q = cgi_request_getenv(req, "QUERY_STRING");
 
 		// Sometimes, GET comes without any data
-		if (q && *q)
-			ret = process_data(q, &formvars_start, &formvars_last, '=', '&');
+		if (q && *q && form_in_place)
+			ret = process_data_in_place(req->arena,
+					cgi_arena_strndup(req->arena, q, strlen(q)),
+					req->form_start, req->form_last, '=', '&');
+		else if (q && *q)
+			ret = process_data_arena(req->arena, q, req->form_start,
+			                         req->form_last, '=', '&');
 	}
 	else if (! strcasecmp("POST", method))
 	{
+		FILE *in = cgi_request_in(req);
 		char *post_data;
-		char *length_str;
+		const char *content_type;
+		const char *length_str;
 		char *trailing;
 		unsigned long length;
-		/* no current support for file uploads, so limit upload data size
-		 * 1 MB should be overkill for text data
-		 */
-		const unsigned long content_max = 1024UL * 1024UL;
 
-		length_str = getenv("CONTENT_LENGTH");
+		length_str = cgi_request_getenv(req, "CONTENT_LENGTH");
 		if (! length_str || ! *length_str)
 			return NULL;
 
 		/* validate length. not checking for negative as is cast unsigned. */
 		length = strtoul(length_str, &trailing, 10);
-		if (*trailing != '\0' || ! length || length > content_max)
+		if (*trailing != '\0' || ! length
+				|| (form_content_max && length > form_content_max))
 			return NULL;
 
-		post_data = (char *)malloc(length + 1);
-		if (! post_data)
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+		content_type = cgi_request_getenv(req, "CONTENT_TYPE");
 
-		if (fread(post_data, sizeof(char), length, stdin) == length)
+		if (content_type && ! strncasecmp(content_type, "multipart/form-data", 19))
 		{
-			post_data[length] = '\0';
-			ret = process_data(post_data, &formvars_start, &formvars_last,
-			                   '=', '&');
+			/* files are streamed to disk or to the upload handler */
+			ret = cgi_read_multipart(req, in, length, content_type,
+			                         form_field_max);
 		}
+		else if (! form_in_place)
+		{
+			/* parse while reading, memory is bounded by the largest field */
+			ret = cgi_read_urlencoded(req->arena, in, length, form_field_max,
+			                          req->form_start, req->form_last);
+		}
+		else if (length < SIZE_MAX - ARENA_ALIGN)
+		{
+			/* in place decoding keeps the body in request memory, where
+			 * the form variables point to */
+			post_data = cgi_arena_alloc(req->arena, length + 1);
 
-		free(post_data);
+			if (post_data
+			    && fread(post_data, sizeof(char), length, in) == length)
+			{
+				post_data[length] = '\0';
+				ret = process_data_in_place(req->arena, post_data,
+				                            req->form_start, req->form_last,
+				                            '=', '&');
+			}
+		}
 	}
 
+	slist_index_build(&req->form_index, *req->form_start, *req->form_last);
+
 	return ret;
 }
 
+/**
+* Decode form data in place.
+* With this option cgi_process_form() keeps a single copy of the query string
+* or POST body in request memory and decodes names and values right there, the
+* form variables point into that buffer until cgi_end().
+* @param enable 1 to decode in place, 0 for the default
+* @see cgi_process_form
+**/
+void cgi_form_decode_in_place(int enable)
+{
+	form_in_place = enable;
+}
+
+/**
+* Set limits for POST data.
+* The body is parsed while it is read, so memory is bounded by the largest
+* field. Bodies larger than content_max are rejected completely, parsing stops
+* at the first field larger than field_max. Both default to 1 MB, they apply to
+* multipart/form-data as well, where field_max does not limit files. In place
+* decoding (see cgi_form_decode_in_place()) needs the whole body in memory and
+* only honours content_max.
+* @param content_max Maximum CONTENT_LENGTH in bytes, 0 for no limit
+* @param field_max Maximum decoded length of name plus value, 0 for no limit
+* @see cgi_process_form
+**/
+void cgi_form_limits(unsigned long content_max, size_t field_max)
+{
+	form_content_max = content_max;
+	form_field_max = field_max;
+}
+
 /**
 * Kills the application with a message.
 * Writes msg and terminate
@@ -214,6 +372,64 @@ void cgi_fatal(const char *msg)
 	exit(1);
 }
 
+// Copy size bytes from fd to out in the kernel: splice() if out is a
+// pipe, sendfile() otherwise. Returns the bytes copied, less than size
+// if the kernel can't do it for these descriptors.
+static size_t include_kernel(int out, int fd, off_t start, size_t size)
+{
+	size_t done = 0;
+#ifdef __linux__
+	struct stat st;
+	loff_t off = start;
+	off_t soff = start;
+	ssize_t n;
+	int pipe_out = fstat(out, &st) == 0 && S_ISFIFO(st.st_mode);
+
+	while (done < size) {
+		if (pipe_out)
+			n = splice(fd, &off, out, NULL, size - done, SPLICE_F_MORE);
+		else
+			n = sendfile(out, fd, &soff, size - done);
+
+		if (n > 0)
+			done += n;
+		else if (n == -1 && errno == EINTR)
+			continue;
+		else
+			break;
+	}
+#endif
+	return done;
+}
+
+// Copy size bytes of fd from offset start to stdout, stdio buffers
+// flushed first so the order is kept. Whatever the kernel didn't copy,
+// e.g. stdout is not a file descriptor (FastCGI, compression), goes
+// through a fixed buffer. The file offset is never used nor moved.
+static size_t include_fd(int fd, off_t start, size_t size)
+{
+	char buf[INCLUDE_BUFSIZE];
+	size_t done = 0;
+	ssize_t n;
+	int out;
+
+	fflush(stdout);
+	if ((out = fileno(stdout)) != -1)
+		done = include_kernel(out, fd, start, size);
+
+	while (done < size) {
+		n = pread(fd, buf, size - done < sizeof(buf) ? size - done : sizeof(buf),
+		          start + done);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0 || fwrite(buf, 1, n, stdout) != (size_t) n)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
 /**
 * Include static files.
 * Function used to include static data ( normally html files ).
@@ -232,42 +448,40 @@ void cgi_fatal(const char *msg)
 */
 int cgi_include(const char *path)
 /* flow: path != NULL
- *       get file stats (for file size)
- *       allocate memory for file contents
- *       open file stream
- *       read whole file into memory - includes shouldn't be huge
- *       write to stdout
+ *       open file, get its size
+ *       buffered response: map the file, see cgi_response_buffer()
+ *       compressed response: send path.gz if it is up to date
+ *       otherwise flush stdout and let the kernel copy the file, or
+ *       read and write it in pieces where it can't
  *       return number of bytes written (0 == failure)
  */
 {
 	struct stat fstats;
-	FILE *fp = NULL;
-	char *fcontents = NULL;
 	size_t nwritten = 0;
+	int fd = -1;
 
 	if (! path)
 		goto err_input;
 
-	if (stat (path, &fstats) == -1)
+	if ((fd = open (path, O_RDONLY)) == -1 || fstat (fd, &fstats) == -1)
 		goto err_input;
 
-	if (! (fcontents = malloc (fstats.st_size)))
-		goto err_memory;
-
-	if (! (fp = fopen (path, "r")))
-		goto err_input;
-
-	if (fread (fcontents, sizeof(char), fstats.st_size, fp) != fstats.st_size)
-		goto err_input;
+	// buffered, or compressed with an up to date path.gz at hand
+	if ((cgi_default_request.response.buffered
+	     && cgi_response_include (&cgi_default_request, path, fd, &fstats,
+	                              0, fstats.st_size))
+	    || cgi_compress_include (&cgi_default_request, path, &fstats)) {
+		nwritten = fstats.st_size;
+		goto cleanup;
+	}
 
-	nwritten = fwrite (fcontents, sizeof(char), fstats.st_size, stdout);
-	if (nwritten != fstats.st_size)
+	nwritten = include_fd (fd, 0, fstats.st_size);
+	if (nwritten != (size_t) fstats.st_size)
 		goto err_output;
 
 cleanup:
-	if (fp)
-		fclose (fp);
-	free (fcontents);
+	if (fd != -1)
+		close (fd);
 
 	return nwritten;
 
@@ -276,14 +490,187 @@ err_input:
 	goto cleanup;
 
 err_output:
-	libcgi_error(E_WARNING, "%s: written: %u of %u",
-	             __FUNCTION__, nwritten, fstats.st_size);
+	libcgi_error(E_WARNING, "%s: written: %lu of %lu", __FUNCTION__,
+	             (unsigned long) nwritten, (unsigned long) fstats.st_size);
 	goto cleanup;
+}
+
+// Body of cgi_send_file(), a part of the file either way.
+static int send_file_part(int fd, const struct stat *st,
+                          unsigned long long first, size_t len)
+{
+	cgi_request *req = &cgi_default_request;
+
+	if (req->response.buffered)
+		return cgi_response_include (req, NULL, fd, st, first, len);
+
+	return include_fd (fd, first, len) == len;
+}
+
+// multipart/byteranges, the length is computed before anything is sent
+static int send_file_ranges(int fd, const struct stat *st, const char *type,
+                            const char *etag, const struct cgi_range *ranges,
+                            int nranges)
+{
+	cgi_request *req = &cgi_default_request;
+	char boundary[80], part[512];
+	unsigned long long length = 0;
+	int i, pass, n;
+
+	snprintf (boundary, sizeof(boundary), "CGI-BYTERANGES-%.*s",
+	          (int) strlen (etag) - 2, etag + 1);
+
+	for (pass = 0; pass < 2; pass++) {
+		if (pass) {
+			cgi_header_set (req, "Status", "206 Partial Content");
+			cgi_header_set (req, "Content-type",
+			                "multipart/byteranges; boundary=%s", boundary);
+		}
+		if (pass && ! req->response.buffered) {
+			cgi_header_set (req, "Content-Length", "%llu", length);
+			cgi_headers_send (req, stdout);
+		}
+
+		for (i = 0; i < nranges; i++) {
+			n = snprintf (part, sizeof(part),
+			              "\r\n--%s\r\nContent-type: %s\r\n"
+			              "Content-Range: bytes %llu-%llu/%llu\r\n\r\n",
+			              boundary, type, ranges[i].first, ranges[i].last,
+			              (unsigned long long) st->st_size);
+			if (n < 0 || (size_t) n >= sizeof(part))
+				return 0;
+
+			if (! pass) {
+				length += n + ranges[i].last - ranges[i].first + 1;
+				continue;
+			}
+
+			fputs (part, stdout);
+			if (! send_file_part (fd, st, ranges[i].first,
+			                      ranges[i].last - ranges[i].first + 1))
+				return 0;
+		}
+
+		n = snprintf (part, sizeof(part), "\r\n--%s--\r\n", boundary);
+		if (pass)
+			fputs (part, stdout);
+		else
+			length += n;
+	}
+
+	return 1;
+}
+
+int cgi_send_file(const char *path, const char *content_type)
+/* flow: headers not sent yet
+ *       open file, get its size and validators
+ *       answer 304 if the client has the file
+ *       answer 416 if none of the requested ranges is in the file
+ *       otherwise send the ranges or the whole file, copied like with
+ *       cgi_include()
+ *       return status sent (0 == failure)
+ */
+{
+	cgi_request *req = &cgi_default_request;
+	struct cgi_response *r = &req->response;
+	struct cgi_range ranges[CGI_RANGE_MAX];
+	char etag[64], tag[72], date[CGI_HTTP_DATE_LEN];
+	const char *type;
+	struct stat fstats;
+	int fd, nranges, gzip = 0, status = 0;
+
+	if (req->headers_initialized) {
+		libcgi_error(E_WARNING, "%s: headers already sent", __FUNCTION__);
+		return 0;
+	}
+
+	if (! path || (fd = open (path, O_RDONLY)) == -1) {
+		libcgi_error(E_WARNING, "%s: file error: %s", __FUNCTION__, path);
+		return 0;
+	}
+	if (fstat (fd, &fstats) == -1 || ! S_ISREG (fstats.st_mode)) {
+		libcgi_error(E_WARNING, "%s: file error: %s", __FUNCTION__, path);
+		goto cleanup;
+	}
 
-err_memory:
-	/* exit(EXIT_FAILURE) */
-	libcgi_error(E_MEMORY, "%s: %s", __FILE__, __FUNCTION__);
-	goto cleanup; /* silence compiler warnings */
+	type = content_type ? content_type : "application/octet-stream";
+
+	// a buffered response may end up compressed and has its own tag
+	// then, ranges are always of the file as it is
+	if (r->buffered) {
+		r->identity = cgi_request_getenv (req, "HTTP_RANGE") != NULL;
+		gzip = ! r->identity && cgi_compress_accepted (req, fstats.st_size);
+	}
+
+	cgi_file_etag (etag, sizeof(etag), &fstats);
+	snprintf (tag, sizeof(tag), "\"%s%s\"", etag, gzip ? "-gz" : "");
+	cgi_http_date (date, fstats.st_mtime);
+	cgi_header_set (req, "ETag", "%s", tag);
+	cgi_header_set (req, "Last-Modified", "%s", date);
+	cgi_header_set (req, "Accept-Ranges", "bytes");
+
+	if (cgi_not_modified (req, tag, fstats.st_mtime)) {
+		cgi_header_set (req, "Status", "304 Not Modified");
+		if (r->buffered)
+			r->not_modified = 1;
+		else
+			cgi_headers_send (req, stdout);
+		status = 304;
+		goto cleanup;
+	}
+
+	nranges = cgi_range_request (req, tag, fstats.st_mtime, fstats.st_size,
+	                             ranges);
+
+	if (nranges < 0) {
+		cgi_header_set (req, "Status", "416 Requested Range Not Satisfiable");
+		cgi_header_set (req, "Content-Range", "bytes */%llu",
+		                (unsigned long long) fstats.st_size);
+		if (! r->buffered) {
+			cgi_header_set (req, "Content-Length", "0");
+			cgi_headers_send (req, stdout);
+		}
+		status = HTTP_STATUS_REQ_RANGE_NOT_SATIS;
+	}
+	else if (nranges > 1) {
+		if (send_file_ranges (fd, &fstats, type, tag, ranges, nranges))
+			status = HTTP_STATUS_PARTIAL_CONTENT;
+	}
+	else if (nranges == 1) {
+		cgi_header_set (req, "Status", "206 Partial Content");
+		cgi_header_set (req, "Content-type", "%s", type);
+		cgi_header_set (req, "Content-Range", "bytes %llu-%llu/%llu",
+		                ranges[0].first, ranges[0].last,
+		                (unsigned long long) fstats.st_size);
+		if (! r->buffered) {
+			cgi_header_set (req, "Content-Length", "%llu",
+			                ranges[0].last - ranges[0].first + 1);
+			cgi_headers_send (req, stdout);
+		}
+		if (send_file_part (fd, &fstats, ranges[0].first,
+		                    ranges[0].last - ranges[0].first + 1))
+			status = HTTP_STATUS_PARTIAL_CONTENT;
+	}
+	else {
+		cgi_header_set (req, "Content-type", "%s", type);
+		if (! r->buffered) {
+			cgi_header_set (req, "Content-Length", "%lu",
+			                (unsigned long) fstats.st_size);
+			cgi_headers_send (req, stdout);
+		}
+		if (r->buffered
+		    ? cgi_response_include (req, path, fd, &fstats, 0, fstats.st_size)
+		    : include_fd (fd, 0, fstats.st_size) == (size_t) fstats.st_size)
+			status = HTTP_STATUS_OK;
+	}
+
+	if (! status)
+		libcgi_error(E_WARNING, "%s: write failed: %s", __FUNCTION__, path);
+
+cleanup:
+	close (fd);
+
+	return status;
 }
 
 /**
@@ -293,18 +680,35 @@ err_memory:
 **/
 void cgi_init_headers()
 {
-	if (!headers_initialized) {
-		printf("Content-type: text/html\r\n\r\n");
+	cgi_request_init_headers(&cgi_default_request);
+}
 
-		headers_initialized = 1;
-	}
+void cgi_request_init_headers(cgi_request *req)
+{
+	if (req->headers_initialized)
+		return;
+
+	// a Content-type of the program stays
+	if (!cgi_header_get(req, "Content-type"))
+		cgi_header_set(req, "Content-type", "text/html");
+
+	// a buffered response sends the headers with the body, the
+	// compression stage once it knows the body is large enough
+	if (req->response.buffered)
+		return;
+
+	req->headers_initialized = 1;
+	if (!cgi_compress_start(req))
+		cgi_headers_send(req, cgi_request_out(req));
 }
 
 /**
 * Return all values with the same name sent by a form.
 * @param name Form variable name
 * @return Form variable contents
-* @see cgi_param
+* @see cgi_param, cgi_param_iter_start
+*
+* Asking for another name starts over with that name.
 *
 * Example:
 * For example, if in your HTML you have something like<br>
@@ -329,35 +733,67 @@ void cgi_init_headers()
 **/
 char *cgi_param_multiple(const char *name)
 {
-	/* DFrostByte: caching of 'name' would allow beginning new name search
-	* without having to fetch all occurrences of previous.
-	*
-	* taking a formvars * parameter would be more flexible. if return was also
-	* formvars *, the function would work in the same way without any
-	* need for static variables which may be problematic in a shared lib
-	*/
-	static formvars *iter = NULL;
-	char *value;
+	return cgi_request_param_multiple(&cgi_default_request, name);
+}
 
-	if (! iter)
-		iter = formvars_start;
+char *cgi_request_param_multiple(cgi_request *req, const char *name)
+{
+	const char *value;
 
-	for (value = NULL; iter; iter = iter->next)
-	{
-		/* DFrostByte: shouldn't really be case-insensitive */
-		if (! strcasecmp(iter->name, name))
-		{
-			value = iter->value;
-			iter = iter->next;
-			break;
-		}
+	if (!name)
+		return NULL;
+
+	// a new name starts over, the name is kept in request memory
+	if (!req->param_multiple_name
+	    || strcasecmp(req->param_multiple_name, name)) {
+		req->param_multiple_name = cgi_arena_strndup(req->arena, name,
+		                                             strlen(name));
+		if (!req->param_multiple_name)
+			return NULL;
+		cgi_request_param_iter_start(req, &req->param_multiple, name);
 	}
-	/* both iter and value will be NULL if no match was found */
-	return value;
+
+	value = slist_index_next(&req->param_multiple);
+	if (!value)
+		req->param_multiple_name = NULL;
+
+	return (char *) value;
+}
+
+size_t cgi_param_count(const char *name)
+{
+	return cgi_request_param_count(&cgi_default_request, name);
+}
+
+size_t cgi_request_param_count(cgi_request *req, const char *name)
+{
+	cgi_param_iter it;
+
+	return slist_index_iter(&req->form_index, name, *req->form_start,
+	                        *req->form_last, &it);
+}
+
+size_t cgi_param_iter_start(cgi_param_iter *it, const char *name)
+{
+	return cgi_request_param_iter_start(&cgi_default_request, it, name);
+}
+
+size_t cgi_request_param_iter_start(cgi_request *req, cgi_param_iter *it,
+                                    const char *name)
+{
+	return slist_index_iter(&req->form_index, name, *req->form_start,
+	                        *req->form_last, it);
+}
+
+const char *cgi_param_next(cgi_param_iter *it)
+{
+	return slist_index_next(it);
 }
+
 /**
 *  Recirects to the specified url.
-* Remember that you cannot send any header before this function, or it will not work.
+* Remember that the headers must not have been sent before this function, or it will not work.
+* A buffered response (see cgi_response_buffer) can be redirected until cgi_end().
 * <b>Note:</b><br>
 * LibCGI does not implement RFC 2396 to make the lib simple and quick. You should be sure
 * to pass a correct URI to this function.
@@ -369,13 +805,16 @@ char *cgi_param_multiple(const char *name)
 **/
 void cgi_redirect(char *url)
 {
-	if (headers_initialized) {
+	if (cgi_default_request.headers_initialized) {
 		libcgi_error(E_WARNING, "<br><b>Cannot redirect. Headers already sent</b><br>");
 
 		return;
 	}
 
-	printf("Location: %s\r\n\r\n", url);
+	cgi_header_set(&cgi_default_request, "Location", "%s", url);
+
+	if (!cgi_default_request.response.buffered)
+		cgi_headers_send(&cgi_default_request, stdout);
 }
 
 /**
@@ -385,13 +824,18 @@ void cgi_redirect(char *url)
 *  @see cgi_end, cgi_process_form, cgi_init_headers
 **/
 int cgi_init()
+{
+	return cgi_request_init(&cgi_default_request);
+}
+
+int cgi_request_init(cgi_request *req)
 {
 	// Well... the reason I put cgi_get_cookies() here is to not
 	// cause problems with session's. Note that, when you want
 	// to use session within your program, you need  cgi_get_cookies()
 	// before session_start(), otherwise we will get some problems... :)
 	// Calling this function here is the best way. Trust me :)
-	cgi_get_cookies();
+	cgi_cookies_parse(req);
 
 	return 1;
 }
@@ -399,19 +843,58 @@ int cgi_init()
 /**
 * Performs cgi clean ups.
 * Provides some methods to clean memory or any other job that need to be done before the end of the application.
+* All request state is reset, so a persistent process (see libcgi/fastcgi.h) can start over with cgi_init().
 * @see cgi_init
 **/
 void cgi_end()
 {
-	slist_free(&formvars_start);
-
-	formvars_last = NULL;
-
-	if (sess_list_start)
-		slist_free(&sess_list_start);
+	cgi_request_end(&cgi_default_request);
+}
 
-	if (cookies_start)
-		slist_free(&cookies_start);
+void cgi_request_end(cgi_request *req)
+{
+	// session changes are written once, before a buffered response
+	// goes out, so the next request of the client finds them
+	sess_flush(req);
+
+	// a buffered response goes out first, it may point to request data,
+	// then headers that were set but never sent, unless the program
+	// started its own header block by writing some of them
+	cgi_compress_end(req);
+	cgi_response_end(req);
+	if (!req->headers_initialized && !req->headers.sent && req->headers.count)
+		cgi_headers_send(req, cgi_request_out(req));
+	cgi_headers_free(req);
+
+	slist_index_clear(&req->form_index, req->arena, req->form_start);
+	slist_index_free(&req->form_index);
+
+	*req->form_last = NULL;
+	req->param_multiple_name = NULL;
+
+	if (*req->sess_start)
+		slist_index_clear(&req->sess_index, req->arena, req->sess_start);
+	*req->sess_last = NULL;
+	slist_index_free(&req->sess_index);
+	sess_unmap(req);
+
+	if (*req->cookies_start)
+		slist_index_clear(&req->cookies_index, req->arena,
+		                  req->cookies_start);
+	*req->cookies_last = NULL;
+	slist_index_free(&req->cookies_index);
+	req->cookies_parsed = 0;
+
+	cgi_request_session_free(req);
+	cgi_uploads_free(req);
+
+	// the environment lives in request memory as well
+	req->env_start = req->env_last = NULL;
+
+	// everything parsed from the request goes at once
+	cgi_arena_release(req->arena);
+
+	req->headers_initialized = 0;
 }
 
 /**
@@ -419,95 +902,105 @@ void cgi_end()
 * Search for special chars ( like %%E1 ) in str, converting them to the ascii character correspondent.
 * @param str String containing data to parse
 * @return The new string
-* @see cgi_escape_special_chars
+* @see cgi_escape_special_chars, cgi_unescape_special_chars_len
 **/
 char *cgi_unescape_special_chars(const char *str)
 {
-	char *new, *write;
-	char c;
-	char hex[2];
+	if ( !str ) return NULL;
+
+	return cgi_unescape_special_chars_len(str, strlen(str), NULL);
+}
+
+char *cgi_unescape_special_chars_len(const char *str, size_t len,
+                                     size_t *decoded_len)
+{
+	char *new;
+	size_t n;
 
 	if ( !str ) return NULL;
 
-	new = (char *) calloc( strlen(str) + 1, 1 );
+	// decoding only ever shrinks, no need to realloc afterwards
+	new = (char *) malloc( len + 1 );
 	if (! new)
-		libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+		libcgi_error(E_MEMORY, "%s, line %i", __FILE__, __LINE__);
+
+	n = cgi_unescape_into(new, str, len);
+	new[n] = '\0';
+
+	if (decoded_len)
+		*decoded_len = n;
+
+	return new;
+}
 
-	for (write = new; *str; ++str, ++write)
+// Escape len bytes of str into dst, which must hold the exact length.
+static size_t escape_into(char *dst, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char *write = dst;
+	size_t i = 0, run;
+	unsigned char c;
+
+	while (i < len)
 	{
-		c = *str;
+		// bytes kept as they are go at once
+		run = cgi_scan_url_unsafe(str + i, len - i);
+		memcpy(write, str + i, run);
+		write += run;
+		i += run;
 
-		if (c == '+')
-			c = ' ';
-		else if (c == '%')
+		if (i == len)
+			break;
+
+		c = str[i++];
+		if (cgi_url_class[c] == CGI_URL_SPACE)
+			*write++ = '+';
+		else
 		{
-			/* check first expected hex character isn't null to avoid reading
-			 * second hex character from beyond the string
-			 */
-			if (str[1])
-			{
-				hex[0] = hextable[(unsigned char)str[1]];
-				hex[1] = hextable[(unsigned char)str[2]];
-
-				/* valid hex characters? */
-				if (hex[0] != 0xFF && hex[1] != 0xFF)
-				{
-					c = (hex[0] << 4) | hex[1];
-					str += 2;
-				}
-			}
+			*write++ = '%';
+			*write++ = hex[c >> 4];
+			*write++ = hex[c & 0x0F];
 		}
-
-		*write = c;
 	}
-	*write = '\0';
 
-	// free unused memory. no reason to fail.
-	new = realloc(new, strlen(new) + 1);
-
-	return new;
+	return write - dst;
 }
 
 /**
 * Transforms' special characters into hexadecimal form ( %%E1 ).
 * @param str String to parse
 * @return The new string
-* @see cgi_unescape_special_chars
+* @see cgi_unescape_special_chars, cgi_escape_special_chars_buf
 **/
 char *cgi_escape_special_chars(const char *str)
 {
-	static const char hex[] = "0123456789ABCDEF";
 	char *new;
-	int i;
 	size_t len = strlen(str);
+	size_t size;
 
-	// worst case scenario: every character would need to be escaped, requiring
-	// 3 times more memory than the original string.
-	new = (char*)malloc((len * 3) + 1);
-	if (! new)
-		libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+	// the result is len plus two for each %XX, counted up front
+	size = len + 2 * cgi_count_url_escapes(str, len);
 
-	for (i = 0; *str; i++, str++)
-	{
-		if (*str == ' ')
-			new[i] = '+';
-		else if (! isalnum(*str) && ! strchr("_-.", *str))
-		{
-			new[i++] = '%';
-			new[i++] = hex[(unsigned char)*str >> 4];
-			new[i]   = hex[(unsigned char)*str & 0x0F];
-		}
-		else
-			new[i] = *str;
-	}
-	new[i] = '\0';
+	new = (char*)malloc(size + 1);
+	if (! new)
+		libcgi_error(E_MEMORY, "%s, line %i", __FILE__, __LINE__);
 
-	// free unused memory. no reason to fail.
-	new = realloc(new, i+1);
+	new[escape_into(new, str, len)] = '\0';
 
 	return new;
 }
 
+size_t cgi_escape_special_chars_buf(char *buf, size_t size, const char *str)
+{
+	size_t len = strlen(str);
+	size_t need = len + 2 * cgi_count_url_escapes(str, len);
+
+	if (need < size)
+		buf[escape_into(buf, str, len)] = '\0';
+
+	return need;
+}
+
 /**
 * Gets the of HTML or URL variable indicated by 'name'
 * @param name Form Variable name
@@ -530,19 +1023,43 @@ char *cgi_escape_special_chars(const char *str)
 **/
 char *cgi_param(const char *var_name)
 {
-	return slist_item(var_name, formvars_start);
+	return cgi_request_param(&cgi_default_request, var_name);
+}
+
+char *cgi_request_param(cgi_request *req, const char *name)
+{
+	return slist_index_item(&req->form_index, name, *req->form_start,
+	                        *req->form_last);
 }
 
 /**
 * Sends a specific header.
 * Sends a specific HTTP header. You won't need to add '\\n\\n' chars.
+* Without a buffered response (see cgi_response_buffer) the header is
+* written right away, so the program may print its body after it. A
+* buffered response collects headers until cgi_end(), a header of the
+* same name replaces the one sent before.
 * @param header HTTP header to send, without new line characters
 * @return True
 * @see cgi_init_headers
 **/
 void cgi_send_header(const char *header)
 {
-	printf("%s\r\n", header);
+	cgi_request_send_header(&cgi_default_request, header);
+}
+
+void cgi_request_send_header(cgi_request *req, const char *header)
+{
+	if (req->headers_initialized) {
+		cgi_request_error(req, E_WARNING, "%s: headers already sent",
+		                  __FUNCTION__);
+		return;
+	}
+
+	// written right away unless a buffered response takes them, a
+	// program may print its body next
+	if (cgi_header_line(req, header) && !req->response.buffered)
+		cgi_headers_write(req, cgi_request_out(req));
 }
 
 const char *cgi_version( void )
@@ -553,17 +1070,18 @@ const char *cgi_version( void )
 void cgi_redirect_status( enum cgi_http_status_code status_code,
 		const char *uri )
 {
-	if ( headers_initialized )
+	if ( cgi_default_request.headers_initialized )
 	{
 		libcgi_error( E_WARNING,
 				"<br><b>Cannot redirect. Headers already sent</b><br>" );
 		return;
 	}
 
-	printf( "Status: %i\r\n"
-			"Location: %s\r\n"
-			"\r\n",
-			status_code, uri );
+	cgi_header_set( &cgi_default_request, "Status", "%i", status_code );
+	cgi_header_set( &cgi_default_request, "Location", "%s", uri );
+
+	if ( !cgi_default_request.response.buffered )
+		cgi_headers_send( &cgi_default_request, stdout );
 }
 
 /**
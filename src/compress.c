@@ -0,0 +1,691 @@
+/*******************************************************************//**
+ *	@file		compress.c
+ *
+ *	gzip compression of response bodies, see cgi_compress().  An
+ *	unbuffered response gets a stream in place of its output from
+ *	cgi_init_headers() on: the body is held back until it reaches the
+ *	size threshold, then the headers are finished and everything goes
+ *	through deflate().  A buffered response (see response.c) knows its
+ *	length and is compressed in one go when it is sent.
+ *
+ *	Included files with an up to date path.gz next to them are not
+ *	compressed again.  The deflate blocks of the .gz are copied into the
+ *	response as they are, like zlib's gzjoin example does: the output
+ *	is byte aligned with a sync flush, the final block bit of the member
+ *	is cleared, and its trailing bits are primed into the deflate stream
+ *	that goes on after it.  Where its blocks are is found once with
+ *	inflate() and kept in a small cache.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/error.h"
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+#define GZIP_CHUNK_SIZE		16384
+#define GZIP_HEADER_LEN		10
+#define GZIP_TRAILER_LEN	8
+#define GZIP_CACHE_SIZE		16
+
+#ifndef PATH_MAX
+#define PATH_MAX			4096
+#endif
+
+/*	settings, see cgi_compress()	*/
+static int compress_level = 0;
+static size_t compress_min = 1024;
+
+typedef int (*gzw_emit)( void *arg, const void *data, size_t len );
+
+/*	gzip framing around a raw deflate stream, so members can be joined	*/
+struct gz_writer {
+	z_stream		zs;
+	uLong			crc;
+	uLong			size;
+	gzw_emit		emit;
+	void			*arg;
+	unsigned char	out[GZIP_CHUNK_SIZE];
+};
+
+struct cgi_gzip {
+	struct gz_writer	w;
+	struct cgi_request	*req;			/**< its headers go out first	*/
+	FILE				*target;		/**< output the stream replaces	*/
+	FILE				*stream;
+	int					started;		/**< Content-Encoding sent	*/
+	int					failed;
+	char				*pending;		/**< body below the threshold	*/
+	size_t				pending_len;
+};
+
+/*	blocks of a .gz file, keyed by the file	*/
+struct gz_cache_entry {
+	dev_t					dev;
+	ino_t					ino;
+	off_t					size;
+	time_t					mtime;
+	struct cgi_gz_member	m;
+};
+
+#if defined(__GNUC__)
+static __thread struct gz_cache_entry gz_cache[GZIP_CACHE_SIZE];
+static __thread unsigned int gz_cache_next = 0;
+#else
+static struct gz_cache_entry gz_cache[GZIP_CACHE_SIZE];
+static unsigned int gz_cache_next = 0;
+#endif
+
+/*	***	Accept-Encoding	***	*/
+
+/*	q=0 in the parameters of a coding, refuses it	*/
+static int coding_refused( const char *p, const char *end )
+{
+	while ( p < end )
+	{
+		while ( p < end && (*p == ';' || *p == ' ' || *p == '\t') ) p++;
+
+		if ( end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=' )
+		{
+			p += 2;
+			if ( p == end || *p != '0' ) return 0;
+			for ( p++; p < end && (*p == '.' || *p == '0'); p++ );
+
+			return p == end || *p == ' ' || *p == '\t' || *p == ';';
+		}
+
+		while ( p < end && *p != ';' ) p++;
+	}
+
+	return 0;
+}
+
+/*	gzip is acceptable by name or by "*", gzip;q=0 wins over "*"	*/
+static int accepts_gzip( const char *header )
+{
+	const char *p = header, *name, *end;
+	size_t len;
+	int gzip = -1, star = -1;
+
+	while ( *p )
+	{
+		while ( *p == ',' || *p == ' ' || *p == '\t' ) p++;
+		name = p;
+		while ( *p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t' ) p++;
+		len = p - name;
+		end = p + strcspn( p, "," );
+
+		if ( (len == 4 && !strncasecmp( name, "gzip", 4 ))
+				|| (len == 6 && !strncasecmp( name, "x-gzip", 6 )) )
+			gzip = !coding_refused( p, end );
+		else if ( len == 1 && *name == '*' )
+			star = !coding_refused( p, end );
+
+		p = end;
+	}
+
+	return gzip >= 0 ? gzip : star > 0;
+}
+
+int cgi_compress_enabled( void )
+{
+	return compress_level != 0;
+}
+
+int cgi_compress_accepted( struct cgi_request *req, size_t length )
+{
+	const char *header;
+
+	if ( !compress_level || length < compress_min ) return 0;
+
+	header = cgi_request_getenv( req, "HTTP_ACCEPT_ENCODING" );
+
+	return header && accepts_gzip( header );
+}
+
+/*	***	gzip writer	***	*/
+
+static int gzw_deflate( struct gz_writer *w, const void *data, size_t len,
+		int flush )
+{
+	size_t n;
+	int ret;
+
+	w->zs.next_in = (void *) data;
+	w->zs.avail_in = len;
+
+	do {
+		w->zs.next_out = w->out;
+		w->zs.avail_out = sizeof(w->out);
+
+		ret = deflate( &w->zs, flush );
+		if ( ret == Z_STREAM_ERROR ) return 0;
+
+		n = sizeof(w->out) - w->zs.avail_out;
+		if ( n && !w->emit( w->arg, w->out, n ) ) return 0;
+	} while ( w->zs.avail_out == 0 );
+
+	return 1;
+}
+
+/*	the header goes out with gzw_start()	*/
+static int gzw_init( struct gz_writer *w, gzw_emit emit, void *arg )
+{
+	memset( &w->zs, 0, sizeof(w->zs) );
+	if ( deflateInit2( &w->zs, compress_level, Z_DEFLATED, -MAX_WBITS, 8,
+			Z_DEFAULT_STRATEGY ) != Z_OK )
+		return 0;
+
+	w->crc = crc32( 0, NULL, 0 );
+	w->size = 0;
+	w->emit = emit;
+	w->arg = arg;
+
+	return 1;
+}
+
+static int gzw_start( struct gz_writer *w )
+{
+	static const unsigned char header[GZIP_HEADER_LEN] = {
+		0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3
+	};
+
+	return w->emit( w->arg, header, sizeof(header) );
+}
+
+static int gzw_write( struct gz_writer *w, const void *data, size_t len )
+{
+	w->crc = crc32( w->crc, data, len );
+	w->size += len;
+
+	return gzw_deflate( w, data, len, Z_NO_FLUSH );
+}
+
+/*	copy the blocks of a precompressed member	*/
+static int gzw_member( struct gz_writer *w, const struct cgi_gz_member *m )
+{
+	const unsigned char *d = m->data;
+	unsigned char byte;
+	int bits;
+
+	/*	end the current block on a byte boundary	*/
+	if ( !gzw_deflate( w, NULL, 0, Z_SYNC_FLUSH ) ) return 0;
+
+	bits = d[m->end] & ((1 << m->end_bits) - 1);
+
+	if ( m->last < m->end )
+	{
+		byte = d[m->last] & ~(1 << m->last_bit);
+
+		if ( !w->emit( w->arg, d + m->start, m->last - m->start )
+				|| !w->emit( w->arg, &byte, 1 )
+				|| !w->emit( w->arg, d + m->last + 1, m->end - m->last - 1 ) )
+			return 0;
+	}
+	else
+	{
+		bits &= ~(1 << m->last_bit);
+		if ( !w->emit( w->arg, d + m->start, m->end - m->start ) ) return 0;
+	}
+
+	w->crc = crc32_combine( w->crc, m->crc, m->size );
+	w->size += m->size;
+
+	/*	go on after the member, without references into it	*/
+	if ( deflateReset( &w->zs ) != Z_OK ) return 0;
+
+	return !m->end_bits || deflatePrime( &w->zs, m->end_bits, bits ) == Z_OK;
+}
+
+static int gzw_finish( struct gz_writer *w )
+{
+	unsigned char trailer[GZIP_TRAILER_LEN];
+	int i;
+
+	if ( !gzw_deflate( w, NULL, 0, Z_FINISH ) ) return 0;
+
+	for ( i = 0; i < 4; i++ )
+	{
+		trailer[i] = (w->crc >> (8 * i)) & 0xff;
+		trailer[4 + i] = (w->size >> (8 * i)) & 0xff;
+	}
+
+	return w->emit( w->arg, trailer, sizeof(trailer) );
+}
+
+/*	***	precompressed siblings	***	*/
+
+/*	find the blocks of a single member .gz file	*/
+static int gz_scan( const unsigned char *d, size_t len,
+		struct cgi_gz_member *m )
+{
+	unsigned char junk[GZIP_CHUNK_SIZE];
+	size_t pos = GZIP_HEADER_LEN, used;
+	unsigned int unused;
+	z_stream zs;
+	int flags, ret;
+
+	if ( len < GZIP_HEADER_LEN + GZIP_TRAILER_LEN || d[0] != 0x1f
+			|| d[1] != 0x8b || d[2] != Z_DEFLATED || (d[3] & 0xe0) )
+		return 0;
+
+	flags = d[3];
+	if ( flags & 4 )	/*	FEXTRA	*/
+		pos += 2 + (d[pos] | (d[pos + 1] << 8));
+	if ( flags & 8 )	/*	FNAME	*/
+		while ( pos < len && d[pos++] );
+	if ( flags & 16 )	/*	FCOMMENT	*/
+		while ( pos < len && d[pos++] );
+	if ( flags & 2 )	/*	FHCRC	*/
+		pos += 2;
+	if ( pos + GZIP_TRAILER_LEN >= len ) return 0;
+
+	m->start = m->last = pos;
+	m->last_bit = 0;
+
+	memset( &zs, 0, sizeof(zs) );
+	if ( inflateInit2( &zs, -MAX_WBITS ) != Z_OK ) return 0;
+
+	zs.next_in = (unsigned char *) d + pos;
+	zs.avail_in = len - GZIP_TRAILER_LEN - pos;
+
+	/*	stop at every block boundary: the last one before the final
+	 *	block is where its header is, the one after it is the end.  At
+	 *	Z_STREAM_END the bits left in the last byte are gone already.	*/
+	m->end_bits = 8;
+	do {
+		zs.next_out = junk;
+		zs.avail_out = sizeof(junk);
+
+		ret = inflate( &zs, Z_BLOCK );
+		if ( ret != Z_OK || !(zs.data_type & 128) ) continue;
+
+		used = zs.next_in - d;
+		unused = zs.data_type & 7;
+
+		if ( !(zs.data_type & 64) )
+		{
+			m->last = unused ? used - 1 : used;
+			m->last_bit = unused ? 8 - unused : 0;
+		}
+		else
+		{
+			m->end = unused ? used - 1 : used;
+			m->end_bits = unused ? 8 - unused : 0;
+		}
+	} while ( ret == Z_OK );
+
+	inflateEnd( &zs );
+
+	/*	one member filling the file	*/
+	if ( ret != Z_STREAM_END || m->end_bits == 8
+			|| zs.next_in - d != (ptrdiff_t) (len - GZIP_TRAILER_LEN) )
+		return 0;
+
+	d += len - GZIP_TRAILER_LEN;
+	m->crc = d[0] | (d[1] << 8) | (d[2] << 16) | ((uLong) d[3] << 24);
+	m->size = d[4] | (d[5] << 8) | (d[6] << 16) | ((uLong) d[7] << 24);
+
+	return 1;
+}
+
+int cgi_compress_sibling( const char *path, const struct stat *st,
+		struct cgi_gz_member *m )
+{
+	char gz_path[PATH_MAX];
+	struct gz_cache_entry *e = NULL;
+	struct stat gst;
+	void *addr;
+	int fd, i;
+
+	if ( snprintf( gz_path, sizeof(gz_path), "%s.gz", path )
+			>= (int) sizeof(gz_path) )
+		return 0;
+
+	if ( (fd = open( gz_path, O_RDONLY )) == -1 ) return 0;
+
+	if ( fstat( fd, &gst ) == -1 || !S_ISREG( gst.st_mode )
+			|| gst.st_mtime < st->st_mtime || !gst.st_size )
+		goto err;
+
+	addr = mmap( NULL, gst.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( addr == MAP_FAILED ) goto err;
+	close( fd );
+
+	for ( i = 0; i < GZIP_CACHE_SIZE; i++ )
+	{
+		if ( gz_cache[i].dev == gst.st_dev && gz_cache[i].ino == gst.st_ino
+				&& gz_cache[i].size == gst.st_size
+				&& gz_cache[i].mtime == gst.st_mtime )
+		{
+			e = &gz_cache[i];
+			*m = e->m;
+			break;
+		}
+	}
+
+	if ( !e )
+	{
+		if ( !gz_scan( addr, gst.st_size, m ) ) goto err_map;
+
+		e = &gz_cache[gz_cache_next++ % GZIP_CACHE_SIZE];
+		e->dev = gst.st_dev;
+		e->ino = gst.st_ino;
+		e->size = gst.st_size;
+		e->mtime = gst.st_mtime;
+		e->m = *m;
+	}
+
+	/*	the .gz must hold the file as it is	*/
+	if ( m->size != ((uLong) st->st_size & 0xffffffffUL) ) goto err_map;
+
+	m->data = addr;
+	m->map_len = gst.st_size;
+
+	return 1;
+
+err_map:
+	munmap( addr, gst.st_size );
+	return 0;
+
+err:
+	close( fd );
+	return 0;
+}
+
+void cgi_compress_sibling_free( struct cgi_gz_member *m )
+{
+	if ( m->data ) munmap( (void *) m->data, m->map_len );
+	m->data = NULL;
+}
+
+/*	***	whole buffered bodies	***	*/
+
+struct gz_buffer {
+	unsigned char	*data;
+	size_t			len;
+	size_t			size;
+};
+
+static int gz_buffer_emit( void *arg, const void *data, size_t len )
+{
+	struct gz_buffer *b = arg;
+	unsigned char *p;
+	size_t size;
+
+	if ( b->len + len > b->size )
+	{
+		for ( size = b->size ? b->size : GZIP_CHUNK_SIZE; size < b->len + len; )
+			size *= 2;
+		if ( !(p = realloc( b->data, size )) ) return 0;
+		b->data = p;
+		b->size = size;
+	}
+
+	memcpy( b->data + b->len, data, len );
+	b->len += len;
+
+	return 1;
+}
+
+unsigned char *cgi_compress_iov( const struct iovec *iov, size_t count,
+		const struct cgi_gz_member **members, size_t *out_len )
+{
+	struct gz_buffer b = { NULL, 0, 0 };
+	struct gz_writer *w;
+	size_t i;
+	int ok;
+
+	if ( !(w = malloc( sizeof(struct gz_writer) )) || !gzw_init( w,
+			gz_buffer_emit, &b ) )
+	{
+		free( w );
+		libcgi_error( E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+		return NULL;
+	}
+
+	ok = gzw_start( w );
+	for ( i = 0; ok && i < count; i++ )
+	{
+		if ( members && members[i] )
+			ok = gzw_member( w, members[i] );
+		else
+			ok = gzw_write( w, iov[i].iov_base, iov[i].iov_len );
+	}
+	ok = ok && gzw_finish( w );
+
+	deflateEnd( &w->zs );
+	free( w );
+
+	if ( !ok )
+	{
+		free( b.data );
+		return NULL;
+	}
+
+	*out_len = b.len;
+
+	return b.data;
+}
+
+/*	***	streaming	***	*/
+
+static int gzip_emit( void *arg, const void *data, size_t len )
+{
+	struct cgi_gzip *gz = arg;
+
+	return fwrite( data, 1, len, gz->target ) == len;
+}
+
+/*	finish the headers, with Content-Encoding if compressing	*/
+static int gzip_begin( struct cgi_gzip *gz, int compress )
+{
+	int ok;
+
+	if ( compress )
+	{
+		cgi_header_set( gz->req, "Content-Encoding", "gzip" );
+		gz->started = 1;
+		ok = cgi_headers_send( gz->req, gz->target ) && gzw_start( &gz->w )
+				&& gzw_write( &gz->w, gz->pending, gz->pending_len );
+	}
+	else
+	{
+		ok = cgi_headers_send( gz->req, gz->target )
+				&& fwrite( gz->pending, 1, gz->pending_len, gz->target )
+				== gz->pending_len;
+	}
+
+	free( gz->pending );
+	gz->pending = NULL;
+	gz->pending_len = 0;
+
+	return ok;
+}
+
+static ssize_t gzip_write( void *cookie, const char *buf, size_t size )
+{
+	struct cgi_gzip *gz = cookie;
+
+	if ( gz->failed ) return -1;
+
+	if ( gz->started )
+	{
+		if ( !gzw_write( &gz->w, buf, size ) ) goto err;
+		return size;
+	}
+
+	if ( gz->pending_len + size < compress_min )
+	{
+		if ( !gz->pending && !(gz->pending = malloc( compress_min )) )
+			goto err;
+		memcpy( gz->pending + gz->pending_len, buf, size );
+		gz->pending_len += size;
+		return size;
+	}
+
+	if ( !gzip_begin( gz, 1 ) || !gzw_write( &gz->w, buf, size ) )
+		goto err;
+
+	return size;
+
+err:
+	gz->failed = 1;
+	return -1;
+}
+
+#if !defined(__GLIBC__)
+static int gzip_funopen_write( void *cookie, const char *buf, int size )
+{
+	return gzip_write( cookie, buf, size );
+}
+#endif
+
+static FILE *gzip_open( struct cgi_gzip *gz )
+{
+#if defined(__GLIBC__)
+	cookie_io_functions_t io = {
+		.read	= NULL,
+		.write	= gzip_write,
+		.seek	= NULL,
+		.close	= NULL,
+	};
+
+	return fopencookie( gz, "w", io );
+#else
+	return funopen( gz, NULL, gzip_funopen_write, NULL, NULL );
+#endif
+}
+
+int cgi_compress_start( struct cgi_request *req )
+{
+	struct cgi_gzip *gz;
+	const char *header;
+
+	if ( !compress_level ) return 0;
+
+	cgi_header_set( req, "Vary", "Accept-Encoding" );
+
+	header = cgi_request_getenv( req, "HTTP_ACCEPT_ENCODING" );
+	if ( !header || !accepts_gzip( header ) ) return 0;
+
+	if ( !(gz = calloc( 1, sizeof(struct cgi_gzip) )) ) goto err_memory;
+
+	if ( !gzw_init( &gz->w, gzip_emit, gz ) )
+	{
+		free( gz );
+		goto err_memory;
+	}
+
+	if ( !(gz->stream = gzip_open( gz )) )
+	{
+		deflateEnd( &gz->w.zs );
+		free( gz );
+		goto err_memory;
+	}
+
+	/*	the program keeps writing where it did, to the stream now	*/
+	gz->req = req;
+	gz->target = cgi_request_out( req );
+	fflush( gz->target );
+	if ( req->out )
+		req->out = gz->stream;
+	else
+		stdout = gz->stream;
+
+	req->gzip = gz;
+
+	return 1;
+
+err_memory:
+	cgi_request_error( req, E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+	return 0;
+}
+
+void cgi_compress_end( struct cgi_request *req )
+{
+	struct cgi_gzip *gz = req->gzip;
+	int ok;
+
+	if ( !gz ) return;
+
+	fflush( gz->stream );
+	if ( req->out )
+		req->out = gz->target;
+	else
+		stdout = gz->target;
+	fclose( gz->stream );
+
+	if ( gz->failed )
+		ok = 0;
+	else if ( gz->started )
+		ok = gzw_finish( &gz->w );
+	else
+		ok = gzip_begin( gz, 0 );
+
+	if ( !ok || fflush( gz->target ) )
+		cgi_request_error( req, E_WARNING, "%s: write failed", __FUNCTION__ );
+
+	deflateEnd( &gz->w.zs );
+	free( gz->pending );
+	free( gz );
+	req->gzip = NULL;
+}
+
+int cgi_compress_include( struct cgi_request *req, const char *path,
+		const struct stat *st )
+{
+	struct cgi_gzip *gz = req->gzip;
+	struct cgi_gz_member m;
+
+	if ( !gz || gz->failed || !cgi_compress_sibling( path, st, &m ) )
+		return 0;
+
+	/*	what was written so far comes first, compressed in any case now	*/
+	fflush( gz->stream );
+	if ( gz->failed || (!gz->started && !gzip_begin( gz, 1 ))
+			|| !gzw_member( &gz->w, &m ) )
+		gz->failed = 1;
+
+	cgi_compress_sibling_free( &m );
+
+	return 1;
+}
+
+/*	***	public API	***	*/
+
+void cgi_compress( int level, size_t min_size )
+{
+	/*	Z_DEFAULT_COMPRESSION, or any other negative level, lets zlib
+	 *	choose	*/
+	if ( level > Z_BEST_COMPRESSION ) level = Z_BEST_COMPRESSION;
+	if ( level < 0 ) level = Z_DEFAULT_COMPRESSION;
+
+	compress_level = level;
+	compress_min = min_size;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
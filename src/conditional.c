@@ -0,0 +1,194 @@
+/*******************************************************************//**
+ *	@file		conditional.c
+ *
+ *	Conditional requests, RFC 7232: HTTP dates, ETag lists, the
+ *	decision whether a GET can be answered with 304 Not Modified and
+ *	If-Range of RFC 7233.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+static const char days[7][4] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static const char months[12][4] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/*	days since the epoch of a proleptic Gregorian date, no timegm()	*/
+static long days_from_civil( long y, int m, int d )
+{
+	long era, yoe, doy;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+void cgi_http_date( char buf[CGI_HTTP_DATE_LEN], time_t t )
+{
+	struct tm tm;
+	unsigned int year;
+
+	if ( !gmtime_r( &t, &tm ) ) memset( &tm, 0, sizeof(tm) );
+
+	/*	the format has four digits of year	*/
+	year = tm.tm_year < -1900 ? 0 : tm.tm_year > 9999 - 1900 ? 9999
+			: (unsigned int) (tm.tm_year + 1900);
+
+	/*	names by hand, strftime() would use the locale, fields bounded
+	 *	so the date always fits	*/
+	snprintf( buf, CGI_HTTP_DATE_LEN,
+			"%.3s, %02u %.3s %04u %02u:%02u:%02u GMT",
+			days[tm.tm_wday % 7], (unsigned int) tm.tm_mday % 100,
+			months[tm.tm_mon % 12], year % 10000,
+			(unsigned int) tm.tm_hour % 100, (unsigned int) tm.tm_min % 100,
+			(unsigned int) tm.tm_sec % 100 );
+}
+
+static int month_index( const char *s )
+{
+	int i;
+
+	for ( i = 0; i < 12; i++ )
+	{
+		if ( !strncasecmp( s, months[i], 3 ) ) return i;
+	}
+
+	return -1;
+}
+
+time_t cgi_http_date_parse( const char *s )
+{
+	char month[4];
+	int d, y, h, mi, sec, m;
+
+	/*	IMF-fixdate "Sun, 06 Nov 1994 08:49:37 GMT", obsolete RFC 850
+	 *	"Sunday, 06-Nov-94 08:49:37 GMT" and asctime()
+	 *	"Sun Nov  6 08:49:37 1994"	*/
+	if ( sscanf( s, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+				&d, month, &y, &h, &mi, &sec ) == 6 )
+		;
+	else if ( sscanf( s, "%*[A-Za-z], %2d-%3s-%2d %2d:%2d:%2d GMT",
+				&d, month, &y, &h, &mi, &sec ) == 6 )
+		y += y < 70 ? 2000 : 1900;
+	else if ( sscanf( s, "%*3s %3s %2d %2d:%2d:%2d %4d",
+				month, &d, &h, &mi, &sec, &y ) == 6 )
+		;
+	else
+		return (time_t) -1;
+
+	month[3] = '\0';
+	if ( (m = month_index( month )) < 0 || d < 1 || d > 31 || h > 23
+			|| mi > 59 || sec > 60 )
+		return (time_t) -1;
+
+	return (time_t) (days_from_civil( y, m + 1, d ) * 86400L
+			+ h * 3600L + mi * 60L + sec);
+}
+
+void cgi_file_etag( char *buf, size_t size, const struct stat *st )
+{
+	/*	cheap, no need to read the file	*/
+	snprintf( buf, size, "%llx-%llx-%llx",
+			(unsigned long long) st->st_ino,
+			(unsigned long long) st->st_size,
+			(unsigned long long) st->st_mtime );
+}
+
+/*	opaque part of an entity tag, without W/ and quotes	*/
+static const char *etag_opaque( const char *s, size_t *len )
+{
+	const char *end;
+
+	if ( !strncmp( s, "W/", 2 ) ) s += 2;
+	if ( *s != '"' || !(end = strchr( s + 1, '"' )) ) return NULL;
+
+	*len = end - s - 1;
+
+	return s + 1;
+}
+
+int cgi_etag_match( const char *header, const char *etag )
+{
+	const char *p = header, *tag, *want;
+	size_t len, want_len;
+
+	if ( !(want = etag_opaque( etag, &want_len )) ) return 0;
+
+	/*	weak comparison, as If-None-Match wants it	*/
+	while ( *p )
+	{
+		while ( *p == ' ' || *p == '\t' || *p == ',' ) p++;
+		if ( *p == '*' ) return 1;
+		if ( !*p ) break;
+
+		if ( (tag = etag_opaque( p, &len )) )
+		{
+			if ( len == want_len && !memcmp( tag, want, len ) ) return 1;
+			p = tag + len + 1;
+		}
+		else
+		{
+			p += strcspn( p, "," );
+		}
+	}
+
+	return 0;
+}
+
+int cgi_if_range( struct cgi_request *req, const char *etag, time_t mtime )
+{
+	const char *header = cgi_request_getenv( req, "HTTP_IF_RANGE" );
+
+	if ( !header ) return 1;
+
+	/*	strong comparison, weak tags never match	*/
+	if ( *header == '"' || !strncmp( header, "W/", 2 ) )
+		return etag && !strcmp( header, etag );
+
+	return mtime != (time_t) -1 && cgi_http_date_parse( header ) == mtime;
+}
+
+int cgi_not_modified( struct cgi_request *req, const char *etag,
+		time_t mtime )
+{
+	const char *method, *header;
+	time_t since;
+
+	method = cgi_request_getenv( req, "REQUEST_METHOD" );
+	if ( !method || (strcmp( method, "GET" ) && strcmp( method, "HEAD" )) )
+		return 0;
+
+	/*	If-None-Match wins, If-Modified-Since is ignored with it	*/
+	if ( (header = cgi_request_getenv( req, "HTTP_IF_NONE_MATCH" )) )
+		return etag && cgi_etag_match( header, etag );
+
+	if ( mtime == (time_t) -1
+			|| !(header = cgi_request_getenv( req, "HTTP_IF_MODIFIED_SINCE" ))
+			|| (since = cgi_http_date_parse( header )) == (time_t) -1 )
+		return 0;
+
+	return mtime <= since;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
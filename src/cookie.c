@@ -16,12 +16,38 @@
 #include "libcgi/cgi_types.h"
 #include "libcgi/error.h"
 
+#include "internal.h"
+
 formvars *cookies_start = NULL;
 formvars *cookies_last = NULL;
 
-extern int headers_initialized;
 extern int cgi_display_errors;
 
+// An item of the cookie list made by cgi_cookies_parse(), the items in
+// request memory are all of this kind
+struct cookie_var {
+	formvars	var;
+	int			escaped;	// value still URL encoded
+};
+
+static int is_ows(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+// value decoded in place the first time it is used, items a program
+// added to the list itself are left as they are
+static void cookie_decode(cgi_request *req, formvars *item)
+{
+	struct cookie_var *cookie = (struct cookie_var *)item;
+
+	if (!cgi_arena_owns(req->arena, item) || !cookie->escaped)
+		return;
+
+	item->value[cgi_unescape_into(item->value, item->value,
+	                              strlen(item->value))] = '\0';
+	cookie->escaped = 0;
+}
 
 /***********************************************************
 				COOKIE GROUP
@@ -38,8 +64,13 @@ extern int cgi_display_errors;
 * @param path Cookie path at the server
 * @param domain Domain where cookie will work :)
 * @param secure Secure or not
+* @return 0 if the headers were sent already
 * @see cgi_cookie_value
 *
+* Without a buffered response (see cgi_response_buffer) the cookie is
+* written right away, a buffered response replaces a cookie of the same
+* name set before.
+*
 * \code
 * cgi_add_cookie("mycookie", "mycookie value", 0, 0, 0, 0);
 * \endcode
@@ -51,84 +82,129 @@ int cgi_add_cookie(const char *name,
 	const char *domain,
 	const int secure)
 {
-	if (headers_initialized)
+	return cgi_request_add_cookie(&cgi_default_request, name, value, max_age,
+	                              path, domain, secure);
+}
+
+int cgi_request_add_cookie(cgi_request *req, const char *name,
+	const char *value,
+	const char *max_age,
+	const char *path,
+	const char *domain,
+	const int secure)
+{
+	if (req->headers_initialized)
 		return 0;
 
-	printf("Set-cookie: %s=%s;", name, value);
+	if (!cgi_cookie_set(req, name, value, max_age, path, domain, secure))
+		return 0;
 
-	if (max_age)
-		printf(" Max-age=%s;", max_age);
-	if (path)
-		printf(" Path=%s;", path);
-	if (domain)
-		printf(" Domain=%s;", domain);
-	if (secure)
-		printf(" Secure");
-	printf("\r\n");
+	// written right away unless a buffered response takes it, as
+	// cgi_send_header() does
+	return req->response.buffered
+	       || cgi_headers_write(req, cgi_request_out(req));
+}
 
-	return 1;
+// Set-cookie in the header table only, a cookie of the same name set
+// before and not written yet is replaced. Sessions kept in the cookie
+// set theirs this way, it changes with every change of the session.
+int cgi_cookie_set(cgi_request *req, const char *name, const char *value,
+	const char *max_age, const char *path, const char *domain, int secure)
+{
+	return cgi_header_set(req, "Set-cookie", "%s=%s;%s%s%s%s%s%s%s%s%s%s",
+	                      name, value,
+	                      max_age ? " Max-age=" : "", max_age ? max_age : "",
+	                      max_age ? ";" : "",
+	                      path ? " Path=" : "", path ? path : "",
+	                      path ? ";" : "",
+	                      domain ? " Domain=" : "", domain ? domain : "",
+	                      domain ? ";" : "",
+	                      secure ? " Secure" : "");
 }
 
 formvars *cgi_get_cookies()
 {
-	register formvars *data;
-	register size_t position;
-	char *cookies, *aux, *str_unesc;
+	return cgi_request_get_cookies(&cgi_default_request);
+}
 
-	if ((cookies = getenv("HTTP_COOKIE")) == NULL)
-		return NULL;
+formvars *cgi_request_get_cookies(cgi_request *req)
+{
+	formvars *item;
 
-	str_unesc = cgi_unescape_special_chars(cookies);
-	cookies = str_unesc;
-	aux = cookies;
+	cgi_cookies_parse(req);
 
-	while (cookies) {
-		position = 0;
-		data = (formvars *)malloc(sizeof(formvars));
-		if (!data)
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+	for (item = *req->cookies_start; item; item = item->next)
+		cookie_decode(req, item);
 
-		while (*aux++ != '=')
-			position++;
+	return *req->cookies_start;
+}
 
-		data->name = (char *)malloc(position+1);
-		if (!data->name) {
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+// Split HTTP_COOKIE into name=value pairs in one pass over one copy of
+// it, RFC 6265 section 4.2.1. Pairs are split before anything is
+// decoded, so escaped ';' and '=' stay in their values. Names are
+// decoded right away, values only when asked for. The list is made
+// once per request, also when the header has no cookie in it.
+formvars *cgi_cookies_parse(cgi_request *req)
+{
+	struct cookie_var *data;
+	const char *header;
+	char *p, *name, *name_end, *value, *value_end;
+	int name_escaped, value_escaped;
 
-			exit(EXIT_FAILURE);
-		}
+	if (req->cookies_parsed)
+		return *req->cookies_start;
+	req->cookies_parsed = 1;
 
-		strncpy(data->name, cookies, position);
-		data->name[position] = '\0';
+	if ((header = cgi_request_getenv(req, "HTTP_COOKIE")) == NULL)
+		return NULL;
 
-		position = 0;
-		cookies = aux;
-		if ((strchr(cookies, ';')) == NULL) {
-			aux = NULL;
-			position = strlen(cookies);
-		}
-		else {
-			while (*aux++ != ';')
-				position++;
-			// Eliminate the blank space after ';'
-			aux++;
+	p = cgi_arena_strndup(req->arena, header, strlen(header));
+
+	while (*p) {
+		while (*p == ' ' || *p == '\t' || *p == ';')
+			p++;
+		if (!*p)
+			break;
+
+		name = p;
+		for (name_escaped = 0; *p && *p != '=' && *p != ';'; p++)
+			name_escaped |= *p == '%' || *p == '+';
+		for (name_end = p; name_end > name && is_ows(name_end[-1]); name_end--);
+
+		// a pair without '=' is no cookie
+		if (*p != '=')
+			continue;
+
+		for (p++; is_ows(*p); p++);
+		value = p;
+		for (value_escaped = 0; *p && *p != ';'; p++)
+			value_escaped |= *p == '%' || *p == '+';
+		for (value_end = p; value_end > value && is_ows(value_end[-1]); value_end--);
+		if (*p)
+			p++;
+
+		if (name_end == name)
+			continue;
+
+		if (value_end - value >= 2 && *value == '"' && value_end[-1] == '"') {
+			value++;
+			value_end--;
 		}
 
-		data->value = (char *)malloc(position + 1);
-		if (!data->value) {
-			exit(-1);
-		}
+		*name_end = '\0';
+		*value_end = '\0';
 
-		strncpy(data->value, cookies, position);
-		data->value[position] = '\0';
+		data = cgi_arena_calloc(req->arena, sizeof(*data));
+		data->var.name = name;
+		if (name_escaped)
+			name[cgi_unescape_into(name, name, name_end - name)] = '\0';
+		data->var.value = value;
+		data->escaped = value_escaped;
 
-		slist_add(data, &cookies_start, &cookies_last);
-		cookies = aux;
+		slist_add(&data->var, req->cookies_start, req->cookies_last);
 	}
 
-	free(str_unesc);
-
-	return cookies_start;
+	return *req->cookies_start;
 }
 
 /**
@@ -139,7 +215,23 @@ formvars *cgi_get_cookies()
 **/
 char *cgi_cookie_value(const char *cookie_name)
 {
-	return slist_item(cookie_name, cookies_start);
+	return cgi_request_cookie_value(&cgi_default_request, cookie_name);
+}
+
+char *cgi_request_cookie_value(cgi_request *req, const char *name)
+{
+	formvars *item;
+
+	cgi_cookies_parse(req);
+
+	item = slist_index_lookup(&req->cookies_index, name, *req->cookies_start,
+	                          *req->cookies_last);
+	if (item == NULL || item->value == NULL)
+		return NULL;
+
+	cookie_decode(req, item);
+
+	return item->value[0] ? item->value : NULL;
 }
 
 /**
@@ -10,9 +10,13 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libcgi/cgi.h"
 #include "libcgi/error.h"
+#include "libcgi/request.h"
+
+#include "internal.h"
 
 const char *libcgi_error_type[] = {
 	"LibCGI Warning",
@@ -22,25 +26,55 @@ const char *libcgi_error_type[] = {
 	"LibCGI out of memory"
 };
 
-void libcgi_error(int error_code, const char *msg, ...)
-{
-	va_list arguments;
+// Set while a message is written, errors on the way are not shown again
+#if defined(__GNUC__)
+static __thread int error_showing = 0;
+#else
+static int error_showing = 0;
+#endif
 
-	if (!cgi_display_errors)
-		return;
+static void error_report(cgi_request *req, int error_code, const char *msg,
+                         va_list arguments)
+{
+	char buf[1024];
+	size_t len;
 
-	cgi_init_headers();
-	va_start(arguments, msg);
+	if (cgi_display_errors && !error_showing) {
+		error_showing = 1;
+		cgi_request_init_headers(req);
 
-	printf("<b>%s</b>: ", libcgi_error_type[error_code]);
-	vprintf(msg, arguments);
-	puts("<br>");
+		len = snprintf(buf, sizeof(buf), "<b>%s</b>: ",
+		               libcgi_error_type[error_code]);
+		vsnprintf(buf + len, sizeof(buf) - len - 5, msg, arguments);
+		len = strlen(buf);
+		memcpy(buf + len, "<br>\n", 5);
 
-	va_end(arguments);
+		cgi_request_write(req, buf, len + 5);
+		error_showing = 0;
+	}
 
+	// the caller can't go on, whether the message was shown or not
 	if ((error_code == E_FATAL) || (error_code == E_MEMORY)) {
-		cgi_end();
+		cgi_request_end(req);
 
 		exit(EXIT_FAILURE);
 	}
 }
+
+void libcgi_error(int error_code, const char *msg, ...)
+{
+	va_list arguments;
+
+	va_start(arguments, msg);
+	error_report(&cgi_default_request, error_code, msg, arguments);
+	va_end(arguments);
+}
+
+void cgi_request_error(cgi_request *req, int error_code, const char *msg, ...)
+{
+	va_list arguments;
+
+	va_start(arguments, msg);
+	error_report(req, error_code, msg, arguments);
+	va_end(arguments);
+}
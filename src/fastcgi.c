@@ -0,0 +1,708 @@
+/*******************************************************************//**
+ *	@file		fastcgi.c
+ *
+ *	FastCGI responder, see https://fastcgi-archives.github.io/ for the
+ *	protocol specification.  Requests are served one at a time per
+ *	connection, FCGI_MPXS_CONNS is reported as 0.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#define _GNU_SOURCE
+
+#include "libcgi/fastcgi.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/cgi_types.h"
+
+#define FCGI_VERSION_1			1
+#define FCGI_HEADER_LEN			8
+#define FCGI_MAX_CONTENT		65535
+
+#define FCGI_BEGIN_REQUEST		1
+#define FCGI_ABORT_REQUEST		2
+#define FCGI_END_REQUEST		3
+#define FCGI_PARAMS				4
+#define FCGI_STDIN				5
+#define FCGI_STDOUT				6
+#define FCGI_STDERR				7
+#define FCGI_DATA				8
+#define FCGI_GET_VALUES			9
+#define FCGI_GET_VALUES_RESULT	10
+#define FCGI_UNKNOWN_TYPE		11
+
+#define FCGI_KEEP_CONN			1
+
+#define FCGI_RESPONDER			1
+
+#define FCGI_REQUEST_COMPLETE	0
+#define FCGI_CANT_MPX_CONN		1
+#define FCGI_UNKNOWN_ROLE		3
+
+struct fcgi_header {
+	unsigned char	type;
+	uint16_t		request_id;
+	uint16_t		content_length;
+	unsigned char	padding_length;
+};
+
+struct fcgi_conn {
+	int				fd;
+	uint16_t		request_id;
+	int				keep_conn;
+	int				params_done;
+	int				stdin_eof;
+	int				aborted;
+	int				error;
+
+	/*	unread content and padding of the current FCGI_STDIN record	*/
+	unsigned int	stdin_left;
+	unsigned int	stdin_pad;
+
+	/*	request parameters, kept to unset them after the request	*/
+	formvars		*params_start;
+	formvars		*params_last;
+};
+
+/*	***	low level I/O	***	*/
+
+static int fcgi_read_full( int fd, void *buf, size_t len )
+{
+	unsigned char *p = buf;
+	ssize_t r;
+
+	while ( len )
+	{
+		r = read( fd, p, len );
+		if ( r < 0 && errno == EINTR ) continue;
+		if ( r <= 0 ) return -1;
+
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int fcgi_skip( int fd, size_t len )
+{
+	unsigned char buf[256];
+	size_t n;
+
+	while ( len )
+	{
+		n = len < sizeof(buf) ? len : sizeof(buf);
+		if ( fcgi_read_full( fd, buf, n ) ) return -1;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int fcgi_writev_full( int fd, struct iovec *iov, int cnt )
+{
+	ssize_t w;
+
+	while ( cnt )
+	{
+		w = writev( fd, iov, cnt );
+		if ( w < 0 && errno == EINTR ) continue;
+		if ( w < 0 ) return -1;
+
+		while ( cnt && (size_t) w >= iov->iov_len )
+		{
+			w -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if ( cnt )
+		{
+			iov->iov_base = (char *) iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+
+	return 0;
+}
+
+/*	Returns 1 on a complete header, 0 on orderly EOF, -1 on errors.	*/
+static int fcgi_read_header( int fd, struct fcgi_header *hdr )
+{
+	unsigned char raw[FCGI_HEADER_LEN];
+	ssize_t r;
+
+	do {
+		r = read( fd, raw, 1 );
+	} while ( r < 0 && errno == EINTR );
+
+	if ( r == 0 ) return 0;
+	if ( r < 0 ) return -1;
+	if ( fcgi_read_full( fd, raw + 1, FCGI_HEADER_LEN - 1 ) ) return -1;
+	if ( raw[0] != FCGI_VERSION_1 ) return -1;
+
+	hdr->type = raw[1];
+	hdr->request_id = (raw[2] << 8) | raw[3];
+	hdr->content_length = (raw[4] << 8) | raw[5];
+	hdr->padding_length = raw[6];
+
+	return 1;
+}
+
+static int fcgi_write_record( int fd, unsigned char type,
+		uint16_t request_id, const void *content, size_t len )
+{
+	unsigned char hdr[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, type,
+		request_id >> 8, request_id & 0xFF,
+		len >> 8, len & 0xFF,
+		0, 0
+	};
+	struct iovec iov[2] = {
+		{ hdr, sizeof(hdr) },
+		{ (void *) content, len }
+	};
+
+	return fcgi_writev_full( fd, iov, len ? 2 : 1 );
+}
+
+static int fcgi_end_request( int fd, uint16_t request_id,
+		uint32_t app_status, unsigned char protocol_status )
+{
+	unsigned char body[8] = {
+		app_status >> 24, (app_status >> 16) & 0xFF,
+		(app_status >> 8) & 0xFF, app_status & 0xFF,
+		protocol_status, 0, 0, 0
+	};
+
+	return fcgi_write_record( fd, FCGI_END_REQUEST, request_id,
+			body, sizeof(body) );
+}
+
+/*	***	name-value pairs	***	*/
+
+static int fcgi_nv_length( const unsigned char **p, const unsigned char *end,
+		size_t *len )
+{
+	if ( *p >= end ) return -1;
+
+	if ( !(**p & 0x80) )
+	{
+		*len = *(*p)++;
+		return 0;
+	}
+
+	if ( end - *p < 4 ) return -1;
+	*len = ((size_t) ((*p)[0] & 0x7F) << 24) | ((size_t) (*p)[1] << 16)
+			| ((size_t) (*p)[2] << 8) | (*p)[3];
+	*p += 4;
+
+	return 0;
+}
+
+/*	Calls fn for every pair, returns -1 on malformed input.	*/
+static int fcgi_parse_pairs( const unsigned char *p, size_t len,
+		void (*fn)( const char *, size_t, const char *, size_t, void * ),
+		void *arg )
+{
+	const unsigned char *end = p + len;
+	size_t name_len, value_len;
+
+	while ( p < end )
+	{
+		if ( fcgi_nv_length( &p, end, &name_len ) ) return -1;
+		if ( fcgi_nv_length( &p, end, &value_len ) ) return -1;
+		if ( (size_t) (end - p) < name_len
+				|| (size_t) (end - p) - name_len < value_len )
+			return -1;
+
+		fn( (const char *) p, name_len, (const char *) p + name_len,
+				value_len, arg );
+		p += name_len + value_len;
+	}
+
+	return 0;
+}
+
+static size_t fcgi_put_pair( unsigned char *out, const char *name,
+		const char *value )
+{
+	size_t name_len = strlen( name ), value_len = strlen( value );
+
+	/*	only used for our own short management values	*/
+	out[0] = name_len;
+	out[1] = value_len;
+	memcpy( out + 2, name, name_len );
+	memcpy( out + 2 + name_len, value, value_len );
+
+	return 2 + name_len + value_len;
+}
+
+struct fcgi_values {
+	unsigned char	buf[128];
+	size_t			len;
+};
+
+static void fcgi_value_cb( const char *name, size_t name_len,
+		const char *value, size_t value_len, void *arg )
+{
+	static const char *known[][2] = {
+		{ "FCGI_MAX_CONNS",		"1" },
+		{ "FCGI_MAX_REQS",		"1" },
+		{ "FCGI_MPXS_CONNS",	"0" },
+	};
+	struct fcgi_values *values = arg;
+	size_t i;
+
+	(void) value;
+	(void) value_len;
+
+	for ( i = 0; i < sizeof(known) / sizeof(known[0]); i++ )
+	{
+		if ( strlen( known[i][0] ) == name_len
+				&& !memcmp( known[i][0], name, name_len )
+				&& values->len + 2 + name_len + 1 <= sizeof(values->buf) )
+		{
+			values->len += fcgi_put_pair( values->buf + values->len,
+					known[i][0], known[i][1] );
+		}
+	}
+}
+
+static void fcgi_param_cb( const char *name, size_t name_len,
+		const char *value, size_t value_len, void *arg )
+{
+	struct fcgi_conn *conn = arg;
+	formvars *item;
+
+	if ( !name_len ) return;
+
+	item = calloc( 1, sizeof(formvars) );
+	if ( !item ) return;
+
+	item->name = strndup( name, name_len );
+	item->value = strndup( value, value_len );
+	if ( !item->name || !item->value )
+	{
+		free( item->name );
+		free( item->value );
+		free( item );
+		return;
+	}
+
+	setenv( item->name, item->value, 1 );
+	slist_add( item, &conn->params_start, &conn->params_last );
+}
+
+static void fcgi_clear_params( struct fcgi_conn *conn )
+{
+	formvars *item;
+
+	for ( item = conn->params_start; item; item = item->next )
+		unsetenv( item->name );
+
+	slist_free( &conn->params_start );
+	conn->params_last = NULL;
+}
+
+/*	***	records outside of the current request	***	*/
+
+/*	Handles a record which is not part of the running request stream.
+ *	Returns -1 on I/O errors.
+ */
+static int fcgi_other_record( struct fcgi_conn *conn,
+		const struct fcgi_header *hdr )
+{
+	unsigned char content[FCGI_MAX_CONTENT];
+	struct fcgi_values values;
+	unsigned char unknown[8] = { 0 };
+
+	if ( hdr->request_id == 0 && hdr->type == FCGI_GET_VALUES )
+	{
+		if ( fcgi_read_full( conn->fd, content, hdr->content_length )
+				|| fcgi_skip( conn->fd, hdr->padding_length ) )
+			return -1;
+
+		values.len = 0;
+		fcgi_parse_pairs( content, hdr->content_length,
+				fcgi_value_cb, &values );
+
+		return fcgi_write_record( conn->fd, FCGI_GET_VALUES_RESULT, 0,
+				values.buf, values.len );
+	}
+
+	/*	nothing else we care about carries content	*/
+	if ( fcgi_skip( conn->fd,
+			(size_t) hdr->content_length + hdr->padding_length ) )
+		return -1;
+
+	if ( hdr->request_id == 0 )
+	{
+		unknown[0] = hdr->type;
+		return fcgi_write_record( conn->fd, FCGI_UNKNOWN_TYPE, 0,
+				unknown, sizeof(unknown) );
+	}
+
+	if ( hdr->type == FCGI_BEGIN_REQUEST
+			&& hdr->request_id != conn->request_id )
+	{
+		return fcgi_end_request( conn->fd, hdr->request_id, 0,
+				FCGI_CANT_MPX_CONN );
+	}
+
+	if ( hdr->type == FCGI_ABORT_REQUEST
+			&& hdr->request_id == conn->request_id )
+	{
+		conn->aborted = 1;
+		conn->stdin_eof = 1;
+	}
+
+	/*	anything else (FCGI_DATA, stray records) is ignored	*/
+	return 0;
+}
+
+/*	***	request streams	***	*/
+
+static ssize_t fcgi_stdin_read( void *cookie, char *buf, size_t size )
+{
+	struct fcgi_conn *conn = cookie;
+	struct fcgi_header hdr;
+	size_t n;
+	int r;
+
+	while ( !conn->stdin_left && !conn->stdin_eof )
+	{
+		r = fcgi_read_header( conn->fd, &hdr );
+		if ( r <= 0 )
+		{
+			conn->error = 1;
+			conn->stdin_eof = 1;
+			break;
+		}
+
+		if ( hdr.type == FCGI_STDIN && hdr.request_id == conn->request_id )
+		{
+			if ( !hdr.content_length )
+			{
+				conn->stdin_eof = 1;
+				if ( fcgi_skip( conn->fd, hdr.padding_length ) )
+					conn->error = 1;
+			}
+
+			conn->stdin_left = hdr.content_length;
+			conn->stdin_pad = hdr.padding_length;
+			continue;
+		}
+
+		if ( fcgi_other_record( conn, &hdr ) )
+		{
+			conn->error = 1;
+			conn->stdin_eof = 1;
+		}
+	}
+
+	if ( !conn->stdin_left ) return 0;
+
+	n = size < conn->stdin_left ? size : conn->stdin_left;
+	if ( fcgi_read_full( conn->fd, buf, n ) )
+	{
+		conn->error = 1;
+		conn->stdin_eof = 1;
+		conn->stdin_left = 0;
+		return -1;
+	}
+
+	conn->stdin_left -= n;
+	if ( !conn->stdin_left && conn->stdin_pad )
+	{
+		if ( fcgi_skip( conn->fd, conn->stdin_pad ) )
+		{
+			conn->error = 1;
+			conn->stdin_eof = 1;
+		}
+		conn->stdin_pad = 0;
+	}
+
+	return n;
+}
+
+static ssize_t fcgi_stdout_write( void *cookie, const char *buf, size_t size )
+{
+	struct fcgi_conn *conn = cookie;
+	size_t done = 0, n;
+
+	if ( conn->aborted || conn->error ) return size;
+
+	while ( done < size )
+	{
+		n = size - done;
+		if ( n > FCGI_MAX_CONTENT ) n = FCGI_MAX_CONTENT;
+
+		if ( fcgi_write_record( conn->fd, FCGI_STDOUT, conn->request_id,
+				buf + done, n ) )
+		{
+			conn->error = 1;
+			return -1;
+		}
+		done += n;
+	}
+
+	return size;
+}
+
+#if !defined(__GLIBC__)
+static int fcgi_funopen_read( void *cookie, char *buf, int size )
+{
+	return fcgi_stdin_read( cookie, buf, size );
+}
+
+static int fcgi_funopen_write( void *cookie, const char *buf, int size )
+{
+	return fcgi_stdout_write( cookie, buf, size );
+}
+#endif
+
+static FILE *fcgi_open_stream( struct fcgi_conn *conn, const char *mode )
+{
+#if defined(__GLIBC__)
+	cookie_io_functions_t io = {
+		.read	= fcgi_stdin_read,
+		.write	= fcgi_stdout_write,
+		.seek	= NULL,
+		.close	= NULL,
+	};
+
+	return fopencookie( conn, mode, io );
+#else
+	return funopen( conn,
+			mode[0] == 'r' ? fcgi_funopen_read : NULL,
+			mode[0] == 'w' ? fcgi_funopen_write : NULL,
+			NULL, NULL );
+#endif
+}
+
+/*	***	request handling	***	*/
+
+static int fcgi_read_params( struct fcgi_conn *conn )
+{
+	struct fcgi_header hdr;
+	unsigned char *params = NULL, *tmp;
+	size_t len = 0;
+	int r, ret = -1;
+
+	while ( !conn->params_done && !conn->aborted )
+	{
+		r = fcgi_read_header( conn->fd, &hdr );
+		if ( r <= 0 ) goto out;
+
+		if ( hdr.type != FCGI_PARAMS || hdr.request_id != conn->request_id )
+		{
+			if ( fcgi_other_record( conn, &hdr ) ) goto out;
+			continue;
+		}
+
+		if ( !hdr.content_length )
+		{
+			conn->params_done = 1;
+			if ( fcgi_skip( conn->fd, hdr.padding_length ) ) goto out;
+			continue;
+		}
+
+		/*	pairs may cross record boundaries, collect them first	*/
+		tmp = realloc( params, len + hdr.content_length );
+		if ( !tmp ) goto out;
+		params = tmp;
+
+		if ( fcgi_read_full( conn->fd, params + len, hdr.content_length )
+				|| fcgi_skip( conn->fd, hdr.padding_length ) )
+			goto out;
+		len += hdr.content_length;
+	}
+
+	if ( params && fcgi_parse_pairs( params, len, fcgi_param_cb, conn ) )
+		goto out;
+
+	ret = 0;
+
+out:
+	free( params );
+	return ret;
+}
+
+static int fcgi_handle_request( struct fcgi_conn *conn,
+		cgi_fcgi_handler handler, void *arg )
+{
+	FILE *in = NULL, *out = NULL;
+	FILE *saved_in = stdin, *saved_out = stdout;
+	char drain[512];
+	int status = 0;
+
+	conn->params_done = 0;
+	conn->stdin_eof = 0;
+	conn->stdin_left = 0;
+	conn->stdin_pad = 0;
+	conn->aborted = 0;
+
+	if ( fcgi_read_params( conn ) ) goto err;
+
+	if ( !conn->aborted )
+	{
+		if ( !(in = fcgi_open_stream( conn, "r" )) ) goto err;
+		if ( !(out = fcgi_open_stream( conn, "w" )) ) goto err;
+
+		stdin = in;
+		stdout = out;
+
+		status = handler( arg );
+
+		/*	clean up whatever the handler left over, and reset the
+		 *	process-wide state for the next request	*/
+		cgi_end();
+
+		fflush( stdout );
+		stdin = saved_in;
+		stdout = saved_out;
+
+		/*	keep the connection in sync for the next request	*/
+		while ( fread( drain, 1, sizeof(drain), in ) > 0 );
+
+		fclose( in );
+		fclose( out );
+		in = out = NULL;
+	}
+
+	fcgi_clear_params( conn );
+
+	if ( conn->error ) return -1;
+
+	if ( !conn->aborted
+			&& fcgi_write_record( conn->fd, FCGI_STDOUT, conn->request_id,
+					NULL, 0 ) )
+		return -1;
+
+	return fcgi_end_request( conn->fd, conn->request_id, status,
+			FCGI_REQUEST_COMPLETE );
+
+err:
+	stdin = saved_in;
+	stdout = saved_out;
+	if ( in ) fclose( in );
+	if ( out ) fclose( out );
+	fcgi_clear_params( conn );
+	return -1;
+}
+
+int cgi_fcgi_serve_connection( int fd, cgi_fcgi_handler handler, void *arg )
+{
+	struct fcgi_conn conn;
+	struct fcgi_header hdr;
+	unsigned char body[8];
+	uint16_t role;
+	int r;
+
+	if ( fd < 0 || !handler )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset( &conn, 0, sizeof(conn) );
+	conn.fd = fd;
+
+	for ( ;; )
+	{
+		r = fcgi_read_header( fd, &hdr );
+		if ( r <= 0 ) return r;
+
+		if ( hdr.type != FCGI_BEGIN_REQUEST || hdr.request_id == 0 )
+		{
+			if ( fcgi_other_record( &conn, &hdr ) ) return -1;
+			continue;
+		}
+
+		if ( hdr.content_length != sizeof(body) ) return -1;
+		if ( fcgi_read_full( fd, body, sizeof(body) )
+				|| fcgi_skip( fd, hdr.padding_length ) )
+			return -1;
+
+		role = (body[0] << 8) | body[1];
+		conn.request_id = hdr.request_id;
+		conn.keep_conn = body[2] & FCGI_KEEP_CONN;
+
+		if ( role != FCGI_RESPONDER )
+		{
+			if ( fcgi_end_request( fd, hdr.request_id, 0,
+					FCGI_UNKNOWN_ROLE ) )
+				return -1;
+		}
+		else if ( fcgi_handle_request( &conn, handler, arg ) )
+		{
+			return -1;
+		}
+
+		conn.request_id = 0;
+		if ( !conn.keep_conn ) return 0;
+	}
+}
+
+int cgi_fcgi_listen( const char *path, int backlog )
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if ( !path || strlen( path ) >= sizeof(addr.sun_path) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+
+	if ( (fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 ) return -1;
+
+	unlink( path );
+	if ( bind( fd, (struct sockaddr *) &addr, sizeof(addr) )
+			|| listen( fd, backlog ) )
+	{
+		close( fd );
+		return -1;
+	}
+
+	return fd;
+}
+
+int cgi_fcgi_run( int listen_fd, cgi_fcgi_handler handler, void *arg )
+{
+	int fd;
+
+	for ( ;; )
+	{
+		fd = accept( listen_fd, NULL, NULL );
+		if ( fd < 0 )
+		{
+			if ( errno == EINTR || errno == ECONNABORTED ) continue;
+			return -1;
+		}
+
+		cgi_fcgi_serve_connection( fd, handler, arg );
+		close( fd );
+	}
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,373 @@
+/*******************************************************************//**
+ *	@file		format.c
+ *
+ *	printf() for HTML: cgi_printf_html() writes to the response with
+ *	strings escaped on the way, see cgi_request_write_html_escaped().
+ *	Numbers and pointers are left to snprintf().
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/error.h"
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+/*	length modifiers	*/
+enum fmt_length {
+	FMT_INT, FMT_CHAR, FMT_SHORT, FMT_LONG, FMT_LLONG, FMT_INTMAX, FMT_SIZE,
+	FMT_PTRDIFF, FMT_LDOUBLE
+};
+
+/*	a directive taken apart	*/
+struct fmt_spec {
+	char			flags[8];
+	int				left;		/**< '-' or a negative width	*/
+	int				has_width;
+	int				width;
+	int				has_precision;
+	int				precision;
+	enum fmt_length	length;
+	char			conv;
+};
+
+/*	an argument of a number conversion	*/
+union fmt_value {
+	intmax_t	i;
+	uintmax_t	u;
+	double		d;
+	long double	ld;
+	void		*p;
+};
+
+/*	parse the directive after '%', NULL on errors	*/
+static const char *fmt_parse( const char *p, struct fmt_spec *s, va_list *ap )
+{
+	size_t n = 0;
+
+	memset( s, 0, sizeof(*s) );
+
+	for ( ; *p && strchr( "-+ #0", *p ); p++ )
+	{
+		if ( *p == '-' ) s->left = 1;
+		else if ( n < sizeof(s->flags) - 1 ) s->flags[n++] = *p;
+	}
+
+	if ( *p == '*' )
+	{
+		s->has_width = 1;
+		s->width = va_arg( *ap, int );
+		p++;
+	}
+	else if ( *p >= '1' && *p <= '9' )
+	{
+		s->has_width = 1;
+		for ( ; *p >= '0' && *p <= '9'; p++ )
+		{
+			if ( s->width > 100000 ) return NULL;
+			s->width = 10 * s->width + *p - '0';
+		}
+	}
+	if ( s->width < 0 )
+	{
+		s->left = 1;
+		s->width = s->width == INT_MIN ? 0 : -s->width;
+	}
+
+	if ( *p == '.' )
+	{
+		s->has_precision = 1;
+		if ( *++p == '*' )
+		{
+			s->precision = va_arg( *ap, int );
+			p++;
+			/*	negative is as if there was none	*/
+			if ( s->precision < 0 ) s->has_precision = 0;
+		}
+		else
+		{
+			for ( ; *p >= '0' && *p <= '9'; p++ )
+			{
+				if ( s->precision > 100000 ) return NULL;
+				s->precision = 10 * s->precision + *p - '0';
+			}
+		}
+	}
+
+	switch ( *p )
+	{
+	case 'h':
+		s->length = *++p == 'h' ? (p++, FMT_CHAR) : FMT_SHORT;
+		break;
+	case 'l':
+		s->length = *++p == 'l' ? (p++, FMT_LLONG) : FMT_LONG;
+		break;
+	case 'q': s->length = FMT_LLONG; p++;		break;
+	case 'j': s->length = FMT_INTMAX; p++;		break;
+	case 'z': s->length = FMT_SIZE; p++;		break;
+	case 't': s->length = FMT_PTRDIFF; p++;		break;
+	case 'L': s->length = FMT_LDOUBLE; p++;		break;
+	}
+
+	if ( !*p || !strchr( "srcdiuoxXeEfFgGaAp%", *p ) ) return NULL;
+	s->conv = *p;
+
+	return p + 1;
+}
+
+static void fmt_fetch( const struct fmt_spec *s, union fmt_value *v,
+		va_list *ap )
+{
+	switch ( s->conv )
+	{
+	case 'd': case 'i':
+		switch ( s->length )
+		{
+		case FMT_CHAR:		v->i = (signed char) va_arg( *ap, int );	break;
+		case FMT_SHORT:		v->i = (short) va_arg( *ap, int );			break;
+		case FMT_LONG:		v->i = va_arg( *ap, long );					break;
+		case FMT_LLONG:		v->i = va_arg( *ap, long long );			break;
+		case FMT_INTMAX:	v->i = va_arg( *ap, intmax_t );				break;
+		case FMT_SIZE:		v->i = va_arg( *ap, ptrdiff_t );			break;
+		case FMT_PTRDIFF:	v->i = va_arg( *ap, ptrdiff_t );			break;
+		default:			v->i = va_arg( *ap, int );					break;
+		}
+		break;
+	case 'u': case 'o': case 'x': case 'X':
+		switch ( s->length )
+		{
+		case FMT_CHAR:
+			v->u = (unsigned char) va_arg( *ap, unsigned int );
+			break;
+		case FMT_SHORT:
+			v->u = (unsigned short) va_arg( *ap, unsigned int );
+			break;
+		case FMT_LONG:		v->u = va_arg( *ap, unsigned long );		break;
+		case FMT_LLONG:		v->u = va_arg( *ap, unsigned long long );	break;
+		case FMT_INTMAX:	v->u = va_arg( *ap, uintmax_t );			break;
+		case FMT_SIZE:		v->u = va_arg( *ap, size_t );				break;
+		case FMT_PTRDIFF:	v->u = va_arg( *ap, ptrdiff_t );			break;
+		default:			v->u = va_arg( *ap, unsigned int );			break;
+		}
+		break;
+	case 'p':
+		v->p = va_arg( *ap, void * );
+		break;
+	default:
+		if ( s->length == FMT_LDOUBLE )
+			v->ld = va_arg( *ap, long double );
+		else
+			v->d = va_arg( *ap, double );
+		break;
+	}
+}
+
+/*	snprintf() of the value with width and precision passed as '*'	*/
+#define FMT_CALL( value ) \
+	( s->has_width && s->has_precision \
+		? snprintf( buf, size, directive, s->width, s->precision, value ) \
+	: s->has_width ? snprintf( buf, size, directive, s->width, value ) \
+	: s->has_precision ? snprintf( buf, size, directive, s->precision, value ) \
+	: snprintf( buf, size, directive, value ) )
+
+static int fmt_number( char *buf, size_t size, const struct fmt_spec *s,
+		const union fmt_value *v )
+{
+	char directive[24], *d = directive;
+
+	*d++ = '%';
+	if ( s->left ) *d++ = '-';
+	d = strcpy( d, s->flags ) + strlen( s->flags );
+	if ( s->has_width ) *d++ = '*';
+	if ( s->has_precision )
+	{
+		*d++ = '.';
+		*d++ = '*';
+	}
+
+	switch ( s->conv )
+	{
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		*d++ = 'j';
+		break;
+	case 'p':
+		break;
+	default:
+		if ( s->length == FMT_LDOUBLE ) *d++ = 'L';
+		break;
+	}
+	*d++ = s->conv;
+	*d = '\0';
+
+	switch ( s->conv )
+	{
+	case 'd': case 'i':
+		return FMT_CALL( v->i );
+	case 'u': case 'o': case 'x': case 'X':
+		return FMT_CALL( v->u );
+	case 'p':
+		return FMT_CALL( v->p );
+	default:
+		if ( s->length == FMT_LDOUBLE ) return FMT_CALL( v->ld );
+		return FMT_CALL( v->d );
+	}
+}
+
+#undef FMT_CALL
+
+static int fmt_pad( cgi_request *req, int n )
+{
+	static const char spaces[] = "                                ";
+
+	for ( ; n > 0; n -= sizeof(spaces) - 1 )
+	{
+		if ( !cgi_request_write( req, spaces, (size_t) n < sizeof(spaces) - 1
+				? (size_t) n : sizeof(spaces) - 1 ) )
+			return 0;
+	}
+
+	return 1;
+}
+
+/*	a string escaped or raw, padded to the width in bytes of the
+ *	string as it is	*/
+static int fmt_string( cgi_request *req, const struct fmt_spec *s,
+		const char *str, size_t len, int raw )
+{
+	int pad = s->has_width && (size_t) s->width > len
+			? s->width - (int) len : 0;
+
+	if ( !s->left && !fmt_pad( req, pad ) ) return 0;
+
+	if ( raw ? !cgi_request_write( req, str, len )
+			: !cgi_request_write_html_escaped( req, str, len ) )
+		return 0;
+
+	return !s->left || fmt_pad( req, pad );
+}
+
+int cgi_printf_html( const char *format, ... )
+{
+	va_list ap;
+	int ret;
+
+	va_start( ap, format );
+	ret = cgi_request_vprintf_html( &cgi_default_request, format, ap );
+	va_end( ap );
+
+	return ret;
+}
+
+int cgi_vprintf_html( const char *format, va_list ap )
+{
+	return cgi_request_vprintf_html( &cgi_default_request, format, ap );
+}
+
+int cgi_request_printf_html( cgi_request *req, const char *format, ... )
+{
+	va_list ap;
+	int ret;
+
+	va_start( ap, format );
+	ret = cgi_request_vprintf_html( req, format, ap );
+	va_end( ap );
+
+	return ret;
+}
+
+int cgi_request_vprintf_html( cgi_request *req, const char *format,
+		va_list ap )
+{
+	const char *p = format, *str;
+	struct fmt_spec spec;
+	union fmt_value value;
+	char buf[128], *big, c;
+	va_list args;
+	size_t len;
+	int n, ok;
+
+	/*	va_list may be an array, pointers to a copy work everywhere	*/
+	va_copy( args, ap );
+
+	while ( *p )
+	{
+		/*	text up to the next directive in one piece	*/
+		len = strcspn( p, "%" );
+		if ( len && !cgi_request_write( req, p, len ) ) goto err;
+		if ( !*(p += len) ) break;
+
+		if ( !(p = fmt_parse( p + 1, &spec, &args )) )
+		{
+			cgi_request_error( req, E_WARNING, "%s: invalid format: %s",
+					"cgi_printf_html", format );
+			goto err;
+		}
+
+		switch ( spec.conv )
+		{
+		case '%':
+			ok = cgi_request_write( req, "%", 1 );
+			break;
+
+		case 's':
+		case 'r':
+			if ( !(str = va_arg( args, const char * )) ) str = "(null)";
+			/*	not beyond the precision, even without a NUL	*/
+			for ( len = 0; str[len] && (!spec.has_precision
+					|| len < (size_t) spec.precision); len++ );
+			ok = fmt_string( req, &spec, str, len, spec.conv == 'r' );
+			break;
+
+		case 'c':
+			c = (char) va_arg( args, int );
+			ok = fmt_string( req, &spec, &c, 1, 0 );
+			break;
+
+		default:
+			fmt_fetch( &spec, &value, &args );
+			if ( (n = fmt_number( buf, sizeof(buf), &spec, &value )) < 0 )
+				goto err;
+
+			if ( (size_t) n < sizeof(buf) )
+			{
+				ok = cgi_request_write( req, buf, n );
+				break;
+			}
+
+			/*	wide fields	*/
+			if ( !(big = malloc( n + 1 )) )
+			{
+				cgi_request_error( req, E_MEMORY, "%s, line %i", __FILE__,
+						__LINE__ );
+				goto err;
+			}
+			fmt_number( big, n + 1, &spec, &value );
+			ok = cgi_request_write( req, big, n );
+			free( big );
+			break;
+		}
+
+		if ( !ok ) goto err;
+	}
+
+	va_end( args );
+	return 1;
+
+err:
+	va_end( args );
+	return 0;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -13,26 +13,7 @@
 
 #include "libcgi/error.h"
 
-struct iso8859_15 {
-	char code;
-	char *html;
-} he[] = {
-	{ 0xE4, "&auml;" },
-	{ 0xC4, "&Auml;" },
-	{ 0xF6, "&ouml;" },
-	{ 0xD6, "&Ouml;" },
-	{ 0xFC, "&uuml;" },
-	{ 0xDC, "&Uuml;" },
-	{ 0xDF, "&szlig;" },
-	{ 0xA4, "&euro;" },
-	{ 0x3C, "&lt;"  },
-	{ 0x3E, "&gt;"  },
-	{ 0x26, "&amp;" },
-	{ 0x22, "&quot;"}
-};
-
-static int ncodes = sizeof(he) / sizeof(struct iso8859_15);
-
+#include "internal.h"
 
 /**************************************************************
 						GENERAL GROUP
@@ -48,39 +29,41 @@ static int ncodes = sizeof(he) / sizeof(struct iso8859_15);
 * @return The new string
 * @author Robert Csok <rcsok@gmx.de>
 */
-// This one needs the struct and ncodes above.
-// ncodes is the number of elements in the struct.
+// The entities are the tables of scan.c, the first pass gets the exact
+// size and the second copies the runs in between in one go.
 char *htmlentities(const char *str)
 {
-	char *buf;
-	int siz, len, i = 0, j;
+	const char *p, *end;
+	char *buf, *q;
+	size_t len, siz, n;
+	unsigned char c;
+
+	len = strlen(str);
+	end = str + len;
 
-	siz = strlen(str) + 1;
+	for (siz = len + 1, p = str; (p += cgi_scan_html_special(p, end - p)) < end; p++)
+		siz += cgi_html_entity_len[cgi_html_class[(unsigned char) *p]] - 1;
 
 	buf = (char *)malloc(siz);
-	if (!buf)
+	if (!buf) {
 		libcgi_error(E_MEMORY, "Failed to alloc memory at htmlentities, cgi.c");
+		return NULL;
+	}
 
-	for (; *str; str++, i++)  {
-		for (j = 0; j < ncodes; j++) {
-			if (*str == he[j].code) {
-				len = strlen(he[j].html) - 1;
-
-				buf = realloc(buf, siz += len);
-				if (!buf)
-					libcgi_error(E_MEMORY, "Failed to alloc memory at htmlentities, cgi.c");
-
-				strcpy(buf + i, he[j].html);
-				i += len;
-				break;
-			}
-		}
-
-		if (j == ncodes)
-			buf[i] = *str;
+	for (p = str, q = buf; p < end; p++) {
+		n = cgi_scan_html_special(p, end - p);
+		memcpy(q, p, n);
+		q += n;
+		p += n;
+		if (p == end)
+			break;
+
+		c = cgi_html_class[(unsigned char) *p];
+		memcpy(q, cgi_html_entity[c], cgi_html_entity_len[c]);
+		q += cgi_html_entity_len[c];
 	}
 
-	buf[i] = '\0';
+	*q = '\0';
 	return buf;
 }
 
@@ -0,0 +1,227 @@
+/*******************************************************************//**
+ *	@file		header.c
+ *
+ *	Response headers of a request.  Headers are collected in a table
+ *	until the body starts, a header of the same name replaces the one
+ *	before, Set-cookie only for the same cookie name.  The table goes
+ *	out in one write: with cgi_init_headers(), a redirect or
+ *	cgi_send_file() unbuffered, with cgi_end() for buffered responses.
+ *	Unbuffered, cgi_send_header(), cgi_add_cookie() and the cookie of
+ *	a session file write the table right away as they always did, a
+ *	program may print its body after them; lines written are not
+ *	replaced, the next one of the same name goes out after them, and
+ *	cgi_end() sends no header block of its own then.
+ *
+ *	Running out of memory is only returned, reporting it would send the
+ *	headers this is about.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+/*	name, and the cookie name of Set-cookie	*/
+static void header_key( const char *line, size_t *name_len, size_t *key_len )
+{
+	const char *colon = strchr( line, ':' ), *p;
+
+	*name_len = *key_len = 0;
+	if ( !colon || colon == line ) return;
+
+	*name_len = *key_len = colon - line;
+
+	if ( *name_len == 10 && !strncasecmp( line, "Set-cookie", 10 ) )
+	{
+		for ( p = colon + 1; *p == ' '; p++ );
+		*key_len = p - line + strcspn( p, "=;" );
+	}
+}
+
+/*	first match from line start on	*/
+static struct cgi_header *header_find( struct cgi_headers *h, size_t start,
+		const char *line, size_t name_len, size_t key_len )
+{
+	struct cgi_header *item;
+	size_t i;
+
+	if ( !name_len ) return NULL;
+
+	for ( i = start; i < h->count; i++ )
+	{
+		item = &h->items[i];
+		if ( item->name_len == name_len && item->key_len == key_len
+				&& !strncasecmp( item->line, line, name_len )
+				&& !strncmp( item->line + name_len, line + name_len,
+					key_len - name_len ) )
+			return item;
+	}
+
+	return NULL;
+}
+
+/*	takes line, the same header keeps its place unless it was written	*/
+static int header_put( struct cgi_request *req, char *line )
+{
+	struct cgi_headers *h = &req->headers;
+	struct cgi_header *item, *items;
+	size_t name_len, key_len;
+
+	header_key( line, &name_len, &key_len );
+
+	if ( (item = header_find( h, h->sent, line, name_len, key_len )) )
+	{
+		free( item->line );
+		item->line = line;
+		return 1;
+	}
+
+	if ( h->count == h->size )
+	{
+		items = realloc( h->items, (h->size ? 2 * h->size : 16)
+				* sizeof(struct cgi_header) );
+		if ( !items )
+		{
+			free( line );
+			return 0;
+		}
+		h->items = items;
+		h->size = h->size ? 2 * h->size : 16;
+	}
+
+	item = &h->items[h->count++];
+	item->line = line;
+	item->name_len = name_len;
+	item->key_len = key_len;
+
+	return 1;
+}
+
+int cgi_header_line( struct cgi_request *req, const char *line )
+{
+	char *copy;
+
+	if ( !(copy = strdup( line )) ) return 0;
+
+	return header_put( req, copy );
+}
+
+int cgi_header_set( struct cgi_request *req, const char *name,
+		const char *format, ... )
+{
+	va_list ap;
+	char *line;
+	size_t len = strlen( name );
+	int n;
+
+	va_start( ap, format );
+	n = vsnprintf( NULL, 0, format, ap );
+	va_end( ap );
+
+	if ( n < 0 || !(line = malloc( len + 2 + n + 1 )) ) return 0;
+
+	memcpy( line, name, len );
+	memcpy( line + len, ": ", 2 );
+	va_start( ap, format );
+	vsnprintf( line + len + 2, n + 1, format, ap );
+	va_end( ap );
+
+	return header_put( req, line );
+}
+
+const char *cgi_header_get( struct cgi_request *req, const char *name )
+{
+	struct cgi_header *item;
+	const char *value;
+	size_t len = strlen( name );
+
+	if ( !(item = header_find( &req->headers, 0, name, len, len )) )
+		return NULL;
+
+	for ( value = item->line + len + 1; *value == ' '; value++ );
+
+	return value;
+}
+
+char *cgi_headers_serialize( struct cgi_request *req, size_t *len )
+{
+	struct cgi_headers *h = &req->headers;
+	size_t i, n, total = 2;
+	char *buf, *p;
+
+	for ( i = h->sent; i < h->count; i++ )
+		total += strlen( h->items[i].line ) + 2;
+
+	if ( !(p = buf = malloc( total )) ) return NULL;
+
+	for ( i = h->sent; i < h->count; i++ )
+	{
+		n = strlen( h->items[i].line );
+		memcpy( p, h->items[i].line, n );
+		memcpy( p + n, "\r\n", 2 );
+		p += n + 2;
+	}
+	memcpy( p, "\r\n", 2 );
+	*len = total;
+
+	return buf;
+}
+
+int cgi_headers_send( struct cgi_request *req, FILE *out )
+{
+	size_t len;
+	char *buf;
+	int ok;
+
+	req->headers_initialized = 1;
+
+	if ( !(buf = cgi_headers_serialize( req, &len )) ) return 0;
+	ok = fwrite( buf, 1, len, out ) == len;
+	free( buf );
+	req->headers.sent = req->headers.count;
+
+	return ok;
+}
+
+/*	the lines not written yet, without the empty line that ends them	*/
+int cgi_headers_write( struct cgi_request *req, FILE *out )
+{
+	struct cgi_headers *h = &req->headers;
+	size_t len;
+	char *buf;
+	int ok;
+
+	if ( h->sent == h->count ) return 1;
+
+	if ( !(buf = cgi_headers_serialize( req, &len )) ) return 0;
+	ok = fwrite( buf, 1, len - 2, out ) == len - 2;
+	free( buf );
+	h->sent = h->count;
+
+	return ok;
+}
+
+void cgi_headers_free( struct cgi_request *req )
+{
+	struct cgi_headers *h = &req->headers;
+	size_t i;
+
+	for ( i = 0; i < h->count; i++ )
+		free( h->items[i].line );
+	free( h->items );
+
+	memset( h, 0, sizeof(*h) );
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
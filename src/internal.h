@@ -0,0 +1,423 @@
+/*******************************************************************//**
+ *	@file		internal.h
+ *
+ *	Declarations shared between the library sources, not installed.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#ifndef CGI_INTERNAL_H
+#define CGI_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "libcgi/cgi_types.h"
+#include "libcgi/request.h"
+
+/*	***	arena.c	***	*/
+
+/*	alignment of arena memory, sizes are rounded up to it	*/
+#define ARENA_ALIGN			(sizeof(void *) > sizeof(double) \
+								? sizeof(void *) : sizeof(double))
+
+struct cgi_arena_block;
+
+struct cgi_arena {
+	struct cgi_arena_block	*head;
+	size_t					block_size;	/**< 0 for the default	*/
+	size_t					used;
+	size_t					peak;
+};
+
+extern struct cgi_arena request_arena;
+
+void *cgi_arena_alloc( struct cgi_arena *arena, size_t size );
+void *cgi_arena_calloc( struct cgi_arena *arena, size_t size );
+char *cgi_arena_strndup( struct cgi_arena *arena, const char *s, size_t len );
+formvars *cgi_arena_formvar( struct cgi_arena *arena );
+int cgi_arena_owns( const struct cgi_arena *arena, const void *p );
+void cgi_arena_release( struct cgi_arena *arena );
+void cgi_arena_destroy( struct cgi_arena *arena );
+
+/*	***	conditional.c	***	*/
+
+struct cgi_request;
+struct stat;
+
+/*	"Sun, 06 Nov 1994 08:49:37 GMT" and the NUL	*/
+#define CGI_HTTP_DATE_LEN	30
+
+void cgi_http_date( char buf[CGI_HTTP_DATE_LEN], time_t t );
+time_t cgi_http_date_parse( const char *s );
+void cgi_file_etag( char *buf, size_t size, const struct stat *st );
+int cgi_etag_match( const char *header, const char *etag );
+int cgi_not_modified( struct cgi_request *req, const char *etag,
+		time_t mtime );
+int cgi_if_range( struct cgi_request *req, const char *etag, time_t mtime );
+
+/*	***	list.c	***	*/
+
+#define SLIST_END	UINT32_MAX
+
+/*	a value of the list, next links the values of the same name	*/
+struct slist_value {
+	formvars	*item;
+	uint32_t	next;
+};
+
+/*	a distinct name, empty if count is 0	*/
+struct slist_slot {
+	uint32_t	hash;
+	uint32_t	head;		/**< first value	*/
+	uint32_t	tail;		/**< last value	*/
+	uint32_t	count;		/**< number of values	*/
+};
+
+/**
+ *	Open addressing hash index over a formvars list, so lookups by
+ *	name do not need to walk the list.  Keys are case folded to keep
+ *	the case insensitive behaviour of slist_item().  Every name links
+ *	all of its values in list order for cgi_param_iter().  The index
+ *	notices items appended with slist_add() and updates itself on the
+ *	next lookup.  Items are deleted through slist_index_delete() or
+ *	slist_index_clear(), which rebuild only the index of that list;
+ *	slist_delete() and slist_free() do so for the lists of the default
+ *	request.
+ */
+struct slist_index {
+	formvars			*start;		/**< list the index was built for	*/
+	formvars			*last;		/**< last item indexed	*/
+	unsigned int		generation;	/**< bumped when tables are dropped, iterators keep it	*/
+	size_t				count;		/**< number of used slots	*/
+	size_t				mask;		/**< number of slots - 1	*/
+	struct slist_slot	*slots;
+	struct slist_value	*values;	/**< all items in list order	*/
+	size_t				nvalues;
+	size_t				values_cap;
+};
+
+void slist_index_build( struct slist_index *idx, formvars *start,
+		formvars *last );
+formvars *slist_index_lookup( struct slist_index *idx, const char *name,
+		formvars *start, formvars *last );
+char *slist_index_item( struct slist_index *idx, const char *name,
+		formvars *start, formvars *last );
+size_t slist_index_iter( struct slist_index *idx, const char *name,
+		formvars *start, formvars *last, cgi_param_iter *it );
+const char *slist_index_next( cgi_param_iter *it );
+int slist_index_delete( struct slist_index *idx, struct cgi_arena *arena,
+		char *name, formvars **start, formvars **last );
+void slist_index_clear( struct slist_index *idx, struct cgi_arena *arena,
+		formvars **start );
+void slist_index_free( struct slist_index *idx );
+
+/*	***	compress.c	***	*/
+
+struct cgi_gzip;
+struct iovec;
+
+/*	a mapped single member .gz file and where its deflate blocks are	*/
+struct cgi_gz_member {
+	const unsigned char	*data;
+	size_t				map_len;
+	size_t				start;		/**< first byte of the deflate data	*/
+	size_t				last;		/**< byte with the final block bit	*/
+	unsigned int		last_bit;
+	size_t				end;		/**< byte with the trailing bits	*/
+	unsigned int		end_bits;	/**< bits used of it, may be 0	*/
+	unsigned long		crc;
+	unsigned long		size;		/**< uncompressed, modulo 2^32	*/
+};
+
+int cgi_compress_enabled( void );
+int cgi_compress_accepted( struct cgi_request *req, size_t length );
+unsigned char *cgi_compress_iov( const struct iovec *iov, size_t count,
+		const struct cgi_gz_member **members, size_t *out_len );
+int cgi_compress_start( struct cgi_request *req );
+void cgi_compress_end( struct cgi_request *req );
+int cgi_compress_sibling( const char *path, const struct stat *st,
+		struct cgi_gz_member *m );
+void cgi_compress_sibling_free( struct cgi_gz_member *m );
+int cgi_compress_include( struct cgi_request *req, const char *path,
+		const struct stat *st );
+
+/*	***	response.c	***	*/
+
+struct cgi_response_block;
+struct cgi_response_map;
+
+/*	buffered response of a request, all zero if not buffering	*/
+struct cgi_response {
+	int							buffered;
+	FILE						*target;		/**< where the response goes	*/
+	FILE						*capture;		/**< replaces stdout, default request only	*/
+	FILE						*saved_stdout;
+	struct iovec				*iov;			/**< headers, then body segments	*/
+	size_t						iov_count;
+	size_t						iov_size;
+	size_t						length;			/**< body bytes	*/
+	struct cgi_response_block	*blocks;
+	struct cgi_response_map		*maps;
+	int							etag_body;		/**< hash the body, cgi_response_etag()	*/
+	int							not_modified;	/**< 304 decided by cgi_send_file()	*/
+	int							identity;		/**< byte ranges, never compressed	*/
+};
+
+/*	***	cookie.c	***	*/
+
+formvars *cgi_cookies_parse( struct cgi_request *req );
+int cgi_cookie_set( struct cgi_request *req, const char *name,
+		const char *value, const char *max_age, const char *path,
+		const char *domain, int secure );
+
+/*	***	header.c	***	*/
+
+/*	a header line of the response	*/
+struct cgi_header {
+	char	*line;		/**< "Name: value" without the line end	*/
+	size_t	name_len;	/**< 0 for lines without a name, never replaced	*/
+	size_t	key_len;	/**< the name, and the cookie name for Set-cookie	*/
+};
+
+/*	headers of a request, in the order they were first set	*/
+struct cgi_headers {
+	struct cgi_header	*items;
+	size_t				count;
+	size_t				size;
+	size_t				sent;		/**< lines written already, see cgi_headers_write()	*/
+};
+
+int cgi_header_line( struct cgi_request *req, const char *line );
+int cgi_header_set( struct cgi_request *req, const char *name,
+		const char *format, ... );
+const char *cgi_header_get( struct cgi_request *req, const char *name );
+char *cgi_headers_serialize( struct cgi_request *req, size_t *len );
+int cgi_headers_send( struct cgi_request *req, FILE *out );
+int cgi_headers_write( struct cgi_request *req, FILE *out );
+void cgi_headers_free( struct cgi_request *req );
+
+/*	***	range.c	***	*/
+
+/*	most ranges of a request that are served, more get the whole file	*/
+#define CGI_RANGE_MAX	16
+
+/*	bytes first to last, both included	*/
+struct cgi_range {
+	unsigned long long	first;
+	unsigned long long	last;
+};
+
+int cgi_range_parse( const char *header, unsigned long long size,
+		struct cgi_range *ranges, int max );
+int cgi_range_request( struct cgi_request *req, const char *etag,
+		time_t mtime, unsigned long long size, struct cgi_range *ranges );
+
+/*	***	request.c	***	*/
+
+/*	session id length	*/
+#define SESS_ID_LEN		45
+
+/**
+ *	State of one request, see libcgi/request.h.  The default request,
+ *	used by all functions without a request argument, keeps its lists
+ *	in the public globals (formvars_start, cookies_start …), so the
+ *	list members point there for it and to own_lists otherwise.
+ */
+struct cgi_request {
+	FILE				*in;			/**< NULL for stdin	*/
+	FILE				*out;			/**< NULL for stdout	*/
+	formvars			*env_start;		/**< NULL for getenv()	*/
+	formvars			*env_last;
+	struct cgi_arena	*arena;
+	int					headers_initialized;	/**< headers sent, or on the way	*/
+	struct cgi_headers	headers;
+	struct cgi_response	response;
+	struct cgi_gzip		*gzip;			/**< compression stage, see compress.c	*/
+
+	formvars			**form_start;
+	formvars			**form_last;
+	struct slist_index	form_index;
+	cgi_param_iter		param_multiple;
+	char				*param_multiple_name;	/**< NULL to start over	*/
+
+	formvars			**cookies_start;
+	formvars			**cookies_last;
+	struct slist_index	cookies_index;
+	int					cookies_parsed;	/**< HTTP_COOKIE split, see cgi_cookies_parse()	*/
+
+	struct cgi_upload	*uploads_start;
+	struct cgi_upload	*uploads_last;
+	cgi_upload_handler	upload_handler;	/**< NULL to spool to files	*/
+	void				*upload_handler_arg;
+
+	formvars			**sess_start;
+	formvars			**sess_last;
+	struct slist_index	sess_index;
+	int					sess_initialized;
+	int					sess_dirty;		/**< changes not written yet	*/
+	char				sess_id[SESS_ID_LEN + 1];
+	char				*sess_fname;
+	void				*sess_map;		/**< session file the variables point into	*/
+	size_t				sess_map_len;
+	const struct sess_store	*sess_store;	/**< of the started session	*/
+
+	/*	storage of requests made with cgi_request_new()	*/
+	struct cgi_arena	own_arena;
+	formvars			*own_lists[6];
+};
+
+extern struct cgi_request cgi_default_request;
+
+static inline FILE *cgi_request_in( struct cgi_request *req )
+{
+	return req->in ? req->in : stdin;
+}
+
+static inline FILE *cgi_request_out( struct cgi_request *req )
+{
+	return req->out ? req->out : stdout;
+}
+
+void cgi_response_end( struct cgi_request *req );
+int cgi_response_include( struct cgi_request *req, const char *path, int fd,
+		const struct stat *st, unsigned long long off, size_t len );
+
+/*	***	cgi.c	***	*/
+
+formvars *process_data(const char *query, formvars **start, formvars **last,
+                       const char sep_value, const char sep_name);
+formvars *process_data_arena(struct cgi_arena *arena, const char *query,
+                             formvars **start, formvars **last,
+                             const char sep_value, const char sep_name);
+formvars *process_data_in_place(struct cgi_arena *arena, char *buf,
+                                formvars **start, formvars **last,
+                                const char sep_value, const char sep_name);
+size_t cgi_unescape_into(char *dst, const char *src, size_t len);
+
+/*	value of a hex digit, 0xFF for other characters	*/
+extern const unsigned char cgi_hextable[256];
+
+/*	***	multipart.c	***	*/
+
+formvars *cgi_read_multipart( struct cgi_request *req, FILE *in,
+		unsigned long length, const char *content_type, size_t field_max );
+void cgi_uploads_free( struct cgi_request *req );
+
+/*	***	scan.c	***	*/
+
+/*	levels for cgi_scan_set_level(), capped to what the CPU has	*/
+#define CGI_SCAN_SCALAR	0
+#define CGI_SCAN_SSE2	1
+#define CGI_SCAN_AVX2	2
+
+/*	cgi_url_class[] values	*/
+#define CGI_URL_KEEP	0
+#define CGI_URL_SPACE	1
+#define CGI_URL_ESCAPE	2
+
+extern const unsigned char cgi_url_class[256];
+
+/*	cgi_html_class[] is 0 for bytes htmlentities() keeps, otherwise the
+ *	index of the replacement in cgi_html_entity[]	*/
+extern const char *const cgi_html_entity[13];
+extern const unsigned char cgi_html_entity_len[13];
+extern const unsigned char cgi_html_class[256];
+
+int cgi_scan_set_level( int level );
+size_t cgi_scan_url_special( const char *s, size_t len );
+size_t cgi_scan_url_unsafe( const char *s, size_t len );
+size_t cgi_count_url_escapes( const char *s, size_t len );
+size_t cgi_scan_html_special( const char *s, size_t len );
+
+/*	***	session.c	***	*/
+
+/*	session_lasterror values, index of session_error_message[]	*/
+typedef enum SESS_ERROR {
+	SESS_NOT_INITIALIZED,
+	SESS_FILE_NOT_INITIALIZED,
+	SESS_HEADERS_SENT,
+	SESS_STARTED,
+	SESS_CREATE_FILE,
+	SESS_DELETE_FILE,
+	SESS_DESTROY,
+	SESS_REMOVE_FROM_LIST,
+	SESS_VAR_REGISTERED,
+	SESS_VAR_NOT_REGISTERED,
+	SESS_OPEN_FILE,
+	SESS_EINVAL,
+	SESS_NO_KEY,
+	SESS_TOO_LARGE
+} sess_error;
+
+/**
+ *	Where a session keeps its variables, see cgi_session_set_backend().
+ *	All return false on errors with session_lasterror set.
+ */
+struct sess_store {
+	/*	load the session named by the cookie value, which may be NULL,
+	 *	or start a new one, and set the session cookie	*/
+	int		(*start)( struct cgi_request *req, const char *cookie );
+	/*	write all variables	*/
+	int		(*save)( struct cgi_request *req );
+	/*	write all variables at the end of a request that changed them,
+	 *	NULL to save() on every change	*/
+	int		(*flush)( struct cgi_request *req );
+	/*	forget the session, NULL if there is nothing to remove	*/
+	int		(*destroy)( struct cgi_request *req );
+};
+
+extern const struct sess_store sess_cookie_store;
+extern const struct sess_store sess_shm_store;
+extern formvars *sess_list_last;
+extern unsigned long sess_max_idle;
+
+int sess_fail( struct cgi_request *req, sess_error error );
+void sess_flush( struct cgi_request *req );
+void sess_unmap( struct cgi_request *req );
+size_t sess_pairs_write( struct cgi_request *req, char *buf, size_t size );
+int sess_pairs_load( struct cgi_request *req, char *buf, size_t len );
+void sess_generate_id( struct cgi_request *req );
+int sess_valid_id( const char *id );
+void cgi_request_session_free( struct cgi_request *req );
+
+/*	***	sha256.c	***	*/
+
+#define CGI_SHA256_LEN	32
+
+struct cgi_sha256 {
+	uint32_t		h[8];
+	uint64_t		len;		/**< bytes hashed so far	*/
+	unsigned char	buf[64];
+};
+
+/*	an HMAC key, the states after hashing the padded key blocks	*/
+struct cgi_hmac_sha256 {
+	struct cgi_sha256	inner;
+	struct cgi_sha256	outer;
+};
+
+void cgi_sha256_init( struct cgi_sha256 *ctx );
+void cgi_sha256_update( struct cgi_sha256 *ctx, const void *data,
+		size_t len );
+void cgi_sha256_final( struct cgi_sha256 *ctx,
+		unsigned char digest[CGI_SHA256_LEN] );
+void cgi_hmac_sha256_key( struct cgi_hmac_sha256 *hmac, const void *key,
+		size_t len );
+void cgi_hmac_sha256( const struct cgi_hmac_sha256 *hmac, const void *data,
+		size_t len, unsigned char mac[CGI_SHA256_LEN] );
+
+/*	***	urlencoded.c	***	*/
+
+formvars *cgi_read_urlencoded( struct cgi_arena *arena, FILE *in,
+		unsigned long length, size_t field_max, formvars **start,
+		formvars **last );
+
+#endif /* CGI_INTERNAL_H */
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
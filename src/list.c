@@ -15,6 +15,39 @@
 
 #include "libcgi/cgi_types.h"
 
+#include "internal.h"
+
+// Index of a list of the default request, programs reach those through
+// the public globals and change them with slist_delete() or slist_free().
+// Items of any list may be in its memory, process_data() puts them there.
+static struct slist_index *slist_owner(formvars **start,
+		struct cgi_arena **arena)
+{
+	struct cgi_request *req = &cgi_default_request;
+
+	*arena = req->arena;
+	if (start == req->form_start)
+		return &req->form_index;
+	if (start == req->cookies_start)
+		return &req->cookies_index;
+	if (start == req->sess_start)
+		return &req->sess_index;
+
+	return NULL;
+}
+
+// Release an item, unless it lives in request memory which is released
+// by cgi_end()
+static void slist_item_free(struct cgi_arena *arena, formvars *item)
+{
+	if (arena && cgi_arena_owns(arena, item))
+		return;
+
+	free(item->name);
+	free(item->value);
+	free(item);
+}
+
 // Add a new item to the list
 void slist_add(formvars *item, formvars **start, formvars **last)
 {
@@ -48,6 +81,20 @@ void slist_add(formvars *item, formvars **start, formvars **last)
 
 // Delete from list the item pointed by name
 int slist_delete(char *name, formvars **start, formvars **last)
+{
+	struct slist_index *idx;
+	struct cgi_arena *arena;
+
+	idx = slist_owner(start, &arena);
+
+	return slist_index_delete(idx, arena, name, start, last);
+}
+
+// Same as slist_delete() for a list of a request, its index, if any, is
+// rebuilt on the next lookup and its iterations end. Items allocated
+// from arena are left to it.
+int slist_index_delete(struct slist_index *idx, struct cgi_arena *arena,
+		char *name, formvars **start, formvars **last)
 {
 	formvars *curr, *prev;
 
@@ -75,10 +122,9 @@ int slist_delete(char *name, formvars **start, formvars **last)
 				*last = prev;
 			}
 
-			/*	deallocate current element	*/
-			free( curr->name );
-			free( curr->value );
-			free( curr );
+			if ( idx ) slist_index_free( idx );
+
+			slist_item_free( arena, curr );
 
 			return 1;
 		}
@@ -112,16 +158,282 @@ char *slist_item(const char *name, formvars *start)
 // Free linked list allocated memory
 void slist_free(formvars **start)
 {
+	struct slist_index *idx;
+	struct cgi_arena *arena;
+
+	idx = slist_owner(start, &arena);
+	slist_index_clear(idx, arena, start);
+}
+
+// Same as slist_free() for a list of a request, see slist_index_delete()
+void slist_index_clear(struct slist_index *idx, struct cgi_arena *arena,
+		formvars **start)
+{
+	if (*start && idx)
+		slist_index_free(idx);
+
 	while (*start) {
-		void *p = *start;
-		free((*start)->name);
-		free((*start)->value);
+		formvars *p = *start;
 
 		*start = (*start)->next;
-
-		free(p);
+		slist_item_free(arena, p);
 	}
 
 	*start = NULL;
 }
 
+
+/*	***	hash index	***	*/
+
+// FNV-1a over the ASCII case folded name
+static uint32_t slist_hash(const char *name)
+{
+	uint32_t h = 2166136261u;
+	unsigned char c;
+
+	while ((c = *name++)) {
+		if (c >= 'A' && c <= 'Z')
+			c |= 0x20;
+		h = (h ^ c) * 16777619u;
+	}
+
+	return h;
+}
+
+// Append item to the values and to the chain of its name, the first
+// item of a name owns the slot like in slist_item()
+static int slist_index_insert(struct slist_index *idx, formvars *item)
+{
+	struct slist_value *values;
+	struct slist_slot *slot;
+	uint32_t h, v;
+	size_t i, cap;
+
+	if (!item->name)
+		return 1;
+
+	if (idx->nvalues == idx->values_cap) {
+		cap = idx->values_cap ? idx->values_cap * 2 : 16;
+		values = realloc(idx->values, cap * sizeof(struct slist_value));
+		if (!values)
+			return 0;
+		idx->values = values;
+		idx->values_cap = cap;
+	}
+
+	v = idx->nvalues++;
+	idx->values[v].item = item;
+	idx->values[v].next = SLIST_END;
+
+	h = slist_hash(item->name);
+	for (i = h & idx->mask; (slot = &idx->slots[i])->count; i = (i + 1) & idx->mask) {
+		if (slot->hash == h
+				&& !strcasecmp(idx->values[slot->head].item->name, item->name)) {
+			idx->values[slot->tail].next = v;
+			slot->tail = v;
+			slot->count++;
+			return 1;
+		}
+	}
+
+	slot->hash = h;
+	slot->head = slot->tail = v;
+	slot->count = 1;
+	idx->count++;
+
+	return 1;
+}
+
+// Make room for want names, the values are kept
+static int slist_index_grow(struct slist_index *idx, size_t want)
+{
+	struct slist_slot *old = idx->slots, *slots;
+	size_t old_size = old ? idx->mask + 1 : 0;
+	size_t size = 16, i, j;
+
+	// keep the load factor at or below 1/2
+	while (size < want * 2)
+		size <<= 1;
+
+	if (size <= old_size)
+		return 1;
+
+	slots = calloc(size, sizeof(struct slist_slot));
+	if (!slots)
+		return 0;
+
+	// names are unique, slots move as they are
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].count)
+			continue;
+		for (j = old[i].hash & (size - 1); slots[j].count; j = (j + 1) & (size - 1));
+		slots[j] = old[i];
+	}
+
+	free(old);
+	idx->slots = slots;
+	idx->mask = size - 1;
+
+	return 1;
+}
+
+// (Re)build the index for the list start ... last
+void slist_index_build(struct slist_index *idx, formvars *start, formvars *last)
+{
+	formvars *item;
+	size_t n = 0;
+
+	slist_index_free(idx);
+
+	for (item = start; item; item = item->next)
+		n++;
+
+	idx->start = start;
+	idx->last = last;
+
+	if (!n || !slist_index_grow(idx, n))
+		return;
+
+	for (item = start; item; item = item->next) {
+		if (!slist_index_insert(idx, item)) {
+			slist_index_free(idx);
+			return;
+		}
+	}
+}
+
+// Bring the index up to date with the list, cheap if items were only
+// appended since the last call
+static int slist_index_sync(struct slist_index *idx, formvars *start,
+		formvars *last)
+{
+	formvars *item;
+	size_t n = 0;
+
+	if (idx->start != start || (idx->last == NULL && last != NULL)) {
+		slist_index_build(idx, start, last);
+		return idx->slots != NULL || start == NULL;
+	}
+
+	if (idx->last == last)
+		return idx->slots != NULL || start == NULL;
+
+	for (item = idx->last->next; item; item = item->next)
+		n++;
+
+	if (!slist_index_grow(idx, idx->count + n))
+		return 0;
+
+	for (item = idx->last->next; item; item = item->next) {
+		if (!slist_index_insert(idx, item)) {
+			slist_index_free(idx);
+			return 0;
+		}
+	}
+	idx->last = last;
+
+	return 1;
+}
+
+// Slot of name, NULL if not there
+static struct slist_slot *slist_index_find(struct slist_index *idx,
+		const char *name)
+{
+	struct slist_slot *slot;
+	uint32_t h;
+	size_t i;
+
+	if (!idx->slots)
+		return NULL;
+
+	h = slist_hash(name);
+	for (i = h & idx->mask; (slot = &idx->slots[i])->count; i = (i + 1) & idx->mask) {
+		if (slot->hash == h
+				&& !strcasecmp(idx->values[slot->head].item->name, name))
+			return slot;
+	}
+
+	return NULL;
+}
+
+// Same as slist_item(), but O(1) on average
+// First item named name, NULL if there is none.
+formvars *slist_index_lookup(struct slist_index *idx, const char *name,
+		formvars *start, formvars *last)
+{
+	struct slist_slot *slot;
+	formvars *item;
+
+	if (!name)
+		return NULL;
+
+	// out of memory, fall back to walking the list
+	if (!slist_index_sync(idx, start, last)) {
+		for (item = start; item; item = item->next) {
+			if (item->name && !strcasecmp(item->name, name))
+				return item;
+		}
+		return NULL;
+	}
+
+	if (!(slot = slist_index_find(idx, name)))
+		return NULL;
+
+	return idx->values[slot->head].item;
+}
+
+char *slist_index_item(struct slist_index *idx, const char *name,
+		formvars *start, formvars *last)
+{
+	formvars *item = slist_index_lookup(idx, name, start, last);
+
+	if (item == NULL || item->value == NULL || item->value[0] == '\0')
+		return NULL;
+
+	return item->value;
+}
+
+// Start iterating over all values of name, returns their number. When
+// the index can't be built the iteration is empty.
+size_t slist_index_iter(struct slist_index *idx, const char *name,
+		formvars *start, formvars *last, cgi_param_iter *it)
+{
+	struct slist_slot *slot = NULL;
+
+	if (name && slist_index_sync(idx, start, last))
+		slot = slist_index_find(idx, name);
+
+	it->index = idx;
+	it->epoch = idx->generation;
+	it->entry = slot ? slot->head : SLIST_END;
+
+	return slot ? slot->count : 0;
+}
+
+// Next value of an iteration, "" for empty values, NULL at the end or
+// if the list lost items since
+const char *slist_index_next(cgi_param_iter *it)
+{
+	struct slist_index *idx = it->index;
+	formvars *item;
+
+	if (!idx || it->entry == SLIST_END || idx->generation != it->epoch)
+		return NULL;
+
+	item = idx->values[it->entry].item;
+	it->entry = idx->values[it->entry].next;
+
+	return item->value ? item->value : "";
+}
+
+// Drop the tables, iterations over them end and the next lookup
+// rebuilds them
+void slist_index_free(struct slist_index *idx)
+{
+	unsigned int generation = idx->generation + 1;
+
+	free(idx->slots);
+	free(idx->values);
+	memset(idx, 0, sizeof(*idx));
+	idx->generation = generation;
+}
@@ -0,0 +1,608 @@
+/*******************************************************************//**
+ *	@file		multipart.c
+ *
+ *	Streaming parser for multipart/form-data bodies (RFC 7578).  The
+ *	body is read in chunks through a window buffer, delimiters are
+ *	found with a Boyer-Moore-Horspool search.  Ordinary fields end up
+ *	in the form variables list, file contents go to a spooled
+ *	temporary file or to a user callback while they arrive, so an
+ *	upload is never held in memory as a whole.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/error.h"
+
+#include "internal.h"
+
+#define MP_CHUNK_SIZE		16384
+#define MP_HEADER_MAX		8192
+#define MP_WINDOW_SIZE		(MP_CHUNK_SIZE + MP_HEADER_MAX)
+/*	RFC 2046 limits boundaries to 70 characters	*/
+#define MP_BOUNDARY_MAX		70
+
+enum mp_state {
+	MP_PREAMBLE,
+	MP_AFTER_DELIMITER,
+	MP_HEADERS,
+	MP_BODY,
+	MP_EPILOGUE
+};
+
+struct mp_parser {
+	unsigned long		remaining;
+
+	/*	"\r\n--" boundary and its Horspool shift table	*/
+	char				delim[MP_BOUNDARY_MAX + 4];
+	size_t				delim_len;
+	size_t				shift[256];
+
+	char				*buf;
+	size_t				len;
+
+	enum mp_state		state;
+
+	/*	current part	*/
+	char				*name;
+	char				*filename;
+	char				*content_type;
+	struct cgi_upload	*upload;
+	char				*field;
+	size_t				field_len;
+	size_t				field_cap;
+	size_t				field_max;
+
+	struct cgi_request	*req;
+	struct cgi_arena	*arena;
+};
+
+static char upload_tmpdir[255] = "/tmp";
+
+/*	***	delimiter search	***	*/
+
+static void mp_init_shift( struct mp_parser *p )
+{
+	size_t i;
+
+	for ( i = 0; i < 256; i++ )
+		p->shift[i] = p->delim_len;
+
+	for ( i = 0; i + 1 < p->delim_len; i++ )
+		p->shift[(unsigned char) p->delim[i]] = p->delim_len - 1 - i;
+}
+
+/*	Returns the offset of the delimiter in buf, or len if not found.	*/
+static size_t mp_search( const struct mp_parser *p, const char *buf,
+		size_t len )
+{
+	const size_t m = p->delim_len;
+	const unsigned char last = p->delim[m - 1];
+	size_t i = 0;
+	unsigned char c;
+
+	while ( i + m <= len )
+	{
+		c = buf[i + m - 1];
+		if ( c == last && !memcmp( buf + i, p->delim, m - 1 ) )
+			return i;
+
+		i += p->shift[c];
+	}
+
+	return len;
+}
+
+/*	***	part handling	***	*/
+
+static int mp_open_tmpfile( void )
+{
+	char path[sizeof(upload_tmpdir) + 16];
+	int fd;
+
+#ifdef O_TMPFILE
+	fd = open( upload_tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC,
+			S_IRUSR | S_IWUSR );
+	if ( fd >= 0 ) return fd;
+#endif
+
+	/*	no O_TMPFILE support by kernel or filesystem	*/
+	snprintf( path, sizeof(path), "%s/cgiupXXXXXX", upload_tmpdir );
+	fd = mkstemp( path );
+	if ( fd >= 0 ) unlink( path );
+
+	return fd;
+}
+
+static int mp_part_begin( struct mp_parser *p )
+{
+	struct cgi_upload *up;
+
+	p->field_len = 0;
+	p->upload = NULL;
+
+	/*	parts with a file name are uploads, the others are form fields,
+	 *	or skipped by mp_part_data() without a name to look them up	*/
+	if ( !p->name || !p->filename ) return 0;
+
+	up = cgi_arena_calloc( p->arena, sizeof(struct cgi_upload) );
+	up->name = p->name;
+	up->filename = p->filename;
+	up->content_type = p->content_type;
+	up->fd = -1;
+
+	if ( !p->req->upload_handler )
+	{
+		up->fd = mp_open_tmpfile();
+		if ( up->fd < 0 )
+		{
+			cgi_request_error( p->req, E_WARNING,
+					"%s: can not create file in %s", __FUNCTION__, upload_tmpdir );
+			return -1;
+		}
+	}
+
+	if ( p->req->uploads_last )
+		p->req->uploads_last->next = up;
+	else
+		p->req->uploads_start = up;
+	p->req->uploads_last = up;
+
+	p->upload = up;
+
+	return 0;
+}
+
+static int mp_part_data( struct mp_parser *p, const char *data, size_t len )
+{
+	size_t cap;
+	ssize_t w;
+
+	if ( !len ) return 0;
+
+	if ( p->upload )
+	{
+		p->upload->size += len;
+
+		if ( p->req->upload_handler )
+			return p->req->upload_handler( p->upload, data, len,
+					p->req->upload_handler_arg );
+
+		while ( len )
+		{
+			w = write( p->upload->fd, data, len );
+			if ( w < 0 && errno == EINTR ) continue;
+			if ( w < 0 ) return -1;
+			data += w;
+			len -= w;
+		}
+
+		return 0;
+	}
+
+	if ( !p->name ) return 0;
+
+	if ( p->field_max && p->field_len + len > p->field_max ) return -1;
+
+	if ( p->field_len + len > p->field_cap )
+	{
+		for ( cap = p->field_cap ? p->field_cap : 256;
+				cap < p->field_len + len; cap *= 2 );
+
+		p->field = realloc( p->field, cap );
+		if ( !p->field )
+			cgi_request_error( p->req, E_MEMORY, "%s, line %i", __FILE__,
+					__LINE__ );
+		p->field_cap = cap;
+	}
+
+	memcpy( p->field + p->field_len, data, len );
+	p->field_len += len;
+
+	return 0;
+}
+
+static int mp_part_end( struct mp_parser *p )
+{
+	formvars *item;
+	int ret = 0;
+
+	if ( p->upload )
+	{
+		if ( p->req->upload_handler )
+			ret = p->req->upload_handler( p->upload, NULL, 0,
+					p->req->upload_handler_arg );
+		else
+			lseek( p->upload->fd, 0, SEEK_SET );
+	}
+	else if ( p->name )
+	{
+		item = cgi_arena_formvar( p->arena );
+		item->name = p->name;
+		if ( p->field_len )
+			item->value = cgi_arena_strndup( p->arena, p->field,
+					p->field_len );
+
+		slist_add( item, p->req->form_start, p->req->form_last );
+	}
+
+	p->name = p->filename = p->content_type = NULL;
+	p->upload = NULL;
+
+	return ret;
+}
+
+/*	***	part headers	***	*/
+
+/*	Parse a parameter value, quoted or token, into request memory.	*/
+static char *mp_param_value( struct cgi_arena *arena, const char **s,
+		const char *end )
+{
+	const char *v = *s;
+	char *out, *o;
+
+	if ( v < end && *v == '"' )
+	{
+		out = o = cgi_arena_alloc( arena, end - v );
+		for ( v++; v < end && *v != '"'; v++ )
+		{
+			if ( *v == '\\' && v + 1 < end ) v++;
+			*o++ = *v;
+		}
+		*o = '\0';
+		*s = v < end ? v + 1 : v;
+
+		return out;
+	}
+
+	while ( v < end && *v != ';' && *v != ' ' && *v != '\t' ) v++;
+	out = cgi_arena_strndup( arena, *s, v - *s );
+	*s = v;
+
+	return out;
+}
+
+/*	Content-Disposition: form-data; name="field"; filename="file.txt"	*/
+static void mp_parse_disposition( struct mp_parser *p, const char *s,
+		const char *end )
+{
+	const char *key;
+	size_t key_len;
+	char *value;
+
+	while ( s < end )
+	{
+		while ( s < end && *s != ';' ) s++;
+		if ( s == end ) break;
+		for ( s++; s < end && (*s == ' ' || *s == '\t'); s++ );
+
+		for ( key = s; s < end && *s != '=' && *s != ';'; s++ );
+		key_len = s - key;
+		if ( s == end || *s != '=' ) continue;
+		s++;
+
+		value = mp_param_value( p->arena, &s, end );
+
+		if ( key_len == 4 && !strncasecmp( key, "name", 4 ) )
+			p->name = value;
+		else if ( key_len == 8 && !strncasecmp( key, "filename", 8 ) )
+			p->filename = value;
+	}
+}
+
+static void mp_parse_header( struct mp_parser *p, const char *line,
+		size_t len )
+{
+	const char *end = line + len, *colon, *value;
+
+	colon = memchr( line, ':', len );
+	if ( !colon ) return;
+
+	for ( value = colon + 1; value < end && (*value == ' ' || *value == '\t');
+			value++ );
+
+	if ( colon - line == 19
+			&& !strncasecmp( line, "Content-Disposition", 19 ) )
+	{
+		mp_parse_disposition( p, value, end );
+	}
+	else if ( colon - line == 12
+			&& !strncasecmp( line, "Content-Type", 12 ) )
+	{
+		p->content_type = cgi_arena_strndup( p->arena, value,
+				end - value );
+	}
+}
+
+/*	***	state machine	***	*/
+
+static void mp_consume( struct mp_parser *p, size_t n )
+{
+	memmove( p->buf, p->buf + n, p->len - n );
+	p->len -= n;
+}
+
+/*	Process as much of the window as possible.  Returns -1 on errors,
+ *	0 if more data is needed.
+ */
+static int mp_process( struct mp_parser *p, int eof )
+{
+	const char *crlf;
+	size_t pos, keep;
+
+	for ( ;; )
+	{
+		switch ( p->state )
+		{
+			case MP_PREAMBLE:
+			case MP_BODY:
+				pos = mp_search( p, p->buf, p->len );
+				if ( pos < p->len )
+				{
+					if ( p->state == MP_BODY
+							&& (mp_part_data( p, p->buf, pos )
+								|| mp_part_end( p )) )
+						return -1;
+
+					mp_consume( p, pos + p->delim_len );
+					p->state = MP_AFTER_DELIMITER;
+					continue;
+				}
+
+				/*	the tail may hold the start of a delimiter	*/
+				keep = p->delim_len - 1;
+				if ( p->len > keep )
+				{
+					if ( p->state == MP_BODY
+							&& mp_part_data( p, p->buf, p->len - keep ) )
+						return -1;
+					mp_consume( p, p->len - keep );
+				}
+				return eof ? -1 : 0;
+
+			case MP_AFTER_DELIMITER:
+				/*	"--" ends the body, else transport padding and CRLF	*/
+				if ( p->len >= 2 && p->buf[0] == '-' && p->buf[1] == '-' )
+				{
+					p->state = MP_EPILOGUE;
+					continue;
+				}
+
+				for ( pos = 0; pos < p->len
+						&& (p->buf[pos] == ' ' || p->buf[pos] == '\t'); pos++ );
+				if ( pos + 2 > p->len )
+					return eof ? -1 : 0;
+				if ( p->buf[pos] != '\r' || p->buf[pos + 1] != '\n' )
+					return -1;
+
+				mp_consume( p, pos + 2 );
+				p->state = MP_HEADERS;
+				continue;
+
+			case MP_HEADERS:
+				crlf = p->len ? memmem( p->buf, p->len, "\r\n", 2 ) : NULL;
+				if ( !crlf )
+					return (eof || p->len >= MP_HEADER_MAX) ? -1 : 0;
+
+				pos = crlf - p->buf;
+				if ( pos )
+				{
+					mp_parse_header( p, p->buf, pos );
+					mp_consume( p, pos + 2 );
+					continue;
+				}
+
+				mp_consume( p, 2 );
+				if ( mp_part_begin( p ) ) return -1;
+				p->state = MP_BODY;
+				continue;
+
+			case MP_EPILOGUE:
+				p->len = 0;
+				return 0;
+		}
+	}
+}
+
+static int mp_boundary( struct mp_parser *p, const char *content_type )
+{
+	const char *b, *end;
+	size_t len;
+
+	b = strcasestr( content_type, "boundary=" );
+	if ( !b ) return -1;
+	b += 9;
+
+	if ( *b == '"' )
+	{
+		end = strchr( ++b, '"' );
+		if ( !end ) return -1;
+	}
+	else
+	{
+		for ( end = b; *end && *end != ';' && *end != ' '; end++ );
+	}
+
+	len = end - b;
+	if ( !len || len > MP_BOUNDARY_MAX ) return -1;
+
+	memcpy( p->delim, "\r\n--", 4 );
+	memcpy( p->delim + 4, b, len );
+	p->delim_len = len + 4;
+	mp_init_shift( p );
+
+	return 0;
+}
+
+/*	Reads length bytes of a multipart/form-data body from in.  Fields
+ *	are added to the form variables of req, files to its uploads.
+ *	Returns the form variables, or NULL on errors (what was complete
+ *	until then is kept).
+ */
+formvars *cgi_read_multipart( struct cgi_request *req, FILE *in,
+		unsigned long length, const char *content_type, size_t field_max )
+{
+	struct mp_parser p;
+	size_t n;
+	int eof = 0;
+
+	memset( &p, 0, sizeof(p) );
+	p.remaining = length;
+	p.field_max = field_max;
+	p.req = req;
+	p.arena = req->arena;
+
+	if ( mp_boundary( &p, content_type ) ) return NULL;
+
+	p.buf = malloc( MP_WINDOW_SIZE );
+	if ( !p.buf )
+		cgi_request_error( req, E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+
+	/*	the first delimiter comes without the leading CRLF	*/
+	memcpy( p.buf, "\r\n", 2 );
+	p.len = 2;
+	p.state = MP_PREAMBLE;
+
+	while ( p.state != MP_EPILOGUE )
+	{
+		n = MP_WINDOW_SIZE - p.len;
+		if ( n > p.remaining ) n = p.remaining;
+		if ( n > MP_CHUNK_SIZE ) n = MP_CHUNK_SIZE;
+
+		if ( n && fread( p.buf + p.len, 1, n, in ) != n )
+			break;
+		p.len += n;
+		p.remaining -= n;
+		eof = !p.remaining;
+
+		if ( mp_process( &p, eof ) ) break;
+		if ( eof && p.state != MP_EPILOGUE ) break;
+	}
+
+	/*	skip the epilogue	*/
+	while ( p.state == MP_EPILOGUE && p.remaining )
+	{
+		n = p.remaining < MP_WINDOW_SIZE ? p.remaining : MP_WINDOW_SIZE;
+		if ( fread( p.buf, 1, n, in ) != n ) break;
+		p.remaining -= n;
+	}
+
+	free( p.buf );
+	free( p.field );
+
+	return p.state == MP_EPILOGUE ? *req->form_start : NULL;
+}
+
+/*	***	public interface	***	*/
+
+void cgi_upload_tmpdir( const char *path )
+{
+	strncpy( upload_tmpdir, path, sizeof(upload_tmpdir) - 1 );
+}
+
+void cgi_upload_set_handler( cgi_upload_handler handler, void *arg )
+{
+	cgi_request_upload_set_handler( &cgi_default_request, handler, arg );
+}
+
+void cgi_request_upload_set_handler( cgi_request *req,
+		cgi_upload_handler handler, void *arg )
+{
+	req->upload_handler = handler;
+	req->upload_handler_arg = arg;
+}
+
+struct cgi_upload *cgi_upload_file( const char *name )
+{
+	return cgi_request_upload_file( &cgi_default_request, name );
+}
+
+struct cgi_upload *cgi_request_upload_file( cgi_request *req,
+		const char *name )
+{
+	struct cgi_upload *up;
+
+	for ( up = req->uploads_start; up && name; up = up->next )
+	{
+		if ( !strcasecmp( up->name, name ) ) return up;
+	}
+
+	return NULL;
+}
+
+struct cgi_upload *cgi_upload_list( void )
+{
+	return cgi_default_request.uploads_start;
+}
+
+struct cgi_upload *cgi_request_upload_list( cgi_request *req )
+{
+	return req->uploads_start;
+}
+
+int cgi_upload_save( const struct cgi_upload *upload, const char *path )
+{
+	char proc[32], buf[8192];
+	off_t off = 0;
+	ssize_t r, w, done;
+	int fd, ret = 0;
+
+	if ( !upload || upload->fd < 0 || !path ) return 0;
+
+	/*	works for O_TMPFILE files on the same filesystem	*/
+	snprintf( proc, sizeof(proc), "/proc/self/fd/%i", upload->fd );
+	if ( !linkat( AT_FDCWD, proc, AT_FDCWD, path, AT_SYMLINK_FOLLOW ) )
+		return 1;
+
+	fd = open( path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+			S_IRUSR | S_IWUSR );
+	if ( fd < 0 ) return 0;
+
+	while ( (r = pread( upload->fd, buf, sizeof(buf), off )) > 0 )
+	{
+		off += r;
+		for ( done = 0; done < r; done += w )
+		{
+			w = write( fd, buf + done, r - done );
+			if ( w < 0 ) goto out;
+		}
+	}
+	ret = (r == 0);
+
+out:
+	close( fd );
+	if ( !ret ) unlink( path );
+
+	return ret;
+}
+
+void cgi_uploads_free( struct cgi_request *req )
+{
+	struct cgi_upload *up;
+
+	for ( up = req->uploads_start; up; up = up->next )
+	{
+		if ( up->fd >= 0 ) close( up->fd );
+	}
+
+	/*	the list itself lives in request memory	*/
+	req->uploads_start = req->uploads_last = NULL;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,141 @@
+/*******************************************************************//**
+ *	@file		range.c
+ *
+ *	Byte ranges, RFC 7233: the Range header of a GET for a file of
+ *	known size, see cgi_send_file().
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+static const char *skip_ows( const char *p )
+{
+	while ( *p == ' ' || *p == '\t' ) p++;
+
+	return p;
+}
+
+/*	digits only, strtoull() would take signs and spaces, too large
+ *	numbers end up as ULLONG_MAX	*/
+static const char *parse_pos( const char *p, unsigned long long *value )
+{
+	char *end;
+
+	if ( *p < '0' || *p > '9' ) return NULL;
+
+	*value = strtoull( p, &end, 10 );
+
+	return end;
+}
+
+int cgi_range_parse( const char *header, unsigned long long size,
+		struct cgi_range *ranges, int max )
+{
+	unsigned long long first, last;
+	struct cgi_range tmp;
+	const char *p, *q;
+	int n = 0, specs = 0, i, j;
+
+	p = skip_ows( header );
+	if ( strncasecmp( p, "bytes=", 6 ) ) return 0;
+
+	for ( p += 6; *p; )
+	{
+		p = skip_ows( p );
+		if ( !*p ) break;
+		if ( *p == ',' )
+		{
+			p++;
+			continue;
+		}
+
+		if ( *p == '-' )
+		{
+			/*	the last bytes	*/
+			if ( !(p = parse_pos( p + 1, &last )) ) return 0;
+			first = size > last ? size - last : 0;
+			last = size - 1;
+			specs++;
+			if ( !size || first > last ) goto next;
+		}
+		else
+		{
+			if ( !(p = parse_pos( p, &first )) || *p++ != '-' ) return 0;
+			if ( (q = parse_pos( p, &last )) )
+				p = q;
+			else
+				last = ULLONG_MAX;
+			if ( last < first ) return 0;
+			specs++;
+			if ( first >= size ) goto next;
+			if ( last >= size ) last = size - 1;
+		}
+
+		/*	too many to be sensible, the whole file is cheaper	*/
+		if ( n == max ) return 0;
+		ranges[n].first = first;
+		ranges[n].last = last;
+		n++;
+
+next:
+		p = skip_ows( p );
+		if ( *p && *p++ != ',' ) return 0;
+	}
+
+	if ( !specs ) return 0;
+	if ( !n ) return -1;
+
+	/*	sorted, overlapping and adjacent ranges in one	*/
+	for ( i = 1; i < n; i++ )
+	{
+		tmp = ranges[i];
+		for ( j = i; j > 0 && ranges[j - 1].first > tmp.first; j-- )
+			ranges[j] = ranges[j - 1];
+		ranges[j] = tmp;
+	}
+
+	for ( i = 0, j = 1; j < n; j++ )
+	{
+		if ( ranges[j].first <= ranges[i].last + 1 )
+		{
+			if ( ranges[j].last > ranges[i].last )
+				ranges[i].last = ranges[j].last;
+		}
+		else
+		{
+			ranges[++i] = ranges[j];
+		}
+	}
+
+	return i + 1;
+}
+
+int cgi_range_request( struct cgi_request *req, const char *etag,
+		time_t mtime, unsigned long long size, struct cgi_range *ranges )
+{
+	const char *method, *header;
+
+	method = cgi_request_getenv( req, "REQUEST_METHOD" );
+	if ( !method || strcmp( method, "GET" ) ) return 0;
+
+	if ( !(header = cgi_request_getenv( req, "HTTP_RANGE" ))
+			|| !cgi_if_range( req, etag, mtime ) )
+		return 0;
+
+	return cgi_range_parse( header, size, ranges, CGI_RANGE_MAX );
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,119 @@
+/*******************************************************************//**
+ *	@file		request.c
+ *
+ *	Request contexts, see libcgi/request.h.  The functions working on
+ *	the request data live with their classic counterparts, here are
+ *	creation, streams and the per request environment.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/error.h"
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+/*	lists of the default request are the public globals	*/
+struct cgi_request cgi_default_request = {
+	.arena			= &request_arena,
+	.form_start		= &formvars_start,
+	.form_last		= &formvars_last,
+	.cookies_start	= &cookies_start,
+	.cookies_last	= &cookies_last,
+	.sess_start		= &sess_list_start,
+	.sess_last		= &sess_list_last,
+};
+
+cgi_request *cgi_request_new( void )
+{
+	struct cgi_request *req;
+
+	req = calloc( 1, sizeof(struct cgi_request) );
+	if ( !req )
+	{
+		libcgi_error( E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+		return NULL;
+	}
+
+	req->arena = &req->own_arena;
+	req->form_start = &req->own_lists[0];
+	req->form_last = &req->own_lists[1];
+	req->cookies_start = &req->own_lists[2];
+	req->cookies_last = &req->own_lists[3];
+	req->sess_start = &req->own_lists[4];
+	req->sess_last = &req->own_lists[5];
+
+	return req;
+}
+
+void cgi_request_free( cgi_request *req )
+{
+	if ( !req ) return;
+
+	cgi_request_end( req );
+	if ( req == &cgi_default_request ) return;
+
+	cgi_arena_destroy( &req->own_arena );
+	free( req );
+}
+
+cgi_request *cgi_request_default( void )
+{
+	return &cgi_default_request;
+}
+
+void cgi_request_set_input( cgi_request *req, FILE *in )
+{
+	req->in = in;
+}
+
+void cgi_request_set_output( cgi_request *req, FILE *out )
+{
+	req->out = out;
+}
+
+void cgi_request_setenv( cgi_request *req, const char *name,
+		const char *value )
+{
+	formvars *item;
+
+	/*	the old value stays in request memory until cgi_request_end()	*/
+	for ( item = req->env_start; item; item = item->next )
+	{
+		if ( !strcmp( item->name, name ) ) break;
+	}
+
+	if ( !item )
+	{
+		item = cgi_arena_formvar( req->arena );
+		item->name = cgi_arena_strndup( req->arena, name, strlen( name ) );
+		slist_add( item, &req->env_start, &req->env_last );
+	}
+
+	item->value = cgi_arena_strndup( req->arena, value, strlen( value ) );
+}
+
+const char *cgi_request_getenv( cgi_request *req, const char *name )
+{
+	formvars *item;
+
+	if ( !req->env_start ) return getenv( name );
+
+	for ( item = req->env_start; item; item = item->next )
+	{
+		if ( !strcmp( item->name, name ) ) return item->value;
+	}
+
+	return NULL;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,565 @@
+/*******************************************************************//**
+ *	@file		response.c
+ *
+ *	Buffered responses, see cgi_response_buffer().  Headers stay in the
+ *	request's header table, see header.c, the body is a list of
+ *	segments: small writes are copied into blocks and merged with the
+ *	segment before them, data passed with cgi_write_ref() and included
+ *	files are referenced where they are.  cgi_end() sends everything
+ *	with writev() behind an exact Content-Length header, gzip compressed
+ *	if cgi_compress() says so, or only the headers with 304 Not Modified
+ *	if the client has the body.
+ *
+ *	Included files stay mapped until cgi_end() hashes, compresses and
+ *	sends them.  A file truncated meanwhile raises SIGBUS there, which is
+ *	documented with cgi_response_buffer() rather than caught.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/error.h"
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX					1024
+#endif
+
+#define RESPONSE_BLOCK_SIZE		16384
+
+/*	iov[0] are the headers and the empty line	*/
+#define RESPONSE_HEAD_IOV		1
+
+/*	copies of small writes	*/
+struct cgi_response_block {
+	struct cgi_response_block	*next;
+	size_t						size;
+	size_t						used;
+	char						data[];
+};
+
+/*	mapped files, see cgi_response_include()	*/
+struct cgi_response_map {
+	struct cgi_response_map		*next;
+	void						*addr;
+	size_t						len;
+	size_t						iov;	/**< its segment	*/
+	struct cgi_gz_member		gz;		/**< precompressed sibling, data NULL if none	*/
+};
+
+/*	***	body segments	***	*/
+
+/*	the request a response belongs to	*/
+static struct cgi_request *response_req( struct cgi_response *r )
+{
+	return (struct cgi_request *) ((char *) r
+			- offsetof(struct cgi_request, response));
+}
+
+static int response_ref( struct cgi_response *r, const void *data,
+		size_t len )
+{
+	struct iovec *iov;
+	size_t size;
+
+	if ( r->iov_count == r->iov_size )
+	{
+		size = r->iov_size * 2;
+		iov = realloc( r->iov, size * sizeof(struct iovec) );
+		if ( !iov )
+		{
+			cgi_request_error( response_req( r ), E_MEMORY, "%s, line %i",
+					__FILE__, __LINE__ );
+			return 0;
+		}
+		r->iov = iov;
+		r->iov_size = size;
+	}
+
+	r->iov[r->iov_count].iov_base = (void *) data;
+	r->iov[r->iov_count].iov_len = len;
+	r->iov_count++;
+	r->length += len;
+
+	return 1;
+}
+
+static int response_copy( struct cgi_response *r, const void *data,
+		size_t len )
+{
+	struct cgi_response_block *block = r->blocks;
+	struct iovec *last;
+	char *p;
+	size_t size;
+
+	if ( !len ) return 1;
+
+	if ( !block || block->size - block->used < len )
+	{
+		size = len > RESPONSE_BLOCK_SIZE ? len : RESPONSE_BLOCK_SIZE;
+		block = malloc( sizeof(struct cgi_response_block) + size );
+		if ( !block )
+		{
+			cgi_request_error( response_req( r ), E_MEMORY, "%s, line %i",
+					__FILE__, __LINE__ );
+			return 0;
+		}
+		block->size = size;
+		block->used = 0;
+		block->next = r->blocks;
+		r->blocks = block;
+	}
+
+	p = block->data + block->used;
+	memcpy( p, data, len );
+	block->used += len;
+
+	/*	consecutive copies end up in one segment	*/
+	last = &r->iov[r->iov_count - 1];
+	if ( r->iov_count > RESPONSE_HEAD_IOV
+			&& (char *) last->iov_base + last->iov_len == p )
+	{
+		last->iov_len += len;
+		r->length += len;
+		return 1;
+	}
+
+	return response_ref( r, p, len );
+}
+
+/*	***	stdout capture of the default request	***	*/
+
+static ssize_t response_capture_write( void *cookie, const char *buf,
+		size_t size )
+{
+	return response_copy( cookie, buf, size ) ? (ssize_t) size : -1;
+}
+
+#if !defined(__GLIBC__)
+static int response_funopen_write( void *cookie, const char *buf, int size )
+{
+	return response_capture_write( cookie, buf, size );
+}
+#endif
+
+static FILE *response_capture_open( struct cgi_response *r )
+{
+#if defined(__GLIBC__)
+	cookie_io_functions_t io = {
+		.read	= NULL,
+		.write	= response_capture_write,
+		.seek	= NULL,
+		.close	= NULL,
+	};
+
+	return fopencookie( r, "w", io );
+#else
+	return funopen( r, NULL, response_funopen_write, NULL, NULL );
+#endif
+}
+
+/*	keep the order of captured output and direct writes	*/
+static inline void response_sync( struct cgi_response *r )
+{
+	if ( r->capture ) fflush( r->capture );
+}
+
+/*	***	flush	***	*/
+
+static int response_writev( int fd, struct iovec *iov, size_t count )
+{
+	ssize_t n;
+
+	while ( count )
+	{
+		n = writev( fd, iov, count > IOV_MAX ? IOV_MAX : count );
+		if ( n < 0 )
+		{
+			if ( errno == EINTR ) continue;
+			return -1;
+		}
+
+		for ( ; count && (size_t) n >= iov->iov_len; iov++, count-- )
+			n -= iov->iov_len;
+
+		if ( count )
+		{
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static int response_fwrite( FILE *out, struct iovec *iov, size_t count )
+{
+	for ( ; count; iov++, count-- )
+	{
+		if ( fwrite( iov->iov_base, 1, iov->iov_len, out ) != iov->iov_len )
+			return -1;
+	}
+
+	return fflush( out );
+}
+
+/*	body segments through gzip, included files with a .gz are not
+ *	compressed again	*/
+static unsigned char *response_compress( struct cgi_response *r,
+		size_t *len )
+{
+	const struct cgi_gz_member **members;
+	struct cgi_response_map *map;
+	unsigned char *gz;
+
+	members = calloc( r->iov_count, sizeof(struct cgi_gz_member *) );
+	if ( !members ) return NULL;
+
+	for ( map = r->maps; map; map = map->next )
+	{
+		if ( map->gz.data ) members[map->iov] = &map->gz;
+	}
+
+	gz = cgi_compress_iov( r->iov + RESPONSE_HEAD_IOV,
+			r->iov_count - RESPONSE_HEAD_IOV, members + RESPONSE_HEAD_IOV, len );
+	free( members );
+
+	return gz;
+}
+
+/*	ETag of the body as it is written, 64 bits of checksums and the
+ *	length, cheaper than a cryptographic hash	*/
+static void response_hash( struct cgi_response *r, const char *suffix,
+		char *etag, size_t size )
+{
+	uLong crc = crc32( 0L, Z_NULL, 0 ), adler = adler32( 0L, Z_NULL, 0 );
+	const unsigned char *p;
+	size_t i, len, n;
+
+	for ( i = RESPONSE_HEAD_IOV; i < r->iov_count; i++ )
+	{
+		p = r->iov[i].iov_base;
+		for ( len = r->iov[i].iov_len; len; len -= n, p += n )
+		{
+			n = len > UINT_MAX ? UINT_MAX : len;
+			crc = crc32( crc, p, n );
+			adler = adler32( adler, p, n );
+		}
+	}
+
+	snprintf( etag, size, "\"%lx-%08lx%08lx%s\"", (unsigned long) r->length,
+			(unsigned long) crc, (unsigned long) adler, suffix );
+}
+
+/*	ETag header and the If-None-Match check for generated bodies, the
+ *	gzip representation has its own tag	*/
+static int response_not_modified( struct cgi_request *req, int gzip )
+{
+	struct cgi_response *r = &req->response;
+	char tag[64];
+
+	if ( r->not_modified ) return 1;
+
+	/*	a redirect or an error of the program	*/
+	if ( !r->etag_body || cgi_header_get( req, "Status" )
+			|| cgi_header_get( req, "Location" ) )
+		return 0;
+
+	response_hash( r, gzip ? "-gz" : "", tag, sizeof(tag) );
+	cgi_header_set( req, "ETag", "%s", tag );
+
+	if ( !cgi_not_modified( req, tag, (time_t) -1 ) ) return 0;
+
+	cgi_header_set( req, "Status", "304 Not Modified" );
+
+	return 1;
+}
+
+static int response_flush( struct cgi_request *req )
+{
+	struct cgi_response *r = &req->response;
+	unsigned char *gz = NULL;
+	char *head;
+	size_t gz_len, head_len;
+	int fd, ret, gzip, not_modified;
+
+	gzip = !r->identity && cgi_compress_accepted( req, r->length );
+	not_modified = response_not_modified( req, gzip );
+
+	/*	a body needs a type, cgi_init_headers() may not have been called	*/
+	if ( r->length && !not_modified && !cgi_header_get( req, "Content-type" ) )
+		cgi_header_set( req, "Content-type", "text/html" );
+
+	if ( cgi_compress_enabled() )
+		cgi_header_set( req, "Vary", "Accept-Encoding" );
+
+	/*	the whole body is known, compress it in one go	*/
+	if ( not_modified )
+	{
+		r->iov_count = RESPONSE_HEAD_IOV;
+	}
+	else if ( gzip && (gz = response_compress( r, &gz_len )) )
+	{
+		cgi_header_set( req, "Content-Encoding", "gzip" );
+		r->iov[RESPONSE_HEAD_IOV].iov_base = gz;
+		r->iov[RESPONSE_HEAD_IOV].iov_len = gz_len;
+		r->iov_count = RESPONSE_HEAD_IOV + 1;
+		r->length = gz_len;
+	}
+	if ( !not_modified )
+		cgi_header_set( req, "Content-Length", "%lu",
+				(unsigned long) r->length );
+
+	req->headers_initialized = 1;
+	if ( !(head = cgi_headers_serialize( req, &head_len )) )
+	{
+		free( gz );
+		return -1;
+	}
+	r->iov[0].iov_base = head;
+	r->iov[0].iov_len = head_len;
+
+	fflush( r->target );
+	fd = fileno( r->target );
+
+	if ( fd >= 0 )
+		ret = response_writev( fd, r->iov, r->iov_count );
+	else
+		ret = response_fwrite( r->target, r->iov, r->iov_count );
+
+	free( head );
+	free( gz );
+
+	return ret;
+}
+
+void cgi_response_end( struct cgi_request *req )
+{
+	struct cgi_response *r = &req->response;
+	struct cgi_response_block *block;
+	struct cgi_response_map *map;
+
+	if ( !r->buffered ) return;
+
+	if ( r->capture )
+	{
+		fflush( r->capture );
+		stdout = r->saved_stdout;
+		fclose( r->capture );
+	}
+
+	if ( response_flush( req ) )
+	{
+		cgi_request_error( req, E_WARNING, "%s: write failed: %s",
+				__FUNCTION__, strerror( errno ) );
+	}
+
+	free( r->iov );
+
+	while ( (block = r->blocks) )
+	{
+		r->blocks = block->next;
+		free( block );
+	}
+
+	while ( (map = r->maps) )
+	{
+		r->maps = map->next;
+		munmap( map->addr, map->len );
+		cgi_compress_sibling_free( &map->gz );
+		free( map );
+	}
+
+	memset( r, 0, sizeof(*r) );
+}
+
+/*	maps the file, it must keep its size until cgi_end()	*/
+int cgi_response_include( struct cgi_request *req, const char *path, int fd,
+		const struct stat *st, unsigned long long off, size_t len )
+{
+	struct cgi_response *r = &req->response;
+	struct cgi_response_map *map;
+	size_t skip;
+	void *addr;
+
+	if ( !r->buffered ) return 0;
+	if ( !len ) return 1;
+
+	if ( !(map = calloc( 1, sizeof(struct cgi_response_map) )) ) return 0;
+
+	/*	only the pages of a byte range	*/
+	skip = off % sysconf( _SC_PAGESIZE );
+	addr = mmap( NULL, len + skip, PROT_READ, MAP_PRIVATE, fd,
+			(off_t) (off - skip) );
+	if ( addr == MAP_FAILED )
+	{
+		free( map );
+		return 0;
+	}
+
+	/*	the .gz is used if the response ends up compressed	*/
+	if ( path && !off && len == (size_t) st->st_size
+			&& cgi_compress_accepted( req, (size_t) -1 ) )
+		cgi_compress_sibling( path, st, &map->gz );
+
+	map->addr = addr;
+	map->len = len + skip;
+	map->next = r->maps;
+	r->maps = map;
+
+	response_sync( r );
+	map->iov = r->iov_count;
+
+	return response_ref( r, (char *) addr + skip, len );
+}
+
+/*	***	public API	***	*/
+
+int cgi_response_buffer( void )
+{
+	return cgi_request_response_buffer( &cgi_default_request );
+}
+
+int cgi_request_response_buffer( cgi_request *req )
+{
+	struct cgi_response *r = &req->response;
+
+	if ( r->buffered ) return 1;
+
+	if ( req->headers_initialized )
+	{
+		cgi_request_error( req, E_WARNING, "%s: headers already sent",
+				__FUNCTION__ );
+		return 0;
+	}
+
+	if ( !(r->iov = malloc( 64 * sizeof(struct iovec) )) ) goto err;
+
+	r->buffered = 1;
+	r->iov_size = 64;
+	r->iov_count = RESPONSE_HEAD_IOV;
+	r->target = cgi_request_out( req );
+
+	/*	catch puts(), printf() and friends of the program	*/
+	if ( req == &cgi_default_request )
+	{
+		if ( !(r->capture = response_capture_open( r )) ) goto err;
+		fflush( stdout );
+		r->saved_stdout = stdout;
+		stdout = r->capture;
+	}
+
+	return 1;
+
+err:
+	cgi_request_error( req, E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+	free( r->iov );
+	memset( r, 0, sizeof(*r) );
+	return 0;
+}
+
+int cgi_response_etag( void )
+{
+	return cgi_request_response_etag( &cgi_default_request );
+}
+
+int cgi_request_response_etag( cgi_request *req )
+{
+	if ( !req->response.buffered )
+	{
+		cgi_request_error( req, E_WARNING, "%s: response not buffered",
+				__FUNCTION__ );
+		return 0;
+	}
+
+	req->response.etag_body = 1;
+
+	return 1;
+}
+
+int cgi_write( const void *data, size_t len )
+{
+	return cgi_request_write( &cgi_default_request, data, len );
+}
+
+int cgi_request_write( cgi_request *req, const void *data, size_t len )
+{
+	struct cgi_response *r = &req->response;
+
+	if ( !r->buffered )
+		return fwrite( data, 1, len, cgi_request_out( req ) ) == len;
+
+	response_sync( r );
+
+	return response_copy( r, data, len );
+}
+
+int cgi_write_ref( const void *data, size_t len )
+{
+	return cgi_request_write_ref( &cgi_default_request, data, len );
+}
+
+int cgi_request_write_ref( cgi_request *req, const void *data, size_t len )
+{
+	struct cgi_response *r = &req->response;
+
+	if ( !r->buffered )
+		return fwrite( data, 1, len, cgi_request_out( req ) ) == len;
+
+	if ( !len ) return 1;
+
+	response_sync( r );
+
+	return response_ref( r, data, len );
+}
+
+int cgi_write_html_escaped( const char *s, size_t len )
+{
+	return cgi_request_write_html_escaped( &cgi_default_request, s, len );
+}
+
+/*	runs without special characters in one piece	*/
+int cgi_request_write_html_escaped( cgi_request *req, const char *s,
+		size_t len )
+{
+	const char *end = s + len;
+	unsigned char c;
+	size_t n;
+
+	while ( s < end )
+	{
+		n = cgi_scan_html_special( s, end - s );
+		if ( n && !cgi_request_write( req, s, n ) ) return 0;
+		if ( (s += n) == end ) break;
+
+		c = cgi_html_class[(unsigned char) *s++];
+		if ( !cgi_request_write( req, cgi_html_entity[c],
+				cgi_html_entity_len[c] ) )
+			return 0;
+	}
+
+	return 1;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
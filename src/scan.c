@@ -0,0 +1,447 @@
+/*******************************************************************//**
+ *	@file		scan.c
+ *
+ *	Vectorized scanners for the string functions.  Each scanner finds
+ *	the next byte that needs work, so callers can copy everything in
+ *	between at once.  On x86 SSE2 is the baseline, AVX2 is used when
+ *	the CPU has it, other targets get the plain loop.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+
+#include "internal.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) \
+		&& (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86	1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*scan_fn)( const char *s, size_t len );
+
+/*	cgi_escape_special_chars() class of every byte	*/
+const unsigned char cgi_url_class[256] = {
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	1, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 0, 0, 2,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 2, 2,		2, 2, 2, 2,
+	2, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 2,		2, 2, 2, 0,
+	2, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2,
+	2, 2, 2, 2,		2, 2, 2, 2
+};
+
+/*	htmlentities() replacements, cgi_html_class[] indexes them	*/
+const char *const cgi_html_entity[13] = {
+	NULL, "&lt;", "&gt;", "&amp;", "&quot;",
+	"&auml;", "&Auml;", "&ouml;", "&Ouml;", "&uuml;", "&Uuml;", "&szlig;",
+	"&euro;"
+};
+
+const unsigned char cgi_html_entity_len[13] = {
+	0, 4, 4, 5, 6,		6, 6, 6, 6, 6, 6, 7,	6
+};
+
+const unsigned char cgi_html_class[256] = {
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 4, 0,		0, 0, 3, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		1, 0, 2, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		12, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		6, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 8, 0,
+	0, 0, 0, 0,		10, 0, 0, 11,
+	0, 0, 0, 0,		5, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 0, 0,
+	0, 0, 0, 0,		0, 0, 7, 0,
+	0, 0, 0, 0,		9, 0, 0, 0
+};
+
+/*	***	'%' and '+'	***	*/
+
+static size_t scan_url_scalar( const char *s, size_t len )
+{
+	size_t i;
+
+	for ( i = 0; i < len && s[i] != '%' && s[i] != '+'; i++ );
+
+	return i;
+}
+
+#ifdef SCAN_X86
+static size_t scan_url_sse2( const char *s, size_t len )
+{
+	const __m128i pct = _mm_set1_epi8( '%' ), plus = _mm_set1_epi8( '+' );
+	__m128i v;
+	unsigned int mask;
+	size_t i;
+
+	for ( i = 0; i + 16 <= len; i += 16 )
+	{
+		v = _mm_loadu_si128( (const __m128i *) (s + i) );
+		mask = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( v, pct ),
+				_mm_cmpeq_epi8( v, plus ) ) );
+		if ( mask ) return i + __builtin_ctz( mask );
+	}
+
+	return i + scan_url_scalar( s + i, len - i );
+}
+
+__attribute__((target("avx2")))
+static size_t scan_url_avx2( const char *s, size_t len )
+{
+	const __m256i pct = _mm256_set1_epi8( '%' ), plus = _mm256_set1_epi8( '+' );
+	__m256i v;
+	unsigned int mask;
+	size_t i;
+
+	for ( i = 0; i + 32 <= len; i += 32 )
+	{
+		v = _mm256_loadu_si256( (const __m256i *) (s + i) );
+		mask = _mm256_movemask_epi8( _mm256_or_si256(
+				_mm256_cmpeq_epi8( v, pct ), _mm256_cmpeq_epi8( v, plus ) ) );
+		if ( mask ) return i + __builtin_ctz( mask );
+	}
+
+	return i + scan_url_sse2( s + i, len - i );
+}
+#endif
+
+/*	***	bytes cgi_escape_special_chars() changes	***	*/
+
+/*	offset of the first byte not kept as is	*/
+static size_t scan_url_unsafe_scalar( const char *s, size_t len )
+{
+	size_t i;
+
+	for ( i = 0; i < len && !cgi_url_class[(unsigned char) s[i]]; i++ );
+
+	return i;
+}
+
+/*	number of bytes that become %XX	*/
+static size_t count_url_escapes_scalar( const char *s, size_t len )
+{
+	size_t i, n = 0;
+
+	for ( i = 0; i < len; i++ )
+		n += cgi_url_class[(unsigned char) s[i]] >> 1;
+
+	return n;
+}
+
+#ifdef SCAN_X86
+/*	0xFF for [0-9A-Za-z_.-], signed compares leave bytes >= 0x80 out	*/
+static inline __m128i url_safe_sse2( __m128i v )
+{
+	const __m128i lower = _mm_or_si128( v, _mm_set1_epi8( 0x20 ) );
+	__m128i digit, alpha, punct;
+
+	digit = _mm_and_si128( _mm_cmpgt_epi8( v, _mm_set1_epi8( '0' - 1 ) ),
+			_mm_cmpgt_epi8( _mm_set1_epi8( '9' + 1 ), v ) );
+	alpha = _mm_and_si128( _mm_cmpgt_epi8( lower, _mm_set1_epi8( 'a' - 1 ) ),
+			_mm_cmpgt_epi8( _mm_set1_epi8( 'z' + 1 ), lower ) );
+	punct = _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '_' ) ),
+			_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '-' ) ),
+				_mm_cmpeq_epi8( v, _mm_set1_epi8( '.' ) ) ) );
+
+	return _mm_or_si128( _mm_or_si128( digit, alpha ), punct );
+}
+
+static size_t scan_url_unsafe_sse2( const char *s, size_t len )
+{
+	unsigned int mask;
+	size_t i;
+
+	for ( i = 0; i + 16 <= len; i += 16 )
+	{
+		mask = ~_mm_movemask_epi8( url_safe_sse2(
+				_mm_loadu_si128( (const __m128i *) (s + i) ) ) ) & 0xFFFF;
+		if ( mask ) return i + __builtin_ctz( mask );
+	}
+
+	return i + scan_url_unsafe_scalar( s + i, len - i );
+}
+
+static size_t count_url_escapes_sse2( const char *s, size_t len )
+{
+	const __m128i space = _mm_set1_epi8( ' ' );
+	__m128i v;
+	size_t i, n = 0;
+
+	for ( i = 0; i + 16 <= len; i += 16 )
+	{
+		v = _mm_loadu_si128( (const __m128i *) (s + i) );
+		n += __builtin_popcount( ~_mm_movemask_epi8( _mm_or_si128(
+				url_safe_sse2( v ), _mm_cmpeq_epi8( v, space ) ) ) & 0xFFFF );
+	}
+
+	return n + count_url_escapes_scalar( s + i, len - i );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i url_safe_avx2( __m256i v )
+{
+	const __m256i lower = _mm256_or_si256( v, _mm256_set1_epi8( 0x20 ) );
+	__m256i digit, alpha, punct;
+
+	digit = _mm256_and_si256( _mm256_cmpgt_epi8( v, _mm256_set1_epi8( '0' - 1 ) ),
+			_mm256_cmpgt_epi8( _mm256_set1_epi8( '9' + 1 ), v ) );
+	alpha = _mm256_and_si256(
+			_mm256_cmpgt_epi8( lower, _mm256_set1_epi8( 'a' - 1 ) ),
+			_mm256_cmpgt_epi8( _mm256_set1_epi8( 'z' + 1 ), lower ) );
+	punct = _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '_' ) ),
+			_mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '-' ) ),
+				_mm256_cmpeq_epi8( v, _mm256_set1_epi8( '.' ) ) ) );
+
+	return _mm256_or_si256( _mm256_or_si256( digit, alpha ), punct );
+}
+
+__attribute__((target("avx2")))
+static size_t scan_url_unsafe_avx2( const char *s, size_t len )
+{
+	unsigned int mask;
+	size_t i;
+
+	for ( i = 0; i + 32 <= len; i += 32 )
+	{
+		mask = ~_mm256_movemask_epi8( url_safe_avx2(
+				_mm256_loadu_si256( (const __m256i *) (s + i) ) ) );
+		if ( mask ) return i + __builtin_ctz( mask );
+	}
+
+	return i + scan_url_unsafe_sse2( s + i, len - i );
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_url_escapes_avx2( const char *s, size_t len )
+{
+	const __m256i space = _mm256_set1_epi8( ' ' );
+	__m256i v;
+	size_t i, n = 0;
+
+	for ( i = 0; i + 32 <= len; i += 32 )
+	{
+		v = _mm256_loadu_si256( (const __m256i *) (s + i) );
+		n += __builtin_popcount( ~_mm256_movemask_epi8( _mm256_or_si256(
+				url_safe_avx2( v ), _mm256_cmpeq_epi8( v, space ) ) ) );
+	}
+
+	return n + count_url_escapes_sse2( s + i, len - i );
+}
+#endif
+
+/*	***	bytes htmlentities() replaces	***	*/
+
+static size_t scan_html_scalar( const char *s, size_t len )
+{
+	size_t i;
+
+	for ( i = 0; i < len && !cgi_html_class[(unsigned char) s[i]]; i++ );
+
+	return i;
+}
+
+#ifdef SCAN_X86
+/*	one compare per byte of cgi_html_entity[], bytes >= 0x80 only if
+ *	there are any	*/
+static size_t scan_html_sse2( const char *s, size_t len )
+{
+	__m128i v, m, high;
+	unsigned int mask;
+	size_t i;
+
+	for ( i = 0; i + 16 <= len; i += 16 )
+	{
+		v = _mm_loadu_si128( (const __m128i *) (s + i) );
+		m = _mm_or_si128(
+				_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '<' ) ),
+					_mm_cmpeq_epi8( v, _mm_set1_epi8( '>' ) ) ),
+				_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '&' ) ),
+					_mm_cmpeq_epi8( v, _mm_set1_epi8( '"' ) ) ) );
+
+		if ( _mm_movemask_epi8( v ) )
+		{
+			high = _mm_or_si128(
+					_mm_or_si128(
+						_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xE4 ) ),
+							_mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xC4 ) ) ),
+						_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xF6 ) ),
+							_mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xD6 ) ) ) ),
+					_mm_or_si128(
+						_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xFC ) ),
+							_mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xDC ) ) ),
+						_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xDF ) ),
+							_mm_cmpeq_epi8( v, _mm_set1_epi8( (char) 0xA4 ) ) ) ) );
+			m = _mm_or_si128( m, high );
+		}
+
+		if ( (mask = _mm_movemask_epi8( m )) ) return i + __builtin_ctz( mask );
+	}
+
+	return i + scan_html_scalar( s + i, len - i );
+}
+
+/*	nibble lookup: every high nibble of a byte with an entity has a
+ *	bit, lo_tab[] has the bits of the high nibbles that make one with
+ *	the low nibble	*/
+__attribute__((target("avx2")))
+static size_t scan_html_avx2( const char *s, size_t len )
+{
+	const __m256i lo_tab = _mm256_setr_epi8(
+			0x00, 0x00, 0x01, 0x00, 0x2C, 0x00, 0x51, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x52, 0x00, 0x02, 0x10,
+			0x00, 0x00, 0x01, 0x00, 0x2C, 0x00, 0x51, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x52, 0x00, 0x02, 0x10 );
+	const __m256i hi_tab = _mm256_setr_epi8(
+			0x00, 0x00, 0x01, 0x02, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x04, 0x00, 0x08, 0x10, 0x20, 0x40,
+			0x00, 0x00, 0x01, 0x02, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x04, 0x00, 0x08, 0x10, 0x20, 0x40 );
+	const __m256i nibble = _mm256_set1_epi8( 0x0F );
+	__m256i v, hit;
+	unsigned int mask;
+	size_t i;
+
+	for ( i = 0; i + 32 <= len; i += 32 )
+	{
+		v = _mm256_loadu_si256( (const __m256i *) (s + i) );
+		hit = _mm256_and_si256(
+				_mm256_shuffle_epi8( lo_tab, _mm256_and_si256( v, nibble ) ),
+				_mm256_shuffle_epi8( hi_tab, _mm256_and_si256(
+					_mm256_srli_epi16( v, 4 ), nibble ) ) );
+		mask = ~_mm256_movemask_epi8( _mm256_cmpeq_epi8( hit,
+				_mm256_setzero_si256() ) );
+		if ( mask ) return i + __builtin_ctz( mask );
+	}
+
+	return i + scan_html_sse2( s + i, len - i );
+}
+#endif
+
+/*	***	dispatch	***	*/
+
+struct scan_ops {
+	scan_fn		url_special;
+	scan_fn		url_unsafe;
+	scan_fn		url_escapes;
+	scan_fn		html_special;
+};
+
+static const struct scan_ops scan_levels[] = {
+	{ scan_url_scalar, scan_url_unsafe_scalar, count_url_escapes_scalar,
+		scan_html_scalar },
+#ifdef SCAN_X86
+	{ scan_url_sse2, scan_url_unsafe_sse2, count_url_escapes_sse2,
+		scan_html_sse2 },
+	{ scan_url_avx2, scan_url_unsafe_avx2, count_url_escapes_avx2,
+		scan_html_avx2 },
+#endif
+};
+
+/*	set once on first use, concurrent requests may race to do it	*/
+static const struct scan_ops *scan = NULL;
+
+static int scan_cpu_level( void )
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) ) return CGI_SCAN_AVX2;
+
+	return CGI_SCAN_SSE2;
+#else
+	return CGI_SCAN_SCALAR;
+#endif
+}
+
+int cgi_scan_set_level( int level )
+{
+	int max = scan_cpu_level();
+
+	if ( level < 0 || level > max ) level = max;
+
+	__atomic_store_n( &scan, &scan_levels[level], __ATOMIC_RELEASE );
+
+	return level;
+}
+
+static inline const struct scan_ops *scan_ops( void )
+{
+	const struct scan_ops *ops = __atomic_load_n( &scan, __ATOMIC_ACQUIRE );
+
+	if ( !ops )
+		ops = &scan_levels[cgi_scan_set_level( -1 )];
+
+	return ops;
+}
+
+size_t cgi_scan_url_special( const char *s, size_t len )
+{
+	return scan_ops()->url_special( s, len );
+}
+
+size_t cgi_scan_url_unsafe( const char *s, size_t len )
+{
+	return scan_ops()->url_unsafe( s, len );
+}
+
+size_t cgi_count_url_escapes( const char *s, size_t len )
+{
+	return scan_ops()->url_escapes( s, len );
+}
+
+size_t cgi_scan_html_special( const char *s, size_t len )
+{
+	return scan_ops()->html_special( s, len );
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -47,33 +47,40 @@
 #include "libcgi/session.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "libcgi/cgi.h"
 #include "libcgi/cgi_types.h"
 #include "libcgi/error.h"
 
-// session id length
-#define SESS_ID_LEN 45
+#include "internal.h"
 
-// File pointer to session file in the server
-FILE *sess_file;
-
-static char sess_id[SESS_ID_LEN + 1];
-static char *sess_fname = NULL;
-static unsigned int save_path_len;
+// Session files start with a header of SESS_FILE_HEAD bytes: NUL and
+// "CGS", the version, three reserved bytes, the number of records and
+// the CRC-32 of the records. A record is the length of the name and of
+// the value, then name and value, each with a NUL, so the variables can
+// point into the mapped file. Numbers are 32 bit little endian. Files
+// of older versions are "name=value;name=value" text, which never
+// started with a NUL
+#define SESS_FILE_MAGIC		"\0CGS"
+#define SESS_FILE_VERSION	1
+#define SESS_FILE_HEAD		16
 
 char SESSION_SAVE_PATH[255] = "/tmp/";
 char SESSION_COOKIE_NAME[50] = "CGISID";
 
-bool sess_initialized = false;
 int session_lasterror = 0;
 
 // We can use this variable to get the error message from a ( possible ) session error
@@ -91,79 +98,160 @@ const char *session_error_message[] = {
  	"Session variable already registered",
  	"Session variable not registered",
  	"Failed to open session file for manipulation",
- 	"Invalid argument"
+ 	"Invalid argument",
+ 	"No key to sign session cookies",
+ 	"Session too large for a cookie"
 };
 
-
-// cgi.c
-extern int headers_initialized;
-extern void libcgi_error(int error_code, const char *msg, ...);
-extern formvars *process_data(const char *query, formvars **start, formvars **last,
-                              const char sep_value, const char sep_name);
-
-// Error types
-typedef enum SESS_ERROR {
-	SESS_NOT_INITIALIZED,
-	SESS_FILE_NOT_INITIALIZED,
-	SESS_HEADERS_SENT,
-	SESS_STARTED,
-	SESS_CREATE_FILE,
-	SESS_DELETE_FILE,
-	SESS_DESTROY,
-	SESS_REMOVE_FROM_LIST,
-	SESS_VAR_REGISTERED,
-	SESS_VAR_NOT_REGISTERED,
-	SESS_OPEN_FILE,
-	SESS_EINVAL
-} sess_error;
-
 // This variables are used to control the linked list of all
 // session objects. Most of time you don't need to use them
 // directly
 formvars *sess_list_start = NULL;
 formvars *sess_list_last = NULL;
 
+// Seconds a session may stay unused, 0 for no limit
+unsigned long sess_max_idle = 0;
+
+static const struct sess_store sess_file_store;
+
+// Where sessions started from now on keep their variables
+static const struct sess_store *sess_backend = &sess_file_store;
+
+// Sets session_lasterror and warns about it, returns false
+int sess_fail(struct cgi_request *req, sess_error error)
+{
+	session_lasterror = error;
+
+	cgi_request_error(req, E_WARNING, "%s", session_error_message[error]);
+
+	return false;
+}
+
+// Build the session file name of req for sid
+static void sess_set_fname(struct cgi_request *req, const char *sid)
+{
+	unsigned int save_path_len;
+
+	save_path_len = strlen(SESSION_SAVE_PATH) + strlen(SESSION_FILE_PREFIX);
+
+	free(req->sess_fname);
+	req->sess_fname = (char *)malloc(save_path_len + SESS_ID_LEN + 1);
+	if (!req->sess_fname)
+		cgi_request_error(req, E_MEMORY, "File %s, line %i", __FILE__, __LINE__);
+
+	snprintf(req->sess_fname, (SESS_ID_LEN + save_path_len + 1), "%s%s%s", SESSION_SAVE_PATH, SESSION_FILE_PREFIX, sid);
+	req->sess_fname[SESS_ID_LEN + save_path_len] = '\0';
+}
+
+// Writes the session variables as NUL terminated name and value pairs,
+// for stores keeping them in one piece. Returns the length, nothing is
+// written if it is more than size
+size_t sess_pairs_write(struct cgi_request *req, char *buf, size_t size)
+{
+	size_t len = 0, name_len, value_len;
+	const char *value;
+	formvars *var;
+
+	for (var = *req->sess_start; var; var = var->next) {
+		value = var->value ? var->value : "";
+		name_len = strlen(var->name) + 1;
+		value_len = strlen(value) + 1;
+
+		if (len + name_len + value_len <= size) {
+			memcpy(buf + len, var->name, name_len);
+			memcpy(buf + len + name_len, value, value_len);
+		}
+		len += name_len + value_len;
+	}
+
+	return len;
+}
+
+// Adds the pairs of sess_pairs_write() to the session, pointing into
+// buf, which has to live in request memory
+int sess_pairs_load(struct cgi_request *req, char *buf, size_t len)
+{
+	char *p, *end = buf + len;
+	size_t nuls = 0;
+	formvars *var;
+
+	// pairs of strings, nothing after the last
+	for (p = buf; p < end; p++)
+		if (!*p)
+			nuls++;
+	if ((len && end[-1]) || nuls % 2)
+		return false;
+
+	for (p = buf; p < end; ) {
+		var = cgi_arena_formvar(req->arena);
+		var->name = p;
+		p += strlen(p) + 1;
+		var->value = p;
+		p += strlen(p) + 1;
+		slist_add(var, req->sess_start, req->sess_last);
+	}
+
+	return true;
+}
+
 // Generate a session "unique" id
-void sess_generate_id()
+void sess_generate_id(struct cgi_request *req)
 {
 	static char table[] = "123456789abcdefghijlmnopqrstuvxzwyABCDEFGHIJLMOPQRSTUVXZYW";
 	unsigned int len = strlen(table);
 	register int i;
+	// timeval, gettimeofday are used togheter with srand() function,
+	// once, seeding again within the same microsecond gave the same id
+	static int seeded = 0;
+	struct timeval tv;
 
- 	save_path_len = strlen(SESSION_SAVE_PATH) + strlen(SESSION_FILE_PREFIX);
-
-	sess_fname = (char *)malloc(save_path_len + SESS_ID_LEN + 1);
-	if (!sess_fname)
-		libcgi_error(E_MEMORY, "File %s, line %s", __FILE__, __LINE__);
+	if (!seeded) {
+		gettimeofday(&tv, NULL);
+		srand(tv.tv_sec * tv.tv_usec * 100000 ^ getpid());
+		seeded = 1;
+	}
 
 	for (i = 0; i < SESS_ID_LEN; i++)
-		sess_id[i] = table[rand()%len];
-	sess_id[SESS_ID_LEN] = '\0';
-
-	snprintf(sess_fname, (SESS_ID_LEN + save_path_len + 1), "%s%s%s", SESSION_SAVE_PATH, SESSION_FILE_PREFIX, sess_id);
-	sess_fname[SESS_ID_LEN + save_path_len] = '\0';
+		req->sess_id[i] = table[rand()%len];
+	req->sess_id[SESS_ID_LEN] = '\0';
 }
 
-int sess_create_file()
+// Whether id looks like one of sess_generate_id(), ids from cookies
+// become file names and table keys
+int sess_valid_id(const char *id)
 {
-	// timeval, gettimeofday are used togheter with srand() function
-	struct timeval tv;
+	size_t n;
+
+	if (!id)
+		return 0;
 
-	gettimeofday(&tv, NULL);
-	srand(tv.tv_sec * tv.tv_usec * 100000);
+	for (n = 0; n < SESS_ID_LEN; n++) {
+		if (!((id[n] >= '0' && id[n] <= '9') || (id[n] >= 'a' && id[n] <= 'z')
+		      || (id[n] >= 'A' && id[n] <= 'Z')))
+			return 0;
+	}
 
-	sess_generate_id();
-	sess_file = fopen(sess_fname, "w");
+	return id[n] == '\0';
+}
+
+int sess_create_file(struct cgi_request *req)
+{
+	FILE *sess_file;
+
+	sess_generate_id(req);
+	sess_set_fname(req, req->sess_id);
+	sess_file = fopen(req->sess_fname, "w");
 	if (!sess_file) {
 		session_lasterror = SESS_CREATE_FILE;
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		cgi_request_error(req, E_WARNING, "%s",
+		                  session_error_message[session_lasterror]);
 
 		return 0;
 	}
 
 	// Changes file permission to 0600
-	chmod(sess_fname, S_IRUSR|S_IWUSR);
+	chmod(req->sess_fname, S_IRUSR|S_IWUSR);
 	fclose(sess_file);
 
 	return 1;
@@ -185,60 +273,201 @@ int sess_create_file()
  */
 int cgi_session_destroy( void )
 {
-	// Remember: unlink() returns 0 if success :)
-	if (!unlink(sess_fname)) {
-		sess_initialized = false;
-		slist_free(&sess_list_start);
+	return cgi_request_session_destroy( &cgi_default_request );
+}
+
+int cgi_request_session_destroy(cgi_request *req)
+{
+	if (req->sess_initialized && (!req->sess_store->destroy ||
+	                              req->sess_store->destroy(req))) {
+		req->sess_initialized = false;
+		req->sess_dirty = false;
+		slist_index_clear(&req->sess_index, req->arena, req->sess_start);
+		*req->sess_last = NULL;
 
 		// hhhmmm..
-		if (headers_initialized)
-			libcgi_error(E_WARNING, "Headers already sent. session_destroy() can't fully unregister the session");
+		if (req->headers_initialized)
+			cgi_request_error(req, E_WARNING, "Headers already sent. session_destroy() can't fully unregister the session");
 		else
-			cgi_add_cookie(SESSION_COOKIE_NAME, "", 0, 0, 0, 0);
+			cgi_request_add_cookie(req, SESSION_COOKIE_NAME, "", 0, 0, 0, 0);
 
 		return true;
 	}
 	else {
 		session_lasterror = SESS_DESTROY;
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		cgi_request_error(req, E_WARNING, "%s",
+		                  session_error_message[session_lasterror]);
 
 		return false;
 	}
 }
 
-int sess_file_rewrite()
+static int sess_file_destroy(struct cgi_request *req)
+{
+	// Remember: unlink() returns 0 if success :)
+	return req->sess_fname && !unlink(req->sess_fname);
+}
+
+static void sess_put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+static uint32_t sess_get32(const unsigned char *p)
+{
+	return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Rewrites all data to the session file, once at the end of the
+// request. It goes to a temporary file renamed over the old one, so
+// other requests read either version, never half of one
+int sess_file_rewrite(struct cgi_request *req)
 {
+	unsigned char head[SESS_FILE_HEAD] = SESS_FILE_MAGIC, rec[8];
+	uLong crc = crc32(0L, Z_NULL, 0);
+	uint32_t count = 0, name_len, value_len;
+	const char *value;
 	formvars *data;
+	FILE *sess_file;
+	char *tmp_name;
+	size_t len;
+	int fd, ok;
+
+	len = strlen(req->sess_fname);
+	tmp_name = (char *)malloc(len + 8);
+	if (!tmp_name)
+		cgi_request_error(req, E_MEMORY, "File %s, line %i", __FILE__, __LINE__);
+	memcpy(tmp_name, req->sess_fname, len);
+	memcpy(tmp_name + len, ".XXXXXX", 8);
+
+	// mkstemp() creates it with permission 0600
+	fd = mkstemp(tmp_name);
+	if (fd < 0 || !(sess_file = fdopen(fd, "w"))) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_name);
+		}
+		free(tmp_name);
 
-	// Rewrites all data to session file
-	sess_file = fopen(sess_fname, "w");
+		return sess_fail(req, SESS_OPEN_FILE);
+	}
 
-	if (!sess_file) {
-		session_lasterror = SESS_OPEN_FILE;
+	// records after room for the header, which needs their checksum
+	fwrite(head, 1, sizeof(head), sess_file);
+	for (data = *req->sess_start; data; data = data->next, count++) {
+		value = data->value ? data->value : "";
+		name_len = strlen(data->name);
+		value_len = strlen(value);
+		sess_put32(rec, name_len);
+		sess_put32(rec + 4, value_len);
+
+		fwrite(rec, 1, sizeof(rec), sess_file);
+		fwrite(data->name, 1, name_len + 1, sess_file);
+		fwrite(value, 1, value_len + 1, sess_file);
+
+		crc = crc32(crc, rec, sizeof(rec));
+		crc = crc32(crc, (const Bytef *)data->name, name_len + 1);
+		crc = crc32(crc, (const Bytef *)value, value_len + 1);
+	}
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+	head[4] = SESS_FILE_VERSION;
+	sess_put32(head + 8, count);
+	sess_put32(head + 12, crc);
+	ok = !fseek(sess_file, 0, SEEK_SET)
+	     && fwrite(head, 1, sizeof(head), sess_file) == sizeof(head)
+	     && !ferror(sess_file);
+	ok = !fclose(sess_file) && ok;
+	if (!ok || rename(tmp_name, req->sess_fname)) {
+		unlink(tmp_name);
+		free(tmp_name);
+
+		return sess_fail(req, SESS_OPEN_FILE);
+	}
 
-		return 0;
+	free(tmp_name);
+
+	return 1;
+}
+
+// Points the session variables into a mapped file of the current
+// version, false if it is damaged
+static int sess_file_load(struct cgi_request *req, unsigned char *map, size_t size)
+{
+	unsigned char *p = map + SESS_FILE_HEAD, *end = map + size;
+	uint32_t count, i, name_len, value_len;
+	formvars *var;
+
+	if (size < SESS_FILE_HEAD || memcmp(map, SESS_FILE_MAGIC, 4) ||
+	    map[4] != SESS_FILE_VERSION)
+		return false;
+
+	count = sess_get32(map + 8);
+	if (sess_get32(map + 12) != (uint32_t)crc32(crc32(0L, Z_NULL, 0), p, end - p))
+		return false;
+
+	// all records are checked before the first is used
+	for (i = 0; i < count; i++) {
+		if (end - p < 8)
+			return false;
+		name_len = sess_get32(p);
+		value_len = sess_get32(p + 4);
+		p += 8;
+		if ((size_t)(end - p) < (size_t)name_len + value_len + 2 ||
+		    p[name_len] || p[name_len + 1 + value_len])
+			return false;
+		p += name_len + 1 + value_len + 1;
 	}
+	if (p != end)
+		return false;
 
-	data = sess_list_start;
+	for (p = map + SESS_FILE_HEAD, i = 0; i < count; i++) {
+		name_len = sess_get32(p);
+		value_len = sess_get32(p + 4);
 
-	if (data != NULL) {
-		fprintf(sess_file, "%s=%s", data->name, data->value);
-		data = data->next;
+		var = cgi_arena_formvar(req->arena);
+		var->name = (char *)p + 8;
+		var->value = var->name + name_len + 1;
+		slist_add(var, req->sess_start, req->sess_last);
 
-		if (data) {
-			while (data) {
-				fprintf(sess_file, ";%s=%s", data->name, data->value);
-				data = data->next;
-			}
-		}
+		p += 8 + name_len + 1 + value_len + 1;
 	}
 
-	fclose(sess_file);
+	return true;
+}
 
-	return 1;
+// Releases the mapped session file, after the variables pointing into it
+void sess_unmap(struct cgi_request *req)
+{
+	if (req->sess_map)
+		munmap(req->sess_map, req->sess_map_len);
+
+	req->sess_map = NULL;
+	req->sess_map_len = 0;
+}
+
+// A change of the session variables: stores with a flush() write them
+// once at the end of the request, the others right away
+static int sess_changed(struct cgi_request *req)
+{
+	if (req->sess_store->flush) {
+		req->sess_dirty = true;
+		return true;
+	}
+
+	return req->sess_store->save(req);
+}
+
+// Writes the changes of the request, called by cgi_end()
+void sess_flush(struct cgi_request *req)
+{
+	if (req->sess_initialized && req->sess_dirty)
+		req->sess_store->flush(req);
+
+	req->sess_dirty = false;
 }
 
 
@@ -250,7 +479,13 @@ int sess_file_rewrite()
 */
 char *cgi_session_var(const char *var_name)
 {
-	return slist_item(var_name, sess_list_start);
+	return cgi_request_session_var(&cgi_default_request, var_name);
+}
+
+char *cgi_request_session_var(cgi_request *req, const char *name)
+{
+	return slist_index_item(&req->sess_index, name, *req->sess_start,
+	                        *req->sess_last);
 }
 
 /**
@@ -311,6 +546,12 @@ void cgi_session_save_path(const char *path)
  *	@return	True in case of success, false on error.
  */
 int cgi_session_register_var(const char *name, const char *value)
+{
+	return cgi_request_session_register_var(&cgi_default_request, name, value);
+}
+
+int cgi_request_session_register_var(cgi_request *req, const char *name,
+                                     const char *value)
 {
 	formvars *data;
 
@@ -319,54 +560,29 @@ int cgi_session_register_var(const char *name, const char *value)
 		return false;
 	}
 
-	if (!sess_initialized) {
+	if (!req->sess_initialized) {
 		session_lasterror = SESS_NOT_INITIALIZED;
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		cgi_request_error(req, E_WARNING, "%s",
+		                  session_error_message[session_lasterror]);
 
 		return false;
 	}
 
-	if (!cgi_session_var_exists(name)) {
-		sess_file = fopen(sess_fname, "a");
-		if (!sess_file) {
-			session_lasterror = SESS_OPEN_FILE;
+	if (!cgi_request_session_var_exists(req, name)) {
+		data = cgi_arena_formvar(req->arena);
+		data->name = cgi_arena_strndup(req->arena, name, strlen(name));
+		data->value = cgi_arena_strndup(req->arena, value, strlen(value));
 
-			libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		slist_add(data, req->sess_start, req->sess_last);
 
+		// a variable the store could not keep is dropped again
+		if (!sess_changed(req)) {
+			slist_index_delete(&req->sess_index, req->arena, data->name,
+			                   req->sess_start, req->sess_last);
 			return false;
 		}
 
-		data = (formvars *)malloc(sizeof(formvars));
-		if (!data)
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
-
-		data->name = (char *)malloc(strlen(name) + 1);
-		if (!data->name)
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
-
-		data->value = (char *)malloc(strlen(value) + 1);
-
-		if (!data->value) {
-			free(data->name);
-
-			libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
-		}
-
-		strncpy(data->name, name, strlen(name));
-		data->name[strlen(name)] = '\0';
-
-		strncpy(data->value, value, strlen(value));
-		data->value[strlen(value)] = '\0';
-
-		if (!sess_list_last)
-			fprintf(sess_file, "%s=%s", name, value);
-		else
-			fprintf(sess_file, ";%s=%s", name, value);
-
-		slist_add(data, &sess_list_start, &sess_list_last);
-
-		fclose(sess_file);
 		return true;
 	}
 
@@ -388,31 +604,56 @@ int cgi_session_register_var(const char *name, const char *value)
  *	@return	True in case of success, false on error.
  */
 int cgi_session_alter_var(const char *name, const char *new_value)
+{
+	return cgi_request_session_alter_var(&cgi_default_request, name,
+	                                     new_value);
+}
+
+int cgi_request_session_alter_var(cgi_request *req, const char *name,
+                                  const char *new_value)
 {
 	register formvars *data;
-	unsigned int value_len;
+	size_t value_len;
+	char *old_value;
+	int pooled;
 
 	if (!name || !new_value) {
 		session_lasterror = SESS_EINVAL;
 		return false;
 	}
 
-	data = sess_list_start;
+	if (!req->sess_initialized)
+		return sess_fail(req, SESS_NOT_INITIALIZED);
+
+	data = *req->sess_start;
 	while (data) {
 		if (!strcmp(data->name, name)) {
-			value_len = strlen(new_value) + 1;
+			// nothing to write for the same value
+			if (data->value && !strcmp(data->value, new_value))
+				return true;
+
+			value_len = strlen(new_value);
 
-			if (value_len > strlen(data->value)) {
-				data->value = realloc(data->value, value_len+1);
+			// the old value stays in request memory until cgi_end()
+			old_value = data->value;
+			pooled = cgi_arena_owns(req->arena, data);
+			if (pooled)
+				data->value = cgi_arena_strndup(req->arena, new_value, value_len);
+			else {
+				data->value = realloc(data->value, value_len + 1);
 				if (!data->value)
-					libcgi_error(E_MEMORY, "%s, line %s", __FILE__, __LINE__);
+					cgi_request_error(req, E_MEMORY, "%s, line %i", __FILE__,
+					                  __LINE__);
 
+				memcpy(data->value, new_value, value_len + 1);
 			}
 
-			strncpy(data->value, new_value, value_len);
-			data->value[value_len] = '\0';
-
-			sess_file_rewrite();
+			if (!sess_changed(req)) {
+				// a value the store could not keep is taken back
+				if (pooled)
+					data->value = old_value;
+				return false;
+			}
 
 			return true;
 		}
@@ -436,7 +677,12 @@ int cgi_session_alter_var(const char *name, const char *new_value)
  */
 int cgi_session_var_exists(const char *name)
 {
-	if (!slist_item(name, sess_list_start)) {
+	return cgi_request_session_var_exists(&cgi_default_request, name);
+}
+
+int cgi_request_session_var_exists(cgi_request *req, const char *name)
+{
+	if (!cgi_request_session_var(req, name)) {
 		session_lasterror = SESS_VAR_NOT_REGISTERED;
 		return false;
 	}
@@ -451,23 +697,31 @@ int cgi_session_var_exists(const char *name)
 */
 int cgi_session_unregister_var(char *name)
 {
-	if (!sess_initialized) {
+	return cgi_request_session_unregister_var(&cgi_default_request, name);
+}
+
+int cgi_request_session_unregister_var(cgi_request *req, char *name)
+{
+	if (!req->sess_initialized) {
 		session_lasterror = SESS_NOT_INITIALIZED;
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		cgi_request_error(req, E_WARNING, "%s",
+		                  session_error_message[session_lasterror]);
 
 		return 0;
 	}
 
-	if (!slist_delete(name, &sess_list_start, &sess_list_last)) {
+	if (!slist_index_delete(&req->sess_index, req->arena, name,
+	                        req->sess_start, req->sess_last)) {
 		session_lasterror = SESS_REMOVE_FROM_LIST;
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		cgi_request_error(req, E_WARNING, "%s",
+		                  session_error_message[session_lasterror]);
 
 		return 0;
 	}
 
-	if (!sess_file_rewrite())
+	if (!sess_changed(req))
 		return 0;
 
 	return 1;
@@ -486,98 +740,198 @@ int cgi_session_unregister_var(char *name)
  */
 int cgi_session_start()
 {
-	char *buf = NULL, *sid = NULL;
-	struct stat st;
-	FILE *fp;
+	return cgi_request_session_start(&cgi_default_request);
+}
 
-	if (sess_initialized) {
+int cgi_request_session_start(cgi_request *req)
+{
+	if (req->sess_initialized) {
 		session_lasterror = SESS_STARTED;
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		cgi_request_error(req, E_WARNING, "%s",
+		                  session_error_message[session_lasterror]);
 
 		return false;
 	}
 
-	if (headers_initialized) {
+	if (req->headers_initialized) {
 		session_lasterror = SESS_HEADERS_SENT;
 
-		libcgi_error(E_WARNING, session_error_message[session_lasterror]);
+		cgi_request_error(req, E_WARNING, "%s",
+		                  session_error_message[session_lasterror]);
 
 		return false;
 	}
 
-	// Get the session ID
-	sid = cgi_cookie_value(SESSION_COOKIE_NAME);
-
-	// If there isn't a session ID, we need to create one
-	if (sid == NULL) {
-		if (sess_create_file()) {
-			cgi_add_cookie(SESSION_COOKIE_NAME, sess_id, 0, 0, 0, 0);
+	req->sess_store = sess_backend;
+	if (!req->sess_store->start(req, cgi_request_cookie_value(req, SESSION_COOKIE_NAME)))
+		return false;
 
-			sess_initialized = true;
+	slist_index_build(&req->sess_index, *req->sess_start, *req->sess_last);
+	req->sess_initialized = true;
 
-			return true;
-		}
+	return true;
+}
 
+// Creates a new session file and sets its cookie
+static int sess_file_new(struct cgi_request *req)
+{
+	if (!sess_create_file(req))
 		return false;
-	}
-	// Make sure the file exists
-	else {
-		save_path_len = strlen(SESSION_SAVE_PATH) + strlen(SESSION_FILE_PREFIX);
 
-		sess_fname = (char *)malloc(save_path_len + SESS_ID_LEN + 1);
-		if (!sess_fname)
-			libcgi_error(E_MEMORY, "File %s, line %s", __FILE__, __LINE__);
+	cgi_request_add_cookie(req, SESSION_COOKIE_NAME, req->sess_id, 0, 0, 0, 0);
 
-		snprintf(sess_fname, (SESS_ID_LEN + save_path_len + 1), "%s%s%s", SESSION_SAVE_PATH, SESSION_FILE_PREFIX, sid);
-		sess_fname[SESS_ID_LEN + save_path_len] = '\0';
+	return true;
+}
 
-		errno = 0;
-		fp = fopen(sess_fname, "r");
-		if (errno == ENOENT) {
-			// The file doesn't exists. Create a new session
-			if (sess_create_file()) {
-				cgi_add_cookie(SESSION_COOKIE_NAME, sess_id, 0, 0, 0, 0);
+static int sess_file_start(struct cgi_request *req, const char *sid)
+{
+	unsigned char *map;
+	struct stat st;
+	size_t len;
+	time_t now;
+	char *buf;
+	int fd;
 
-				libcgi_error(E_WARNING, "Session Cookie exists, but file don't. A new one was created.");
-				sess_initialized = true;
+	// If there isn't a session ID, or one we could not have made, we
+	// need to create one
+	if (!sess_valid_id(sid))
+		return sess_file_new(req);
 
-				return true;
-			}
+	// Make sure the file exists
+	sess_set_fname(req, sid);
 
+	fd = open(req->sess_fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 && errno == ENOENT) {
+		// The file doesn't exists. Create a new session
+		if (!sess_file_new(req))
 			return false;
+
+		cgi_request_error(req, E_WARNING, "Session Cookie exists, but file don't. A new one was created.");
+
+		return true;
+	}
+	if (fd < 0)
+		return sess_fail(req, SESS_OPEN_FILE);
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return sess_fail(req, SESS_OPEN_FILE);
+	}
+
+	// A session unused for too long is gone, one unused for half the
+	// time is marked as used, writes do that anyway
+	now = time(NULL);
+	if (sess_max_idle && now > st.st_mtime) {
+		if ((unsigned long)(now - st.st_mtime) > sess_max_idle) {
+			close(fd);
+			unlink(req->sess_fname);
+
+			return sess_file_new(req);
 		}
+		if ((unsigned long)(now - st.st_mtime) > sess_max_idle / 2)
+			futimens(fd, NULL);
 	}
 
 	// Well, at this point we've the session ID
-	strncpy(sess_id, sid, SESS_ID_LEN);
-	sess_id[SESS_ID_LEN] = '\0';
+	strncpy(req->sess_id, sid, SESS_ID_LEN);
+	req->sess_id[SESS_ID_LEN] = '\0';
 
-	// Now we need to read all the file contents
-	// This is a temporary solution, I'll try to
-	// make a faster implementation
-	stat(sess_fname, &st);
-	buf = (char *)malloc(st.st_size + 2);
-	if (!buf)
-		libcgi_error(E_MEMORY, "File %s, line %s", __FILE__, __LINE__);
+	// A new session has an empty file
+	if (st.st_size == 0) {
+		close(fd);
+		return true;
+	}
 
-	fgets(buf, st.st_size+1, fp);
+	// The variables point into a private mapping of the file, it stays
+	// until cgi_end() even if another request replaces the file
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return sess_fail(req, SESS_OPEN_FILE);
 
-	if (buf != NULL && strlen(buf) > 1)
-		process_data(buf, &sess_list_start, &sess_list_last, '=', ';');
+	req->sess_map = map;
+	req->sess_map_len = st.st_size;
 
-	fclose(fp);
-	sess_initialized = true;
-	free(buf);
+	if (!map[0]) {
+		if (sess_file_load(req, map, st.st_size))
+			return true;
+
+		// A damaged file is a new session
+		sess_unmap(req);
+		unlink(req->sess_fname);
+		if (!sess_file_new(req))
+			return false;
+
+		cgi_request_error(req, E_WARNING, "Session file is damaged. A new one was created.");
+
+		return true;
+	}
+
+	// The first line of a text file, it is written again in the current
+	// format at the end of the request
+	for (len = 0; len < (size_t)st.st_size && map[len] && map[len] != '\n'; len++);
+	buf = cgi_arena_strndup(req->arena, (char *)map, len);
+	sess_unmap(req);
+
+	if (len > 1)
+		process_data_arena(req->arena, buf, req->sess_start, req->sess_last,
+		                   '=', ';');
+	req->sess_dirty = true;
 
 	return true;
 }
 
+static const struct sess_store sess_file_store = {
+	.start		= sess_file_start,
+	.save		= sess_file_rewrite,
+	.flush		= sess_file_rewrite,
+	.destroy	= sess_file_destroy,
+};
+
+/**
+* Sets how long a session may stay unused before it is gone.
+* A session file not used for longer is removed by cgi_session_start(),
+* a signed session cookie carries the time it expires, and is sent again
+* with a new time when half of it has passed.
+*
+* @param seconds Idle time, 0 ( the default ) for no limit, a day for
+* session cookies
+* @see cgi_session_set_backend()
+* @note This function must be called before cgi_session_start()
+**/
+void cgi_session_set_max_idle_time(unsigned long seconds)
+{
+	sess_max_idle = seconds;
+}
+
+void cgi_session_set_backend(enum cgi_session_backend backend)
+{
+	switch (backend) {
+		case CGI_SESSION_COOKIE:
+			sess_backend = &sess_cookie_store;
+			break;
+		case CGI_SESSION_SHM:
+			sess_backend = &sess_shm_store;
+			break;
+		default:
+			sess_backend = &sess_file_store;
+			break;
+	}
+}
+
 void cgi_session_free( void )
 {
-	free( sess_fname );
-	sess_fname = NULL;
-	sess_initialized = false;
+	cgi_request_session_free( &cgi_default_request );
+}
+
+void cgi_request_session_free( struct cgi_request *req )
+{
+	free( req->sess_fname );
+	req->sess_fname = NULL;
+	req->sess_store = NULL;
+	req->sess_initialized = false;
+	req->sess_dirty = false;
 }
 
 /**
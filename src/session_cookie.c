@@ -0,0 +1,343 @@
+/*******************************************************************//**
+ *	@file		session_cookie.c
+ *
+ *	Sessions kept in the session cookie, see cgi_session_set_backend().
+ *	The cookie value is
+ *
+ *		1.<key id>.<expires>.<payload>.<mac>
+ *
+ *	with the expiry in seconds since the epoch, the variables as NUL
+ *	terminated name and value pairs and the HMAC-SHA256 of "<cookie
+ *	name>=" and everything before the last dot, both in base64url
+ *	without padding.  Loading points the variables into one decoded copy
+ *	of the payload.
+ *
+ *	A signed cookie can't be revoked, so it always expires: after the
+ *	idle time, or SESS_COOKIE_LIFETIME without one.  Cookies with expiry
+ *	0 are refused.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+#define SESS_COOKIE_VERSION	"1"
+
+/*	"name=value" of the cookie, browsers keep 4096 bytes with the
+ *	attributes	*/
+#define SESS_COOKIE_MAX		4000
+
+#define SESS_KEYS			8
+#define SESS_KEY_MIN		16
+
+/*	seconds a cookie is valid without cgi_session_set_max_idle_time()	*/
+#define SESS_COOKIE_LIFETIME	(24UL * 60 * 60)
+
+/*	base64url length of a MAC	*/
+#define SESS_MAC_LEN		43
+
+struct sess_key {
+	unsigned int			id;
+	struct cgi_hmac_sha256	hmac;
+};
+
+/*	the last key signs	*/
+static struct sess_key sess_keys[SESS_KEYS];
+static size_t sess_key_count = 0;
+
+static const char b64url[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static size_t b64url_encode( char *out, const unsigned char *in, size_t len )
+{
+	char *p = out;
+	uint32_t v;
+	size_t i;
+
+	for ( i = 0; i + 2 < len; i += 3 )
+	{
+		v = (uint32_t) in[i] << 16 | (uint32_t) in[i + 1] << 8 | in[i + 2];
+		*p++ = b64url[v >> 18];
+		*p++ = b64url[(v >> 12) & 0x3f];
+		*p++ = b64url[(v >> 6) & 0x3f];
+		*p++ = b64url[v & 0x3f];
+	}
+
+	if ( i < len )
+	{
+		v = (uint32_t) in[i] << 16
+				| (i + 1 < len ? (uint32_t) in[i + 1] << 8 : 0);
+		*p++ = b64url[v >> 18];
+		*p++ = b64url[(v >> 12) & 0x3f];
+		if ( i + 1 < len ) *p++ = b64url[(v >> 6) & 0x3f];
+	}
+
+	return p - out;
+}
+
+static int b64url_value( char c )
+{
+	if ( c >= 'A' && c <= 'Z' ) return c - 'A';
+	if ( c >= 'a' && c <= 'z' ) return c - 'a' + 26;
+	if ( c >= '0' && c <= '9' ) return c - '0' + 52;
+	if ( c == '-' ) return 62;
+	if ( c == '_' ) return 63;
+
+	return -1;
+}
+
+/*	decoded length, -1 for invalid input	*/
+static long b64url_decode( unsigned char *out, const char *in, size_t len )
+{
+	unsigned char *p = out;
+	uint32_t v = 0;
+	size_t i;
+	int c;
+
+	if ( len % 4 == 1 ) return -1;
+
+	for ( i = 0; i < len; i++ )
+	{
+		if ( (c = b64url_value( in[i] )) < 0 ) return -1;
+		v = v << 6 | (uint32_t) c;
+		if ( i % 4 == 3 )
+		{
+			*p++ = (unsigned char) (v >> 16);
+			*p++ = (unsigned char) (v >> 8);
+			*p++ = (unsigned char) v;
+		}
+	}
+
+	switch ( len % 4 )
+	{
+	case 2:
+		*p++ = (unsigned char) (v >> 4);
+		break;
+	case 3:
+		*p++ = (unsigned char) (v >> 10);
+		*p++ = (unsigned char) (v >> 2);
+		break;
+	}
+
+	return p - out;
+}
+
+static const struct sess_key *sess_key_find( unsigned long id )
+{
+	size_t i;
+
+	for ( i = 0; i < sess_key_count; i++ )
+		if ( sess_keys[i].id == id ) return &sess_keys[i];
+
+	return NULL;
+}
+
+/*	MAC of the first len bytes of value, at most SESS_COOKIE_MAX	*/
+static void sess_cookie_mac( const struct sess_key *key, const char *value,
+		size_t len, char mac[SESS_MAC_LEN + 1] )
+{
+	char msg[sizeof(SESSION_COOKIE_NAME) + SESS_COOKIE_MAX];
+	unsigned char digest[CGI_SHA256_LEN];
+	size_t n = strlen( SESSION_COOKIE_NAME );
+
+	memcpy( msg, SESSION_COOKIE_NAME, n );
+	msg[n++] = '=';
+	memcpy( msg + n, value, len );
+
+	cgi_hmac_sha256( &key->hmac, msg, n + len, digest );
+	mac[b64url_encode( mac, digest, sizeof(digest) )] = '\0';
+}
+
+/*	compare in the same time wherever the first difference is	*/
+static int sess_equal( const char *a, const char *b, size_t len )
+{
+	unsigned char diff = 0;
+	size_t i;
+
+	for ( i = 0; i < len; i++ )
+		diff |= (unsigned char) (a[i] ^ b[i]);
+
+	return !diff;
+}
+
+static const char *sess_number( const char *p, unsigned long *n )
+{
+	char *end;
+
+	if ( *p < '0' || *p > '9' ) return NULL;
+	*n = strtoul( p, &end, 10 );
+
+	return *end == '.' ? end + 1 : NULL;
+}
+
+/*	the payload of a cookie with a valid signature, NULL otherwise	*/
+static const char *sess_cookie_verify( const char *cookie, size_t *len,
+		unsigned long *expires )
+{
+	const struct sess_key *key;
+	char expect[SESS_MAC_LEN + 1];
+	const char *p, *mac;
+	unsigned long id;
+	size_t n;
+
+	if ( !cookie || (n = strlen( cookie )) > SESS_COOKIE_MAX ) return NULL;
+	if ( strncmp( cookie, SESS_COOKIE_VERSION ".",
+			sizeof(SESS_COOKIE_VERSION) ) )
+		return NULL;
+
+	p = cookie + sizeof(SESS_COOKIE_VERSION);
+	if ( !(p = sess_number( p, &id )) || !(p = sess_number( p, expires )) )
+		return NULL;
+
+	if ( !(mac = strrchr( p, '.' ))
+			|| (size_t) (cookie + n - (mac + 1)) != SESS_MAC_LEN )
+		return NULL;
+
+	if ( !(key = sess_key_find( id )) ) return NULL;
+
+	sess_cookie_mac( key, cookie, mac - cookie, expect );
+	if ( !sess_equal( expect, mac + 1, SESS_MAC_LEN ) ) return NULL;
+
+	*len = mac - p;
+
+	return p;
+}
+
+/*	variables of a verified payload	*/
+static int sess_cookie_load( struct cgi_request *req, const char *payload,
+		size_t len )
+{
+	char *buf;
+	long n;
+
+	buf = cgi_arena_alloc( req->arena, len / 4 * 3 + 3 );
+	if ( (n = b64url_decode( (unsigned char *) buf, payload, len )) <= 0 )
+		return 0;
+
+	return sess_pairs_load( req, buf, n );
+}
+
+static unsigned long sess_cookie_lifetime( void )
+{
+	return sess_max_idle ? sess_max_idle : SESS_COOKIE_LIFETIME;
+}
+
+static int sess_cookie_save( struct cgi_request *req )
+{
+	char value[SESS_COOKIE_MAX + 1], mac[SESS_MAC_LEN + 1], max_age[24];
+	unsigned char raw[SESS_COOKIE_MAX];
+	const struct sess_key *key;
+	unsigned long expires;
+	size_t len, head, room, n;
+
+	if ( !sess_key_count ) return sess_fail( req, SESS_NO_KEY );
+	if ( req->headers_initialized ) return sess_fail( req, SESS_HEADERS_SENT );
+
+	key = &sess_keys[sess_key_count - 1];
+	expires = (unsigned long) time( NULL ) + sess_cookie_lifetime();
+
+	head = snprintf( value, sizeof(value), SESS_COOKIE_VERSION ".%u.%lu.",
+			key->id, expires );
+
+	/*	bytes of payload that fit, before base64	*/
+	n = strlen( SESSION_COOKIE_NAME ) + 1 + head + 1 + SESS_MAC_LEN;
+	room = n < SESS_COOKIE_MAX ? (SESS_COOKIE_MAX - n) / 4 * 3 : 0;
+
+	if ( (len = sess_pairs_write( req, (char *) raw, room )) > room )
+		return sess_fail( req, SESS_TOO_LARGE );
+
+	n = head + b64url_encode( value + head, raw, len );
+	sess_cookie_mac( key, value, n, mac );
+	value[n] = '.';
+	memcpy( value + n + 1, mac, sizeof(mac) );
+
+	if ( sess_max_idle )
+		snprintf( max_age, sizeof(max_age), "%lu", sess_max_idle );
+
+	/*	a cookie set before in this request is replaced	*/
+	if ( req->headers_initialized || !cgi_cookie_set( req, SESSION_COOKIE_NAME,
+			value, sess_max_idle ? max_age : NULL, NULL, NULL, 0 ) )
+		return sess_fail( req, SESS_HEADERS_SENT );
+
+	return 1;
+}
+
+static int sess_cookie_start( struct cgi_request *req, const char *cookie )
+{
+	unsigned long expires = 0, now = (unsigned long) time( NULL );
+	const char *payload;
+	size_t len = 0;
+
+	if ( !sess_key_count ) return sess_fail( req, SESS_NO_KEY );
+
+	req->sess_id[0] = '\0';
+
+	/*	anything not signed by us, expired or without expiry is a new
+	 *	session	*/
+	payload = sess_cookie_verify( cookie, &len, &expires );
+	if ( !payload || expires <= now
+			|| (len && !sess_cookie_load( req, payload, len )) )
+	{
+		slist_index_clear( &req->sess_index, req->arena, req->sess_start );
+		*req->sess_last = NULL;
+		return sess_cookie_save( req );
+	}
+
+	/*	sliding expiry, the cookie goes again after half the time, or
+	 *	at once if it was made for longer than the time now	*/
+	if ( expires - now < sess_cookie_lifetime() / 2
+			|| expires - now > sess_cookie_lifetime() )
+		return sess_cookie_save( req );
+
+	return 1;
+}
+
+const struct sess_store sess_cookie_store = {
+	.start		= sess_cookie_start,
+	.save		= sess_cookie_save,
+	.flush		= NULL,
+	.destroy	= NULL,
+};
+
+int cgi_session_cookie_key( unsigned int id, const void *key, size_t len )
+{
+	size_t i;
+
+	if ( key && len < SESS_KEY_MIN )
+	{
+		session_lasterror = SESS_EINVAL;
+		return 0;
+	}
+
+	/*	drop the key of the same id, or the oldest if there is no room	*/
+	for ( i = 0; i < sess_key_count && sess_keys[i].id != id; i++ );
+	if ( i == sess_key_count && key && sess_key_count == SESS_KEYS ) i = 0;
+	if ( i < sess_key_count )
+	{
+		memmove( &sess_keys[i], &sess_keys[i + 1],
+				(sess_key_count - i - 1) * sizeof(struct sess_key) );
+		memset( &sess_keys[--sess_key_count], 0, sizeof(struct sess_key) );
+	}
+
+	if ( !key ) return 1;
+
+	sess_keys[sess_key_count].id = id;
+	cgi_hmac_sha256_key( &sess_keys[sess_key_count++].hmac, key, len );
+
+	return 1;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,368 @@
+/*******************************************************************//**
+ *	@file		session_shm.c
+ *
+ *	Sessions in a table shared by the processes of a host, see
+ *	cgi_session_set_backend().  The table is a file of fixed size slots
+ *	after a header, in /dev/shm by default, mapped once per process.
+ *	A session lives in one slot of the SESS_SHM_PROBE slots after the
+ *	hash of its id.  Readers copy a slot between two reads of its
+ *	sequence number and try again if a writer came in between, writers
+ *	take the lock of the slot.  A new session takes the least recently
+ *	used slot of its window, free slots were last used at time 0.  Once
+ *	the table is mapped, sessions are read and written without system
+ *	calls.  The table file is only used if it is a regular file of the
+ *	effective user that nobody else can read or write, and not a
+ *	symbolic link.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/request.h"
+
+#include "internal.h"
+
+#define SESS_SHM_MAGIC		"libcgiS1"
+#define SESS_SHM_SLOTS		4096
+#define SESS_SHM_PROBE		16
+
+/*	tries to read a slot that keeps being written	*/
+#define SESS_SHM_RETRIES	1000
+
+/*	seconds after which the lock of a writer is taken over, it has
+ *	died while holding it	*/
+#define SESS_SHM_STALE		2
+
+/*	bytes of session variables in a slot, slots are 4 KiB	*/
+#define SESS_SHM_DATA		(4096 - 24 - (SESS_ID_LEN + 1) - 2)
+
+struct sess_shm_head {
+	char		magic[8];
+	uint32_t	slots;
+	uint32_t	slot_size;
+};
+
+struct sess_shm_slot {
+	uint32_t	seq;		/**< odd while written	*/
+	uint32_t	lock;		/**< time a writer took the slot, 0 if free	*/
+	int64_t		used;		/**< last use, 0 for free slots	*/
+	uint32_t	len;		/**< bytes of data	*/
+	uint32_t	reserved;
+	char		id[SESS_ID_LEN + 1];
+	char		data[SESS_SHM_DATA];
+};
+
+static char sess_shm_path[255] = "/dev/shm/libcgi-sessions";
+
+/*	the mapped table, the header takes the room of slot 0	*/
+static struct sess_shm_slot *sess_shm = NULL;
+static uint32_t sess_shm_slots = 0;
+
+static int sess_shm_attach( struct cgi_request *req )
+{
+	struct sess_shm_head head;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	if ( sess_shm ) return 1;
+
+	fd = open( sess_shm_path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW,
+			S_IRUSR | S_IWUSR );
+	if ( fd < 0 ) return sess_fail( req, SESS_OPEN_FILE );
+
+	/*	a table planted by another user could read or forge sessions	*/
+	if ( fstat( fd, &st ) || !S_ISREG( st.st_mode )
+			|| st.st_uid != geteuid() || (st.st_mode & 077) )
+		goto err;
+
+	/*	the first process sizes the table, the others wait for it	*/
+	flock( fd, LOCK_EX );
+	if ( fstat( fd, &st ) ) goto err;
+	if ( st.st_size == 0 )
+	{
+		memset( &head, 0, sizeof(head) );
+		memcpy( head.magic, SESS_SHM_MAGIC, sizeof(head.magic) );
+		head.slots = SESS_SHM_SLOTS;
+		head.slot_size = sizeof(struct sess_shm_slot);
+
+		st.st_size = (off_t) (head.slots + 1) * sizeof(struct sess_shm_slot);
+		if ( ftruncate( fd, st.st_size )
+				|| pwrite( fd, &head, sizeof(head), 0 ) != sizeof(head) )
+			goto err;
+	}
+	else if ( pread( fd, &head, sizeof(head), 0 ) != sizeof(head) )
+	{
+		goto err;
+	}
+	flock( fd, LOCK_UN );
+
+	size = ((size_t) head.slots + 1) * sizeof(struct sess_shm_slot);
+	if ( memcmp( head.magic, SESS_SHM_MAGIC, sizeof(head.magic) )
+			|| head.slot_size != sizeof(struct sess_shm_slot)
+			|| !head.slots || (size_t) st.st_size < size )
+		goto err;
+
+	map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( map == MAP_FAILED ) return sess_fail( req, SESS_OPEN_FILE );
+
+	sess_shm = map;
+	sess_shm_slots = head.slots;
+
+	return 1;
+
+err:
+	close( fd );
+	return sess_fail( req, SESS_OPEN_FILE );
+}
+
+static struct sess_shm_slot *sess_shm_slot( const char *id, uint32_t i )
+{
+	uint32_t hash = 2166136261u;
+	size_t n;
+
+	for ( n = 0; n < SESS_ID_LEN; n++ )
+		hash = (hash ^ (unsigned char) id[n]) * 16777619u;
+
+	return &sess_shm[1 + (hash + i) % sess_shm_slots];
+}
+
+static int sess_shm_idle( const struct sess_shm_slot *slot, int64_t now )
+{
+	return sess_max_idle && now - __atomic_load_n( &slot->used,
+			__ATOMIC_RELAXED ) > (int64_t) sess_max_idle;
+}
+
+static void sess_shm_lock( struct sess_shm_slot *slot )
+{
+	uint32_t held, now;
+
+	for ( ;; )
+	{
+		now = (uint32_t) time( NULL ) | 1;
+		held = 0;
+		if ( __atomic_compare_exchange_n( &slot->lock, &held, now, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+			break;
+		if ( now - held > SESS_SHM_STALE
+				&& __atomic_compare_exchange_n( &slot->lock, &held, now, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+			break;
+		sched_yield();
+	}
+
+	/*	odd, it stays so if a writer died in the middle	*/
+	__atomic_store_n( &slot->seq, slot->seq | 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+static void sess_shm_unlock( struct sess_shm_slot *slot )
+{
+	__atomic_store_n( &slot->seq, slot->seq + 1, __ATOMIC_RELEASE );
+	__atomic_store_n( &slot->lock, 0, __ATOMIC_RELEASE );
+}
+
+/*	copy the variables of session id into buf, the slot or NULL	*/
+static struct sess_shm_slot *sess_shm_read( const char *id, char *buf,
+		size_t *len )
+{
+	struct sess_shm_slot *slot;
+	uint32_t i, seq, tries;
+	int match = 0;
+
+	for ( i = 0; i < SESS_SHM_PROBE; i++ )
+	{
+		slot = sess_shm_slot( id, i );
+
+		for ( tries = 0; tries < SESS_SHM_RETRIES; tries++ )
+		{
+			if ( (seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE )) & 1 )
+			{
+				if ( tries > 100 ) sched_yield();
+				continue;
+			}
+
+			match = !memcmp( slot->id, id, SESS_ID_LEN + 1 );
+			*len = slot->len;
+			if ( match && *len <= SESS_SHM_DATA )
+				memcpy( buf, slot->data, *len );
+
+			__atomic_thread_fence( __ATOMIC_ACQUIRE );
+			if ( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) == seq ) break;
+		}
+
+		if ( tries < SESS_SHM_RETRIES && match && *len <= SESS_SHM_DATA )
+			return slot;
+	}
+
+	return NULL;
+}
+
+/*	the slot of session id locked, NULL if it is not there	*/
+static struct sess_shm_slot *sess_shm_find( const char *id )
+{
+	struct sess_shm_slot *slot;
+	uint32_t i;
+
+	for ( i = 0; i < SESS_SHM_PROBE; i++ )
+	{
+		slot = sess_shm_slot( id, i );
+		if ( memcmp( slot->id, id, SESS_ID_LEN + 1 ) ) continue;
+
+		sess_shm_lock( slot );
+		if ( !memcmp( slot->id, id, SESS_ID_LEN + 1 ) ) return slot;
+		sess_shm_unlock( slot );
+	}
+
+	return NULL;
+}
+
+/*	the least recently used slot of the window of id	*/
+static struct sess_shm_slot *sess_shm_oldest( const char *id )
+{
+	struct sess_shm_slot *slot, *oldest = NULL;
+	uint32_t i;
+
+	for ( i = 0; i < SESS_SHM_PROBE; i++ )
+	{
+		slot = sess_shm_slot( id, i );
+		if ( !oldest || __atomic_load_n( &slot->used, __ATOMIC_RELAXED )
+				< __atomic_load_n( &oldest->used, __ATOMIC_RELAXED ) )
+			oldest = slot;
+	}
+
+	return oldest;
+}
+
+/*	whether a slot of the window holds id, without locking	*/
+static int sess_shm_seen( const char *id )
+{
+	uint32_t i;
+
+	for ( i = 0; i < SESS_SHM_PROBE; i++ )
+	{
+		if ( !memcmp( sess_shm_slot( id, i )->id, id, SESS_ID_LEN + 1 ) )
+			return 1;
+	}
+
+	return 0;
+}
+
+/*	the slot of session id locked, the least recently used of the
+ *	window if it is not there	*/
+static struct sess_shm_slot *sess_shm_claim( const char *id, int64_t now )
+{
+	struct sess_shm_slot *slot, *oldest;
+
+	for ( ;; )
+	{
+		if ( (slot = sess_shm_find( id )) ) return slot;
+
+		/*	another writer may have stored id or taken the slot while
+		 *	this one waited for the lock	*/
+		oldest = sess_shm_oldest( id );
+		sess_shm_lock( oldest );
+		if ( !sess_shm_seen( id ) && sess_shm_oldest( id ) == oldest ) break;
+		sess_shm_unlock( oldest );
+	}
+
+	memcpy( oldest->id, id, SESS_ID_LEN + 1 );
+	oldest->len = 0;
+	__atomic_store_n( &oldest->used, now, __ATOMIC_RELAXED );
+
+	return oldest;
+}
+
+static int sess_shm_save( struct cgi_request *req )
+{
+	struct sess_shm_slot *slot;
+	char buf[SESS_SHM_DATA];
+	size_t len;
+
+	if ( (len = sess_pairs_write( req, buf, sizeof(buf) )) > sizeof(buf) )
+		return sess_fail( req, SESS_TOO_LARGE );
+
+	slot = sess_shm_claim( req->sess_id, time( NULL ) );
+	memcpy( slot->data, buf, len );
+	slot->len = (uint32_t) len;
+	sess_shm_unlock( slot );
+
+	return 1;
+}
+
+static int sess_shm_start( struct cgi_request *req, const char *cookie )
+{
+	struct sess_shm_slot *slot;
+	int64_t now = time( NULL );
+	size_t len;
+	char *buf;
+
+	if ( !sess_shm_attach( req ) ) return 0;
+
+	buf = cgi_arena_alloc( req->arena, SESS_SHM_DATA );
+	if ( sess_valid_id( cookie ) && (slot = sess_shm_read( cookie, buf,
+			&len )) && !sess_shm_idle( slot, now ) )
+	{
+		memcpy( req->sess_id, cookie, SESS_ID_LEN + 1 );
+		if ( __atomic_load_n( &slot->used, __ATOMIC_RELAXED ) != now )
+			__atomic_store_n( &slot->used, now, __ATOMIC_RELAXED );
+
+		if ( sess_pairs_load( req, buf, len ) ) return 1;
+		slist_index_clear( &req->sess_index, req->arena, req->sess_start );
+		*req->sess_last = NULL;
+	}
+
+	/*	a new session takes its slot right away, like a new file	*/
+	sess_generate_id( req );
+	if ( !sess_shm_save( req ) ) return 0;
+	cgi_request_add_cookie( req, SESSION_COOKIE_NAME, req->sess_id,
+			0, 0, 0, 0 );
+
+	return 1;
+}
+
+static int sess_shm_destroy( struct cgi_request *req )
+{
+	struct sess_shm_slot *slot;
+
+	if ( (slot = sess_shm_find( req->sess_id )) )
+	{
+		memset( slot->id, 0, sizeof(slot->id) );
+		slot->len = 0;
+		__atomic_store_n( &slot->used, 0, __ATOMIC_RELAXED );
+		sess_shm_unlock( slot );
+	}
+
+	return 1;
+}
+
+const struct sess_store sess_shm_store = {
+	.start		= sess_shm_start,
+	.save		= sess_shm_save,
+	.flush		= NULL,
+	.destroy	= sess_shm_destroy,
+};
+
+void cgi_session_shm_path( const char *path )
+{
+	snprintf( sess_shm_path, sizeof(sess_shm_path), "%s", path );
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,177 @@
+/*******************************************************************//**
+ *	@file		sha256.c
+ *
+ *	SHA-256, FIPS 180-4, and HMAC-SHA256, RFC 2104, for signed session
+ *	cookies.  An HMAC key is kept as the hash states after its padded
+ *	blocks, so each signature only hashes the message.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "internal.h"
+
+static const uint32_t k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR( x, n )		(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block( uint32_t h[8], const unsigned char *p )
+{
+	uint32_t w[64], a, b, c, d, e, f, g, hh, t1, t2;
+	int i;
+
+	for ( i = 0; i < 16; i++, p += 4 )
+	{
+		w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16
+				| (uint32_t) p[2] << 8 | p[3];
+	}
+	for ( ; i < 64; i++ )
+	{
+		w[i] = w[i - 16] + w[i - 7]
+				+ (ROR( w[i - 15], 7 ) ^ ROR( w[i - 15], 18 ) ^ (w[i - 15] >> 3))
+				+ (ROR( w[i - 2], 17 ) ^ ROR( w[i - 2], 19 ) ^ (w[i - 2] >> 10));
+	}
+
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+	for ( i = 0; i < 64; i++ )
+	{
+		t1 = hh + (ROR( e, 6 ) ^ ROR( e, 11 ) ^ ROR( e, 25 ))
+				+ ((e & f) ^ (~e & g)) + k[i] + w[i];
+		t2 = (ROR( a, 2 ) ^ ROR( a, 13 ) ^ ROR( a, 22 ))
+				+ ((a & b) ^ (a & c) ^ (b & c));
+		hh = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void cgi_sha256_init( struct cgi_sha256 *ctx )
+{
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy( ctx->h, init, sizeof(init) );
+	ctx->len = 0;
+}
+
+void cgi_sha256_update( struct cgi_sha256 *ctx, const void *data, size_t len )
+{
+	const unsigned char *p = data;
+	size_t used = ctx->len % 64, n;
+
+	ctx->len += len;
+
+	if ( used )
+	{
+		n = 64 - used < len ? 64 - used : len;
+		memcpy( ctx->buf + used, p, n );
+		p += n;
+		len -= n;
+		if ( used + n < 64 ) return;
+		sha256_block( ctx->h, ctx->buf );
+	}
+
+	for ( ; len >= 64; p += 64, len -= 64 )
+		sha256_block( ctx->h, p );
+
+	memcpy( ctx->buf, p, len );
+}
+
+void cgi_sha256_final( struct cgi_sha256 *ctx,
+		unsigned char digest[CGI_SHA256_LEN] )
+{
+	uint64_t bits = ctx->len * 8;
+	size_t used = ctx->len % 64;
+	int i;
+
+	ctx->buf[used++] = 0x80;
+	if ( used > 56 )
+	{
+		memset( ctx->buf + used, 0, 64 - used );
+		sha256_block( ctx->h, ctx->buf );
+		used = 0;
+	}
+	memset( ctx->buf + used, 0, 56 - used );
+	for ( i = 0; i < 8; i++ )
+		ctx->buf[56 + i] = (unsigned char) (bits >> (56 - 8 * i));
+	sha256_block( ctx->h, ctx->buf );
+
+	for ( i = 0; i < 8; i++ )
+	{
+		digest[4 * i] = (unsigned char) (ctx->h[i] >> 24);
+		digest[4 * i + 1] = (unsigned char) (ctx->h[i] >> 16);
+		digest[4 * i + 2] = (unsigned char) (ctx->h[i] >> 8);
+		digest[4 * i + 3] = (unsigned char) ctx->h[i];
+	}
+}
+
+void cgi_hmac_sha256_key( struct cgi_hmac_sha256 *hmac, const void *key,
+		size_t len )
+{
+	unsigned char block[64], pad[64];
+	struct cgi_sha256 ctx;
+	int i;
+
+	memset( block, 0, sizeof(block) );
+	if ( len > sizeof(block) )
+	{
+		cgi_sha256_init( &ctx );
+		cgi_sha256_update( &ctx, key, len );
+		cgi_sha256_final( &ctx, block );
+	}
+	else
+	{
+		memcpy( block, key, len );
+	}
+
+	for ( i = 0; i < 64; i++ ) pad[i] = block[i] ^ 0x36;
+	cgi_sha256_init( &hmac->inner );
+	cgi_sha256_update( &hmac->inner, pad, sizeof(pad) );
+
+	for ( i = 0; i < 64; i++ ) pad[i] = block[i] ^ 0x5c;
+	cgi_sha256_init( &hmac->outer );
+	cgi_sha256_update( &hmac->outer, pad, sizeof(pad) );
+
+	memset( block, 0, sizeof(block) );
+	memset( pad, 0, sizeof(pad) );
+}
+
+void cgi_hmac_sha256( const struct cgi_hmac_sha256 *hmac, const void *data,
+		size_t len, unsigned char mac[CGI_SHA256_LEN] )
+{
+	struct cgi_sha256 ctx = hmac->inner;
+	unsigned char inner[CGI_SHA256_LEN];
+
+	cgi_sha256_update( &ctx, data, len );
+	cgi_sha256_final( &ctx, inner );
+
+	ctx = hmac->outer;
+	cgi_sha256_update( &ctx, inner, sizeof(inner) );
+	cgi_sha256_final( &ctx, mac );
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,591 @@
+/*******************************************************************//**
+ *	@file		template.c
+ *
+ *	Compiled templates, see libcgi/template.h.  A file is read once and
+ *	compiled to a list of operations: literal spans of the file, slots
+ *	for values and jumps for repetitions.  Names are numbered when
+ *	compiling, a render sorts the values of the list into their slots
+ *	in one pass and then just runs the operations.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libcgi/error.h"
+#include "libcgi/request.h"
+#include "libcgi/template.h"
+
+#include "internal.h"
+
+/*	compiled templates kept per thread	*/
+#define TEMPLATE_CACHE_SIZE		32
+
+/*	deepest nesting of repetitions	*/
+#define TEMPLATE_DEPTH_MAX		16
+
+#define TEMPLATE_NO_SLOT		UINT32_MAX
+
+/*	a file rewritten within the same second is still noticed	*/
+#if defined(__linux__)
+#define TPL_MTIME_NS(st)		((st).st_mtim.tv_nsec)
+#else
+#define TPL_MTIME_NS(st)		0L
+#endif
+
+enum tpl_opcode {
+	TPL_TEXT,			/**< literal span of the file	*/
+	TPL_VAR,			/**< escaped value	*/
+	TPL_RAW,			/**< value as it is	*/
+	TPL_SECTION,		/**< once per value, skip the body if none	*/
+	TPL_INVERTED,		/**< only without values	*/
+	TPL_END,			/**< back to its section	*/
+};
+
+struct tpl_op {
+	uint32_t	code;
+	uint32_t	slot;		/**< name, TEMPLATE_NO_SLOT for "."	*/
+	uint32_t	off;		/**< text span	*/
+	uint32_t	len;
+	uint32_t	jump;		/**< operation after the end, or the section	*/
+};
+
+struct cgi_template {
+	char			*text;		/**< file content, names terminated in it	*/
+	struct tpl_op	*ops;
+	uint32_t		nops;
+	uint32_t		nslots;
+	const char		**names;	/**< of the slots, NUL terminated	*/
+	uint32_t		*table;		/**< slot + 1 by hash of the name, 0 empty	*/
+	uint32_t		mask;
+};
+
+struct tpl_cache_entry {
+	char				*path;
+	dev_t				dev;
+	ino_t				ino;
+	off_t				size;
+	time_t				mtime;
+	long				mtime_ns;
+	struct cgi_template	*t;
+};
+
+#if defined(__GNUC__)
+static __thread struct tpl_cache_entry tpl_cache[TEMPLATE_CACHE_SIZE];
+static __thread unsigned int tpl_cache_next = 0;
+#else
+static struct tpl_cache_entry tpl_cache[TEMPLATE_CACHE_SIZE];
+static unsigned int tpl_cache_next = 0;
+#endif
+
+/*	***	names	***	*/
+
+/*	case folded FNV-1a, names are case insensitive like in list.c	*/
+static uint32_t tpl_hash( const char *s, size_t len )
+{
+	uint32_t h = 2166136261u;
+	unsigned char c;
+
+	while ( len-- )
+	{
+		c = *s++;
+		if ( c >= 'A' && c <= 'Z' ) c += 'a' - 'A';
+		h = (h ^ c) * 16777619u;
+	}
+
+	return h;
+}
+
+static uint32_t tpl_lookup( const struct cgi_template *t, const char *name,
+		size_t len )
+{
+	uint32_t i, slot;
+
+	if ( !t->table ) return TEMPLATE_NO_SLOT;
+
+	for ( i = tpl_hash( name, len ) & t->mask; (slot = t->table[i]);
+			i = (i + 1) & t->mask )
+	{
+		if ( !strncasecmp( t->names[slot - 1], name, len )
+				&& !t->names[slot - 1][len] )
+			return slot - 1;
+	}
+
+	return TEMPLATE_NO_SLOT;
+}
+
+/*	***	compile	***	*/
+
+struct tpl_compiler {
+	struct cgi_template	*t;
+	struct cgi_request	*req;		/**< errors are shown to	*/
+	const char			*path;
+	uint32_t			ops_cap;
+	uint32_t			names_cap;
+	uint32_t			stack[TEMPLATE_DEPTH_MAX];
+	unsigned int		depth;
+};
+
+static int tpl_error( struct tpl_compiler *c, const char *at, const char *what )
+{
+	const char *p;
+	unsigned int line = 1;
+
+	for ( p = c->t->text; p < at; p++ )
+		line += *p == '\n';
+
+	cgi_request_error( c->req, E_WARNING, "%s: %s:%u: %s",
+			"cgi_template_render", c->path, line, what );
+
+	return 0;
+}
+
+static struct tpl_op *tpl_emit( struct tpl_compiler *c, uint32_t code )
+{
+	struct cgi_template *t = c->t;
+	struct tpl_op *ops;
+
+	if ( t->nops == c->ops_cap )
+	{
+		c->ops_cap = c->ops_cap ? c->ops_cap * 2 : 32;
+		if ( !(ops = realloc( t->ops, c->ops_cap * sizeof(*ops) )) )
+		{
+			cgi_request_error( c->req, E_MEMORY, "%s, line %i", __FILE__,
+					__LINE__ );
+			return NULL;
+		}
+		t->ops = ops;
+	}
+
+	ops = &t->ops[t->nops++];
+	ops->code = code;
+	ops->slot = TEMPLATE_NO_SLOT;
+	ops->off = ops->len = ops->jump = 0;
+
+	return ops;
+}
+
+/*	slot of a name, numbered in order of appearance; the name is
+ *	terminated in place, the text after it was read already	*/
+static int tpl_slot( struct tpl_compiler *c, char *name, size_t len,
+		uint32_t *slot )
+{
+	struct cgi_template *t = c->t;
+	const char **names;
+	uint32_t i;
+
+	if ( (*slot = tpl_lookup( t, name, len )) != TEMPLATE_NO_SLOT ) return 1;
+
+	if ( t->nslots == c->names_cap )
+	{
+		c->names_cap = c->names_cap ? c->names_cap * 2 : 16;
+		if ( !(names = realloc( t->names, c->names_cap * sizeof(*names) )) )
+			goto err;
+		t->names = names;
+	}
+
+	/*	table at most half full	*/
+	if ( (t->nslots + 1) * 2 > (t->table ? t->mask + 1 : 0) )
+	{
+		uint32_t size = t->table ? (t->mask + 1) * 2 : 32, n, j;
+		uint32_t *table = calloc( size, sizeof(uint32_t) );
+
+		if ( !table ) goto err;
+		for ( n = 0; n < t->nslots; n++ )
+		{
+			for ( j = tpl_hash( t->names[n], strlen( t->names[n] ) ) & (size - 1);
+					table[j]; j = (j + 1) & (size - 1) );
+			table[j] = n + 1;
+		}
+		free( t->table );
+		t->table = table;
+		t->mask = size - 1;
+	}
+
+	name[len] = '\0';
+	t->names[t->nslots] = name;
+	for ( i = tpl_hash( name, len ) & t->mask; t->table[i];
+			i = (i + 1) & t->mask );
+	t->table[i] = t->nslots + 1;
+	*slot = t->nslots++;
+
+	return 1;
+
+err:
+	cgi_request_error( c->req, E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+	return 0;
+}
+
+static int tpl_text( struct tpl_compiler *c, const char *from, const char *to )
+{
+	struct tpl_op *op;
+
+	if ( from == to ) return 1;
+	if ( !(op = tpl_emit( c, TPL_TEXT )) ) return 0;
+
+	op->off = from - c->t->text;
+	op->len = to - from;
+
+	return 1;
+}
+
+/*	one tag, p after the opening braces, returns the end of the tag	*/
+static char *tpl_tag( struct tpl_compiler *c, char *p )
+{
+	struct cgi_template *t = c->t;
+	uint32_t code = TPL_VAR, slot, start;
+	const char *close = "}}";
+	char *name, *end, *next;
+	struct tpl_op *op;
+	size_t len;
+
+	switch ( *p )
+	{
+		case '{':	code = TPL_RAW; close = "}}}"; p++;	break;
+		case '#':	code = TPL_SECTION; p++;			break;
+		case '^':	code = TPL_INVERTED; p++;			break;
+		case '/':	code = TPL_END; p++;				break;
+		case '!':
+			if ( !(end = strstr( p, "}}" )) )
+				return tpl_error( c, p, "unterminated comment" ), NULL;
+			return end + 2;
+	}
+
+	if ( !(end = strstr( p, close )) )
+		return tpl_error( c, p, "unterminated tag" ), NULL;
+	next = end + strlen( close );
+
+	for ( name = p; name < end && (*name == ' ' || *name == '\t'); name++ );
+	while ( end > name && (end[-1] == ' ' || end[-1] == '\t') ) end--;
+	if ( !(len = end - name) || memchr( name, '{', len ) )
+		return tpl_error( c, p, "bad tag" ), NULL;
+
+	if ( len == 1 && *name == '.' )
+	{
+		if ( code != TPL_VAR && code != TPL_RAW )
+			return tpl_error( c, p, "'.' is no list" ), NULL;
+		slot = TEMPLATE_NO_SLOT;
+	}
+	else if ( !tpl_slot( c, name, len, &slot ) )
+	{
+		return NULL;
+	}
+
+	if ( code == TPL_END )
+	{
+		if ( !c->depth || t->ops[c->stack[c->depth - 1]].slot != slot )
+			return tpl_error( c, p, "unexpected end of list" ), NULL;
+		start = c->stack[--c->depth];
+		if ( !(op = tpl_emit( c, TPL_END )) ) return NULL;
+		op->slot = slot;
+		op->jump = start;
+		t->ops[start].jump = t->nops;
+		return next;
+	}
+
+	if ( !(op = tpl_emit( c, code )) ) return NULL;
+	op->slot = slot;
+
+	if ( code == TPL_SECTION || code == TPL_INVERTED )
+	{
+		if ( c->depth == TEMPLATE_DEPTH_MAX )
+			return tpl_error( c, p, "lists nested too deep" ), NULL;
+		c->stack[c->depth++] = t->nops - 1;
+	}
+
+	return next;
+}
+
+static void tpl_free( struct cgi_template *t )
+{
+	if ( !t ) return;
+
+	free( t->text );
+	free( t->ops );
+	free( t->names );
+	free( t->table );
+	free( t );
+}
+
+static struct cgi_template *tpl_compile( struct cgi_request *req,
+		const char *path, int fd, size_t size )
+{
+	struct tpl_compiler c = { NULL, req, path, 0, 0, { 0 }, 0 };
+	struct cgi_template *t;
+	char *p, *open, *text_end;
+	ssize_t n;
+	size_t done = 0;
+
+	if ( size > UINT32_MAX ) return NULL;
+
+	if ( !(t = calloc( 1, sizeof(*t) )) || !(t->text = malloc( size + 1 )) )
+	{
+		cgi_request_error( req, E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+		free( t );
+		return NULL;
+	}
+	c.t = t;
+
+	while ( done < size )
+	{
+		if ( (n = pread( fd, t->text + done, size - done, done )) <= 0 )
+			goto err;
+		done += n;
+	}
+	t->text[size] = '\0';
+	text_end = t->text + size;
+
+	/*	names are terminated in place, so look for tags first	*/
+	for ( p = t->text; (open = strstr( p, "{{" )); )
+	{
+		if ( !tpl_text( &c, p, open ) ) goto err;
+		if ( !(p = tpl_tag( &c, open + 2 )) ) goto err;
+	}
+	if ( !tpl_text( &c, p, text_end ) ) goto err;
+
+	if ( c.depth )
+	{
+		tpl_error( &c, text_end, "unterminated list" );
+		goto err;
+	}
+
+	return t;
+
+err:
+	tpl_free( t );
+	return NULL;
+}
+
+/*	compiled file from the cache, recompiled after changes	*/
+static struct cgi_template *tpl_get( struct cgi_request *req,
+		const char *path )
+{
+	struct tpl_cache_entry *e;
+	struct stat st;
+	int fd, i;
+
+	if ( !path || (fd = open( path, O_RDONLY )) == -1 ) goto err;
+	if ( fstat( fd, &st ) == -1 || !S_ISREG( st.st_mode ) )
+	{
+		close( fd );
+		goto err;
+	}
+
+	for ( i = 0; i < TEMPLATE_CACHE_SIZE; i++ )
+	{
+		e = &tpl_cache[i];
+		if ( e->t && e->dev == st.st_dev && e->ino == st.st_ino
+				&& e->size == st.st_size && e->mtime == st.st_mtime
+				&& e->mtime_ns == TPL_MTIME_NS( st )
+				&& !strcmp( e->path, path ) )
+		{
+			close( fd );
+			return e->t;
+		}
+	}
+
+	/*	a changed file replaces its old entry	*/
+	for ( i = 0, e = NULL; i < TEMPLATE_CACHE_SIZE && !e; i++ )
+	{
+		if ( tpl_cache[i].t && !strcmp( tpl_cache[i].path, path ) )
+			e = &tpl_cache[i];
+	}
+	if ( !e ) e = &tpl_cache[tpl_cache_next++ % TEMPLATE_CACHE_SIZE];
+
+	tpl_free( e->t );
+	free( e->path );
+	memset( e, 0, sizeof(*e) );
+
+	e->t = tpl_compile( req, path, fd, st.st_size );
+	close( fd );
+	if ( !e->t ) return NULL;
+
+	if ( !(e->path = strdup( path )) )
+	{
+		cgi_request_error( req, E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+		tpl_free( e->t );
+		e->t = NULL;
+		return NULL;
+	}
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->size = st.st_size;
+	e->mtime = st.st_mtime;
+	e->mtime_ns = TPL_MTIME_NS( st );
+
+	return e->t;
+
+err:
+	cgi_request_error( req, E_WARNING, "%s: file error: %s",
+			"cgi_template_render", path );
+	return NULL;
+}
+
+/*	***	render	***	*/
+
+struct tpl_out {
+	cgi_request	*req;
+	int			failed;
+};
+
+static void tpl_write( struct tpl_out *out, const char *s, size_t len )
+{
+	out->failed |= !cgi_request_write( out->req, s, len );
+}
+
+/*	a repetition in progress	*/
+struct tpl_frame {
+	uint32_t	section;	/**< index of its operation	*/
+	uint32_t	pos;
+};
+
+static int tpl_run( const struct cgi_template *t, struct tpl_out *out,
+		const uint32_t *count, const uint32_t *first, const char **values )
+{
+	struct tpl_frame stack[TEMPLATE_DEPTH_MAX], *top = NULL;
+	const struct tpl_op *op;
+	const char *value;
+	uint32_t i, slot, pos;
+
+	for ( i = 0; i < t->nops && !out->failed; i++ )
+	{
+		op = &t->ops[i];
+		slot = op->slot;
+
+		switch ( op->code )
+		{
+			case TPL_TEXT:
+				tpl_write( out, t->text + op->off, op->len );
+				break;
+
+			case TPL_VAR:
+			case TPL_RAW:
+				/*	".", or a name with several values, goes by the
+				 *	position of the innermost repetition	*/
+				pos = top ? top->pos : 0;
+				if ( slot == TEMPLATE_NO_SLOT )
+				{
+					if ( !top ) break;
+					slot = t->ops[top->section].slot;
+				}
+				else if ( count[slot] == 1 )
+				{
+					pos = 0;
+				}
+				if ( pos >= count[slot] ) break;
+
+				value = values[first[slot] + pos];
+				if ( op->code == TPL_VAR )
+					out->failed |= !cgi_request_write_html_escaped(
+							out->req, value, strlen( value ) );
+				else
+					tpl_write( out, value, strlen( value ) );
+				break;
+
+			case TPL_SECTION:
+				if ( !count[slot] )
+				{
+					i = op->jump - 1;
+					break;
+				}
+				top = top ? top + 1 : stack;
+				top->section = i;
+				top->pos = 0;
+				break;
+
+			case TPL_INVERTED:
+				if ( count[slot] ) i = op->jump - 1;
+				break;
+
+			case TPL_END:
+				if ( t->ops[op->jump].code == TPL_INVERTED ) break;
+				if ( ++top->pos < count[slot] )
+				{
+					i = op->jump;
+					break;
+				}
+				top = top == stack ? NULL : top - 1;
+				break;
+		}
+	}
+
+	return !out->failed;
+}
+
+int cgi_template_render( const char *path, formvars *vars )
+{
+	return cgi_request_template_render( &cgi_default_request, path, vars );
+}
+
+int cgi_request_template_render( cgi_request *req, const char *path,
+		formvars *vars )
+{
+	const struct cgi_template *t;
+	struct tpl_out out = { req, 0 };
+	uint32_t *count, *first, *fill, slot, total = 0, i;
+	const char **values = NULL;
+	formvars *item;
+	int ret;
+
+	if ( !(t = tpl_get( req, path )) ) return 0;
+
+	/*	sort the values into their slots, in list order	*/
+	if ( !(count = calloc( 3 * (size_t) t->nslots + 1, sizeof(uint32_t) )) )
+		goto err;
+	first = count + t->nslots;
+	fill = first + t->nslots;
+
+	for ( item = vars; item; item = item->next )
+	{
+		if ( item->name && (slot = tpl_lookup( t, item->name,
+				strlen( item->name ) )) != TEMPLATE_NO_SLOT )
+		{
+			count[slot]++;
+			total++;
+		}
+	}
+
+	if ( total && !(values = malloc( total * sizeof(char *) )) )
+	{
+		free( count );
+		goto err;
+	}
+
+	for ( i = 0, total = 0; i < t->nslots; i++ )
+	{
+		first[i] = fill[i] = total;
+		total += count[i];
+	}
+
+	for ( item = vars; item && values; item = item->next )
+	{
+		if ( item->name && (slot = tpl_lookup( t, item->name,
+				strlen( item->name ) )) != TEMPLATE_NO_SLOT )
+			values[fill[slot]++] = item->value ? item->value : "";
+	}
+
+	ret = tpl_run( t, &out, count, first, values );
+
+	free( values );
+	free( count );
+
+	return ret;
+
+err:
+	cgi_request_error( req, E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+	return 0;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
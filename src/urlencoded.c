@@ -0,0 +1,243 @@
+/*******************************************************************//**
+ *	@file		urlencoded.c
+ *
+ *	Incremental parser for application/x-www-form-urlencoded bodies.
+ *	The body is read in fixed size chunks and every name/value pair is
+ *	added to the list as soon as it is complete, so memory is bounded
+ *	by the largest field instead of the whole body.  Escapes may cross
+ *	chunk boundaries.  The result is the same as process_data() on the
+ *	whole body.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcgi/cgi.h"
+#include "libcgi/error.h"
+
+#include "internal.h"
+
+#define URLENC_CHUNK_SIZE	8192
+
+struct urlenc_parser {
+	/*	current field, name followed by the decoded value	*/
+	char			*buf;
+	size_t			len;
+	size_t			cap;
+	size_t			name_len;
+	int				in_value;
+
+	/*	pending escape, pct holds the number of bytes in pct_buf	*/
+	int				pct;
+	char			pct_buf[2];
+
+	size_t			field_max;
+	int				error;
+
+	struct cgi_arena	*arena;
+	formvars		**start;
+	formvars		**last;
+};
+
+static void urlenc_append( struct urlenc_parser *p, const char *s, size_t n )
+{
+	size_t cap;
+
+	if ( p->error || !n ) return;
+
+	if ( p->field_max && p->len + n > p->field_max )
+	{
+		p->error = 1;
+		return;
+	}
+
+	if ( p->len + n > p->cap )
+	{
+		for ( cap = p->cap ? p->cap : 256; cap < p->len + n; cap *= 2 );
+
+		p->buf = realloc( p->buf, cap );
+		if ( !p->buf )
+			libcgi_error( E_MEMORY, "%s, line %i", __FILE__, __LINE__ );
+		p->cap = cap;
+	}
+
+	memcpy( p->buf + p->len, s, n );
+	p->len += n;
+}
+
+/*	Unfinished escapes are kept literally, like process_data() does.	*/
+static void urlenc_flush_pct( struct urlenc_parser *p )
+{
+	if ( p->pct )
+	{
+		urlenc_append( p, "%", 1 );
+		urlenc_append( p, p->pct_buf, p->pct - 1 );
+		p->pct = 0;
+	}
+}
+
+static void urlenc_end_field( struct urlenc_parser *p )
+{
+	formvars *item;
+	size_t value_len;
+
+	urlenc_flush_pct( p );
+	if ( p->error ) return;
+
+	value_len = p->in_value ? p->len - p->name_len : 0;
+	if ( !p->in_value )
+		p->name_len = p->len;
+
+	/*	value is of no use without name	*/
+	if ( p->name_len )
+	{
+		item = cgi_arena_formvar( p->arena );
+		item->name = cgi_arena_strndup( p->arena, p->buf, p->name_len );
+		if ( value_len )
+			item->value = cgi_arena_strndup( p->arena,
+					p->buf + p->name_len, value_len );
+
+		slist_add( item, p->start, p->last );
+	}
+
+	p->len = 0;
+	p->name_len = 0;
+	p->in_value = 0;
+}
+
+static void urlenc_feed( struct urlenc_parser *p, const char *s, size_t n );
+
+/*	One byte of a value following a '%'	*/
+static void urlenc_feed_pct( struct urlenc_parser *p, char c )
+{
+	char pending[2], decoded;
+	int n;
+
+	if ( cgi_hextable[(unsigned char) c] == 0xFF )
+	{
+		/*	malformed, keep '%' and parse the rest again as normal data	*/
+		n = p->pct - 1;
+		memcpy( pending, p->pct_buf, n );
+		p->pct = 0;
+
+		urlenc_append( p, "%", 1 );
+		urlenc_feed( p, pending, n );
+		urlenc_feed( p, &c, 1 );
+		return;
+	}
+
+	if ( p->pct == 1 )
+	{
+		p->pct_buf[0] = c;
+		p->pct = 2;
+		return;
+	}
+
+	decoded = (char) (cgi_hextable[(unsigned char) p->pct_buf[0]] << 4
+			| cgi_hextable[(unsigned char) c]);
+	p->pct = 0;
+	urlenc_append( p, &decoded, 1 );
+}
+
+static void urlenc_feed( struct urlenc_parser *p, const char *s, size_t n )
+{
+	const char *end = s + n, *run;
+
+	while ( s < end && !p->error )
+	{
+		if ( p->pct && *s != '&' )
+		{
+			urlenc_feed_pct( p, *s++ );
+			continue;
+		}
+
+		/*	copy plain runs at once	*/
+		for ( run = s; s < end && *s != '&' && *s != '=' && *s != '%'
+				&& *s != '+'; s++ );
+		urlenc_append( p, run, s - run );
+
+		if ( s == end ) break;
+
+		switch ( *s++ )
+		{
+			case '&':
+				urlenc_end_field( p );
+				break;
+
+			case '=':
+				if ( p->in_value )
+				{
+					urlenc_append( p, "=", 1 );
+				}
+				else
+				{
+					p->name_len = p->len;
+					p->in_value = 1;
+				}
+				break;
+
+			/*	names are not decoded, see process_data()	*/
+			case '%':
+				if ( p->in_value )
+					p->pct = 1;
+				else
+					urlenc_append( p, "%", 1 );
+				break;
+
+			case '+':
+				urlenc_append( p, p->in_value ? " " : "+", 1 );
+				break;
+		}
+	}
+}
+
+/*	Reads length bytes from in and adds all fields to the list, memory
+ *	comes from arena.  Returns *start, or NULL on read errors or a
+ *	field larger than field_max (fields complete until then are kept).
+ */
+formvars *cgi_read_urlencoded( struct cgi_arena *arena, FILE *in,
+		unsigned long length, size_t field_max, formvars **start,
+		formvars **last )
+{
+	struct urlenc_parser p;
+	char chunk[URLENC_CHUNK_SIZE];
+	size_t n, len;
+
+	memset( &p, 0, sizeof(p) );
+	p.field_max = field_max;
+	p.arena = arena;
+	p.start = start;
+	p.last = last;
+
+	while ( length && !p.error )
+	{
+		n = length < sizeof(chunk) ? length : sizeof(chunk);
+		if ( fread( chunk, 1, n, in ) != n )
+		{
+			p.error = 1;
+			break;
+		}
+		length -= n;
+
+		/*	a NUL ends the data, like it does for process_data()	*/
+		len = strnlen( chunk, n );
+		urlenc_feed( &p, chunk, len );
+		if ( len < n ) break;
+	}
+
+	if ( !p.error )
+		urlenc_end_field( &p );
+
+	free( p.buf );
+
+	return p.error ? NULL : *start;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
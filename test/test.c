@@ -8,6 +8,7 @@
  *	@copyright	2017,2018 Alexander Dahl <post@lespocky.de>
  **********************************************************************/
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +19,12 @@
 #include "libcgi/cgi.h"
 #include "libcgi/cgi_types.h"
 #include "libcgi/config.h"
+#include "libcgi/request.h"
+
+#define CGI_SCAN_SCALAR	0
+#define CGI_SCAN_AVX2	2
+
+extern int cgi_scan_set_level( int level );
 
 extern formvars *
 process_data(const char *query, formvars **start, formvars **last,
@@ -35,6 +42,14 @@ static int _test_ltrim( void );
 static int _test_rtrim( void );
 static int version( void );
 static int unescape_special_chars( void );
+static int test_cgi_param_index( void );
+static int test_arena( void );
+static int test_in_place( void );
+static int test_post_stream( void );
+static int test_multipart( void );
+static int test_param_iter( void );
+static int test_include( void );
+static int test_htmlentities( void );
 
 int main( int argc, char *argv[] )
 {
@@ -47,6 +62,14 @@ int main( int argc, char *argv[] )
 		{ "rtrim",					_test_rtrim						},
 		{ "version",				version							},
 		{ "unescape_special_chars",	unescape_special_chars			},
+		{ "param_index",			test_cgi_param_index			},
+		{ "arena",					test_arena						},
+		{ "in_place",				test_in_place					},
+		{ "post_stream",			test_post_stream				},
+		{ "multipart",				test_multipart					},
+		{ "param_iter",				test_param_iter					},
+		{ "include",				test_include					},
+		{ "htmlentities",			test_htmlentities				},
 	};
 
 	/*	require at least one argument to select test	*/
@@ -62,6 +85,24 @@ error:
 	return EXIT_FAILURE;
 }
 
+/*	byte by byte reference for the vectorized encoder	*/
+static void escape_reference( char *dst, const char *src )
+{
+	unsigned char c;
+
+	for ( ; (c = *src); src++ )
+	{
+		if ( c == ' ' )
+			*dst++ = '+';
+		else if ( (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+				|| (c >= 'A' && c <= 'Z') || c == '_' || c == '-' || c == '.' )
+			*dst++ = c;
+		else
+			dst += sprintf( dst, "%%%02X", c );
+	}
+	*dst = '\0';
+}
+
 int test_cgi_escape_special_chars( void )
 {
     puts(__FUNCTION__);
@@ -69,9 +110,11 @@ int test_cgi_escape_special_chars( void )
 	const char *esc_valid = "%._-+0123456789"
 	                        "abcdefghijklmnopqrstuvwxyz"
 	                        "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-	char str[256];
+	char str[256], buf[8], expect[300];
 	char *esc = NULL, *unesc = NULL;
-	int c;
+	unsigned int seed = 1;
+	size_t len, i;
+	int c, level, round;
 
 	for (c = 0; c < 256; ++c)
 		str[c] = (char) c + 1;
@@ -82,9 +125,46 @@ int test_cgi_escape_special_chars( void )
 	check( strcmp(esc, unesc), "strcmp esc unesc" );
 	check( !strcmp(str, unesc), "strcmp str unesc" );
 	check( strspn(esc, esc_valid) == strlen(esc), "strspn" );
+	check( strlen(esc) == 255 + 2 * (255 - 66), "exact length" );
 
 	free( esc );
 	free( unesc );
+
+	/*	caller buffer, nothing written if too small	*/
+	strcpy( buf, "keep" );
+	check( cgi_escape_special_chars_buf( buf, 7, "a b/c" ) == 7, "need" );
+	check( !strcmp( buf, "keep" ), "untouched" );
+	check( cgi_escape_special_chars_buf( buf, 4, "" ) == 0, "empty" );
+	check( !strcmp( buf, "" ), "empty result" );
+	len = cgi_escape_special_chars_buf( buf, 8, "a b" );
+	len += cgi_escape_special_chars_buf( buf + len, sizeof(buf) - len, "/c" );
+	check( len == 7 && !strcmp( buf, "a+b%2Fc" ), "append '%s'", buf );
+
+	/*	every scanner must agree with the byte by byte reference	*/
+	for ( level = CGI_SCAN_SCALAR; level <= CGI_SCAN_AVX2; level++ )
+	{
+		if ( cgi_scan_set_level( level ) != level ) break;
+
+		for ( round = 0; round < 2000; round++ )
+		{
+			seed = seed * 1103515245 + 12345;
+			len = (seed >> 16) % 100;
+			for ( i = 0; i < len; i++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				str[i] = (seed >> 16) % 4 ? (char) ('a' + i % 26)
+						: (char) ((seed >> 20) % 255 + 1);
+			}
+			str[len] = '\0';
+
+			escape_reference( expect, str );
+			check( (esc = cgi_escape_special_chars( str )), "escape" );
+			check( !strcmp( esc, expect ), "level %i round %i", level, round );
+			free( esc );
+		}
+	}
+	cgi_scan_set_level( -1 );
+
 	return EXIT_SUCCESS;
 
 error:
@@ -161,6 +241,12 @@ int test_cgi_param_multiple( void )
 	check( !strcmp(cgi_param_multiple("one"), "four"),	"four" );
 	check( !cgi_param_multiple("one"),					"one again" );
 
+	/*	another name starts over, the old one too	*/
+	check( !strcmp(cgi_param_multiple("one"), "one"),	"restart" );
+	check( !strcmp(cgi_param_multiple("two"), "three"),	"switch" );
+	check( !strcmp(cgi_param_multiple("ONE"), "one"),	"switch back" );
+	check( !cgi_param_multiple("none"),					"none" );
+
 	cgi_end();
 
 	return EXIT_SUCCESS;
@@ -336,12 +422,657 @@ error:
 	return EXIT_FAILURE;
 }
 
+static int hexdigit( char c )
+{
+	if ( c >= '0' && c <= '9' ) return c - '0';
+	if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+	if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+
+	return -1;
+}
+
+/*	byte by byte reference for the vectorized decoder	*/
+static size_t unescape_reference( char *dst, const char *src, size_t len )
+{
+	size_t i, n = 0;
+
+	for ( i = 0; i < len; i++ )
+	{
+		if ( src[i] == '+' )
+			dst[n++] = ' ';
+		else if ( src[i] == '%' && i + 2 < len && hexdigit( src[i + 1] ) >= 0
+				&& hexdigit( src[i + 2] ) >= 0 )
+		{
+			dst[n++] = hexdigit( src[i + 1] ) << 4 | hexdigit( src[i + 2] );
+			i += 2;
+		}
+		else
+			dst[n++] = src[i];
+	}
+
+	return n;
+}
+
 int unescape_special_chars( void )
 {
+	const char alphabet[] = "%+aF9zZ\xC3\0-";
+	char src[200], expect[200], *got;
+	unsigned int seed = 1;
+	size_t len, n, expect_len, i;
+	int level, round;
+
 	check( NULL == cgi_unescape_special_chars( NULL ), "null" );
 
+	got = cgi_unescape_special_chars( "a%20b+c%zz%4" );
+	check( !strcmp( got, "a b c%zz%4" ), "malformed '%s'", got );
+	free( got );
+
+	got = cgi_unescape_special_chars_len( "a%00b", 5, &n );
+	check( n == 3 && !memcmp( got, "a\0b", 4 ), "NUL" );
+	free( got );
+
+	/*	every scanner must agree with the reference, escapes at all
+	 *	positions of 16 and 32 byte blocks	*/
+	for ( level = CGI_SCAN_SCALAR; level <= CGI_SCAN_AVX2; level++ )
+	{
+		if ( cgi_scan_set_level( level ) != level ) break;
+
+		for ( round = 0; round < 2000; round++ )
+		{
+			seed = seed * 1103515245 + 12345;
+			len = (seed >> 16) % sizeof(src);
+			for ( i = 0; i < len; i++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				/*	mostly clean runs	*/
+				src[i] = (seed >> 16) % 8 ? 'x'
+						: alphabet[(seed >> 20) % (sizeof(alphabet) - 1)];
+			}
+
+			expect_len = unescape_reference( expect, src, len );
+			got = cgi_unescape_special_chars_len( src, len, &n );
+			check( n == expect_len && !memcmp( got, expect, n )
+					&& got[n] == '\0', "level %i round %i", level, round );
+			free( got );
+		}
+	}
+	cgi_scan_set_level( -1 );
+
+	return EXIT_SUCCESS;
+error:
+	return EXIT_FAILURE;
+}
+
+int test_cgi_param_index( void )
+{
+	char query[16384], name[32], expect[32], *p = query;
+	int i;
+
+	/*	lots of fields, every tenth name appears twice	*/
+	for ( i = 0; i < 500; i++ )
+	{
+		p += sprintf( p, "%sField%i=v%i", i ? "&" : "", i, i );
+		if ( !(i % 10) )
+			p += sprintf( p, "&FIELD%i=dup%i", i, i );
+	}
+	p += sprintf( p, "&empty=&novalue" );
+
+	check( !setenv( "QUERY_STRING", query, 1 ), "setenv" );
+	check( !putenv( "REQUEST_METHOD=GET" ), "putenv" );
+	check( cgi_process_form(), "process form" );
+
+	for ( i = 0; i < 500; i++ )
+	{
+		/*	lookups are case insensitive, first value wins	*/
+		sprintf( name, "fIeLd%i", i );
+		sprintf( expect, "v%i", i );
+		check( cgi_param( name ) && !strcmp( cgi_param( name ), expect ),
+				"param %s", name );
+	}
+
+	check( cgi_param( "field500" ) == NULL, "not existing" );
+	check( cgi_param( "empty" ) == NULL, "empty value" );
+	check( cgi_param( "novalue" ) == NULL, "no value" );
+	check( cgi_param( NULL ) == NULL, "NULL name" );
+
+	/*	items appended after parsing must be found too	*/
+	process_data( "late=comer", &formvars_start, &formvars_last, '=', '&' );
+	check( cgi_param( "LATE" ) && !strcmp( cgi_param( "late" ), "comer" ),
+			"appended item" );
+
+	/*	and deleted ones must vanish	*/
+	check( slist_delete( "field3", &formvars_start, &formvars_last ),
+			"delete" );
+	check( cgi_param( "field3" ) == NULL, "deleted item" );
+	check( !strcmp( cgi_param( "field4" ), "v4" ), "after delete" );
+
+	cgi_end();
+	check( cgi_param( "field4" ) == NULL, "after cgi_end" );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_arena( void )
+{
+	formvars *item;
+	char big[5000];
+	size_t peak;
+
+	memset( big, 'x', sizeof(big) );
+	memcpy( big, "big=", 4 );
+	big[sizeof(big) - 1] = '\0';
+
+	/*	tiny blocks, the big value needs a block of its own	*/
+	cgi_arena_set_size( 64 );
+
+	process_data( "a=1&b=%32&c=three", &formvars_start, &formvars_last,
+			'=', '&' );
+	process_data( big, &formvars_start, &formvars_last, '=', '&' );
+	process_data( "d=4", &formvars_start, &formvars_last, '=', '&' );
+
+	check( !strcmp( cgi_param( "b" ), "2" ), "b" );
+	check( strlen( cgi_param( "big" ) ) == sizeof(big) - 5, "big" );
+	check( !strcmp( cgi_param( "d" ), "4" ), "d" );
+
+	/*	items in request memory are left to it, others are free()d	*/
+	check( slist_delete( "a", &formvars_start, &formvars_last ), "delete" );
+	check( (item = malloc( sizeof(formvars) )), "item" );
+	check( (item->name = malloc( 2 )), "name" );
+	strcpy( item->name, "e" );
+	item->value = NULL;
+	slist_add( item, &formvars_start, &formvars_last );
+	check( cgi_param_count( "e" ) == 1, "malloc item" );
+
+	peak = cgi_arena_peak();
+	check( peak >= sizeof(big), "peak %zu", peak );
+
+	cgi_end();
+	check( formvars_start == NULL, "released" );
+
+	/*	peak is a high water mark over requests	*/
+	process_data( "a=1", &formvars_start, &formvars_last, '=', '&' );
+	check( cgi_arena_peak() == peak, "peak kept" );
+	check( !strcmp( cgi_param( "a" ), "1" ), "a" );
+
+	cgi_end();
+	cgi_arena_set_size( 0 );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_in_place( void )
+{
+	char list[2][128], *p;
+	formvars *item;
+	int i;
+
+	cgi_form_decode_in_place( 1 );
+
+	check( !putenv( "REQUEST_METHOD=GET" ), "putenv" );
+	check( !putenv( "QUERY_STRING=a%20b=c%26d&x=1&&novalue&=noname&y=%41" ),
+			"putenv" );
+	check( (item = cgi_process_form()), "process form" );
+
+	/*	names are not decoded, like in the other modes	*/
+	check( !strcmp( item->name, "a%20b" ), "name '%s'", item->name );
+	check( !strcmp( item->value, "c&d" ), "value '%s'", item->value );
+	check( !strcmp( cgi_param( "x" ), "1" ), "x" );
+	check( !strcmp( cgi_param( "y" ), "A" ), "y" );
+	check( cgi_param( "novalue" ) == NULL, "no value" );
+
+	/*	all strings point into one buffer	*/
+	check( item->value == item->name + 6, "name and value adjacent" );
+	check( !strcmp( getenv( "QUERY_STRING" ),
+			"a%20b=c%26d&x=1&&novalue&=noname&y=%41" ), "env untouched" );
+
+	cgi_end();
+
+	check( !putenv( "QUERY_STRING" ), "putenv" );
+	check( (item = _post( "one=%31&two=2%2B2" )), "POST" );
+	check( !strcmp( cgi_param( "one" ), "1" ), "one" );
+	check( !strcmp( cgi_param( "two" ), "2+2" ), "two" );
+	check( item->next->name == item->name + 8, "in body buffer" );
+
+	cgi_end();
+
+	/*	the same list as without the option	*/
+	check( !putenv( "REQUEST_METHOD=GET" ), "putenv" );
+	check( !putenv( "QUERY_STRING=a%20b=1&%41=%42&c+d=x+y&e%=%&f=" ),
+			"putenv" );
+	for ( i = 0; i < 2; i++ )
+	{
+		cgi_form_decode_in_place( i );
+		p = list[i];
+		for ( item = cgi_process_form(); item; item = item->next )
+			p += sprintf( p, "%s=%s;", item->name,
+					item->value ? item->value : "" );
+		cgi_end();
+	}
+	check( !strcmp( list[0], list[1] ), "'%s' and '%s'", list[0], list[1] );
+	check( !strcmp( list[0], "a%20b=1;%41=B;c+d=x y;e%=%;f=;" ), "'%s'",
+			list[0] );
+
+	/*	a length without room for the terminator	*/
+	cgi_form_decode_in_place( 1 );
+	cgi_form_limits( 0, 0 );
+	check( !putenv( "REQUEST_METHOD=POST" ), "putenv" );
+	check( !setenv( "CONTENT_LENGTH", "18446744073709551615", 1 ),
+			"CONTENT_LENGTH" );
+	check( !cgi_process_form(), "huge length" );
+	cgi_end();
+	/*	one that would wrap around when rounded up in request memory	*/
+	check( !setenv( "CONTENT_LENGTH", "18446744073709551614", 1 ),
+			"CONTENT_LENGTH" );
+	check( !cgi_process_form(), "wrapping length" );
+	cgi_end();
+	cgi_form_limits( 1024UL * 1024UL, 1024UL * 1024UL );
+	unsetenv( "CONTENT_LENGTH" );
+
+	cgi_form_decode_in_place( 0 );
+
 	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_post_stream( void )
+{
+	static char body[20001];
+	const char alphabet[] = "ab%4F+=&";
+	formvars *start = NULL, *last = NULL, *a, *b;
+	unsigned int seed = 1;
+	int i, round;
+
+	/*	escape crossing the 8 KiB chunk boundary	*/
+	memset( body, 'x', 8190 );
+	memcpy( body, "big=", 4 );
+	strcpy( body + 8190, "%41%2" "0&next=1" );
+	check( _post( body ), "POST" );
+	check( cgi_param( "big" )[8186] == 'A', "A" );
+	check( cgi_param( "big" )[8187] == ' ', "space" );
+	check( !strcmp( cgi_param( "next" ), "1" ), "next" );
+	cgi_end();
+
+	/*	random bodies must give the same list as process_data()	*/
+	for ( round = 0; round < 20; round++ )
+	{
+		for ( i = 0; i < 20000; i++ )
+		{
+			seed = seed * 1103515245 + 12345;
+			body[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+		}
+		body[20000] = '\0';
+
+		process_data( body, &start, &last, '=', '&' );
+		check( _post( body ) || !start, "POST" );
+
+		for ( a = start, b = formvars_start; a && b;
+				a = a->next, b = b->next )
+		{
+			check( !strcmp( a->name, b->name ), "name" );
+			check( (!a->value && !b->value)
+					|| (a->value && b->value && !strcmp( a->value, b->value )),
+					"value" );
+		}
+		check( !a && !b, "same length" );
+
+		slist_free( &start );
+		cgi_end();
+	}
+
+	/*	limits	*/
+	cgi_form_limits( 10, 0 );
+	check( !_post( "a=1&b=2&c=3" ), "content max" );
+	cgi_end();
+	/*	the body was not read, drop it	*/
+	check( read( STDIN_FILENO, body, 11 ) == 11, "drain" );
+
+	cgi_form_limits( 0, 4 );
+	check( !_post( "a=1&bbb=22&c=3" ), "field max" );
+	check( !strcmp( cgi_param( "a" ), "1" ), "fields before" );
+	check( !cgi_param( "c" ), "fields after" );
+	cgi_end();
+
+	cgi_form_limits( 1024UL * 1024UL, 1024UL * 1024UL );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+static int upload_count( const struct cgi_upload *upload, const char *data,
+		size_t len, void *arg )
+{
+	size_t *count = arg;
+
+	(void) upload;
+	if ( data ) *count += len;
+	else *count += 1000000;
+
+	return 0;
+}
+
+int test_multipart( void )
+{
+	static char body[40000], content[30000], back[30000];
+	const char *end = "\r\n--xyz--\r\nepilogue";
+	struct cgi_upload *up;
+	char path[64];
+	size_t len, count = 0;
+	int i, fd;
+
+	/*	content with partial delimiters, across the 16 KiB window	*/
+	for ( i = 0; i < (int) sizeof(content); i++ )
+		content[i] = "\r\n--xy"[i % 6];
+
+	len = sprintf( body, "preamble\r\n--xyz\r\n"
+			"Content-Disposition: form-data; name=\"a\"\r\n\r\n"
+			"1\r\n--xyz  \r\n"
+			"content-disposition: form-data; name=\"f\"; filename=\"x\\\"y.txt\"\r\n"
+			"Content-Type: text/plain\r\n\r\n" );
+	memcpy( body + len, content, sizeof(content) );
+	len += sizeof(content);
+	strcpy( body + len, end );
+
+	check( !setenv( "CONTENT_TYPE",
+			"multipart/form-data; boundary=\"xyz\"", 1 ), "CONTENT_TYPE" );
+	check( _post( body ), "POST" );
+	check( !strcmp( cgi_param( "a" ), "1" ), "field" );
+	check( !cgi_param( "f" ), "file is no field" );
+
+	check( (up = cgi_upload_file( "F" )), "upload" );
+	check( up == cgi_upload_list() && !up->next, "list" );
+	check( !strcmp( up->filename, "x\"y.txt" ), "filename %s", up->filename );
+	check( !strcmp( up->content_type, "text/plain" ), "content type" );
+	check( up->size == sizeof(content), "size %zu", up->size );
+	check( read( up->fd, back, sizeof(back) ) == sizeof(back), "read" );
+	check( !memcmp( back, content, sizeof(content) ), "content" );
+
+	/*	save by link or copy	*/
+	snprintf( path, sizeof(path), "/tmp/cgi-test-upload-%i", (int) getpid() );
+	unlink( path );
+	check( cgi_upload_save( up, path ), "save" );
+	check( (fd = open( path, O_RDONLY )) >= 0, "open" );
+	check( read( fd, back, sizeof(back) ) == sizeof(back), "read saved" );
+	check( !memcmp( back, content, sizeof(content) ), "saved content" );
+	close( fd );
+	unlink( path );
+	cgi_end();
+	check( !cgi_upload_list(), "uploads reset" );
+
+	/*	handler instead of files	*/
+	cgi_upload_set_handler( upload_count, &count );
+	check( _post( body ), "POST handler" );
+	check( count == 1000000 + sizeof(content), "handler count %zu", count );
+	check( cgi_upload_file( "f" )->fd == -1, "no file" );
+	cgi_end();
+	cgi_upload_set_handler( NULL, NULL );
+
+	/*	truncated body	*/
+	body[len] = '\0';
+	check( !_post( body ), "truncated" );
+	check( !strcmp( cgi_param( "a" ), "1" ), "fields before" );
+	cgi_end();
+
+	check( !unsetenv( "CONTENT_TYPE" ), "unsetenv" );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_param_iter( void )
+{
+	formvars *other, *other_start = NULL, *other_last = NULL;
+	char data[8192], *p = data;
+	cgi_param_iter a, b, c;
+	const char *value;
+	int i;
+
+	/*	interleaved names with many values, one empty	*/
+	for ( i = 0; i < 300; i++ )
+		p += sprintf( p, "a=%i&b=x%i&", i, i );
+	strcpy( p, "c=&a=last" );
+
+	process_data( data, &formvars_start, &formvars_last, '=', '&' );
+
+	check( cgi_param_count( "a" ) == 301, "count a" );
+	check( cgi_param_count( "B" ) == 300, "count b" );
+	check( cgi_param_count( "c" ) == 1, "count c" );
+	check( cgi_param_count( "none" ) == 0, "count none" );
+	check( cgi_param_count( NULL ) == 0, "count NULL" );
+
+	/*	iterations of several names run at the same time	*/
+	check( cgi_param_iter_start( &a, "a" ) == 301, "iter a" );
+	check( cgi_param_iter_start( &b, "b" ) == 300, "iter b" );
+	for ( i = 0; i < 300; i++ )
+	{
+		check( (value = cgi_param_next( &a )) && atoi( value ) == i,
+				"a %i", i );
+		check( (value = cgi_param_next( &b )) && value[0] == 'x'
+				&& atoi( value + 1 ) == i, "b %i", i );
+	}
+	check( !strcmp( cgi_param_next( &a ), "last" ), "a last" );
+	check( !cgi_param_next( &a ) && !cgi_param_next( &a ), "a end" );
+	check( !cgi_param_next( &b ), "b end" );
+
+	check( cgi_param_iter_start( &c, "c" ) == 1, "iter c" );
+	check( !strcmp( cgi_param_next( &c ), "" ), "empty value" );
+	check( !cgi_param_next( &c ), "c end" );
+	check( cgi_param_iter_start( &c, "none" ) == 0 && !cgi_param_next( &c ),
+			"iter none" );
+
+	/*	values added later are seen, deleting ends iterations	*/
+	process_data( "a=more", &formvars_start, &formvars_last, '=', '&' );
+	check( cgi_param_count( "a" ) == 302, "count appended" );
+	cgi_param_iter_start( &a, "a" );
+	check( !strcmp( cgi_param_next( &a ), "0" ), "a again" );
+	slist_delete( "c", &formvars_start, &formvars_last );
+	check( !cgi_param_next( &a ), "stale" );
+	check( cgi_param_count( "a" ) == 302 && cgi_param_count( "c" ) == 0,
+			"count after delete" );
+
+	/*	only deleting from the form variables ends them	*/
+	other = calloc( 1, sizeof(formvars) );
+	check( other && (other->name = malloc( 2 )), "other item" );
+	strcpy( other->name, "x" );
+	slist_add( other, &other_start, &other_last );
+	cgi_param_iter_start( &a, "a" );
+	check( !strcmp( cgi_param_next( &a ), "0" ), "a before" );
+	check( slist_delete( "x", &other_start, &other_last ), "delete other" );
+	slist_free( &cookies_start );
+	check( (value = cgi_param_next( &a )) && !strcmp( value, "1" ),
+			"a after other" );
+
+	cgi_param_iter_start( &a, "a" );
+	cgi_end();
+	check( !cgi_param_next( &a ), "after end" );
+	check( cgi_param_count( "a" ) == 0, "count after end" );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+/*	stdout to out while including path between two printf()s	*/
+static int include_to( FILE *out, const char *path )
+{
+	FILE *saved = stdout;
+	int n;
+
+	stdout = out;
+	printf( "[" );
+	n = cgi_include( path );
+	printf( "]" );
+	fflush( stdout );
+	stdout = saved;
+
+	return n;
+}
+
+int test_include( void )
+{
+	static char data[20000], buf[sizeof(data) + 16];
+	char path[64], empty[sizeof(path) + 7];
+	FILE *f = NULL, *out = NULL;
+	int fds[2] = { -1, -1 };
+	size_t i, n;
+
+	for ( i = 0; i < sizeof(data); i++ )
+		data[i] = 'a' + i % 26;
+
+	snprintf( path, sizeof(path), "/tmp/libcgi-include-%i", (int) getpid() );
+	snprintf( empty, sizeof(empty), "%s-empty", path );
+	check( (f = fopen( path, "w" )), "fopen" );
+	fwrite( data, 1, sizeof(data), f );
+	fclose( f );
+	check( (f = fopen( empty, "w" )), "fopen empty" );
+	fclose( f );
+
+	/*	regular file, sendfile()	*/
+	check( (out = tmpfile()), "tmpfile" );
+	check( include_to( out, path ) == sizeof(data), "file" );
+	rewind( out );
+	n = fread( buf, 1, sizeof(buf), out );
+	check( n == sizeof(data) + 2 && buf[0] == '[' && buf[n - 1] == ']'
+			&& !memcmp( buf + 1, data, sizeof(data) ), "file content" );
+	fclose( out );
+
+	/*	pipe, splice(), fits into the pipe buffer	*/
+	check( !pipe( fds ), "pipe" );
+	check( (out = fdopen( fds[1], "w" )), "fdopen" );
+	check( include_to( out, path ) == sizeof(data), "pipe" );
+	fclose( out );
+	for ( n = 0; (i = read( fds[0], buf + n, sizeof(buf) - n )) > 0; n += i );
+	close( fds[0] );
+	check( n == sizeof(data) + 2 && buf[0] == '[' && buf[n - 1] == ']'
+			&& !memcmp( buf + 1, data, sizeof(data) ), "pipe content" );
+
+	check( include_to( stderr, empty ) == 0, "empty" );
+	check( cgi_include( "/nonexistent/libcgi" ) == 0, "missing" );
+
+	unlink( path );
+	unlink( empty );
+
+	return EXIT_SUCCESS;
+
+error:
+	unlink( path );
+	unlink( empty );
+	return EXIT_FAILURE;
+}
+
+static char *html_reference( char *dst, const char *src, size_t len )
+{
+	static const struct { unsigned char c; const char *html; } he[] = {
+		{ '<', "&lt;" }, { '>', "&gt;" }, { '&', "&amp;" }, { '"', "&quot;" },
+		{ 0xE4, "&auml;" }, { 0xC4, "&Auml;" }, { 0xF6, "&ouml;" },
+		{ 0xD6, "&Ouml;" }, { 0xFC, "&uuml;" }, { 0xDC, "&Uuml;" },
+		{ 0xDF, "&szlig;" }, { 0xA4, "&euro;" },
+	};
+	size_t i, j;
+
+	for ( i = 0; i < len; i++ )
+	{
+		for ( j = 0; j < sizeof(he) / sizeof(he[0]); j++ )
+			if ( (unsigned char) src[i] == he[j].c ) break;
+
+		if ( j < sizeof(he) / sizeof(he[0]) )
+		{
+			memcpy( dst, he[j].html, strlen( he[j].html ) );
+			dst += strlen( he[j].html );
+		}
+		else
+			*dst++ = src[i];
+	}
+	*dst = '\0';
+
+	return dst;
+}
+
+int test_htmlentities( void )
+{
+	const char alphabet[] = "<>&\"\xE4\xC4\xF6\xD6\xFC\xDC\xDF\xA4\xE3\x80'";
+	char str[200], expect[1500], out_buf[1500], *got = NULL;
+	cgi_request *req = NULL;
+	FILE *out = NULL;
+	unsigned int seed = 7;
+	size_t len, n;
+	int level, round, i;
+
+	got = htmlentities( "Tom & \"Jerry\" <3 \xA4" );
+	check( !strcmp( got, "Tom &amp; &quot;Jerry&quot; &lt;3 &euro;" ),
+			"entities '%s'", got );
+	free( got );
+
+	got = htmlentities( "" );
+	check( !strcmp( got, "" ), "empty" );
+	free( got );
+
+	/*	every scanner must agree with the reference, entities at all
+	 *	positions of 16 and 32 byte blocks	*/
+	for ( level = CGI_SCAN_SCALAR; level <= CGI_SCAN_AVX2; level++ )
+	{
+		if ( cgi_scan_set_level( level ) != level ) break;
+
+		for ( round = 0; round < 2000; round++ )
+		{
+			seed = seed * 1103515245 + 12345;
+			len = (seed >> 16) % sizeof(str);
+			for ( i = 0; i < (int) len; i++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				/*	mostly clean runs, any other byte now and then	*/
+				if ( (seed >> 16) % 8 )
+					str[i] = 'a' + i % 26;
+				else if ( (seed >> 19) % 4 )
+					str[i] = alphabet[(seed >> 21) % (sizeof(alphabet) - 1)];
+				else
+					str[i] = (char) ((seed >> 21) % 255 + 1);
+			}
+			str[len] = '\0';
+
+			html_reference( expect, str, len );
+			got = htmlentities( str );
+			check( !strcmp( got, expect ), "level %i round %i", level, round );
+			free( got );
+		}
+	}
+	cgi_scan_set_level( -1 );
+
+	/*	streaming, NUL bytes included	*/
+	check( (req = cgi_request_new()), "new" );
+	check( (out = tmpfile()), "tmpfile" );
+	cgi_request_set_output( req, out );
+
+	memcpy( str, "a<b\0\xDF>", 6 );
+	check( cgi_request_write_html_escaped( req, str, 6 ), "write" );
+	check( cgi_request_write_html_escaped( req, "", 0 ), "write empty" );
+	check( cgi_request_write_html_escaped( req, "&", 1 ), "write entity" );
+
+	rewind( out );
+	n = fread( out_buf, 1, sizeof(out_buf), out );
+	check( n == 23 && !memcmp( out_buf, "a&lt;b\0&szlig;&gt;&amp;", 23 ),
+			"streamed %zu", n );
+
+	fclose( out );
+	cgi_request_free( req );
+
+	return EXIT_SUCCESS;
+
 error:
+	if ( out ) fclose( out );
+	if ( req ) cgi_request_free( req );
 	return EXIT_FAILURE;
 }
 
@@ -0,0 +1,404 @@
+/*******************************************************************//**
+ *	@file		test_compress.c
+ *
+ *	Test gzip compression of responses, streamed and buffered, and the
+ *	Accept-Encoding negotiation.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "cgi_test.h"
+
+#include "libcgi/cgi.h"
+#include "libcgi/request.h"
+
+#define BODY_SIZE	100000
+
+/*	local declarations	*/
+static int test_stream( void );
+static int test_buffered( void );
+static int test_negotiate( void );
+static int test_precompressed( void );
+
+static char body[BODY_SIZE];
+static char out_buf[2 * BODY_SIZE];
+
+int main( int argc, char *argv[] )
+{
+	struct cgi_test_action	actions[] = {
+		{ "stream",		test_stream		},
+		{ "buffered",	test_buffered	},
+		{ "negotiate",	test_negotiate	},
+		{ "precompressed",	test_precompressed	},
+	};
+	size_t i;
+
+	/*	require at least one argument to select test	*/
+	if ( argc < 2 ) return EXIT_FAILURE;
+
+	for ( i = 0; i < BODY_SIZE; i++ )
+		body[i] = "<p>libcgi</p>\n"[i % 14];
+
+	return run_action( argv[1], actions,
+			sizeof(actions)/sizeof(struct cgi_test_action) );
+}
+
+/*	run one request writing len bytes of body, returns the output	*/
+static size_t run( const char *accept, int buffered, size_t len )
+{
+	cgi_request *req;
+	FILE *out;
+	size_t i, n;
+
+	req = cgi_request_new();
+	out = tmpfile();
+	if ( !req || !out ) return 0;
+
+	if ( accept ) cgi_request_setenv( req, "HTTP_ACCEPT_ENCODING", accept );
+	cgi_request_setenv( req, "REQUEST_METHOD", "GET" );
+	cgi_request_set_output( req, out );
+
+	if ( buffered ) cgi_request_response_buffer( req );
+	cgi_request_init_headers( req );
+
+	/*	in pieces, like a program printing a page	*/
+	for ( i = 0; i < len; i += n )
+	{
+		n = len - i < 1000 ? len - i : 1000;
+		cgi_request_write( req, body + i, n );
+	}
+
+	cgi_request_free( req );
+
+	rewind( out );
+	n = fread( out_buf, 1, sizeof(out_buf) - 1, out );
+	out_buf[n] = '\0';
+	fclose( out );
+
+	return n;
+}
+
+/*	offset of the body in out_buf	*/
+static size_t body_offset( void )
+{
+	char *end = strstr( out_buf, "\r\n\r\n" );
+
+	return end ? (size_t) (end - out_buf) + 4 : 0;
+}
+
+/*	the compressed body in out_buf decodes to the first len bytes of body	*/
+static int inflates_to( size_t offset, size_t size, size_t len )
+{
+	static char plain[BODY_SIZE + 1];
+	z_stream zs;
+	int ret;
+
+	memset( &zs, 0, sizeof(zs) );
+	if ( inflateInit2( &zs, 15 + 16 ) != Z_OK ) return 0;
+
+	zs.next_in = (unsigned char *) out_buf + offset;
+	zs.avail_in = size - offset;
+	zs.next_out = (unsigned char *) plain;
+	zs.avail_out = sizeof(plain);
+
+	ret = inflate( &zs, Z_FINISH );
+	inflateEnd( &zs );
+
+	return ret == Z_STREAM_END && zs.total_out == len
+			&& !memcmp( plain, body, len );
+}
+
+int test_stream( void )
+{
+	size_t n, off;
+
+	cgi_compress( 6, 4096 );
+
+	n = run( "deflate, gzip", 0, BODY_SIZE );
+	off = body_offset();
+	check( off, "headers" );
+	check( strstr( out_buf, "Vary: Accept-Encoding\r\n" ), "vary" );
+	check( strstr( out_buf, "Content-Encoding: gzip\r\n" ), "encoding" );
+	check( n - off < BODY_SIZE / 10, "size %lu", (unsigned long) (n - off) );
+	check( inflates_to( off, n, BODY_SIZE ), "inflate" );
+
+	/*	below the threshold the body stays as it is	*/
+	n = run( "gzip", 0, 4000 );
+	off = body_offset();
+	check( strstr( out_buf, "Vary: Accept-Encoding\r\n" ), "small vary" );
+	check( !strstr( out_buf, "Content-Encoding" ), "small encoding" );
+	check( n - off == 4000 && !memcmp( out_buf + off, body, 4000 ),
+			"small body" );
+
+	/*	exactly the threshold is compressed	*/
+	n = run( "gzip", 0, 4096 );
+	off = body_offset();
+	check( strstr( out_buf, "Content-Encoding: gzip\r\n" ), "threshold" );
+	check( inflates_to( off, n, 4096 ), "threshold inflate" );
+
+	/*	zlib's default level	*/
+	cgi_compress( -1, 0 );
+	n = run( "gzip", 0, BODY_SIZE );
+	off = body_offset();
+	check( strstr( out_buf, "Content-Encoding: gzip\r\n" ), "default level" );
+	check( inflates_to( off, n, BODY_SIZE ), "default inflate" );
+
+	/*	disabled	*/
+	cgi_compress( 0, 0 );
+	n = run( "gzip", 0, BODY_SIZE );
+	check( !strstr( out_buf, "Vary" ) && n - body_offset() == BODY_SIZE,
+			"disabled" );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_buffered( void )
+{
+	char length[64];
+	size_t n, off;
+
+	cgi_compress( 9, 1024 );
+
+	n = run( "gzip", 1, BODY_SIZE );
+	off = body_offset();
+	check( strstr( out_buf, "Content-Encoding: gzip\r\n" ), "encoding" );
+	snprintf( length, sizeof(length), "Content-Length: %lu\r\n",
+			(unsigned long) (n - off) );
+	check( strstr( out_buf, length ), "length '%s'", length );
+	check( inflates_to( off, n, BODY_SIZE ), "inflate" );
+
+	n = run( "gzip", 1, 100 );
+	off = body_offset();
+	check( strstr( out_buf, "Vary: Accept-Encoding\r\n" ), "small vary" );
+	check( strstr( out_buf, "Content-Length: 100\r\n" ), "small length" );
+	check( !strstr( out_buf, "Content-Encoding" ), "small encoding" );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_negotiate( void )
+{
+	const struct {
+		const char	*header;
+		int			gzip;
+	} cases[] = {
+		{ NULL,						0 },
+		{ "",						0 },
+		{ "gzip",					1 },
+		{ "GZip",					1 },
+		{ "x-gzip",					1 },
+		{ "deflate, br",			0 },
+		{ "gzipper",				0 },
+		{ "gzip;q=0",				0 },
+		{ "gzip; q=0.000, *",		0 },
+		{ "gzip;q=0.5",				1 },
+		{ "gzip;q=0.01",			1 },
+		{ "*",						1 },
+		{ "*;q=0",					0 },
+		{ "identity, *;q=0.1",		1 },
+		{ "br;q=1.0, gzip;q=0.8",	1 },
+	};
+	size_t i;
+
+	cgi_compress( 1, 0 );
+
+	for ( i = 0; i < sizeof(cases) / sizeof(cases[0]); i++ )
+	{
+		run( cases[i].header, 0, 2000 );
+		check( !strstr( out_buf, "Content-Encoding: gzip" ) == !cases[i].gzip,
+				"'%s'", cases[i].header ? cases[i].header : "(null)" );
+	}
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+/*	write data to path, and gzip compressed to path.gz	*/
+static int write_files( const char *path, const char *data, size_t len,
+		const char *gz_data, int level, const char *name )
+{
+	static unsigned char out[2 * BODY_SIZE];
+	char gz_path[128];
+	gz_header header;
+	z_stream zs;
+	FILE *f;
+	int ok;
+
+	if ( !(f = fopen( path, "w" )) ) return 0;
+	ok = fwrite( data, 1, len, f ) == len;
+	fclose( f );
+
+	memset( &zs, 0, sizeof(zs) );
+	memset( &header, 0, sizeof(header) );
+	header.name = (unsigned char *) name;
+	header.os = 3;
+	if ( deflateInit2( &zs, level, Z_DEFLATED, 15 + 16, 8,
+			Z_DEFAULT_STRATEGY ) != Z_OK )
+		return 0;
+	if ( name ) deflateSetHeader( &zs, &header );
+
+	zs.next_in = (unsigned char *) gz_data;
+	zs.avail_in = len;
+	zs.next_out = out;
+	zs.avail_out = sizeof(out);
+	ok = ok && deflate( &zs, Z_FINISH ) == Z_STREAM_END;
+	deflateEnd( &zs );
+
+	snprintf( gz_path, sizeof(gz_path), "%s.gz", path );
+	if ( !(f = fopen( gz_path, "w" )) ) return 0;
+	ok = ok && fwrite( out, 1, zs.total_out, f ) == zs.total_out;
+	fclose( f );
+
+	return ok;
+}
+
+/*	a page of fragments through the default request, out_buf gets the
+ *	decompressed body	*/
+static int page( const char *dir, int buffered, size_t *plain_len )
+{
+	static char plain[4 * BODY_SIZE];
+	FILE *out, *saved = stdout;
+	char path[128];
+	size_t n, off;
+	z_stream zs;
+	int ret;
+
+	if ( !(out = tmpfile()) ) return 0;
+	stdout = out;
+
+	if ( buffered ) cgi_response_buffer();
+	cgi_init_headers();
+	printf( "head\n" );
+	snprintf( path, sizeof(path), "%s/top.inc", dir );
+	cgi_include( path );
+	printf( "mid\n" );
+	snprintf( path, sizeof(path), "%s/main.inc", dir );
+	cgi_include( path );
+	snprintf( path, sizeof(path), "%s/tiny.inc", dir );
+	cgi_include( path );
+	snprintf( path, sizeof(path), "%s/plain.inc", dir );
+	cgi_include( path );
+	printf( "tail\n" );
+	cgi_end();
+
+	stdout = saved;
+	rewind( out );
+	n = fread( out_buf, 1, sizeof(out_buf) - 1, out );
+	out_buf[n] = '\0';
+	fclose( out );
+
+	if ( !strstr( out_buf, "Content-Encoding: gzip\r\n" ) ) return 0;
+	off = body_offset();
+
+	memset( &zs, 0, sizeof(zs) );
+	if ( inflateInit2( &zs, 15 + 16 ) != Z_OK ) return 0;
+	zs.next_in = (unsigned char *) out_buf + off;
+	zs.avail_in = n - off;
+	zs.next_out = (unsigned char *) plain;
+	zs.avail_out = sizeof(plain) - 1;
+	ret = inflate( &zs, Z_FINISH );
+	inflateEnd( &zs );
+
+	/*	nothing after the gzip stream	*/
+	if ( ret != Z_STREAM_END || zs.avail_in ) return 0;
+
+	plain[zs.total_out] = '\0';
+	*plain_len = zs.total_out;
+	memcpy( out_buf, plain, zs.total_out + 1 );
+
+	return 1;
+}
+
+int test_precompressed( void )
+{
+	static char upper[BODY_SIZE];
+	char dir[64], path[128], expect[256];
+	struct timeval times[2];
+	size_t len, i;
+	int buffered;
+
+	snprintf( dir, sizeof(dir), "/tmp/libcgi-gz-%i", (int) getpid() );
+	check( !mkdir( dir, 0700 ), "mkdir" );
+
+	/*	the .gz files hold upper case text, to see which one is sent	*/
+	for ( i = 0; i < BODY_SIZE; i++ )
+		upper[i] = body[i] >= 'a' && body[i] <= 'z' ? body[i] - 32 : body[i];
+
+	snprintf( path, sizeof(path), "%s/top.inc", dir );
+	check( write_files( path, body, 1000, upper, 9, "top.inc" ), "top" );
+	snprintf( path, sizeof(path), "%s/main.inc", dir );
+	check( write_files( path, body, BODY_SIZE, upper, 1, NULL ), "main" );
+	snprintf( path, sizeof(path), "%s/tiny.inc", dir );
+	check( write_files( path, "x", 1, "X", 6, NULL ), "tiny" );
+	snprintf( path, sizeof(path), "%s/plain.inc", dir );
+	check( write_files( path, "plain\n", 6, "PLAIN\n", 6, NULL ), "plain" );
+
+	/*	plain.inc.gz is older than plain.inc	*/
+	strcat( path, ".gz" );
+	times[0].tv_sec = times[1].tv_sec = 1000000000;
+	times[0].tv_usec = times[1].tv_usec = 0;
+	check( !utimes( path, times ), "utimes" );
+
+	setenv( "HTTP_ACCEPT_ENCODING", "gzip", 1 );
+	cgi_compress( 6, 0 );
+
+	for ( buffered = 0; buffered < 2; buffered++ )
+	{
+		check( page( dir, buffered, &len ), "page %i", buffered );
+		check( len == 5 + 1000 + 4 + BODY_SIZE + 1 + 6 + 5,
+				"length %lu", (unsigned long) len );
+		check( !strncmp( out_buf, "head\n", 5 ), "head" );
+		check( !memcmp( out_buf + 5, upper, 1000 ), "top from .gz" );
+		check( !strncmp( out_buf + 1005, "mid\n", 4 ), "mid" );
+		check( !memcmp( out_buf + 1009, upper, BODY_SIZE ), "main from .gz" );
+		snprintf( expect, sizeof(expect), "Xplain\ntail\n" );
+		check( !strcmp( out_buf + 1009 + BODY_SIZE, expect ),
+				"tail '%s'", out_buf + 1009 + BODY_SIZE );
+	}
+
+	/*	not taken when the client does not accept gzip	*/
+	setenv( "HTTP_ACCEPT_ENCODING", "identity", 1 );
+	check( !page( dir, 0, &len ), "identity" );
+	check( strstr( out_buf, "head\n<p>libcgi</p>" ), "identity body" );
+
+	unsetenv( "HTTP_ACCEPT_ENCODING" );
+	cgi_compress( 0, 0 );
+	for ( i = 0; i < 4; i++ )
+	{
+		snprintf( path, sizeof(path), "%s/%s", dir,
+				(const char *[]) { "top.inc", "main.inc", "tiny.inc",
+						"plain.inc" }[i] );
+		unlink( path );
+		strcat( path, ".gz" );
+		unlink( path );
+	}
+	rmdir( dir );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
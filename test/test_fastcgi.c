@@ -0,0 +1,310 @@
+/*******************************************************************//**
+ *	@file		test_fastcgi.c
+ *
+ *	Test the FastCGI request loop.  The web server side is played by
+ *	the test itself over a socketpair: all records are written up
+ *	front, the loop serves the connection, then the answer records are
+ *	read back and checked.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cgi_test.h"
+
+#include "libcgi/cgi.h"
+#include "libcgi/fastcgi.h"
+
+#define FCGI_BEGIN_REQUEST		1
+#define FCGI_END_REQUEST		3
+#define FCGI_PARAMS				4
+#define FCGI_STDIN				5
+#define FCGI_STDOUT				6
+#define FCGI_GET_VALUES			9
+#define FCGI_GET_VALUES_RESULT	10
+
+struct fcgi_answer {
+	char	out[4096];
+	size_t	out_len;
+	int		app_status;
+	int		protocol_status;
+};
+
+/*	local declarations	*/
+static int test_get( void );
+static int test_post( void );
+static int test_keep_conn( void );
+static int test_get_values( void );
+
+int main( int argc, char *argv[] )
+{
+	struct cgi_test_action	actions[] = {
+		{ "get",		test_get		},
+		{ "post",		test_post		},
+		{ "keepconn",	test_keep_conn	},
+		{ "values",		test_get_values	},
+	};
+
+	/*	require at least one argument to select test	*/
+	if ( argc < 2 ) return EXIT_FAILURE;
+
+	return run_action( argv[1], actions,
+			sizeof(actions)/sizeof(struct cgi_test_action) );
+}
+
+/*	***	web server side	***	*/
+
+static void put_record( int fd, int type, int id, const void *data,
+		size_t len, size_t padding )
+{
+	unsigned char hdr[8] = { 1, type, id >> 8, id & 0xFF,
+			len >> 8, len & 0xFF, padding, 0 };
+	unsigned char pad[8] = { 0 };
+
+	write( fd, hdr, sizeof(hdr) );
+	if ( len ) write( fd, data, len );
+	if ( padding ) write( fd, pad, padding );
+}
+
+static void put_begin( int fd, int id, int keep_conn )
+{
+	unsigned char body[8] = { 0, 1, keep_conn, 0, 0, 0, 0, 0 };
+
+	put_record( fd, FCGI_BEGIN_REQUEST, id, body, sizeof(body), 0 );
+}
+
+/*	params as NULL terminated list of name, value, name, value, …	*/
+static void put_params( int fd, int id, const char **pairs )
+{
+	unsigned char buf[1024];
+	size_t len = 0, name_len, value_len;
+
+	for ( ; pairs[0]; pairs += 2 )
+	{
+		name_len = strlen( pairs[0] );
+		value_len = strlen( pairs[1] );
+		buf[len++] = name_len;
+		buf[len++] = value_len;
+		memcpy( buf + len, pairs[0], name_len );
+		len += name_len;
+		memcpy( buf + len, pairs[1], value_len );
+		len += value_len;
+	}
+
+	/*	split in two records to cross a pair boundary	*/
+	put_record( fd, FCGI_PARAMS, id, buf, len / 2, 3 );
+	put_record( fd, FCGI_PARAMS, id, buf + len / 2, len - len / 2, 0 );
+	put_record( fd, FCGI_PARAMS, id, NULL, 0, 0 );
+}
+
+static int get_answer( int fd, int id, struct fcgi_answer *answer )
+{
+	unsigned char hdr[8], content[65535 + 255];
+	size_t len;
+
+	memset( answer, 0, sizeof(*answer) );
+
+	while ( read( fd, hdr, sizeof(hdr) ) == sizeof(hdr) )
+	{
+		len = (hdr[4] << 8) | hdr[5];
+		if ( len + hdr[6] && read( fd, content, len + hdr[6] )
+				!= (ssize_t) (len + hdr[6]) )
+			return -1;
+		if ( ((hdr[2] << 8) | hdr[3]) != id ) continue;
+
+		if ( hdr[1] == FCGI_STDOUT || hdr[1] == FCGI_GET_VALUES_RESULT )
+		{
+			if ( answer->out_len + len >= sizeof(answer->out) ) return -1;
+			memcpy( answer->out + answer->out_len, content, len );
+			answer->out_len += len;
+			answer->out[answer->out_len] = '\0';
+			if ( hdr[1] == FCGI_GET_VALUES_RESULT ) return 0;
+		}
+		else if ( hdr[1] == FCGI_END_REQUEST )
+		{
+			answer->app_status = (content[0] << 24) | (content[1] << 16)
+					| (content[2] << 8) | content[3];
+			answer->protocol_status = content[4];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*	***	handlers	***	*/
+
+static int handler( void *arg )
+{
+	char *a, *cookie;
+
+	(void) arg;
+
+	cgi_init();
+	cgi_process_form();
+	cgi_init_headers();
+
+	a = cgi_param( "a" );
+	cookie = cgi_cookie_value( "c" );
+
+	printf( "a=%s c=%s query=%s", a ? a : "-", cookie ? cookie : "-",
+			getenv( "QUERY_STRING" ) ? "set" : "unset" );
+
+	return 3;
+}
+
+/*	***	tests	***	*/
+
+int test_get( void )
+{
+	const char *params[] = {
+		"REQUEST_METHOD",	"GET",
+		"QUERY_STRING",		"a=%41b+c&b=2",
+		"HTTP_COOKIE",		"c=cookie",
+		NULL
+	};
+	struct fcgi_answer answer;
+	int sv[2];
+
+	check( !socketpair( AF_UNIX, SOCK_STREAM, 0, sv ), "socketpair" );
+
+	put_begin( sv[0], 1, 0 );
+	put_params( sv[0], 1, params );
+	put_record( sv[0], FCGI_STDIN, 1, NULL, 0, 0 );
+	shutdown( sv[0], SHUT_WR );
+
+	check( cgi_fcgi_serve_connection( sv[1], handler, NULL ) == 0, "serve" );
+	check( get_answer( sv[0], 1, &answer ) == 0, "answer" );
+
+	check( answer.protocol_status == 0, "protocol status" );
+	check( answer.app_status == 3, "app status %i", answer.app_status );
+	check( !strcmp( answer.out, "Content-type: text/html\r\n\r\n"
+			"a=Ab c c=cookie query=set" ), "output '%s'", answer.out );
+	check( getenv( "QUERY_STRING" ) == NULL, "params unset" );
+
+	close( sv[0] );
+	close( sv[1] );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_post( void )
+{
+	const char *params[] = {
+		"REQUEST_METHOD",	"POST",
+		"CONTENT_LENGTH",	"14",
+		NULL
+	};
+	struct fcgi_answer answer;
+	int sv[2];
+
+	check( !socketpair( AF_UNIX, SOCK_STREAM, 0, sv ), "socketpair" );
+
+	put_begin( sv[0], 7, 0 );
+	put_params( sv[0], 7, params );
+	/*	body split in the middle of an escape	*/
+	put_record( sv[0], FCGI_STDIN, 7, "b=0&a=x%2", 9, 7 );
+	put_record( sv[0], FCGI_STDIN, 7, "0y%21", 5, 0 );
+	put_record( sv[0], FCGI_STDIN, 7, NULL, 0, 0 );
+	shutdown( sv[0], SHUT_WR );
+
+	check( cgi_fcgi_serve_connection( sv[1], handler, NULL ) == 0, "serve" );
+	check( get_answer( sv[0], 7, &answer ) == 0, "answer" );
+
+	check( !strcmp( answer.out, "Content-type: text/html\r\n\r\n"
+			"a=x y! c=- query=unset" ), "output '%s'", answer.out );
+
+	close( sv[0] );
+	close( sv[1] );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_keep_conn( void )
+{
+	const char *first[] = {
+		"QUERY_STRING",		"a=first",
+		"HTTP_COOKIE",		"c=one",
+		NULL
+	};
+	const char *second[] = {
+		"REQUEST_METHOD",	"GET",
+		NULL
+	};
+	struct fcgi_answer answer;
+	int sv[2];
+
+	check( !socketpair( AF_UNIX, SOCK_STREAM, 0, sv ), "socketpair" );
+
+	put_begin( sv[0], 1, 1 );
+	put_params( sv[0], 1, first );
+	/*	unread body must be skipped by the loop	*/
+	put_record( sv[0], FCGI_STDIN, 1, "unread", 6, 0 );
+	put_record( sv[0], FCGI_STDIN, 1, NULL, 0, 0 );
+
+	put_begin( sv[0], 2, 1 );
+	put_params( sv[0], 2, second );
+	put_record( sv[0], FCGI_STDIN, 2, NULL, 0, 0 );
+	shutdown( sv[0], SHUT_WR );
+
+	check( cgi_fcgi_serve_connection( sv[1], handler, NULL ) == 0, "serve" );
+
+	check( get_answer( sv[0], 1, &answer ) == 0, "first answer" );
+	check( !strcmp( answer.out, "Content-type: text/html\r\n\r\n"
+			"a=first c=one query=set" ), "first output '%s'", answer.out );
+
+	/*	nothing of the first request may leak into the second	*/
+	check( get_answer( sv[0], 2, &answer ) == 0, "second answer" );
+	check( !strcmp( answer.out, "Content-type: text/html\r\n\r\n"
+			"a=- c=- query=unset" ), "second output '%s'", answer.out );
+
+	close( sv[0] );
+	close( sv[1] );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_get_values( void )
+{
+	const unsigned char query[] = "\x0f\x00" "FCGI_MPXS_CONNS";
+	struct fcgi_answer answer;
+	int sv[2];
+
+	check( !socketpair( AF_UNIX, SOCK_STREAM, 0, sv ), "socketpair" );
+
+	put_record( sv[0], FCGI_GET_VALUES, 0, query, sizeof(query) - 1, 0 );
+	shutdown( sv[0], SHUT_WR );
+
+	check( cgi_fcgi_serve_connection( sv[1], handler, NULL ) == 0, "serve" );
+	check( get_answer( sv[0], 0, &answer ) == 0, "answer" );
+	check( answer.out_len == 2 + 15 + 1, "length %zu", answer.out_len );
+	check( !memcmp( answer.out + 2, "FCGI_MPXS_CONNS0", 16 ), "value" );
+
+	close( sv[0] );
+	close( sv[1] );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -0,0 +1,1033 @@
+/*******************************************************************//**
+ *	@file		test_request.c
+ *
+ *	Test request contexts: several requests side by side in one
+ *	thread, and one request per thread in a small worker pool.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cgi_test.h"
+
+#include "libcgi/cgi.h"
+#include "libcgi/request.h"
+
+#define WORKERS		4
+#define ROUNDS		500
+
+/*	local declarations	*/
+static int test_side_by_side( void );
+static int test_threads( void );
+static int test_response( void );
+static int test_response_default( void );
+static int test_conditional( void );
+static int test_ranges( void );
+static int test_printf_html( void );
+static int test_headers( void );
+static int test_cookies( void );
+static int test_uploads( void );
+static int test_errors( void );
+
+int main( int argc, char *argv[] )
+{
+	struct cgi_test_action	actions[] = {
+		{ "side_by_side",	test_side_by_side	},
+		{ "threads",		test_threads		},
+		{ "response",		test_response		},
+		{ "response_default",	test_response_default	},
+		{ "conditional",	test_conditional	},
+		{ "ranges",			test_ranges			},
+		{ "printf_html",	test_printf_html	},
+		{ "headers",		test_headers		},
+		{ "cookies",		test_cookies		},
+		{ "uploads",		test_uploads		},
+		{ "errors",			test_errors			},
+	};
+
+	/*	require at least one argument to select test	*/
+	if ( argc < 2 ) return EXIT_FAILURE;
+
+	return run_action( argv[1], actions,
+			sizeof(actions)/sizeof(struct cgi_test_action) );
+}
+
+/*	POST body in a temporary file, as request input	*/
+static FILE *body( const char *data )
+{
+	FILE *f = tmpfile();
+
+	if ( !f ) return NULL;
+
+	fputs( data, f );
+	rewind( f );
+
+	return f;
+}
+
+int test_side_by_side( void )
+{
+	cgi_request *a = NULL, *b = NULL;
+	FILE *in = NULL, *out = NULL;
+	char buf[256];
+	size_t n;
+
+	check( (a = cgi_request_new()), "new a" );
+	check( (b = cgi_request_new()), "new b" );
+	check( (in = body( "v=1&v=2&x=post" )), "body" );
+	check( (out = tmpfile()), "out" );
+
+	cgi_request_setenv( a, "QUERY_STRING", "v=3&x=get" );
+	cgi_request_setenv( a, "HTTP_COOKIE", "c=a" );
+	cgi_request_setenv( b, "REQUEST_METHOD", "POST" );
+	cgi_request_setenv( b, "CONTENT_LENGTH", "14" );
+	cgi_request_setenv( b, "HTTP_COOKIE", "c=b" );
+	cgi_request_set_input( b, in );
+	cgi_request_set_output( b, out );
+
+	check( cgi_request_getenv( a, "REQUEST_METHOD" ) == NULL, "own env" );
+	check( cgi_request_init( a ) && cgi_request_init( b ), "init" );
+	check( cgi_request_process_form( a ), "form a" );
+	check( cgi_request_process_form( b ), "form b" );
+
+	check( !strcmp( cgi_request_param( a, "x" ), "get" ), "param a" );
+	check( !strcmp( cgi_request_param( b, "x" ), "post" ), "param b" );
+	check( !strcmp( cgi_request_cookie_value( a, "c" ), "a" ), "cookie a" );
+	check( !strcmp( cgi_request_cookie_value( b, "c" ), "b" ), "cookie b" );
+
+	/*	iterations of different requests do not disturb each other	*/
+	check( !strcmp( cgi_request_param_multiple( b, "v" ), "1" ), "b 1" );
+	check( !strcmp( cgi_request_param_multiple( a, "v" ), "3" ), "a 3" );
+	check( !strcmp( cgi_request_param_multiple( b, "v" ), "2" ), "b 2" );
+	check( !cgi_request_param_multiple( a, "v" ), "a end" );
+
+	/*	the default request is untouched	*/
+	check( formvars_start == NULL && cookies_start == NULL, "globals" );
+	check( cgi_param( "x" ) == NULL, "default param" );
+
+	check( cgi_request_add_cookie( b, "s", "1", NULL, NULL, NULL, 0 ),
+			"cookie" );
+	cgi_request_init_headers( b );
+	check( !cgi_request_add_cookie( b, "late", "1", NULL, NULL, NULL, 0 ),
+			"cookie after headers" );
+	rewind( out );
+	n = fread( buf, 1, sizeof(buf) - 1, out );
+	buf[n] = '\0';
+	check( !strcmp( buf, "Set-cookie: s=1;\r\nContent-type: text/html\r\n\r\n" ),
+			"output '%s'", buf );
+
+	/*	end resets a request for reuse, environment included	*/
+	cgi_request_end( a );
+	check( cgi_request_param( a, "x" ) == NULL, "reset" );
+	check( cgi_request_getenv( a, "QUERY_STRING" )
+			== getenv( "QUERY_STRING" ), "env reset" );
+	check( !strcmp( cgi_request_param( b, "x" ), "post" ), "b kept" );
+
+	cgi_request_free( a );
+	cgi_request_free( b );
+	cgi_request_free( NULL );
+	fclose( in );
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+/*	whole content of a stream	*/
+static char *slurp( FILE *f, char *buf, size_t size )
+{
+	size_t n;
+
+	fflush( f );
+	rewind( f );
+	n = fread( buf, 1, size - 1, f );
+	buf[n] = '\0';
+
+	return buf;
+}
+
+int test_response( void )
+{
+	static char big[100000];
+	static char buf[120000];
+	cgi_request *req = NULL;
+	FILE *out = NULL;
+	char expect[256];
+	int i;
+
+	check( (req = cgi_request_new()), "new" );
+	check( (out = tmpfile()), "out" );
+	cgi_request_set_output( req, out );
+
+	/*	unbuffered writes go out right away	*/
+	check( cgi_request_write( req, "direct", 6 ), "write" );
+	check( !strcmp( slurp( out, buf, sizeof(buf) ), "direct" ), "direct" );
+	rewind( out );
+	check( !ftruncate( fileno( out ), 0 ), "truncate" );
+
+	check( cgi_request_response_buffer( req ), "buffer" );
+	check( cgi_request_response_buffer( req ), "buffer twice" );
+	check( cgi_request_add_cookie( req, "a", "1", NULL, NULL, NULL, 0 ),
+			"cookie" );
+	cgi_request_send_header( req, "X-Test: yes" );
+	cgi_request_init_headers( req );
+
+	memset( big, 'x', sizeof(big) );
+	for ( i = 0; i < 1000; i++ )
+		check( cgi_request_write( req, "0123456789", 10 ), "small %i", i );
+	check( cgi_request_write_ref( req, big, sizeof(big) ), "ref" );
+	check( cgi_request_write( req, "end", 3 ), "end" );
+
+	/*	nothing is written before cgi_request_end()	*/
+	check( !strcmp( slurp( out, buf, sizeof(buf) ), "" ), "held" );
+
+	/*	referenced data is sent as it is at the end	*/
+	big[0] = 'y';
+	cgi_request_end( req );
+
+	snprintf( expect, sizeof(expect), "Set-cookie: a=1;\r\n"
+			"X-Test: yes\r\n"
+			"Content-type: text/html\r\n"
+			"Content-Length: %i\r\n\r\n", 10000 + 100000 + 3 );
+	slurp( out, buf, sizeof(buf) );
+	check( !strncmp( buf, expect, strlen( expect ) ), "headers '%.120s'", buf );
+	for ( i = 0; i < 1000; i++ )
+	{
+		check( !memcmp( buf + strlen( expect ) + i * 10, "0123456789", 10 ),
+				"small %i", i );
+	}
+	check( buf[strlen( expect ) + 10000] == 'y', "ref data" );
+	check( !strcmp( buf + strlen( expect ) + 110000, "end" ), "end" );
+
+	/*	the next request is not buffered unless asked again	*/
+	rewind( out );
+	check( !ftruncate( fileno( out ), 0 ), "truncate" );
+	cgi_request_init_headers( req );
+	check( !strcmp( slurp( out, buf, sizeof(buf) ),
+			"Content-type: text/html\r\n\r\n" ), "unbuffered" );
+	check( !cgi_request_response_buffer( req ), "headers sent" );
+
+	cgi_request_free( req );
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+int test_response_default( void )
+{
+	FILE *out = NULL, *inc = NULL, *saved = stdout;
+	char path[64], buf[512];
+
+	snprintf( path, sizeof(path), "/tmp/libcgi-include-%i", (int) getpid() );
+	check( (inc = fopen( path, "w" )), "include file" );
+	fputs( "<p>included</p>\n", inc );
+	fclose( inc );
+
+	check( (out = tmpfile()), "out" );
+	stdout = out;
+
+	check( cgi_response_buffer(), "buffer" );
+	cgi_send_header( "Content-Type: text/plain" );
+	printf( "hello %i\n", 42 );
+	check( cgi_include( path ) == 16, "include" );
+	check( cgi_write( "bye\n", 4 ), "write" );
+	cgi_end();
+
+	check( stdout == out, "stdout restored" );
+	stdout = saved;
+	unlink( path );
+
+	check( !strcmp( slurp( out, buf, sizeof(buf) ),
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 29\r\n\r\n"
+			"hello 42\n<p>included</p>\nbye\n" ), "output '%s'", buf );
+
+	/*	without any header text/html is assumed	*/
+	rewind( out );
+	check( !ftruncate( fileno( out ), 0 ), "truncate" );
+	stdout = out;
+	check( cgi_response_buffer(), "buffer" );
+	fputs( "x", stdout );
+	cgi_end();
+	stdout = saved;
+	check( !strcmp( slurp( out, buf, sizeof(buf) ),
+			"Content-type: text/html\r\n"
+			"Content-Length: 1\r\n\r\nx" ), "default '%s'", buf );
+
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	stdout = saved;
+	return EXIT_FAILURE;
+}
+
+/*	value of a header in a response, "" if missing	*/
+static char *header_value( const char *response, const char *name,
+		char *buf, size_t size )
+{
+	const char *p = strstr( response, name );
+	size_t n = 0;
+
+	if ( p )
+	{
+		p += strlen( name );
+		n = strcspn( p, "\r" );
+		if ( n >= size ) n = size - 1;
+		memcpy( buf, p, n );
+	}
+	buf[n] = '\0';
+
+	return buf;
+}
+
+/*	response of cgi_send_file() with the default request	*/
+static int send_file( FILE *out, const char *path, char *buf, size_t size,
+		int buffered )
+{
+	FILE *saved = stdout;
+	int status;
+
+	rewind( out );
+	if ( ftruncate( fileno( out ), 0 ) ) return -1;
+
+	stdout = out;
+	if ( buffered ) cgi_response_buffer();
+	status = cgi_send_file( path, "text/plain" );
+	cgi_end();
+	stdout = saved;
+	slurp( out, buf, size );
+
+	return status;
+}
+
+int test_conditional( void )
+{
+	FILE *out = NULL, *f = NULL, *saved = stdout;
+	char path[64], buf[512], etag[64], date[64], weak[160];
+	int i;
+
+	snprintf( path, sizeof(path), "/tmp/libcgi-cond-%i", (int) getpid() );
+	check( (f = fopen( path, "w" )), "file" );
+	fputs( "conditional\n", f );
+	fclose( f );
+	check( (out = tmpfile()), "out" );
+
+	setenv( "REQUEST_METHOD", "GET", 1 );
+	unsetenv( "HTTP_IF_NONE_MATCH" );
+	unsetenv( "HTTP_IF_MODIFIED_SINCE" );
+
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 200, "200" );
+	check( strstr( buf, "Content-type: text/plain\r\n"
+			"Content-Length: 12\r\n\r\nconditional\n" ), "body '%s'", buf );
+	check( header_value( buf, "ETag: ", etag, sizeof(etag) )[0] == '"',
+			"etag '%s'", buf );
+	check( header_value( buf, "Last-Modified: ", date, sizeof(date) )[0],
+			"last modified" );
+	check( strlen( date ) == 29 && !strcmp( date + 25, " GMT" ), "date '%s'",
+			date );
+
+	/*	weak comparison in a list, no body	*/
+	snprintf( weak, sizeof(weak), "\"other\", W/%s", etag );
+	setenv( "HTTP_IF_NONE_MATCH", weak, 1 );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 304, "304 etag" );
+	check( strstr( buf, "Status: 304 Not Modified\r\n\r\n" )
+			&& !strstr( buf, "conditional" ), "not modified '%s'", buf );
+	setenv( "HTTP_IF_NONE_MATCH", "*", 1 );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 304, "304 *" );
+
+	/*	If-None-Match wins over If-Modified-Since	*/
+	setenv( "HTTP_IF_NONE_MATCH", "\"other\"", 1 );
+	setenv( "HTTP_IF_MODIFIED_SINCE", date, 1 );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 200, "etag wins" );
+
+	unsetenv( "HTTP_IF_NONE_MATCH" );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 304, "304 date" );
+	setenv( "HTTP_IF_MODIFIED_SINCE", "Sunday, 06-Nov-94 08:49:37 GMT", 1 );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 200, "older" );
+	setenv( "HTTP_IF_MODIFIED_SINCE", "Sun Nov  6 08:49:37 2095", 1 );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 304, "asctime" );
+	setenv( "HTTP_IF_MODIFIED_SINCE", "yesterday", 1 );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 200, "bad date" );
+
+	/*	only for GET and HEAD	*/
+	setenv( "HTTP_IF_MODIFIED_SINCE", date, 1 );
+	setenv( "REQUEST_METHOD", "POST", 1 );
+	check( send_file( out, path, buf, sizeof(buf), 0 ) == 200, "post" );
+	setenv( "REQUEST_METHOD", "GET", 1 );
+	unsetenv( "HTTP_IF_MODIFIED_SINCE" );
+
+	/*	buffered, the same tag without compression	*/
+	check( send_file( out, path, buf, sizeof(buf), 1 ) == 200, "buffered" );
+	check( strstr( buf, "Content-Length: 12\r\n\r\nconditional\n" ),
+			"buffered body '%s'", buf );
+	check( strstr( buf, etag ), "same tag '%s'", buf );
+	setenv( "HTTP_IF_NONE_MATCH", etag, 1 );
+	check( send_file( out, path, buf, sizeof(buf), 1 ) == 304, "buffered 304" );
+	check( strstr( buf, "Status: 304 Not Modified\r\n" )
+			&& !strstr( buf, "Content-Length" )
+			&& !strcmp( buf + strlen( buf ) - 4, "\r\n\r\n" ),
+			"buffered not modified '%s'", buf );
+	unsetenv( "HTTP_IF_NONE_MATCH" );
+
+	/*	generated content, the tag is a hash of the body	*/
+	for ( i = 0; i < 3; i++ )
+	{
+		rewind( out );
+		check( !ftruncate( fileno( out ), 0 ), "truncate" );
+		stdout = out;
+		check( cgi_response_buffer(), "buffer" );
+		check( cgi_response_etag(), "etag" );
+		printf( "generated %i\n", i < 2 ? 1 : 2 );
+		cgi_end();
+		stdout = saved;
+		slurp( out, buf, sizeof(buf) );
+
+		if ( i == 0 )
+		{
+			check( strstr( buf, "Content-Length: 12\r\n\r\ngenerated 1\n" ),
+					"generated '%s'", buf );
+			header_value( buf, "ETag: ", etag, sizeof(etag) );
+			setenv( "HTTP_IF_NONE_MATCH", etag, 1 );
+		}
+		else if ( i == 1 )
+		{
+			check( strstr( buf, "Status: 304 Not Modified\r\n" )
+					&& !strstr( buf, "generated" ), "cached '%s'", buf );
+		}
+		else
+		{
+			check( strstr( buf, "generated 2\n" ) && !strstr( buf, etag ),
+					"changed '%s'", buf );
+		}
+	}
+
+	/*	a status of the program is kept	*/
+	rewind( out );
+	check( !ftruncate( fileno( out ), 0 ), "truncate" );
+	stdout = out;
+	check( cgi_response_buffer(), "buffer" );
+	check( cgi_response_etag(), "etag" );
+	cgi_send_header( "Status: 404 Not Found" );
+	printf( "generated 1\n" );
+	cgi_end();
+	stdout = saved;
+	slurp( out, buf, sizeof(buf) );
+	check( !strstr( buf, "ETag" ) && strstr( buf, "generated 1" ),
+			"status '%s'", buf );
+	check( !cgi_response_etag(), "not buffered" );
+
+	unsetenv( "HTTP_IF_NONE_MATCH" );
+	unlink( path );
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	stdout = saved;
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+/*	ranged response for a Range header, unbuffered and buffered must
+ *	agree	*/
+static int send_range( FILE *out, const char *path, const char *range,
+		char *buf, size_t size )
+{
+	static char other[2048];
+	int status;
+
+	if ( range )
+		setenv( "HTTP_RANGE", range, 1 );
+	else
+		unsetenv( "HTTP_RANGE" );
+
+	status = send_file( out, path, other, sizeof(other), 1 );
+	if ( send_file( out, path, buf, size, 0 ) != status ) return -1;
+
+	/*	the same apart from where Content-Length is	*/
+	if ( strlen( buf ) != strlen( other ) ) return -1;
+
+	return status;
+}
+
+int test_ranges( void )
+{
+	FILE *out = NULL, *f = NULL;
+	char path[64], buf[2048], etag[64], date[64], value[sizeof(etag) + 2], expect[512], *p;
+	int i, n;
+
+	snprintf( path, sizeof(path), "/tmp/libcgi-range-%i", (int) getpid() );
+	check( (f = fopen( path, "w" )), "file" );
+	for ( i = 0; i < 100; i++ )
+		fputc( 'a' + i % 26, f );
+	fclose( f );
+	check( (out = tmpfile()), "out" );
+
+	setenv( "REQUEST_METHOD", "GET", 1 );
+	unsetenv( "HTTP_IF_NONE_MATCH" );
+	unsetenv( "HTTP_IF_MODIFIED_SINCE" );
+	unsetenv( "HTTP_IF_RANGE" );
+
+	check( send_range( out, path, NULL, buf, sizeof(buf) ) == 200, "200" );
+	check( strstr( buf, "Accept-Ranges: bytes\r\n" ), "accept '%s'", buf );
+	header_value( buf, "ETag: ", etag, sizeof(etag) );
+	header_value( buf, "Last-Modified: ", date, sizeof(date) );
+
+	/*	one range, from an offset	*/
+	check( send_range( out, path, "bytes=26-29", buf, sizeof(buf) ) == 206,
+			"206" );
+	check( strstr( buf, "Status: 206 Partial Content\r\n" )
+			&& strstr( buf, "Content-Range: bytes 26-29/100\r\n" )
+			&& strstr( buf, "Content-Length: 4\r\n\r\nabcd" )
+			&& !strcmp( buf + strlen( buf ) - 4, "abcd" ), "range '%s'", buf );
+
+	/*	suffix, open end and a too large end are cut to the file	*/
+	check( send_range( out, path, "bytes=-3", buf, sizeof(buf) ) == 206
+			&& strstr( buf, "bytes 97-99/100" )
+			&& !strcmp( buf + strlen( buf ) - 3, "tuv" ), "suffix '%s'", buf );
+	check( send_range( out, path, "bytes=98-", buf, sizeof(buf) ) == 206
+			&& strstr( buf, "bytes 98-99/100" ), "open '%s'", buf );
+	check( send_range( out, path, " bytes=90-1000", buf, sizeof(buf) ) == 206
+			&& strstr( buf, "bytes 90-99/100" ), "cut '%s'", buf );
+	check( send_range( out, path, "bytes=-1000", buf, sizeof(buf) ) == 206
+			&& strstr( buf, "bytes 0-99/100" ), "suffix cut '%s'", buf );
+
+	/*	several, overlapping ones merged and sorted	*/
+	check( send_range( out, path, "bytes=52-53, 0-1,1-2,200-300",
+			buf, sizeof(buf) ) == 206, "multi" );
+	check( strstr( buf, "Content-type: multipart/byteranges; boundary=" ),
+			"multipart '%s'", buf );
+	header_value( buf, "boundary=", value, sizeof(value) );
+	check( (p = strstr( buf, "\r\n\r\n" )), "body" );
+	n = snprintf( expect, sizeof(expect),
+			"\r\n--%s\r\nContent-type: text/plain\r\n"
+			"Content-Range: bytes 0-2/100\r\n\r\nabc"
+			"\r\n--%s\r\nContent-type: text/plain\r\n"
+			"Content-Range: bytes 52-53/100\r\n\r\nab"
+			"\r\n--%s--\r\n", value, value, value );
+	check( !strcmp( p + 4, expect ), "parts '%s'", p + 4 );
+	snprintf( value, sizeof(value), "Content-Length: %i\r\n", n );
+	check( strstr( buf, value ), "length '%s'", buf );
+
+	/*	none in the file	*/
+	check( send_range( out, path, "bytes=100-200,-0", buf, sizeof(buf) )
+			== 416, "416" );
+	check( strstr( buf, "Status: 416 Requested Range Not Satisfiable\r\n" )
+			&& strstr( buf, "Content-Range: bytes */100\r\n" )
+			&& strstr( buf, "Content-Length: 0\r\n\r\n" ), "416 '%s'", buf );
+
+	/*	malformed, or too many, get the whole file	*/
+	check( send_range( out, path, "bytes=5-2", buf, sizeof(buf) ) == 200,
+			"reversed" );
+	check( send_range( out, path, "items=0-1", buf, sizeof(buf) ) == 200,
+			"unit" );
+	check( send_range( out, path, "bytes=1-2;", buf, sizeof(buf) ) == 200,
+			"junk" );
+	check( send_range( out, path, "bytes=0-0,2-2,4-4,6-6,8-8,10-10,12-12,"
+			"14-14,16-16,18-18,20-20,22-22,24-24,26-26,28-28,30-30,32-32",
+			buf, sizeof(buf) ) == 200, "too many" );
+
+	/*	If-Range with the current tag or date, not with a weak tag	*/
+	setenv( "HTTP_IF_RANGE", etag, 1 );
+	check( send_range( out, path, "bytes=0-1", buf, sizeof(buf) ) == 206,
+			"if-range tag" );
+	setenv( "HTTP_IF_RANGE", date, 1 );
+	check( send_range( out, path, "bytes=0-1", buf, sizeof(buf) ) == 206,
+			"if-range date" );
+	snprintf( value, sizeof(value), "W/%s", etag );
+	setenv( "HTTP_IF_RANGE", value, 1 );
+	check( send_range( out, path, "bytes=0-1", buf, sizeof(buf) ) == 200,
+			"if-range weak" );
+	setenv( "HTTP_IF_RANGE", "\"old\"", 1 );
+	check( send_range( out, path, "bytes=0-1", buf, sizeof(buf) ) == 200,
+			"if-range old" );
+	unsetenv( "HTTP_IF_RANGE" );
+
+	/*	304 comes first, ranges are for GET only	*/
+	setenv( "HTTP_IF_NONE_MATCH", etag, 1 );
+	check( send_range( out, path, "bytes=0-1", buf, sizeof(buf) ) == 304,
+			"304" );
+	unsetenv( "HTTP_IF_NONE_MATCH" );
+	setenv( "REQUEST_METHOD", "HEAD", 1 );
+	check( send_range( out, path, "bytes=0-1", buf, sizeof(buf) ) == 200,
+			"head" );
+	setenv( "REQUEST_METHOD", "GET", 1 );
+
+	unsetenv( "HTTP_RANGE" );
+	unlink( path );
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	unsetenv( "HTTP_RANGE" );
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+static void *worker( void *arg )
+{
+	long id = (long) arg;
+	cgi_request *req;
+	char query[64], expect[16], *value;
+	int round, i, ok = 1;
+
+	req = cgi_request_new();
+
+	for ( round = 0; round < ROUNDS && ok; round++ )
+	{
+		snprintf( query, sizeof(query), "m=a&m=b&m=c&id=%li&r=%i", id, round );
+		cgi_request_setenv( req, "QUERY_STRING", query );
+		cgi_request_process_form( req );
+
+		snprintf( expect, sizeof(expect), "%i", round );
+		ok = atol( cgi_request_param( req, "id" ) ) == id
+				&& !strcmp( cgi_request_param( req, "r" ), expect );
+
+		for ( i = 0; (value = cgi_request_param_multiple( req, "m" )); i++ )
+			ok = ok && value[0] == 'a' + i;
+		ok = ok && i == 3;
+
+		cgi_request_end( req );
+	}
+
+	cgi_request_free( req );
+
+	return ok ? arg : NULL;
+}
+
+int test_threads( void )
+{
+	pthread_t threads[WORKERS];
+	void *ret;
+	long i;
+
+	for ( i = 0; i < WORKERS; i++ )
+	{
+		check( !pthread_create( &threads[i], NULL, worker, (void *) (i + 1) ),
+				"pthread_create" );
+	}
+
+	for ( i = 0; i < WORKERS; i++ )
+	{
+		check( !pthread_join( threads[i], &ret ), "pthread_join" );
+		check( ret == (void *) (i + 1), "worker %li", i );
+	}
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
+/*	cgi_request_printf_html() output of one call	*/
+static char *printf_html( cgi_request *req, FILE *out, char *buf,
+		size_t size, int *ret, const char *format, ... )
+{
+	va_list ap;
+
+	rewind( out );
+	if ( ftruncate( fileno( out ), 0 ) ) return NULL;
+
+	va_start( ap, format );
+	*ret = cgi_request_vprintf_html( req, format, ap );
+	va_end( ap );
+
+	return slurp( out, buf, size );
+}
+
+int test_printf_html( void )
+{
+	static char wide[600];
+	cgi_request *req = NULL;
+	FILE *out = NULL, *saved = stdout;
+	char buf[1024], expect[700];
+	int ret;
+
+	check( (req = cgi_request_new()), "new" );
+	check( (out = tmpfile()), "out" );
+	cgi_request_set_output( req, out );
+
+	/*	strings and characters escaped, %r as it is	*/
+	printf_html( req, out, buf, sizeof(buf), &ret,
+			"<a href=\"?q=%s\">%s</a>%r%c%%", "a&b", "<\"x\">", "<br>", '<' );
+	check( ret && !strcmp( buf, "<a href=\"?q=a&amp;b\">&lt;&quot;x&quot;"
+			"&gt;</a><br>&lt;%" ), "escaped '%s'", buf );
+
+	/*	width and precision count bytes before escaping	*/
+	printf_html( req, out, buf, sizeof(buf), &ret, "[%5s|%-4s|%.2s|%*.*r|%s]",
+			"<", "&", "<<<", -3, 1, "xy", (char *) NULL );
+	check( ret && !strcmp( buf, "[    &lt;|&amp;   |&lt;&lt;|x  |(null)]" ),
+			"width '%s'", buf );
+
+	/*	numbers like printf()	*/
+	printf_html( req, out, buf, sizeof(buf), &ret,
+			"%d %+05i %hhd %hu %lx %llu %zu %jd %08.3f %-6.1e| %Lg %#o %X",
+			-42, 7, 300, 70000, 255ul, 1ull << 40, (size_t) 12, (intmax_t) -1,
+			3.14159, 12345.0, (long double) 0.5, 8, 0xBEEF );
+	snprintf( expect, sizeof(expect),
+			"%d %+05i %hhd %hu %lx %llu %zu %jd %08.3f %-6.1e| %Lg %#o %X",
+			-42, 7, 300, 70000, 255ul, 1ull << 40, (size_t) 12, (intmax_t) -1,
+			3.14159, 12345.0, (long double) 0.5, 8, 0xBEEF );
+	check( ret && !strcmp( buf, expect ), "numbers '%s' '%s'", buf, expect );
+
+	/*	wider than the number buffer	*/
+	printf_html( req, out, buf, sizeof(buf), &ret, "%500d|%p", 1, (void *) buf );
+	snprintf( wide, sizeof(wide), "%500d|%p", 1, (void *) buf );
+	check( ret && !strcmp( buf, wide ), "wide" );
+
+	/*	invalid formats stop with 0	*/
+	cgi_display_errors = 0;
+	printf_html( req, out, buf, sizeof(buf), &ret, "a%nb", &ret );
+	check( !ret && !strcmp( buf, "a" ), "%%n '%s'", buf );
+	printf_html( req, out, buf, sizeof(buf), &ret, "a%" );
+	check( !ret && !strcmp( buf, "a" ), "trailing '%s'", buf );
+
+	cgi_request_free( req );
+	req = NULL;
+
+	/*	the default request into a buffered response	*/
+	rewind( out );
+	check( !ftruncate( fileno( out ), 0 ), "truncate" );
+	stdout = out;
+	cgi_response_buffer();
+	ret = cgi_printf_html( "%s=%d", "a<b", 1 );
+	cgi_end();
+	stdout = saved;
+	check( ret, "buffered" );
+	check( !strcmp( slurp( out, buf, sizeof(buf) ), "Content-type: text/html"
+			"\r\nContent-Length: 8\r\n\r\na&lt;b=1" ), "buffered '%s'", buf );
+
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	stdout = saved;
+	if ( req ) cgi_request_free( req );
+	if ( out ) fclose( out );
+	return EXIT_FAILURE;
+}
+
+/*	output so far, then start over	*/
+static char *take( FILE *out, char *buf, size_t size )
+{
+	slurp( out, buf, size );
+	rewind( out );
+
+	return ftruncate( fileno( out ), 0 ) ? NULL : buf;
+}
+
+int test_headers( void )
+{
+	cgi_request *req = NULL;
+	FILE *out = NULL, *saved = stdout;
+	char buf[1024];
+
+	cgi_display_errors = 0;
+
+	check( (req = cgi_request_new()), "new" );
+	check( (out = tmpfile()), "out" );
+	cgi_request_set_output( req, out );
+
+	/*	unbuffered, headers and cookies of the program go out right
+	 *	away, written ones are not replaced	*/
+	check( cgi_request_add_cookie( req, "a", "1", NULL, NULL, NULL, 0 ),
+			"cookie" );
+	cgi_request_send_header( req, "X-A: 1" );
+	check( cgi_request_add_cookie( req, "a", "2", "60", NULL, NULL, 0 ),
+			"cookie again" );
+	check( !strcmp( slurp( out, buf, sizeof(buf) ), "Set-cookie: a=1;\r\n"
+			"X-A: 1\r\nSet-cookie: a=2; Max-age=60;\r\n" ),
+			"written '%s'", buf );
+
+	cgi_request_init_headers( req );
+	cgi_request_send_header( req, "X-Late: 1" );
+	check( !cgi_request_add_cookie( req, "late", "1", NULL, NULL, NULL, 0 ),
+			"late cookie" );
+	check( !strcmp( take( out, buf, sizeof(buf) ), "Set-cookie: a=1;\r\n"
+			"X-A: 1\r\nSet-cookie: a=2; Max-age=60;\r\n"
+			"Content-type: text/html\r\n\r\n" ), "sent '%s'", buf );
+	cgi_request_end( req );
+
+	/*	a type of the program stays	*/
+	cgi_request_send_header( req, "Content-Type: text/plain" );
+	cgi_request_init_headers( req );
+	check( !strcmp( take( out, buf, sizeof(buf) ),
+			"Content-Type: text/plain\r\n\r\n" ), "type '%s'", buf );
+	cgi_request_end( req );
+
+	/*	nothing more at the end once the program wrote its headers	*/
+	check( cgi_request_add_cookie( req, "c", "1", NULL, NULL, NULL, 0 ),
+			"cookie c" );
+	cgi_request_end( req );
+	check( !strcmp( take( out, buf, sizeof(buf) ), "Set-cookie: c=1;\r\n" ),
+			"end '%s'", buf );
+	cgi_request_end( req );
+	check( !strcmp( take( out, buf, sizeof(buf) ), "" ), "nothing '%s'", buf );
+
+	/*	buffered, the same header or cookie replaces the one before in
+	 *	its place, headers change until the end	*/
+	check( cgi_request_response_buffer( req ), "buffer" );
+	check( cgi_request_add_cookie( req, "a", "1", NULL, NULL, NULL, 0 ),
+			"buffered a" );
+	cgi_request_send_header( req, "X-A: 1" );
+	check( cgi_request_add_cookie( req, "b", "1", NULL, "/", NULL, 1 ),
+			"buffered b" );
+	check( cgi_request_add_cookie( req, "a", "2", "60", NULL, NULL, 0 ),
+			"buffered a again" );
+	cgi_request_send_header( req, "x-a: 2" );
+	check( !strcmp( slurp( out, buf, sizeof(buf) ), "" ), "held '%s'", buf );
+	cgi_request_init_headers( req );
+	check( cgi_request_write( req, "body", 4 ), "write" );
+	cgi_request_send_header( req, "Content-type: text/plain" );
+	cgi_request_send_header( req, "Cache-Control: max-age=60" );
+	check( cgi_request_add_cookie( req, "late", "1", NULL, NULL, NULL, 0 ),
+			"buffered cookie" );
+	cgi_request_end( req );
+	check( !strcmp( take( out, buf, sizeof(buf) ),
+			"Set-cookie: a=2; Max-age=60;\r\n"
+			"x-a: 2\r\n"
+			"Set-cookie: b=1; Path=/; Secure\r\n"
+			"Content-type: text/plain\r\n"
+			"Cache-Control: max-age=60\r\n"
+			"Set-cookie: late=1;\r\n"
+			"Content-Length: 4\r\n\r\nbody" ), "buffered '%s'", buf );
+
+	cgi_request_free( req );
+	req = NULL;
+
+	/*	a late redirect of a buffered response	*/
+	stdout = out;
+	check( cgi_response_buffer(), "buffer default" );
+	cgi_init_headers();
+	printf( "page" );
+	cgi_redirect_status( HTTP_STATUS_SEE_OTHER, "/next" );
+	cgi_end();
+	stdout = saved;
+	check( !strcmp( take( out, buf, sizeof(buf) ),
+			"Content-type: text/html\r\n"
+			"Status: 303\r\n"
+			"Location: /next\r\n"
+			"Content-Length: 4\r\n\r\npage" ), "redirect '%s'", buf );
+
+	/*	a program printing its body after its own headers	*/
+	stdout = out;
+	cgi_send_header( "Content-type: text/plain\r\n" );
+	printf( "body" );
+	cgi_end();
+	stdout = saved;
+	check( !strcmp( take( out, buf, sizeof(buf) ),
+			"Content-type: text/plain\r\n\r\nbody" ), "printed '%s'", buf );
+
+	/*	unbuffered, the redirect ends the headers	*/
+	stdout = out;
+	cgi_send_header( "Cache-Control: no-store" );
+	cgi_redirect_status( HTTP_STATUS_SEE_OTHER, "/next" );
+	cgi_init_headers();
+	cgi_end();
+	stdout = saved;
+	check( !strcmp( take( out, buf, sizeof(buf) ),
+			"Cache-Control: no-store\r\n"
+			"Status: 303\r\n"
+			"Location: /next\r\n\r\n" ), "unbuffered redirect '%s'", buf );
+
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	stdout = saved;
+	if ( req ) cgi_request_free( req );
+	if ( out ) fclose( out );
+	return EXIT_FAILURE;
+}
+
+int test_cookies( void )
+{
+	static char header[8192];
+	cgi_request *req = NULL;
+	formvars *item;
+	char *p = header;
+	int i, n;
+
+	check( (req = cgi_request_new()), "new" );
+
+	/*	escaped separators stay in the value, quotes and blanks around
+	 *	it go, pairs without name or '=' are skipped	*/
+	cgi_request_setenv( req, "HTTP_COOKIE", "a=1; b=\"quoted\";c=x%3By%3Dz; "
+			"d=sp+ace%20x ; e; =novalue; f= g ;; h%20n=v; a=dup" );
+	check( !strcmp( cgi_request_cookie_value( req, "a" ), "1" ), "a" );
+	check( !strcmp( cgi_request_cookie_value( req, "b" ), "quoted" ), "b" );
+	check( !strcmp( cgi_request_cookie_value( req, "c" ), "x;y=z" ), "c" );
+	check( !strcmp( cgi_request_cookie_value( req, "d" ), "sp ace x" ), "d" );
+	check( !strcmp( cgi_request_cookie_value( req, "c" ), "x;y=z" ),
+			"decoded once" );
+	check( !cgi_request_cookie_value( req, "e" ), "e" );
+	check( !strcmp( cgi_request_cookie_value( req, "f" ), "g" ), "f" );
+	check( !strcmp( cgi_request_cookie_value( req, "h n" ), "v" ), "name" );
+
+	for ( n = 0, item = cgi_request_get_cookies( req ); item;
+			item = item->next, n++ )
+		check( !strpbrk( item->value, "%+" ), "%s decoded", item->name );
+	check( n == 7, "count %i", n );
+	cgi_request_end( req );
+
+	/*	the empty header and none at all	*/
+	cgi_request_setenv( req, "HTTP_COOKIE", " ; " );
+	check( !cgi_request_get_cookies( req ), "empty" );
+	cgi_request_end( req );
+	check( !cgi_request_cookie_value( req, "a" ), "none" );
+	cgi_request_end( req );
+
+	/*	a header without cookies is split once, not on every lookup	*/
+	for ( p = header, i = 0; i < 100; i++ )
+		p += sprintf( p, "junk%i; ", i );
+	setenv( "HTTP_COOKIE", header, 1 );
+	for ( i = 0; i < 100; i++ )
+		check( !cgi_cookie_value( "a" ), "junk" );
+	check( cgi_arena_peak() < 2 * strlen( header ) + 1024, "peak %lu",
+			(unsigned long) cgi_arena_peak() );
+	cgi_end();
+	unsetenv( "HTTP_COOKIE" );
+	p = header;
+
+	/*	a large header of which two cookies are used, only those are
+	 *	decoded	*/
+	for ( i = 0; i < 100; i++ )
+		p += sprintf( p, "_tag%i=%%7B%%22id%%22%%3A%i%%7D; ", i, i );
+	strcpy( p, "sid=abc; lang=de%2Dat" );
+	cgi_request_setenv( req, "HTTP_COOKIE", header );
+	check( !strcmp( cgi_request_cookie_value( req, "lang" ), "de-at" ),
+			"lang" );
+	check( !strcmp( cgi_request_cookie_value( req, "sid" ), "abc" ), "sid" );
+	cgi_request_free( req );
+	req = NULL;
+
+	/*	the default request keeps the list in cookies_start	*/
+	setenv( "HTTP_COOKIE", header, 1 );
+	cgi_init();
+	for ( n = 0, item = cookies_start; item; item = item->next, n++ )
+	{
+		if ( strncmp( item->name, "_tag", 4 ) ) continue;
+		check( !strncmp( item->value, "%7B", 3 ), "%s lazy", item->name );
+	}
+	check( n == 102, "count %i", n );
+	check( !strcmp( cgi_cookie_value( "_tag7" ), "{\"id\":7}" ), "tag" );
+	check( !strcmp( cgi_get_cookies()->value, "{\"id\":0}" ), "all" );
+	cgi_end();
+	unsetenv( "HTTP_COOKIE" );
+
+	return EXIT_SUCCESS;
+
+error:
+	if ( req ) cgi_request_free( req );
+	return EXIT_FAILURE;
+}
+
+/*	bytes of file contents seen by a request's upload handler	*/
+static int count_upload( const struct cgi_upload *upload, const char *data,
+		size_t len, void *arg )
+{
+	(void) upload;
+	(void) data;
+	*(size_t *) arg += len;
+
+	return 0;
+}
+
+int test_uploads( void )
+{
+	const char *data = "--b\r\nContent-Disposition: form-data; name=\"x\""
+			"\r\n\r\n1\r\n--b\r\nContent-Disposition: form-data; name=\"f\"; "
+			"filename=\"f.txt\"\r\n\r\nhello\r\n--b--\r\n";
+	cgi_request *a = NULL, *b = NULL;
+	FILE *in_a = NULL, *in_b = NULL;
+	char length[24];
+	size_t count = 0;
+
+	check( (a = cgi_request_new()) && (b = cgi_request_new()), "new" );
+	check( (in_a = body( data )) && (in_b = body( data )), "body" );
+	snprintf( length, sizeof(length), "%zu", strlen( data ) );
+
+	cgi_request_set_input( a, in_a );
+	cgi_request_set_input( b, in_b );
+	cgi_request_setenv( a, "REQUEST_METHOD", "POST" );
+	cgi_request_setenv( b, "REQUEST_METHOD", "POST" );
+	cgi_request_setenv( a, "CONTENT_LENGTH", length );
+	cgi_request_setenv( b, "CONTENT_LENGTH", length );
+	cgi_request_setenv( a, "CONTENT_TYPE", "multipart/form-data; boundary=b" );
+	cgi_request_setenv( b, "CONTENT_TYPE", "multipart/form-data; boundary=b" );
+
+	/*	only a has a handler, b spools to a file	*/
+	cgi_request_upload_set_handler( a, count_upload, &count );
+	check( cgi_request_process_form( a ) && cgi_request_process_form( b ),
+			"form" );
+	check( count == 5, "count %zu", count );
+	check( cgi_request_upload_file( a, "f" )->fd == -1, "a no file" );
+	check( cgi_request_upload_file( b, "f" )->fd >= 0, "b file" );
+	check( cgi_request_upload_file( b, "f" )->size == 5, "b size" );
+
+	cgi_request_free( a );
+	cgi_request_free( b );
+	fclose( in_a );
+	fclose( in_b );
+
+	return EXIT_SUCCESS;
+
+error:
+	if ( a ) cgi_request_free( a );
+	if ( b ) cgi_request_free( b );
+	return EXIT_FAILURE;
+}
+
+int test_errors( void )
+{
+	cgi_request *req = NULL;
+	FILE *out = NULL;
+	char buf[256];
+
+	check( (req = cgi_request_new()) && (out = tmpfile()), "new" );
+	cgi_request_set_output( req, out );
+
+	/*	a warning of a context goes to its output, after its headers	*/
+	cgi_display_errors = 1;
+	check( !cgi_request_response_etag( req ), "warning" );
+	check( !strcmp( slurp( out, buf, sizeof(buf) ), "Content-type: "
+			"text/html\r\n\r\n<b>LibCGI Warning</b>: "
+			"cgi_request_response_etag: response not buffered<br>\n" ),
+			"output '%s'", buf );
+
+	/*	the default request did not send its headers	*/
+	check( cgi_add_cookie( "c", "1", NULL, NULL, NULL, 0 ), "default" );
+	cgi_end();
+
+	cgi_request_free( req );
+	fclose( out );
+
+	return EXIT_SUCCESS;
+
+error:
+	if ( req ) cgi_request_free( req );
+	return EXIT_FAILURE;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */
@@ -12,12 +12,22 @@
  **********************************************************************/
 
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "cgi_test.h"
 
 #include "libcgi/cgi.h"
+#include "libcgi/request.h"
+#include "libcgi/session.h"
 
 #define CGI_TEST_SHRT_COOKIE_NAME	"cgi_sess"
 #define CGI_TEST_COOKIE_NAME_49		"_______ten____twenty____thirty____fourty_____fift"
@@ -25,13 +35,46 @@
 #define CGI_TEST_COOKIE_NAME_51		"_______ten____twenty____thirty____fourty_____fifty_"
 #define CGI_TEST_LONG_COOKIE_NAME	"_______ten____twenty____thirty____fourty_____fifty_____sixty"
 
+/*	HMAC-SHA256 of the library, the key state is opaque here	*/
+union test_hmac {
+	unsigned char		state[512];
+	unsigned long long	align;
+};
+extern void cgi_hmac_sha256_key( void *hmac, const void *key, size_t len );
+extern void cgi_hmac_sha256( const void *hmac, const void *data, size_t len,
+		unsigned char mac[32] );
+
 /*	local declarations	*/
 static int cookie_name( void );
+static int file_store( void );
+static int file_dirty( void );
+static int file_format( void );
+static int file_unbuffered( void );
+static int cookie_store( void );
+static int cookie_keys( void );
+static int cookie_size( void );
+static int cookie_expiry( void );
+static int hmac_sha256( void );
+static int shm_store( void );
+static int shm_shared( void );
+static int shm_evict( void );
 
 int main( int argc, char *argv[] )
 {
 	struct cgi_test_action	actions[] = {
-		{ "cookie_name",	cookie_name	},
+		{ "cookie_name",	cookie_name		},
+		{ "file_store",		file_store		},
+		{ "file_dirty",		file_dirty		},
+		{ "file_format",	file_format		},
+		{ "file_unbuffered",	file_unbuffered	},
+		{ "cookie_store",	cookie_store	},
+		{ "cookie_keys",	cookie_keys		},
+		{ "cookie_size",	cookie_size		},
+		{ "cookie_expiry",	cookie_expiry	},
+		{ "hmac_sha256",	hmac_sha256		},
+		{ "shm_store",		shm_store		},
+		{ "shm_shared",		shm_shared		},
+		{ "shm_evict",		shm_evict		},
 	};
 
 	/*	require at least one argument to select test	*/
@@ -80,4 +123,773 @@ error:
 	return EXIT_FAILURE;
 }
 
+static cgi_request *req = NULL;
+static FILE *out = NULL;
+
+/*	a request sending the session cookie, NULL for none	*/
+static int begin( const char *cookie )
+{
+	char header[sizeof(SESSION_COOKIE_NAME) + 4200];
+
+	if ( !(req = cgi_request_new()) || !(out = tmpfile()) ) return 0;
+	cgi_request_set_output( req, out );
+
+	if ( cookie )
+	{
+		snprintf( header, sizeof(header), "%s=%s", SESSION_COOKIE_NAME,
+				cookie );
+		cgi_request_setenv( req, "HTTP_COOKIE", header );
+	}
+
+	return cgi_request_init( req );
+}
+
+/*	end the request, the value of the session cookie it set in cookie,
+ *	returns the number of session cookies set	*/
+static int finish( char *cookie, size_t size )
+{
+	size_t n, name_len = strlen( SESSION_COOKIE_NAME );
+	char buf[8192], *p;
+	int count = 0;
+
+	cgi_request_free( req );
+	req = NULL;
+
+	rewind( out );
+	n = fread( buf, 1, sizeof(buf) - 1, out );
+	buf[n] = '\0';
+	fclose( out );
+	out = NULL;
+
+	cookie[0] = '\0';
+	for ( p = buf; (p = strstr( p, "Set-cookie: " )); count++ )
+	{
+		p += strlen( "Set-cookie: " );
+		if ( strncmp( p, SESSION_COOKIE_NAME, name_len ) || p[name_len] != '=' )
+			return -1;
+		p += name_len + 1;
+		n = strcspn( p, ";" );
+		if ( n >= size ) return -1;
+		memcpy( cookie, p, n );
+		cookie[n] = '\0';
+	}
+
+	return count;
+}
+
+static void cleanup( void )
+{
+	if ( req ) cgi_request_free( req );
+	if ( out ) fclose( out );
+	req = NULL;
+	out = NULL;
+}
+
+int file_store( void )
+{
+	struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+	char sid[64], other[64], path[512];
+	FILE *f;
+
+	cgi_display_errors = 0;
+
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "a", "1" ), "register a" );
+	check( cgi_request_session_register_var( req, "b", "2" ), "register b" );
+	check( cgi_request_session_alter_var( req, "a", "3" ), "alter" );
+	check( finish( sid, sizeof(sid) ) == 1, "cookie" );
+	snprintf( path, sizeof(path), "%s%s%s", SESSION_SAVE_PATH,
+			SESSION_FILE_PREFIX, sid );
+
+	check( begin( sid ) && cgi_request_session_start( req ), "again" );
+	check( !strcmp( cgi_request_session_var( req, "a" ), "3" )
+			&& !strcmp( cgi_request_session_var( req, "b" ), "2" ), "values" );
+	check( finish( other, sizeof(other) ) == 0, "no new cookie" );
+
+	/*	an idle session is gone	*/
+	cgi_session_set_max_idle_time( 60 );
+	check( !utimes( path, times ), "utimes" );
+	check( begin( sid ) && cgi_request_session_start( req ), "idle" );
+	check( !cgi_request_session_var_exists( req, "a" ), "idle value" );
+	check( access( path, F_OK ), "idle file" );
+	/*	the cookie of the new session went out already, destroy adds one	*/
+	check( cgi_request_session_destroy( req ), "destroy" );
+	check( finish( other, sizeof(other) ) == 2 && !strcmp( other, "" ),
+			"destroy cookie" );
+
+	/*	an id that can't be ours starts a new session	*/
+	check( begin( "../../x" ) && cgi_request_session_start( req ), "path" );
+	check( finish( other, sizeof(other) ) == 1 && strlen( other ) == 45,
+			"path id '%s'", other );
+	sid[44] = '-';
+	snprintf( path, sizeof(path), "%s%s%s", SESSION_SAVE_PATH,
+			SESSION_FILE_PREFIX, sid );
+	check( (f = fopen( path, "w" )) && !fclose( f ), "planted" );
+	check( begin( sid ) && cgi_request_session_start( req ), "alphabet" );
+	check( finish( other, sizeof(other) ) == 1 && strcmp( other, sid ),
+			"alphabet id" );
+	unlink( path );
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	return EXIT_FAILURE;
+}
+
+/*	content of a session file as "name=value;name=value", "" if it is
+ *	missing, "?" if it is not in the binary format	*/
+static const char *contents( const char *path )
+{
+	static char text[512];
+	unsigned char buf[512], *p;
+	size_t n = 0, len = 0, name_len, value_len;
+	unsigned int count, i;
+	FILE *f;
+
+	text[0] = '\0';
+	if ( !(f = fopen( path, "r" )) ) return text;
+	n = fread( buf, 1, sizeof(buf), f );
+	fclose( f );
+
+	if ( n < 16 || memcmp( buf, "\0CGS\1", 5 ) ) return "?";
+
+	count = buf[8] | buf[9] << 8 | buf[10] << 16 | (unsigned) buf[11] << 24;
+	for ( p = buf + 16, i = 0; i < count; i++ )
+	{
+		name_len = p[0] | p[1] << 8;
+		value_len = p[4] | p[5] << 8;
+		len += snprintf( text + len, sizeof(text) - len, "%s%s=%s",
+				i ? ";" : "", (char *) p + 8, (char *) p + 8 + name_len + 1 );
+		p += 8 + name_len + 1 + value_len + 1;
+	}
+
+	return text;
+}
+
+/*	temporary files of a session left in the save path	*/
+static int leftovers( const char *sid )
+{
+	char prefix[128];
+	struct dirent *d;
+	int count = 0;
+	DIR *dir;
+
+	snprintf( prefix, sizeof(prefix), "%s%s.", SESSION_FILE_PREFIX, sid );
+	if ( !(dir = opendir( SESSION_SAVE_PATH )) ) return -1;
+	while ( (d = readdir( dir )) )
+		if ( !strncmp( d->d_name, prefix, strlen( prefix ) ) ) count++;
+	closedir( dir );
+
+	return count;
+}
+
+int file_dirty( void )
+{
+	struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+	char sid[64], other[64], path[512];
+	struct stat before, after;
+
+	cgi_display_errors = 0;
+
+	/*	changes are written once, at the end	*/
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "a", "1" ), "register a" );
+	check( cgi_request_session_register_var( req, "b", "2" ), "register b" );
+	check( cgi_request_session_register_var( req, "e", "" ), "register e" );
+	check( cgi_request_session_alter_var( req, "a", "3" ), "alter" );
+	check( finish( sid, sizeof(sid) ) == 1, "cookie" );
+	snprintf( path, sizeof(path), "%s%s%s", SESSION_SAVE_PATH,
+			SESSION_FILE_PREFIX, sid );
+	check( !strcmp( contents( path ), "a=3;b=2;e=" ), "written '%s'",
+			contents( path ) );
+
+	/*	requests changing nothing do not write	*/
+	check( !utimes( path, times ) && !stat( path, &before ), "stat" );
+	check( begin( sid ) && cgi_request_session_start( req ), "read" );
+	check( !strcmp( cgi_request_session_var( req, "a" ), "3" ), "a" );
+	check( cgi_request_session_alter_var( req, "b", "2" ), "same value" );
+	check( finish( other, sizeof(other) ) == 0, "read cookie" );
+	check( !stat( path, &after ) && after.st_mtime == before.st_mtime
+			&& after.st_ino == before.st_ino, "not written" );
+
+	/*	a new file replaces the old one	*/
+	check( begin( sid ) && cgi_request_session_start( req ), "change" );
+	check( cgi_request_session_unregister_var( req, "a" ), "unregister" );
+	check( cgi_request_session_alter_var( req, "b", "x;y" ), "alter b" );
+	check( !strcmp( contents( path ), "a=3;b=2;e=" ), "not yet" );
+	check( finish( other, sizeof(other) ) == 0, "change cookie" );
+	check( !stat( path, &after ) && after.st_ino != before.st_ino,
+			"renamed" );
+	check( !strcmp( contents( path ), "b=x;y;e=" ), "changed '%s'",
+			contents( path ) );
+	check( leftovers( sid ) == 0, "temporary files" );
+
+	/*	destroyed sessions are not written again	*/
+	check( begin( sid ) && cgi_request_session_start( req ), "destroy" );
+	check( cgi_request_session_register_var( req, "c", "1" ), "register c" );
+	check( cgi_request_session_destroy( req ), "destroyed" );
+	check( finish( other, sizeof(other) ) == 1, "destroy cookie" );
+	check( access( path, F_OK ), "removed" );
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	return EXIT_FAILURE;
+}
+
+int file_format( void )
+{
+	const char *sid = "migrate123456789abcdefghijlmnopqrstuvxzwyABCD";
+	const char *value = "x;y=z\nw";
+	char other[64], path[512];
+	FILE *f;
+
+	cgi_display_errors = 0;
+	snprintf( path, sizeof(path), "%s%s%s", SESSION_SAVE_PATH,
+			SESSION_FILE_PREFIX, sid );
+
+	/*	text files are read, and written again in the binary format	*/
+	check( (f = fopen( path, "w" )) && fputs( "a=1;b=two\nrest", f ) >= 0
+			&& !fclose( f ), "text file" );
+	check( begin( sid ) && cgi_request_session_start( req ), "text" );
+	check( !strcmp( cgi_request_session_var( req, "a" ), "1" )
+			&& !strcmp( cgi_request_session_var( req, "b" ), "two" ), "values" );
+	check( finish( other, sizeof(other) ) == 0, "text cookie" );
+	check( !strcmp( contents( path ), "a=1;b=two" ), "migrated '%s'",
+			contents( path ) );
+
+	/*	values with separators and line ends stay as they are	*/
+	check( begin( sid ) && cgi_request_session_start( req ), "binary" );
+	check( cgi_request_session_register_var( req, "v", value ), "register" );
+	check( finish( other, sizeof(other) ) == 0, "binary cookie" );
+	check( begin( sid ) && cgi_request_session_start( req ), "again" );
+	check( !strcmp( cgi_request_session_var( req, "v" ), value ), "value" );
+	check( !strcmp( cgi_request_session_var( req, "b" ), "two" ), "b" );
+	check( finish( other, sizeof(other) ) == 0, "again cookie" );
+
+	/*	a damaged file is a new session	*/
+	check( (f = fopen( path, "r+" )) && !fseek( f, 20, SEEK_SET )
+			&& fputc( 'X', f ) != EOF && !fclose( f ), "damage" );
+	check( begin( sid ) && cgi_request_session_start( req ), "damaged" );
+	check( !cgi_request_session_var_exists( req, "a" ), "damaged value" );
+	/*	unbuffered, the cookie of the new session is written already and
+	 *	the one of destroy follows it	*/
+	check( cgi_request_session_destroy( req ), "destroy" );
+	check( finish( other, sizeof(other) ) == 2 && !strcmp( other, "" ),
+			"new cookie" );
+	check( access( path, F_OK ), "damaged file" );
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+/*	what the default request wrote to stdout since the last call	*/
+static const char *printed( FILE *f, char *buf, size_t size )
+{
+	size_t n;
+
+	fflush( f );
+	rewind( f );
+	n = fread( buf, 1, size - 1, f );
+	buf[n] = '\0';
+	rewind( f );
+	if ( ftruncate( fileno( f ), 0 ) ) buf[0] = '\0';
+
+	return buf;
+}
+
+int file_unbuffered( void )
+{
+	FILE *f = NULL, *saved = stdout;
+	char buf[1024], expect[256], cookie[128];
+	size_t n = strlen( SESSION_COOKIE_NAME );
+
+	cgi_display_errors = 0;
+	unsetenv( "HTTP_COOKIE" );
+	check( (f = tmpfile()), "tmpfile" );
+
+	/*	the session cookie goes before a body the program prints with
+	 *	its own headers	*/
+	stdout = f;
+	cgi_init();
+	cgi_session_start();
+	printf( "Content-type: text/plain\r\n\r\nbody\n" );
+	cgi_end();
+	stdout = saved;
+	printed( f, buf, sizeof(buf) );
+	check( !strncmp( buf, "Set-cookie: ", 12 )
+			&& !strncmp( buf + 12, SESSION_COOKIE_NAME, n )
+			&& buf[12 + n] == '=' && strlen( buf + 12 + n + 1 ) > 45,
+			"cookie '%s'", buf );
+	snprintf( cookie, sizeof(cookie), "%.*s", (int) n + 1 + 45, buf + 12 );
+	snprintf( expect, sizeof(expect),
+			"Set-cookie: %s;\r\nContent-type: text/plain\r\n\r\nbody\n",
+			cookie );
+	check( !strcmp( buf, expect ), "printed '%s'", buf );
+
+	/*	destroy, end and redirect, one header block	*/
+	setenv( "HTTP_COOKIE", cookie, 1 );
+	stdout = f;
+	cgi_init();
+	cgi_session_start();
+	cgi_session_destroy();
+	cgi_end();
+	cgi_redirect_status( HTTP_STATUS_SEE_OTHER, "session.cgi" );
+	stdout = saved;
+	snprintf( expect, sizeof(expect), "Set-cookie: %s=;\r\nStatus: 303\r\n"
+			"Location: session.cgi\r\n\r\n", SESSION_COOKIE_NAME );
+	check( !strcmp( printed( f, buf, sizeof(buf) ), expect ),
+			"destroy '%s'", buf );
+
+	fclose( f );
+	unsetenv( "HTTP_COOKIE" );
+
+	return EXIT_SUCCESS;
+
+error:
+	stdout = saved;
+	if ( f ) fclose( f );
+	return EXIT_FAILURE;
+}
+
+int cookie_store( void )
+{
+	char cookie[4200], other[4200];
+	const char *value = "a;b=c&d\ne %41+";
+
+	cgi_display_errors = 0;
+	cgi_session_set_backend( CGI_SESSION_COOKIE );
+
+	/*	not without a key	*/
+	check( begin( NULL ) && !cgi_request_session_start( req ), "no key" );
+	check( !strcmp( session_error_message[session_lasterror],
+			"No key to sign session cookies" ), "no key error" );
+	cleanup();
+	check( !cgi_session_cookie_key( 1, "short", 5 ), "short key" );
+	check( cgi_session_cookie_key( 1, "0123456789abcdef", 16 ), "key" );
+
+	/*	changes set the cookie again, it goes out once	*/
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "user", "tom" ), "user" );
+	check( cgi_request_session_register_var( req, "data", value ), "data" );
+	check( cgi_request_session_register_var( req, "gone", "x" ), "gone" );
+	check( cgi_request_session_register_var( req, "empty", "" ), "empty" );
+	check( cgi_request_session_alter_var( req, "user", "jerry" ), "alter" );
+	check( cgi_request_session_unregister_var( req, "gone" ), "unregister" );
+	check( finish( cookie, sizeof(cookie) ) == 1, "one cookie" );
+	check( !strncmp( cookie, "1.1.", 4 ) && strncmp( cookie, "1.1.0.", 6 ),
+			"cookie '%s'", cookie );
+
+	check( begin( cookie ) && cgi_request_session_start( req ), "load" );
+	check( !strcmp( cgi_request_session_var( req, "user" ), "jerry" ), "user" );
+	check( !strcmp( cgi_request_session_var( req, "data" ), value ), "data" );
+	check( cgi_request_session_var( req, "empty" ) == NULL, "empty" );
+	check( !cgi_request_session_var_exists( req, "gone" ), "gone" );
+	check( finish( other, sizeof(other) ) == 0, "unchanged" );
+
+	/*	a changed cookie is a new session	*/
+	strcpy( other, cookie );
+	other[10] = other[10] == 'A' ? 'B' : 'A';
+	check( begin( other ) && cgi_request_session_start( req ), "tampered" );
+	check( !cgi_request_session_var_exists( req, "user" ), "tampered user" );
+	check( finish( other, sizeof(other) ) == 1 && strcmp( other, cookie ),
+			"new cookie" );
+
+	/*	and so is a cookie of another name	*/
+	cgi_session_cookie_name( "OTHER" );
+	check( begin( cookie ) && cgi_request_session_start( req ), "renamed" );
+	check( !cgi_request_session_var_exists( req, "user" ), "renamed user" );
+	cleanup();
+	cgi_session_cookie_name( "CGISID" );
+
+	check( begin( cookie ) && cgi_request_session_start( req ), "destroy" );
+	check( cgi_request_session_destroy( req ), "destroyed" );
+	check( !cgi_request_session_var_exists( req, "user" ), "destroyed user" );
+	check( finish( other, sizeof(other) ) == 1 && !strcmp( other, "" ),
+			"destroy cookie" );
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	return EXIT_FAILURE;
+}
+
+int cookie_keys( void )
+{
+	char old[4200], cookie[4200];
+	unsigned int i;
+
+	cgi_display_errors = 0;
+	cgi_session_set_backend( CGI_SESSION_COOKIE );
+	check( cgi_session_cookie_key( 1, "first key, 16 bytes", 19 ), "key 1" );
+
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "v", "1" ), "register" );
+	check( finish( old, sizeof(old) ) == 1, "cookie" );
+
+	/*	a new key signs, the old one still verifies	*/
+	check( cgi_session_cookie_key( 2, "second key, 16 bytes", 20 ), "key 2" );
+	check( begin( old ) && cgi_request_session_start( req ), "rotated" );
+	check( !strcmp( cgi_request_session_var( req, "v" ), "1" ), "old value" );
+	check( cgi_request_session_alter_var( req, "v", "2" ), "alter" );
+	check( finish( cookie, sizeof(cookie) ) == 1
+			&& !strncmp( cookie, "1.2.", 4 ), "signed by 2 '%s'", cookie );
+
+	/*	until it is removed	*/
+	check( cgi_session_cookie_key( 1, NULL, 0 ), "remove 1" );
+	check( begin( old ) && cgi_request_session_start( req ), "removed" );
+	check( !cgi_request_session_var_exists( req, "v" ), "removed value" );
+	cleanup();
+	check( begin( cookie ) && cgi_request_session_start( req ), "key 2 left" );
+	check( !strcmp( cgi_request_session_var( req, "v" ), "2" ), "new value" );
+	cleanup();
+
+	/*	the oldest goes for more than 8 keys	*/
+	for ( i = 3; i < 11; i++ )
+		check( cgi_session_cookie_key( i, "more keys, 16 bytes", 19 ), "%u", i );
+	check( begin( cookie ) && cgi_request_session_start( req ), "full" );
+	check( !cgi_request_session_var_exists( req, "v" ), "dropped key" );
+	cleanup();
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	return EXIT_FAILURE;
+}
+
+int cookie_size( void )
+{
+	char big[2000], cookie[4200];
+
+	cgi_display_errors = 0;
+	cgi_session_set_backend( CGI_SESSION_COOKIE );
+	check( cgi_session_cookie_key( 1, "0123456789abcdef", 16 ), "key" );
+
+	memset( big, 'x', sizeof(big) - 1 );
+	big[sizeof(big) - 1] = '\0';
+
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "big", big ), "big" );
+	check( cgi_request_session_register_var( req, "v", "1" ), "v" );
+
+	/*	what does not fit is not kept	*/
+	check( !cgi_request_session_register_var( req, "more", big ), "more" );
+	check( !strcmp( session_error_message[session_lasterror],
+			"Session too large for a cookie" ), "error" );
+	check( !cgi_request_session_var_exists( req, "more" ), "more kept" );
+	check( !cgi_request_session_alter_var( req, "v", big ), "alter" );
+	check( !strcmp( cgi_request_session_var( req, "v" ), "1" ), "altered" );
+
+	check( finish( cookie, sizeof(cookie) ) == 1, "cookie" );
+	check( strlen( SESSION_COOKIE_NAME ) + 1 + strlen( cookie ) <= 4000,
+			"length %zu", strlen( cookie ) );
+
+	check( begin( cookie ) && cgi_request_session_start( req ), "load" );
+	check( !strcmp( cgi_request_session_var( req, "big" ), big ), "big value" );
+	cleanup();
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	return EXIT_FAILURE;
+}
+
+/*	"1.1.0.<payload of cookie>.<mac>", signed with key	*/
+static void cookie_forever( char *forged, size_t size, const char *cookie,
+		const char *key )
+{
+	static const char b64url[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	union test_hmac hmac;
+	unsigned char mac[32];
+	char msg[4300], *p;
+	const char *payload = strchr( strchr( strchr( cookie, '.' ) + 1, '.' )
+			+ 1, '.' ) + 1;
+	size_t i, n;
+
+	n = snprintf( forged, size, "1.1.0.%.*s",
+			(int) (strrchr( cookie, '.' ) - payload), payload );
+	snprintf( msg, sizeof(msg), "%s=%s", SESSION_COOKIE_NAME, forged );
+	cgi_hmac_sha256_key( &hmac, key, strlen( key ) );
+	cgi_hmac_sha256( &hmac, msg, strlen( msg ), mac );
+
+	p = forged + n;
+	*p++ = '.';
+	for ( i = 0; i < 32; i += 3 )
+	{
+		unsigned long v = (unsigned long) mac[i] << 16
+				| (i + 1 < 32 ? mac[i + 1] << 8 : 0)
+				| (i + 2 < 32 ? mac[i + 2] : 0);
+		*p++ = b64url[v >> 18 & 63];
+		*p++ = b64url[v >> 12 & 63];
+		if ( i + 1 < 32 ) *p++ = b64url[v >> 6 & 63];
+		if ( i + 2 < 32 ) *p++ = b64url[v & 63];
+	}
+	*p = '\0';
+}
+
+int cookie_expiry( void )
+{
+	char cookie[4200], again[4200];
+	unsigned long expires = 0, now = (unsigned long) time( NULL );
+
+	cgi_display_errors = 0;
+	cgi_session_set_backend( CGI_SESSION_COOKIE );
+	check( cgi_session_cookie_key( 1, "0123456789abcdef", 16 ), "key" );
+
+	/*	without an idle time the cookie still expires, after a day	*/
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "v", "1" ), "register" );
+	check( finish( cookie, sizeof(cookie) ) == 1, "cookie" );
+	check( sscanf( cookie, "1.1.%lu.", &expires ) == 1
+			&& expires >= now + 86400 && expires <= now + 86400 + 5,
+			"lifetime '%s'", cookie );
+
+	/*	a signed cookie without expiry is refused	*/
+	cookie_forever( again, sizeof(again), cookie, "0123456789abcdef" );
+	check( begin( cookie ) && cgi_request_session_start( req ), "valid" );
+	check( cgi_request_session_var_exists( req, "v" ), "valid value" );
+	cleanup();
+	check( begin( again ) && cgi_request_session_start( req ), "forever" );
+	check( !cgi_request_session_var_exists( req, "v" ), "forever value" );
+	check( finish( again, sizeof(again) ) == 1
+			&& strncmp( again, "1.1.0.", 6 ), "new '%s'", again );
+
+	/*	a shorter limit set later sends the cookie again with it	*/
+	cgi_session_set_max_idle_time( 1 );
+	check( begin( cookie ) && cgi_request_session_start( req ), "limit" );
+	check( !strcmp( cgi_request_session_var( req, "v" ), "1" ), "value" );
+	check( finish( again, sizeof(again) ) == 1
+			&& sscanf( again, "1.1.%lu.", &expires ) == 1
+			&& expires <= (unsigned long) time( NULL ) + 1,
+			"expiry '%s'", again );
+
+	sleep( 2 );
+	check( begin( again ) && cgi_request_session_start( req ), "expired" );
+	check( !cgi_request_session_var_exists( req, "v" ), "expired value" );
+	cleanup();
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	return EXIT_FAILURE;
+}
+
+static char shm_path[64];
+
+static void shm_setup( void )
+{
+	snprintf( shm_path, sizeof(shm_path), "/tmp/libcgi-shm-%i",
+			(int) getpid() );
+	unlink( shm_path );
+	cgi_session_shm_path( shm_path );
+	cgi_session_set_backend( CGI_SESSION_SHM );
+	cgi_display_errors = 0;
+}
+
+int shm_store( void )
+{
+	char sid[64], other[64], big[5000], link[80];
+	int fd;
+
+	shm_setup();
+
+	/*	a table others can use, or a link to one, is refused	*/
+	check( (fd = open( shm_path, O_CREAT | O_WRONLY, 0600 )) >= 0, "create" );
+	check( !fchmod( fd, 0644 ) && !close( fd ), "chmod" );
+	check( begin( NULL ) && !cgi_request_session_start( req ), "readable" );
+	cleanup();
+	snprintf( link, sizeof(link), "%s-link", shm_path );
+	check( !chmod( shm_path, 0600 ) && !symlink( shm_path, link ), "symlink" );
+	cgi_session_shm_path( link );
+	check( begin( NULL ) && !cgi_request_session_start( req ), "link" );
+	cleanup();
+	unlink( link );
+	cgi_session_shm_path( shm_path );
+
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "a", "x;y=z" ), "a" );
+	check( cgi_request_session_register_var( req, "b", "2" ), "b" );
+	check( cgi_request_session_register_var( req, "c", "3" ), "c" );
+	check( cgi_request_session_alter_var( req, "b", "two" ), "alter" );
+	check( cgi_request_session_unregister_var( req, "c" ), "unregister" );
+	check( finish( sid, sizeof(sid) ) == 1 && strlen( sid ) == 45, "id" );
+
+	check( begin( sid ) && cgi_request_session_start( req ), "again" );
+	check( !strcmp( cgi_request_session_var( req, "a" ), "x;y=z" ), "a" );
+	check( !strcmp( cgi_request_session_var( req, "b" ), "two" ), "b" );
+	check( !cgi_request_session_var_exists( req, "c" ), "c" );
+
+	/*	a slot holds about 4000 bytes	*/
+	memset( big, 'x', sizeof(big) - 1 );
+	big[sizeof(big) - 1] = '\0';
+	check( !cgi_request_session_register_var( req, "big", big ), "big" );
+	check( !cgi_request_session_var_exists( req, "big" ), "big kept" );
+	big[3900] = '\0';
+	check( cgi_request_session_register_var( req, "big", big ), "fits" );
+	check( finish( other, sizeof(other) ) == 0, "no new cookie" );
+
+	check( begin( sid ) && cgi_request_session_start( req ), "big again" );
+	check( !strcmp( cgi_request_session_var( req, "big" ), big ), "big" );
+	check( cgi_request_session_destroy( req ), "destroy" );
+	check( finish( other, sizeof(other) ) == 1 && !strcmp( other, "" ),
+			"destroy cookie" );
+
+	/*	unknown ids are new sessions	*/
+	check( begin( sid ) && cgi_request_session_start( req ), "destroyed" );
+	check( !cgi_request_session_var_exists( req, "a" ), "destroyed a" );
+	check( finish( other, sizeof(other) ) == 1 && strcmp( other, sid ),
+			"new id" );
+	check( begin( "../../etc/passwd" ) && cgi_request_session_start( req ),
+			"bad id" );
+	check( finish( other, sizeof(other) ) == 1 && strlen( other ) == 45,
+			"bad id replaced" );
+
+	/*	idle sessions are gone	*/
+	cgi_session_set_max_idle_time( 1 );
+	check( begin( NULL ) && cgi_request_session_start( req ), "idle start" );
+	check( cgi_request_session_register_var( req, "v", "1" ), "idle v" );
+	check( finish( sid, sizeof(sid) ) == 1, "idle id" );
+	sleep( 2 );
+	check( begin( sid ) && cgi_request_session_start( req ), "idle" );
+	check( !cgi_request_session_var_exists( req, "v" ), "idle value" );
+	cleanup();
+
+	unlink( shm_path );
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	unlink( shm_path );
+	return EXIT_FAILURE;
+}
+
+int shm_shared( void )
+{
+	char sid[64];
+	pid_t pid;
+	int status;
+
+	shm_setup();
+
+	check( begin( NULL ) && cgi_request_session_start( req ), "start" );
+	check( cgi_request_session_register_var( req, "v", "parent" ), "v" );
+	check( finish( sid, sizeof(sid) ) == 1, "id" );
+
+	/*	another process sees the session and changes it	*/
+	check( (pid = fork()) >= 0, "fork" );
+	if ( pid == 0 )
+	{
+		if ( !begin( sid ) || !cgi_request_session_start( req )
+				|| strcmp( cgi_request_session_var( req, "v" ), "parent" )
+				|| !cgi_request_session_alter_var( req, "v", "child" ) )
+			_exit( EXIT_FAILURE );
+		cgi_request_free( req );
+		_exit( EXIT_SUCCESS );
+	}
+	check( waitpid( pid, &status, 0 ) == pid && WIFEXITED( status )
+			&& WEXITSTATUS( status ) == EXIT_SUCCESS, "child" );
+
+	check( begin( sid ) && cgi_request_session_start( req ), "again" );
+	check( !strcmp( cgi_request_session_var( req, "v" ), "child" ), "v" );
+	cleanup();
+
+	unlink( shm_path );
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	unlink( shm_path );
+	return EXIT_FAILURE;
+}
+
+int shm_evict( void )
+{
+	char sid[64], first[64], value[16];
+	int i;
+
+	shm_setup();
+
+	check( begin( NULL ) && cgi_request_session_start( req ), "first" );
+	check( cgi_request_session_register_var( req, "v", "first" ), "v" );
+	check( finish( first, sizeof(first) ) == 1, "first id" );
+	sleep( 1 );
+
+	/*	more sessions than slots, each new one finds room	*/
+	for ( i = 0; i < 3 * 4096; i++ )
+	{
+		snprintf( value, sizeof(value), "%i", i );
+		check( begin( NULL ) && cgi_request_session_start( req ), "%i", i );
+		check( cgi_request_session_register_var( req, "v", value ), "v %i", i );
+		check( finish( sid, sizeof(sid) ) == 1, "id %i", i );
+	}
+
+	check( begin( sid ) && cgi_request_session_start( req ), "last" );
+	check( !strcmp( cgi_request_session_var( req, "v" ), value ), "last v" );
+	cleanup();
+
+	/*	the oldest made room	*/
+	check( begin( first ) && cgi_request_session_start( req ), "evicted" );
+	check( !cgi_request_session_var_exists( req, "v" ), "evicted v" );
+	cleanup();
+
+	unlink( shm_path );
+
+	return EXIT_SUCCESS;
+
+error:
+	cleanup();
+	unlink( shm_path );
+	return EXIT_FAILURE;
+}
+
+/*	known answers of RFC 4231, test cases 1 and 6	*/
+int hmac_sha256( void )
+{
+	static const unsigned char expect1[32] = {
+		0xb0, 0x34, 0x4c, 0x61, 0xd8, 0xdb, 0x38, 0x53,
+		0x5c, 0xa8, 0xaf, 0xce, 0xaf, 0x0b, 0xf1, 0x2b,
+		0x88, 0x1d, 0xc2, 0x00, 0xc9, 0x83, 0x3d, 0xa7,
+		0x26, 0xe9, 0x37, 0x6c, 0x2e, 0x32, 0xcf, 0xf7,
+	};
+	static const unsigned char expect6[32] = {
+		0x60, 0xe4, 0x31, 0x59, 0x1e, 0xe0, 0xb6, 0x7f,
+		0x0d, 0x8a, 0x26, 0xaa, 0xcb, 0xf5, 0xb7, 0x7f,
+		0x8e, 0x0b, 0xc6, 0x21, 0x37, 0x28, 0xc5, 0x14,
+		0x05, 0x46, 0x04, 0x0f, 0x0e, 0xe3, 0x7f, 0x54,
+	};
+	const char *data6 = "Test Using Larger Than Block-Size Key - Hash Key First";
+	union test_hmac hmac;
+	unsigned char key[131], mac[32];
+
+	/*	20 byte key	*/
+	memset( key, 0x0b, 20 );
+	cgi_hmac_sha256_key( &hmac, key, 20 );
+	cgi_hmac_sha256( &hmac, "Hi There", 8, mac );
+	check( !memcmp( mac, expect1, sizeof(mac) ), "case 1" );
+
+	/*	key longer than a block, hashed first	*/
+	memset( key, 0xaa, sizeof(key) );
+	cgi_hmac_sha256_key( &hmac, key, sizeof(key) );
+	cgi_hmac_sha256( &hmac, data6, strlen( data6 ), mac );
+	check( !memcmp( mac, expect6, sizeof(mac) ), "case 6" );
+
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}
+
 /* vim: set noet sts=0 ts=4 sw=4 sr: */
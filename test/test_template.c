@@ -0,0 +1,298 @@
+/*******************************************************************//**
+ *	@file		test_template.c
+ *
+ *	Test compiled templates: values and escaping, lists, the cache of
+ *	compiled files and syntax errors.  Templates are written to
+ *	temporary files, rendered into a request context and compared.
+ *
+ *	SPDX-License-Identifier: LGPL-2.1+
+ *	License-Filename: LICENSES/LGPL-2.1.txt
+ *
+ *	@copyright	2026 libcgi contributors
+ **********************************************************************/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cgi_test.h"
+
+#include "libcgi/cgi.h"
+#include "libcgi/request.h"
+#include "libcgi/template.h"
+
+/*	local declarations	*/
+static int test_values( void );
+static int test_lists( void );
+static int test_cache( void );
+static int test_errors( void );
+static int test_buffered( void );
+
+int main( int argc, char *argv[] )
+{
+	struct cgi_test_action	actions[] = {
+		{ "values",		test_values		},
+		{ "lists",		test_lists		},
+		{ "cache",		test_cache		},
+		{ "errors",		test_errors		},
+		{ "buffered",	test_buffered	},
+	};
+
+	/*	require at least one argument to select test	*/
+	if ( argc < 2 ) return EXIT_FAILURE;
+
+	return run_action( argv[1], actions,
+			sizeof(actions)/sizeof(struct cgi_test_action) );
+}
+
+static char path[64];
+static int path_index = 0;
+
+/*	name=value pairs to a list of static items	*/
+static formvars *vars( const char *const *pairs )
+{
+	static formvars items[32];
+	formvars *start = NULL, **next = &start;
+	int i;
+
+	for ( i = 0; pairs && pairs[2 * i]; i++ )
+	{
+		items[i].name = (char *) pairs[2 * i];
+		items[i].value = (char *) pairs[2 * i + 1];
+		*next = &items[i];
+		next = &items[i].next;
+	}
+	*next = NULL;
+
+	return start;
+}
+
+static int write_template( const char *text )
+{
+	FILE *f;
+
+	snprintf( path, sizeof(path), "/tmp/libcgi-template-%i-%i", (int) getpid(),
+			path_index );
+	if ( !(f = fopen( path, "w" )) ) return 0;
+	fputs( text, f );
+
+	return !fclose( f );
+}
+
+/*	render the template file with the pairs, the output in buf	*/
+static int render_file( const char *const *pairs, char *buf, size_t size )
+{
+	cgi_request *req;
+	FILE *out;
+	size_t n;
+	int ret;
+
+	if ( !(req = cgi_request_new()) ) return -1;
+	if ( !(out = tmpfile()) ) return -1;
+	cgi_request_set_output( req, out );
+
+	ret = cgi_request_template_render( req, path, vars( pairs ) );
+
+	rewind( out );
+	n = fread( buf, 1, size - 1, out );
+	buf[n] = '\0';
+	fclose( out );
+	cgi_request_free( req );
+
+	return ret;
+}
+
+/*	render text with the pairs	*/
+static int render( const char *text, const char *const *pairs, char *buf,
+		size_t size )
+{
+	if ( !write_template( text ) ) return -1;
+
+	return render_file( pairs, buf, size );
+}
+
+int test_values( void )
+{
+	const char *pairs[] = {
+		"title", "Tom & \"Jerry\" <3", "Empty", NULL, "name", "first",
+		"NAME", "second", NULL
+	};
+	char buf[512];
+
+	check( render( "<h1>{{title}}</h1>", pairs, buf, sizeof(buf) ) == 1,
+			"render" );
+	check( !strcmp( buf, "<h1>Tom &amp; &quot;Jerry&quot; &lt;3</h1>" ),
+			"escaped '%s'", buf );
+
+	check( render( "{{{title}}}|{{{ title }}}", pairs, buf, sizeof(buf) ),
+			"raw" );
+	check( !strcmp( buf, "Tom & \"Jerry\" <3|Tom & \"Jerry\" <3" ),
+			"raw '%s'", buf );
+
+	/*	first value, case insensitive, missing and empty give nothing	*/
+	check( render( "[{{Name}}][{{missing}}][{{empty}}]{{! not here }}.",
+			pairs, buf, sizeof(buf) ), "lookup" );
+	check( !strcmp( buf, "[first][][]." ), "lookup '%s'", buf );
+
+	check( render( "", pairs, buf, sizeof(buf) ) && !strcmp( buf, "" ),
+			"empty template" );
+	check( render( "no tags { } }}", NULL, buf, sizeof(buf) )
+			&& !strcmp( buf, "no tags { } }}" ), "text '%s'", buf );
+
+	unlink( path );
+
+	return EXIT_SUCCESS;
+
+error:
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+int test_lists( void )
+{
+	const char *pairs[] = {
+		"item", "a", "price", "1", "site", "<shop>",
+		"item", "b", "price", "2",
+		"item", "c", "price", "3",
+		"tag", "x", "tag", "y", NULL
+	};
+	char buf[512];
+
+	/*	rows of parallel lists, single values stay the same	*/
+	check( render( "{{#item}}<{{.}}:{{price}}@{{site}}>{{/item}}", pairs,
+			buf, sizeof(buf) ), "rows" );
+	check( !strcmp( buf, "<a:1@&lt;shop&gt;><b:2@&lt;shop&gt;>"
+			"<c:3@&lt;shop&gt;>" ), "rows '%s'", buf );
+
+	/*	missing lists are skipped, inverted ones shown	*/
+	check( render( "{{#none}}x{{.}}{{/none}}{{^none}}none{{/none}}"
+			"{{^item}}items{{/item}}", pairs, buf, sizeof(buf) ), "inverted" );
+	check( !strcmp( buf, "none" ), "inverted '%s'", buf );
+
+	/*	nested, "." is the innermost	*/
+	check( render( "{{#ITEM}}{{.}}({{#tag}}{{{.}}}{{/tag}}){{/item}}", pairs,
+			buf, sizeof(buf) ), "nested" );
+	check( !strcmp( buf, "a(xy)b(xy)c(xy)" ), "nested '%s'", buf );
+
+	check( render( "{{.}}{{#tag}}{{/tag}}.", pairs, buf, sizeof(buf) )
+			&& !strcmp( buf, "." ), "dot outside '%s'", buf );
+
+	unlink( path );
+
+	return EXIT_SUCCESS;
+
+error:
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+int test_cache( void )
+{
+	const char *pairs[] = { "v", "1", NULL };
+	struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+	char buf[128], other[64];
+	int i;
+
+	check( render( "first {{v}}", pairs, buf, sizeof(buf) )
+			&& !strcmp( buf, "first 1" ), "first '%s'", buf );
+
+	/*	a changed file is compiled again, even of the same size and
+	 *	within the same second	*/
+	check( render( "other {{v}}", pairs, buf, sizeof(buf) )
+			&& !strcmp( buf, "other 1" ), "other '%s'", buf );
+
+	/*	or set back to an older time	*/
+	check( write_template( "older {{v}}" ), "write" );
+	check( !utimes( path, times ), "utimes" );
+	check( render_file( pairs, buf, sizeof(buf) )
+			&& !strcmp( buf, "older 1" ), "older '%s'", buf );
+
+	/*	more files than the cache holds, each is compiled again when
+	 *	its turn comes	*/
+	for ( i = 0; i < 80; i++ )
+	{
+		path_index = i % 40;
+		snprintf( other, sizeof(other), "t%i {{v}}", path_index );
+		check( render( other, pairs, buf, sizeof(buf) ), "render %i", i );
+		snprintf( other, sizeof(other), "t%i 1", path_index );
+		check( !strcmp( buf, other ), "t%i '%s'", i, buf );
+		unlink( path );
+	}
+	path_index = 0;
+
+	unlink( path );
+
+	return EXIT_SUCCESS;
+
+error:
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+int test_errors( void )
+{
+	const char *bad[] = {
+		"{{open", "{{}}", "{{#a}}", "{{/a}}", "{{#a}}{{/b}}", "{{#.}}{{/.}}",
+		"{{! open", "{{{raw}}", NULL
+	};
+	char buf[128];
+	int i;
+
+	cgi_display_errors = 0;
+
+	for ( i = 0; bad[i]; i++ )
+	{
+		check( render( bad[i], NULL, buf, sizeof(buf) ) == 0, "'%s'", bad[i] );
+		check( !strcmp( buf, "" ), "output of '%s'", bad[i] );
+	}
+
+	check( !cgi_template_render( "/nonexistent/libcgi", NULL ), "missing" );
+
+	unlink( path );
+
+	return EXIT_SUCCESS;
+
+error:
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+int test_buffered( void )
+{
+	const char *pairs[] = { "v", "a<b", NULL };
+	cgi_request *req = NULL;
+	FILE *out = NULL;
+	char buf[256];
+	size_t n;
+
+	check( write_template( "<p>{{v}}</p>" ), "write" );
+	check( (req = cgi_request_new()), "new" );
+	check( (out = tmpfile()), "out" );
+	cgi_request_set_output( req, out );
+
+	check( cgi_request_response_buffer( req ), "buffer" );
+	check( cgi_request_template_render( req, path, vars( pairs ) ), "render" );
+	check( cgi_request_write( req, "!", 1 ), "write" );
+	cgi_request_end( req );
+
+	rewind( out );
+	n = fread( buf, 1, sizeof(buf) - 1, out );
+	buf[n] = '\0';
+	check( !strcmp( buf, "Content-type: text/html\r\n"
+			"Content-Length: 14\r\n\r\n<p>a&lt;b</p>!" ), "buffered '%s'", buf );
+
+	cgi_request_free( req );
+	fclose( out );
+	unlink( path );
+
+	return EXIT_SUCCESS;
+
+error:
+	unlink( path );
+	return EXIT_FAILURE;
+}
+
+/* vim: set noet sts=0 ts=4 sw=4 sr: */